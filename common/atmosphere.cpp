@@ -0,0 +1,390 @@
+#include "atmosphere.hpp"
+#include "glcapture.hpp"
+#include "jobs.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+using namespace std;
+
+static const float PI = 3.14159265f;
+
+//Earth, in kilometres (Hillaire's reference values)
+static const float BOTTOM_RADIUS = 6360.0f;
+static const float TOP_RADIUS = 6460.0f;
+static const glm::vec3 RAYLEIGH_SCATTERING(5.802e-3f, 13.558e-3f, 33.1e-3f); //Per kilometre at the ground
+static const float RAYLEIGH_HEIGHT = 8.0f; //Scale height of the exponential density
+static const float MIE_SCATTERING = 3.996e-3f;
+static const float MIE_EXTINCTION = 4.440e-3f;
+static const float MIE_HEIGHT = 1.2f;
+static const glm::vec3 OZONE_ABSORPTION(0.650e-3f, 1.881e-3f, 0.085e-3f);
+static const float OZONE_CENTRE = 25.0f; //The ozone layer's density is a tent around this altitude
+static const float OZONE_WIDTH = 15.0f;
+static const float GROUND_ALBEDO = 0.3f;
+
+static const int TRANSMITTANCE_SAMPLES = 40;
+static const int MULTI_SCATTERING_DIRECTIONS = 8; //Squared, spread evenly over the sphere
+static const int MULTI_SCATTERING_SAMPLES = 20;
+
+//Texture units the compute program samples the transmittance and multiple scattering from (past every unit the frame uses)
+static const int TRANSMITTANCE_UNIT = 15;
+static const int MULTI_SCATTERING_UNIT = 16;
+static const int COMPUTE_GROUP_SIZE = 8; //Square, as declared in atmosphere.comp
+
+struct Medium
+{
+	glm::vec3 rayleigh; //Scattering
+	float mie;
+	glm::vec3 extinction;
+};
+
+static Medium sampleMedium(const Atmosphere& atmosphere, float altitude)
+{
+	altitude = max(altitude, 0.0f);
+	float mieDensity = atmosphere.mieDensity * exp(-altitude / MIE_HEIGHT);
+	float ozone = max(0.0f, 1.0f - fabs(altitude - OZONE_CENTRE) / OZONE_WIDTH);
+
+	Medium medium;
+	medium.rayleigh = RAYLEIGH_SCATTERING * (atmosphere.rayleighDensity * exp(-altitude / RAYLEIGH_HEIGHT));
+	medium.mie = MIE_SCATTERING * mieDensity;
+	medium.extinction = medium.rayleigh + glm::vec3(MIE_EXTINCTION * mieDensity) + OZONE_ABSORPTION * ozone;
+	return medium;
+}
+
+//Rays from radius r at cosine mu from the zenith, with the planet's centre at the origin
+static float distanceToTop(float r, float mu)
+{
+	float discriminant = r * r * (mu * mu - 1.0f) + TOP_RADIUS * TOP_RADIUS;
+	return max(0.0f, -r * mu + sqrt(max(discriminant, 0.0f)));
+}
+
+static bool hitsGround(float r, float mu)
+{
+	return mu < 0.0f && r * r * (mu * mu - 1.0f) + BOTTOM_RADIUS * BOTTOM_RADIUS >= 0.0f;
+}
+
+static float distanceToGround(float r, float mu)
+{
+	float discriminant = r * r * (mu * mu - 1.0f) + BOTTOM_RADIUS * BOTTOM_RADIUS;
+	return max(0.0f, -r * mu - sqrt(max(discriminant, 0.0f)));
+}
+
+//Bilinear lookup of a table built at parameters i / (width - 1), j / (height - 1)
+static glm::vec3 sampleTable(const vector<glm::vec3>& table, int width, int height, float u, float v)
+{
+	float x = min(max(u, 0.0f), 1.0f) * (width - 1);
+	float y = min(max(v, 0.0f), 1.0f) * (height - 1);
+	int x0 = min(int(x), width - 2), y0 = min(int(y), height - 2);
+	float fx = x - x0, fy = y - y0;
+	const glm::vec3* row = &table[size_t(y0) * width + x0];
+	return glm::mix(glm::mix(row[0], row[1], fx), glm::mix(row[width], row[width + 1], fx), fy);
+}
+
+//Bruneton's parameterisation: the distance to the top of the atmosphere across the range of rays that miss
+//the ground, and the distance to the horizon for the altitude
+static const float HORIZON_TOP = sqrt(TOP_RADIUS * TOP_RADIUS - BOTTOM_RADIUS * BOTTOM_RADIUS);
+
+static glm::vec2 transmittanceParameters(float r, float mu)
+{
+	float rho = sqrt(max(r * r - BOTTOM_RADIUS * BOTTOM_RADIUS, 0.0f));
+	float minDistance = TOP_RADIUS - r, maxDistance = rho + HORIZON_TOP;
+	return glm::vec2((distanceToTop(r, mu) - minDistance) / max(maxDistance - minDistance, 1e-6f), rho / HORIZON_TOP);
+}
+
+static glm::vec3 transmittanceToTop(const Atmosphere& atmosphere, float r, float mu)
+{
+	glm::vec2 uv = transmittanceParameters(r, mu);
+	return sampleTable(atmosphere.transmittance, TRANSMITTANCE_WIDTH, TRANSMITTANCE_HEIGHT, uv.x, uv.y);
+}
+
+//Sunlight reaching radius r, none in the planet's shadow
+static glm::vec3 sunTransmittance(const Atmosphere& atmosphere, float r, float muSun)
+{
+	return hitsGround(r, muSun) ? glm::vec3(0.0f) : transmittanceToTop(atmosphere, r, muSun);
+}
+
+struct RayMarch
+{
+	glm::vec3 luminance = glm::vec3(0.0f); //Scattered towards the origin
+	glm::vec3 throughput = glm::vec3(1.0f); //Transmittance from the origin
+	glm::vec3 transfer = glm::vec3(0.0f); //Light scattered once more, for a unit isotropic source (multiple scattering)
+};
+
+//Adds one segment of length dt around position (planet centred), lit once by a sun of unit illuminance
+//(atmosphere.comp marches the sky view and aerial perspective the same way, with the multiple scattering added)
+static void marchSegment(const Atmosphere& atmosphere, RayMarch& march, glm::vec3 position, float dt, glm::vec3 sun, float rayleighWeight,
+						 float mieWeight)
+{
+	float r = glm::length(position);
+	Medium medium = sampleMedium(atmosphere, r - BOTTOM_RADIUS);
+	float muSun = glm::dot(position, sun) / r;
+	glm::vec3 scattering = medium.rayleigh + glm::vec3(medium.mie);
+	glm::vec3 source = sunTransmittance(atmosphere, r, muSun) * (medium.rayleigh * rayleighWeight + glm::vec3(medium.mie * mieWeight));
+
+	//Integrated across the segment against its own extinction, so long segments do not gain energy
+	glm::vec3 segment = glm::exp(-medium.extinction * dt);
+	glm::vec3 integral = (glm::vec3(1.0f) - segment) / glm::max(medium.extinction, glm::vec3(1e-9f));
+	march.luminance += march.throughput * source * integral;
+	march.transfer += march.throughput * scattering * integral;
+	march.throughput *= segment;
+}
+
+//Marches from origin along a unit direction to the ground or the top of the atmosphere in samples segments,
+//shorter near the origin, and adds the sunlit ground where the ray ends on it
+static RayMarch marchRay(const Atmosphere& atmosphere, glm::vec3 origin, glm::vec3 direction, glm::vec3 sun, int samples, float rayleighWeight,
+						 float mieWeight)
+{
+	float r = glm::length(origin), mu = glm::dot(origin, direction) / r;
+	bool ground = hitsGround(r, mu);
+	float end = ground ? distanceToGround(r, mu) : distanceToTop(r, mu);
+
+	RayMarch march;
+	float previous = 0.0f;
+	for (int i = 1; i <= samples; i++)
+	{
+		float fraction = float(i) / samples;
+		float t = end * fraction * fraction;
+		marchSegment(atmosphere, march, origin + direction * (0.5f * (previous + t)), t - previous, sun, rayleighWeight, mieWeight);
+		previous = t;
+	}
+	if (ground)
+	{
+		glm::vec3 position = origin + direction * end;
+		float muSun = glm::dot(glm::normalize(position), sun);
+		march.luminance += march.throughput * sunTransmittance(atmosphere, BOTTOM_RADIUS, muSun) * (max(muSun, 0.0f) * GROUND_ALBEDO / PI);
+	}
+	return march;
+}
+
+static void buildTransmittance(Atmosphere& atmosphere)
+{
+	atmosphere.transmittance.resize(size_t(TRANSMITTANCE_WIDTH) * TRANSMITTANCE_HEIGHT);
+	parallelFor(0, TRANSMITTANCE_HEIGHT, 4, [&](int first, int last)
+	{
+		for (int j = first; j < last; j++)
+		{
+			float rho = HORIZON_TOP * j / (TRANSMITTANCE_HEIGHT - 1);
+			float r = sqrt(rho * rho + BOTTOM_RADIUS * BOTTOM_RADIUS);
+			float minDistance = TOP_RADIUS - r, maxDistance = rho + HORIZON_TOP;
+			for (int i = 0; i < TRANSMITTANCE_WIDTH; i++)
+			{
+				float distance = minDistance + (maxDistance - minDistance) * i / (TRANSMITTANCE_WIDTH - 1);
+				float mu = distance == 0.0f ? 1.0f : (HORIZON_TOP * HORIZON_TOP - rho * rho - distance * distance) / (2.0f * r * distance);
+				mu = min(max(mu, -1.0f), 1.0f);
+
+				//Optical depth along the ray, at the middle of equal steps
+				glm::vec3 depth(0.0f);
+				float dt = distance / TRANSMITTANCE_SAMPLES;
+				for (int s = 0; s < TRANSMITTANCE_SAMPLES; s++)
+				{
+					float t = (s + 0.5f) * dt;
+					float altitude = sqrt(r * r + t * t + 2.0f * r * mu * t) - BOTTOM_RADIUS;
+					depth += sampleMedium(atmosphere, altitude).extinction * dt;
+				}
+				atmosphere.transmittance[size_t(j) * TRANSMITTANCE_WIDTH + i] = glm::exp(-depth);
+			}
+		}
+	});
+}
+
+//Light scattered twice or more, as a source of isotropic radiance per unit scattering: the second order
+//over all directions, summed as a geometric series of the fraction f scattered once more, L / (1 - f)
+static void buildMultipleScattering(Atmosphere& atmosphere)
+{
+	atmosphere.multiScattering.resize(size_t(MULTI_SCATTERING_SIZE) * MULTI_SCATTERING_SIZE);
+	const float isotropic = 1.0f / (4.0f * PI);
+	parallelFor(0, MULTI_SCATTERING_SIZE, 1, [&](int first, int last)
+	{
+		for (int j = first; j < last; j++)
+		{
+			float r = BOTTOM_RADIUS + (TOP_RADIUS - BOTTOM_RADIUS) * max(float(j) / (MULTI_SCATTERING_SIZE - 1), 1e-4f);
+			glm::vec3 origin(0.0f, r, 0.0f);
+			for (int i = 0; i < MULTI_SCATTERING_SIZE; i++)
+			{
+				float muSun = 2.0f * i / (MULTI_SCATTERING_SIZE - 1) - 1.0f;
+				glm::vec3 sun(sqrt(max(1.0f - muSun * muSun, 0.0f)), muSun, 0.0f);
+
+				glm::vec3 luminance(0.0f), transfer(0.0f);
+				for (int a = 0; a < MULTI_SCATTERING_DIRECTIONS; a++)
+				{
+					float cosTheta = 1.0f - 2.0f * (a + 0.5f) / MULTI_SCATTERING_DIRECTIONS;
+					float sinTheta = sqrt(max(1.0f - cosTheta * cosTheta, 0.0f));
+					for (int b = 0; b < MULTI_SCATTERING_DIRECTIONS; b++)
+					{
+						float phi = 2.0f * PI * (b + 0.5f) / MULTI_SCATTERING_DIRECTIONS;
+						glm::vec3 direction(sinTheta * cos(phi), cosTheta, sinTheta * sin(phi));
+						RayMarch march = marchRay(atmosphere, origin, direction, sun, MULTI_SCATTERING_SAMPLES, isotropic, isotropic);
+						luminance += march.luminance;
+						transfer += march.transfer;
+					}
+				}
+
+				//Both are integrals over the sphere of an isotropic phase function, so averages of the directions
+				const float directions = float(MULTI_SCATTERING_DIRECTIONS * MULTI_SCATTERING_DIRECTIONS);
+				luminance /= directions;
+				transfer /= directions;
+				atmosphere.multiScattering[size_t(j) * MULTI_SCATTERING_SIZE + i] = luminance / (glm::vec3(1.0f) - glm::min(transfer, glm::vec3(0.99f)));
+			}
+		}
+	});
+}
+
+//Binds what both passes of the compute program read and write, and their shared uniforms
+static void beginTablePass(const Atmosphere& atmosphere, GLuint program, bool aerial)
+{
+	glUseProgram(program);
+	glActiveTexture(GL_TEXTURE0 + TRANSMITTANCE_UNIT);
+	glBindTexture(GL_TEXTURE_2D, atmosphere.transmittanceTexture);
+	glActiveTexture(GL_TEXTURE0 + MULTI_SCATTERING_UNIT);
+	glBindTexture(GL_TEXTURE_2D, atmosphere.multiScatteringTexture);
+	glActiveTexture(GL_TEXTURE0);
+	glBindImageTexture(0, atmosphere.skyViewTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+	glBindImageTexture(1, atmosphere.aerialTexture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+	glUniform1i(glGetUniformLocation(program, "transmittance"), TRANSMITTANCE_UNIT);
+	glUniform1i(glGetUniformLocation(program, "multiScattering"), MULTI_SCATTERING_UNIT);
+	glUniform1i(glGetUniformLocation(program, "buildAerial"), aerial ? 1 : 0);
+	glUniform1f(glGetUniformLocation(program, "rayleighDensity"), atmosphere.rayleighDensity);
+	glUniform1f(glGetUniformLocation(program, "mieDensity"), atmosphere.mieDensity);
+	glUniform1f(glGetUniformLocation(program, "cameraRadius"), BOTTOM_RADIUS + atmosphere.cameraAltitude);
+}
+
+//Runs the pass over a width x height grid and makes its writes visible to the draws that sample them
+static void endTablePass(int width, int height)
+{
+	glDispatchCompute(GLuint((width + COMPUTE_GROUP_SIZE - 1) / COMPUTE_GROUP_SIZE), GLuint((height + COMPUTE_GROUP_SIZE - 1) / COMPUTE_GROUP_SIZE), 1);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+static void createTexture(GLuint& texture, GLenum target)
+{
+	glGenTextures(1, &texture);
+	glBindTexture(target, texture);
+	glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+}
+
+void initAtmosphere(Atmosphere& atmosphere)
+{
+	createTexture(atmosphere.transmittanceTexture, GL_TEXTURE_2D);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, TRANSMITTANCE_WIDTH, TRANSMITTANCE_HEIGHT, 0, GL_RGB, GL_FLOAT, nullptr);
+	createTexture(atmosphere.multiScatteringTexture, GL_TEXTURE_2D);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, MULTI_SCATTERING_SIZE, MULTI_SCATTERING_SIZE, 0, GL_RGB, GL_FLOAT, nullptr);
+	createTexture(atmosphere.skyViewTexture, GL_TEXTURE_2D);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SKY_VIEW_WIDTH, SKY_VIEW_HEIGHT, 0, GL_RGBA, GL_FLOAT, nullptr);
+	createTexture(atmosphere.aerialTexture, GL_TEXTURE_3D);
+	glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, AERIAL_PERSPECTIVE_SIZE, AERIAL_PERSPECTIVE_SIZE, AERIAL_PERSPECTIVE_SIZE, 0, GL_RGBA, GL_FLOAT,
+				 nullptr);
+	glBindTexture(GL_TEXTURE_3D, 0);
+}
+
+void updateAtmosphere(Atmosphere& atmosphere, GLuint program, glm::vec3 sun, glm::vec3 camera)
+{
+	atmosphere.frameMs = 0.0;
+	atmosphere.sunDirection = glm::length(sun) > 0.0f ? glm::normalize(sun) : glm::vec3(0.0f, 1.0f, 0.0f);
+	atmosphere.cameraAltitude = max(camera.y * atmosphere.kilometresPerUnit, 0.001f);
+
+	float r = BOTTOM_RADIUS + atmosphere.cameraAltitude;
+	atmosphere.horizonNadir = acos(sqrt(r * r - BOTTOM_RADIUS * BOTTOM_RADIUS) / r);
+	atmosphere.horizonZenith = PI - atmosphere.horizonNadir;
+
+	glm::vec2 densities(atmosphere.rayleighDensity, atmosphere.mieDensity);
+	bool tablesChanged = densities != atmosphere.builtDensities;
+	if (tablesChanged)
+	{
+		auto start = chrono::steady_clock::now();
+		buildTransmittance(atmosphere);
+		buildMultipleScattering(atmosphere);
+		glBindTexture(GL_TEXTURE_2D, atmosphere.transmittanceTexture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TRANSMITTANCE_WIDTH, TRANSMITTANCE_HEIGHT, GL_RGB, GL_FLOAT, atmosphere.transmittance.data());
+		glBindTexture(GL_TEXTURE_2D, atmosphere.multiScatteringTexture);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, MULTI_SCATTERING_SIZE, MULTI_SCATTERING_SIZE, GL_RGB, GL_FLOAT, atmosphere.multiScattering.data());
+		glBindTexture(GL_TEXTURE_2D, 0);
+		atmosphere.builtDensities = densities;
+		atmosphere.transmittanceBuilds++;
+		atmosphere.transmittanceMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		atmosphere.frameMs += atmosphere.transmittanceMs;
+	}
+	atmosphere.sunColour = sunTransmittance(atmosphere, r, atmosphere.sunDirection.y) / transmittanceToTop(atmosphere, r, 1.0f);
+
+	//The sky barely changes over a hundred metres of altitude
+	if (tablesChanged || atmosphere.sunDirection.y != atmosphere.skyViewSun || fabs(atmosphere.cameraAltitude - atmosphere.skyViewAltitude) > 0.1f)
+	{
+		auto start = chrono::steady_clock::now();
+		beginTablePass(atmosphere, program, false);
+
+		//In a frame with the sun at azimuth 0
+		float muSun = atmosphere.sunDirection.y;
+		glUniform3f(glGetUniformLocation(program, "sun"), sqrt(max(1.0f - muSun * muSun, 0.0f)), muSun, 0.0f);
+		glUniform2f(glGetUniformLocation(program, "skyViewHorizon"), atmosphere.horizonZenith, atmosphere.horizonNadir);
+		endTablePass(SKY_VIEW_WIDTH, SKY_VIEW_HEIGHT);
+		atmosphere.skyViewSun = muSun;
+		atmosphere.skyViewAltitude = atmosphere.cameraAltitude;
+		atmosphere.skyViewBuilds++;
+		atmosphere.skyViewMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		atmosphere.frameMs += atmosphere.skyViewMs;
+	}
+}
+
+void updateAerialPerspective(Atmosphere& atmosphere, GLuint program, const glm::mat4& viewProjection)
+{
+	if (viewProjection == atmosphere.aerialViewProjection && atmosphere.sunDirection == atmosphere.aerialSun &&
+		atmosphere.cameraAltitude == atmosphere.aerialAltitude && atmosphere.aerialDistance == atmosphere.aerialRange &&
+		atmosphere.transmittanceBuilds == atmosphere.aerialTables)
+		return;
+
+	//A column of froxels per pixel of a size x size image, marched once from the camera through its slices
+	auto start = chrono::steady_clock::now();
+	beginTablePass(atmosphere, program, true);
+	glm::mat4 inverseViewProjection = glm::inverse(viewProjection);
+	glm::vec3 sun = atmosphere.sunDirection;
+	glUniform3f(glGetUniformLocation(program, "sun"), sun.x, sun.y, sun.z);
+	glUniformMatrix4fv(glGetUniformLocation(program, "inverseViewProjection"), 1, GL_FALSE, &inverseViewProjection[0][0]);
+	glUniform1f(glGetUniformLocation(program, "aerialRange"), atmosphere.aerialDistance);
+	endTablePass(AERIAL_PERSPECTIVE_SIZE, AERIAL_PERSPECTIVE_SIZE);
+	atmosphere.aerialViewProjection = viewProjection;
+	atmosphere.aerialSun = atmosphere.sunDirection;
+	atmosphere.aerialAltitude = atmosphere.cameraAltitude;
+	atmosphere.aerialRange = atmosphere.aerialDistance;
+	atmosphere.aerialTables = atmosphere.transmittanceBuilds;
+	atmosphere.aerialBuilds++;
+	atmosphere.aerialMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	atmosphere.frameMs += atmosphere.aerialMs;
+}
+
+void setAtmosphereSkyUniforms(const Atmosphere& atmosphere, GLuint program)
+{
+	glm::vec3 sun = atmosphere.sunDirection, disc = atmosphere.sunColour;
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, atmosphere.skyViewTexture);
+	glActiveTexture(GL_TEXTURE0);
+	glUniform1i(glGetUniformLocation(program, "skyView"), 1);
+	glUniform3f(glGetUniformLocation(program, "sunDirection"), sun.x, sun.y, sun.z);
+	glUniform3f(glGetUniformLocation(program, "sunDisc"), disc.x, disc.y, disc.z);
+	glUniform2f(glGetUniformLocation(program, "skyViewHorizon"), atmosphere.horizonZenith, atmosphere.horizonNadir);
+	glUniform1f(glGetUniformLocation(program, "exposure"), atmosphere.exposure);
+}
+
+void setAtmosphereUniforms(const Atmosphere& atmosphere, GLuint program, int width, int height)
+{
+	glm::vec3 colour = atmosphere.sunColour;
+	glUniform3f(glGetUniformLocation(program, "sunColour"), colour.x, colour.y, colour.z);
+	glUniform1f(glGetUniformLocation(program, "exposure"), atmosphere.exposure);
+	glUniform2f(glGetUniformLocation(program, "aerialScreenSize"), float(width), float(height));
+	glUniform1f(glGetUniformLocation(program, "aerialDepthScale"), atmosphere.kilometresPerUnit / atmosphere.aerialDistance);
+	glActiveTexture(GL_TEXTURE14);
+	glBindTexture(GL_TEXTURE_3D, atmosphere.aerialTexture);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void destroyAtmosphere(Atmosphere& atmosphere)
+{
+	glDeleteTextures(1, &atmosphere.transmittanceTexture);
+	glDeleteTextures(1, &atmosphere.multiScatteringTexture);
+	glDeleteTextures(1, &atmosphere.skyViewTexture);
+	glDeleteTextures(1, &atmosphere.aerialTexture);
+	atmosphere = Atmosphere();
+}
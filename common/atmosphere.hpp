@@ -0,0 +1,99 @@
+#ifndef ATMOSPHERE_HPP
+#define ATMOSPHERE_HPP
+
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+//Atmospheric scattering
+//A physically based sky and aerial perspective lit by the directional light, after Hillaire's table-driven
+//model: Rayleigh and Mie scattering and ozone absorption over a spherical planet, with multiple scattering
+//approximated by an isotropic term. Everything is integrated into small tables, each rebuilt only when
+//what it depends on changes:
+// - transmittance to the top of the atmosphere, by altitude and zenith angle, and multiple scattering, by
+//   altitude and sun angle: only the settings. Integrated on the CPU (on the job system) and uploaded
+// - the sky-view table (the sky's radiance around the camera, by zenith angle and azimuth from the sun):
+//   the sun's elevation and the camera's altitude, so turning the light around costs nothing
+// - the aerial perspective volume (light scattered in and transmittance from the camera, in froxels over
+//   the camera frustum): the camera and the light, so nearly every frame
+//The last two are marched on the GPU by a compute shader (src/atmosphere.comp) reading the first two, so
+//the CPU only issues a dispatch and the frame never waits on the march.
+//The sky then costs one fetch per pixel and the terrain one more, however long the paths through the air.
+//The scene's colours are display values, so the sky's radiance is tone mapped and gamma encoded in the
+//shaders, and the terrain's white light becomes the sunlight's colour through the air.
+//The ground is the world's y = 0 plane (the planet's surface under the camera); distances are kilometres.
+
+static const int TRANSMITTANCE_WIDTH = 256; //Zenith angle
+static const int TRANSMITTANCE_HEIGHT = 64; //Altitude
+static const int MULTI_SCATTERING_SIZE = 32; //Sun angle by altitude
+static const int SKY_VIEW_WIDTH = 192; //Azimuth from the sun (0 to pi, the sky is symmetric about the sun)
+static const int SKY_VIEW_HEIGHT = 108; //Zenith angle, denser towards the horizon
+static const int AERIAL_PERSPECTIVE_SIZE = 32; //Froxels across, up and deep
+
+struct Atmosphere
+{
+	//Settings
+	bool enabled = false;
+	bool aerialPerspective = true;
+	float kilometresPerUnit = 2.0f; //Scale of the world in the atmosphere
+	float exposure = 10.0f; //Scales the radiance for a sun of unit illuminance before it is tone mapped for display
+	float rayleighDensity = 1.0f; //Of Earth's air
+	float mieDensity = 1.0f; //Of Earth's aerosols (haze)
+	float aerialDistance = 32.0f; //Kilometres covered by the volume's slices
+
+	//RGB for a sun of unit illuminance, rows along the second parameter (the CPU reads them for the sun's colour)
+	std::vector<glm::vec3> transmittance;
+	std::vector<glm::vec3> multiScattering;
+	GLuint transmittanceTexture = 0;
+	GLuint multiScatteringTexture = 0;
+	GLuint skyViewTexture = 0; //RGBA16F, written by the compute shader
+	GLuint aerialTexture = 0; //In-scattered light and mean transmittance; slices of rows from the bottom of the screen
+
+	glm::vec3 sunDirection = glm::vec3(0.0f, 1.0f, 0.0f);
+	glm::vec3 sunColour = glm::vec3(1.0f); //Sunlight through the air to the camera, relative to the sun overhead (white at noon)
+	float cameraAltitude = 0.0f; //Kilometres
+	float horizonZenith = 0.0f; //Zenith angle of the horizon from the camera, just past pi / 2
+	float horizonNadir = 0.0f; //From the horizon down to the nadir (pi - horizonZenith)
+
+	//What the tables were built for
+	glm::vec2 builtDensities = glm::vec2(-1.0f);
+	float skyViewSun = 2.0f; //Cosine of the sun's zenith angle
+	float skyViewAltitude = -1.0f;
+	glm::mat4 aerialViewProjection = glm::mat4(0.0f);
+	glm::vec3 aerialSun = glm::vec3(0.0f);
+	float aerialAltitude = -1.0f;
+	float aerialRange = 0.0f;
+	int aerialTables = -1; //transmittanceBuilds
+
+	//Statistics
+	int transmittanceBuilds = 0; //With the multiple scattering
+	int skyViewBuilds = 0;
+	int aerialBuilds = 0;
+	double transmittanceMs = 0.0; //Of the last build
+	double skyViewMs = 0.0; //CPU time to issue the dispatch (the march shows in the GPU time of the caller's section)
+	double aerialMs = 0.0;
+	double frameMs = 0.0; //CPU time spent on tables this frame
+};
+
+//Creates the table textures
+void initAtmosphere(Atmosphere& atmosphere);
+
+//Rebuilds the tables the settings, the light or the camera's altitude invalidated. program is the
+//compute program of src/atmosphere.comp, sun points at the light (lightPos), camera is the camera's world position
+void updateAtmosphere(Atmosphere& atmosphere, GLuint program, glm::vec3 sun, glm::vec3 camera);
+
+//Rebuilds the aerial perspective volume when the camera (its unjittered view-projection) or the light
+//moved. Call after updateAtmosphere
+void updateAerialPerspective(Atmosphere& atmosphere, GLuint program, const glm::mat4& viewProjection);
+
+//sunDirection, sunDisc, skyViewHorizon and exposure of the sky program (the sky-view table is bound to unit 1)
+void setAtmosphereSkyUniforms(const Atmosphere& atmosphere, GLuint program);
+
+//sunColour of a terrain program, and its aerial perspective: exposure, the volume (bound to unit 14) and
+//the mapping of a width x height render target's pixels and of distances into it
+void setAtmosphereUniforms(const Atmosphere& atmosphere, GLuint program, int width, int height);
+
+void destroyAtmosphere(Atmosphere& atmosphere);
+
+#endif
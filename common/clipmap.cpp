@@ -0,0 +1,398 @@
+#include "clipmap.hpp"
+#include "framememory.hpp"
+#include "glcapture.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+using namespace std;
+
+//With the window origin snapped to (even cell - (CELLS/2 + 1)), the finer level's footprint always
+//starts HOLE_OFFSET or HOLE_OFFSET + 1 cells into the coarser window, so four ring meshes cover every case
+static const int HOLE_SIZE = CLIPMAP_GRID_CELLS / 2;
+static const int HOLE_OFFSET = CLIPMAP_GRID_CELLS / 4 + 1;
+static const int VERTS_PER_SIDE = CLIPMAP_GRID_CELLS + 1;
+
+static int positiveMod(int value, int n)
+{
+	int m = value % n;
+	return m < 0 ? m + n : m;
+}
+
+//Mirrored repeat so the height field tiles seamlessly in every direction
+static int mirrorIndex(int i, int n)
+{
+	int m = positiveMod(i, 2 * n);
+	return m < n ? m : 2 * n - 1 - m;
+}
+
+static float sampleHeight(const ClipmapHeights& source, int mip, float worldX, float worldZ)
+{
+	const vector<float>& data = source.mips[mip];
+	int w = source.mipWidths[mip];
+	int h = source.mipHeights[mip];
+
+	//Same mapping as the base mesh: [-worldSize/2, worldSize/2] -> [0, 1]
+	float fx = (worldX / source.worldSize + 0.5f) * w - 0.5f;
+	float fz = (worldZ / source.worldSize + 0.5f) * h - 0.5f;
+	int x0 = int(floor(fx));
+	int z0 = int(floor(fz));
+	float tx = fx - x0;
+	float tz = fz - z0;
+
+	int xa = mirrorIndex(x0, w), xb = mirrorIndex(x0 + 1, w);
+	int za = mirrorIndex(z0, h), zb = mirrorIndex(z0 + 1, h);
+
+	float top = data[size_t(za) * w + xa] * (1 - tx) + data[size_t(za) * w + xb] * tx;
+	float bottom = data[size_t(zb) * w + xa] * (1 - tx) + data[size_t(zb) * w + xb] * tx;
+	return top * (1 - tz) + bottom * tz;
+}
+
+//Pick the mip whose texel size is closest to (but not larger than) the level spacing
+static int mipForSpacing(const ClipmapHeights& source, float spacing)
+{
+	float texelSize = source.worldSize / source.mipWidths[0];
+	int mip = int(floor(log2(max(spacing / texelSize, 1.0f))));
+	return min(mip, int(source.mipWidths.size()) - 1);
+}
+
+//Upload the grid rectangle [gx, gx + w) x [gz, gz + h) of a level, splitting it where it wraps around the texture
+//The heights are sampled straight into the upload ring and copied into the texture from there
+static void uploadRegion(Clipmap& clipmap, int level, int gx, int gz, int w, int h)
+{
+	const ClipmapLevel& clipLevel = clipmap.levels[level];
+	const ClipmapHeights& source = *clipmap.source;
+	int mip = mipForSpacing(source, clipLevel.spacing);
+
+	for (int z = gz; z < gz + h;)
+	{
+		int tz = positiveMod(z, CLIPMAP_TEXTURE_SIZE);
+		int rows = min(gz + h - z, CLIPMAP_TEXTURE_SIZE - tz);
+
+		for (int x = gx; x < gx + w;)
+		{
+			int tx = positiveMod(x, CLIPMAP_TEXTURE_SIZE);
+			int columns = min(gx + w - x, CLIPMAP_TEXTURE_SIZE - tx);
+
+			UploadAllocation upload = uploadAllocate(size_t(rows) * columns * sizeof(float));
+			float* texels = static_cast<float*>(upload.data);
+			for (int j = 0; j < rows; j++)
+				for (int i = 0; i < columns; i++)
+					texels[size_t(j) * columns + i] = sampleHeight(source, mip, (x + i) * clipLevel.spacing, (z + j) * clipLevel.spacing);
+			finishUpload(upload);
+
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, upload.buffer);
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, tx, tz, level, columns, rows, 1, GL_RED, GL_FLOAT, (const void*)uintptr_t(upload.offset));
+			clipmap.texelsUpdated += rows * columns;
+			x += columns;
+		}
+
+		z += rows;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+//Append the two triangles of every cell in [0, CELLS)^2, skipping the hole (pass holeSize 0 for none)
+static void appendGridIndices(vector<unsigned int>& indices, int holeX, int holeZ, int holeSize)
+{
+	for (int z = 0; z < CLIPMAP_GRID_CELLS; z++)
+	{
+		for (int x = 0; x < CLIPMAP_GRID_CELLS; x++)
+		{
+			if (x >= holeX && x < holeX + holeSize && z >= holeZ && z < holeZ + holeSize)
+				continue;
+
+			unsigned int v00 = z * VERTS_PER_SIDE + x;
+			unsigned int v10 = v00 + 1;
+			unsigned int v01 = v00 + VERTS_PER_SIDE;
+			unsigned int v11 = v01 + 1;
+
+			//Counter-clockwise when seen from above, matching the base mesh
+			indices.push_back(v00);
+			indices.push_back(v01);
+			indices.push_back(v10);
+			indices.push_back(v10);
+			indices.push_back(v01);
+			indices.push_back(v11);
+		}
+	}
+}
+
+shared_ptr<const ClipmapHeights> buildClipmapHeights(const vector<float>& heights, int width, int height, float worldSize, float baseSpacing)
+{
+	if (heights.empty() || width < 2 || height < 2)
+		return nullptr;
+
+	shared_ptr<ClipmapHeights> source = make_shared<ClipmapHeights>();
+	source->worldSize = worldSize;
+
+	//Build the height mip chain with a 2x2 box filter
+	source->mips.assign(1, heights);
+	source->mipWidths.assign(1, width);
+	source->mipHeights.assign(1, height);
+	while (source->mipWidths.back() > 1 && source->mipHeights.back() > 1)
+	{
+		const vector<float>& src = source->mips.back();
+		int sw = source->mipWidths.back();
+		int sh = source->mipHeights.back();
+		int dw = sw / 2;
+		int dh = sh / 2;
+
+		vector<float> dst(size_t(dw) * dh);
+		for (int z = 0; z < dh; z++)
+			for (int x = 0; x < dw; x++)
+				dst[size_t(z) * dw + x] = 0.25f * (src[size_t(2 * z) * sw + 2 * x] + src[size_t(2 * z) * sw + 2 * x + 1] +
+												  src[size_t(2 * z + 1) * sw + 2 * x] + src[size_t(2 * z + 1) * sw + 2 * x + 1]);
+
+		source->mips.push_back(move(dst));
+		source->mipWidths.push_back(dw);
+		source->mipHeights.push_back(dh);
+	}
+
+	//Mips finer than the finest level are never sampled -> free them (mip widths stay for texel size lookups)
+	int finestMip = mipForSpacing(*source, baseSpacing);
+	for (int m = 0; m < finestMip; m++)
+		vector<float>().swap(source->mips[m]);
+
+	return source;
+}
+
+shared_ptr<ClipmapHeights> editableClipmapHeights(const ClipmapHeights& source, const vector<float>& heights)
+{
+	shared_ptr<ClipmapHeights> editable = make_shared<ClipmapHeights>(source);
+	for (size_t m = 1; m < editable->mips.size(); m++)
+		editable->mips[m].resize(size_t(editable->mipWidths[m]) * editable->mipHeights[m]);
+	updateClipmapHeights(*editable, heights, 0, 0, source.mipWidths[0] - 1, source.mipHeights[0] - 1);
+	return editable;
+}
+
+void updateClipmapHeights(ClipmapHeights& source, const vector<float>& heights, int x0, int z0, int x1, int z1)
+{
+	int width = source.mipWidths[0];
+	if (!source.mips[0].empty())
+		for (int z = z0; z <= z1; z++)
+			copy(&heights[size_t(z) * width + x0], &heights[size_t(z) * width + x1] + 1, &source.mips[0][size_t(z) * width + x0]);
+
+	//Each level only needs the texels under the changed ones of the level before
+	for (size_t m = 1; m < source.mips.size(); m++)
+	{
+		const vector<float>& src = m == 1 ? heights : source.mips[m - 1];
+		int sw = source.mipWidths[m - 1];
+		int dw = source.mipWidths[m];
+		vector<float>& dst = source.mips[m];
+
+		x0 /= 2, z0 /= 2;
+		x1 = min(x1 / 2, dw - 1), z1 = min(z1 / 2, source.mipHeights[m] - 1);
+		for (int z = z0; z <= z1; z++)
+			for (int x = x0; x <= x1; x++)
+				dst[size_t(z) * dw + x] = 0.25f * (src[size_t(2 * z) * sw + 2 * x] + src[size_t(2 * z) * sw + 2 * x + 1] +
+												   src[size_t(2 * z + 1) * sw + 2 * x] + src[size_t(2 * z + 1) * sw + 2 * x + 1]);
+	}
+}
+
+bool initClipmap(Clipmap& clipmap, shared_ptr<const ClipmapHeights> source, float baseSpacing, int numLevels)
+{
+	if (!source || numLevels < 1)
+		return false;
+
+	clipmap.numLevels = numLevels;
+	clipmap.source = source;
+	clipmap.levels.assign(numLevels, ClipmapLevel());
+	for (int l = 0; l < numLevels; l++)
+		clipmap.levels[l].spacing = baseSpacing * float(1 << l);
+
+	//Height texture array: one toroidal layer per level
+	glGenTextures(1, &clipmap.heightTexture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, clipmap.heightTexture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R32F, CLIPMAP_TEXTURE_SIZE, CLIPMAP_TEXTURE_SIZE, numLevels, 0, GL_RED, GL_FLOAT, nullptr);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	//Every level shares one grid of local cell coordinates
+	vector<glm::vec2> vertices;
+	for (int z = 0; z < VERTS_PER_SIDE; z++)
+		for (int x = 0; x < VERTS_PER_SIDE; x++)
+			vertices.push_back(glm::vec2(x, z));
+
+	//Full grid for the finest level, then one ring per possible hole offset
+	vector<unsigned int> indices;
+	for (int variant = 0; variant < 5; variant++)
+	{
+		clipmap.indexOffsets[variant] = indices.size() * sizeof(unsigned int);
+		if (variant == 0)
+			appendGridIndices(indices, 0, 0, 0);
+		else
+			appendGridIndices(indices, HOLE_OFFSET + ((variant - 1) & 1), HOLE_OFFSET + ((variant - 1) >> 1), HOLE_SIZE);
+		clipmap.indexCounts[variant] = GLsizei(indices.size() - clipmap.indexOffsets[variant] / sizeof(unsigned int));
+	}
+
+	glGenVertexArrays(1, &clipmap.vertexArray);
+	glBindVertexArray(clipmap.vertexArray);
+
+	glEnableVertexAttribArray(0);
+	glGenBuffers(1, &clipmap.vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, clipmap.vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec2), &vertices[0], GL_STATIC_DRAW);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+	glGenBuffers(1, &clipmap.elementBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, clipmap.elementBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+
+	glBindVertexArray(0);
+	return true;
+}
+
+void setClipmapHeights(Clipmap& clipmap, shared_ptr<const ClipmapHeights> source)
+{
+	clipmap.source = source;
+	for (ClipmapLevel& level : clipmap.levels)
+		level.valid = false;
+}
+
+void updateClipmap(Clipmap& clipmap, glm::vec3 cameraPos)
+{
+	clipmap.texelsUpdated = 0;
+	if (!clipmap.source)
+		return;
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, clipmap.heightTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	for (int l = 0; l < clipmap.numLevels; l++)
+	{
+		ClipmapLevel& level = clipmap.levels[l];
+
+		//Snap to an even cell so the finer level's footprint lands on this level's vertices
+		int centreX = 2 * int(floor(cameraPos.x / (2.0f * level.spacing)));
+		int centreZ = 2 * int(floor(cameraPos.z / (2.0f * level.spacing)));
+		int newX = centreX - (CLIPMAP_GRID_CELLS / 2 + 1);
+		int newZ = centreZ - (CLIPMAP_GRID_CELLS / 2 + 1);
+
+		//The texture holds [origin - 1, origin - 1 + SIZE) so the shader can take neighbours for normals
+		int oldBaseX = level.originX - 1, oldBaseZ = level.originZ - 1;
+		int baseX = newX - 1, baseZ = newZ - 1;
+		int dx = newX - level.originX;
+		int dz = newZ - level.originZ;
+
+		if (!level.valid || abs(dx) >= CLIPMAP_TEXTURE_SIZE || abs(dz) >= CLIPMAP_TEXTURE_SIZE)
+		{
+			uploadRegion(clipmap, l, baseX, baseZ, CLIPMAP_TEXTURE_SIZE, CLIPMAP_TEXTURE_SIZE);
+		}
+		else
+		{
+			//Newly exposed columns (over the full new height)
+			if (dx > 0)
+				uploadRegion(clipmap, l, oldBaseX + CLIPMAP_TEXTURE_SIZE, baseZ, dx, CLIPMAP_TEXTURE_SIZE);
+			else if (dx < 0)
+				uploadRegion(clipmap, l, baseX, baseZ, -dx, CLIPMAP_TEXTURE_SIZE);
+
+			//Newly exposed rows (columns already refreshed above are skipped)
+			int rowX = dx > 0 ? baseX : baseX - dx;
+			int rowWidth = CLIPMAP_TEXTURE_SIZE - abs(dx);
+			if (dz > 0)
+				uploadRegion(clipmap, l, rowX, oldBaseZ + CLIPMAP_TEXTURE_SIZE, rowWidth, dz);
+			else if (dz < 0)
+				uploadRegion(clipmap, l, rowX, baseZ, rowWidth, -dz);
+		}
+
+		level.originX = newX;
+		level.originZ = newZ;
+		level.valid = true;
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+//First and last window cell along one axis whose bilinear samples read any texel in [first, last] of an axis of size texels
+static bool windowRange(int base, float spacing, float worldSize, int size, int first, int last, int& firstCell, int& lastCell)
+{
+	firstCell = INT_MAX, lastCell = INT_MIN;
+	for (int cell = base; cell < base + CLIPMAP_TEXTURE_SIZE; cell++)
+	{
+		int texel = int(floor((cell * spacing / worldSize + 0.5f) * size - 0.5f));
+		int a = mirrorIndex(texel, size), b = mirrorIndex(texel + 1, size);
+		if ((a >= first && a <= last) || (b >= first && b <= last))
+		{
+			firstCell = min(firstCell, cell);
+			lastCell = max(lastCell, cell);
+		}
+	}
+	return firstCell <= lastCell;
+}
+
+void updateClipmapRegion(Clipmap& clipmap, int x0, int z0, int x1, int z1)
+{
+	if (!clipmap.source)
+		return;
+
+	const ClipmapHeights& source = *clipmap.source;
+	glBindTexture(GL_TEXTURE_2D_ARRAY, clipmap.heightTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+	for (int l = 0; l < clipmap.numLevels; l++)
+	{
+		//Levels not uploaded yet will be in full anyway
+		const ClipmapLevel& level = clipmap.levels[l];
+		if (!level.valid)
+			continue;
+
+		int mip = mipForSpacing(source, level.spacing);
+		int firstX, lastX, firstZ, lastZ;
+		if (windowRange(level.originX - 1, level.spacing, source.worldSize, source.mipWidths[mip], x0 >> mip, x1 >> mip, firstX, lastX) &&
+			windowRange(level.originZ - 1, level.spacing, source.worldSize, source.mipHeights[mip], z0 >> mip, z1 >> mip, firstZ, lastZ))
+			uploadRegion(clipmap, l, firstX, firstZ, lastX - firstX + 1, lastZ - firstZ + 1);
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+
+void drawClipmap(const Clipmap& clipmap, GLuint program, GLenum textureUnit)
+{
+	glActiveTexture(textureUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, clipmap.heightTexture);
+	glUniform1i(glGetUniformLocation(program, "heightClipmap"), textureUnit - GL_TEXTURE0);
+
+	GLint originLocation = glGetUniformLocation(program, "levelOrigin");
+	GLint spacingLocation = glGetUniformLocation(program, "levelSpacing");
+	GLint levelLocation = glGetUniformLocation(program, "level");
+	GLint coarserLocation = glGetUniformLocation(program, "hasCoarser");
+
+	glBindVertexArray(clipmap.vertexArray);
+
+	//Finest first so the coarse rings are mostly rejected by the depth test
+	for (int l = 0; l < clipmap.numLevels; l++)
+	{
+		const ClipmapLevel& level = clipmap.levels[l];
+
+		int variant = 0;
+		if (l > 0)
+		{
+			const ClipmapLevel& finer = clipmap.levels[l - 1];
+			int holeX = finer.originX / 2 - level.originX;
+			int holeZ = finer.originZ / 2 - level.originZ;
+			variant = 1 + (holeX - HOLE_OFFSET) + 2 * (holeZ - HOLE_OFFSET);
+		}
+
+		glUniform2i(originLocation, level.originX, level.originZ);
+		glUniform1f(spacingLocation, level.spacing);
+		glUniform1i(levelLocation, l);
+		glUniform1i(coarserLocation, l + 1 < clipmap.numLevels && clipmap.levels[l + 1].valid);
+
+		glDrawElements(GL_TRIANGLES, clipmap.indexCounts[variant], GL_UNSIGNED_INT, (void*)clipmap.indexOffsets[variant]);
+	}
+
+	glBindVertexArray(0);
+}
+
+void destroyClipmap(Clipmap& clipmap)
+{
+	glDeleteTextures(1, &clipmap.heightTexture);
+	glDeleteBuffers(1, &clipmap.vertexBuffer);
+	glDeleteBuffers(1, &clipmap.elementBuffer);
+	glDeleteVertexArrays(1, &clipmap.vertexArray);
+	clipmap = Clipmap();
+}
@@ -0,0 +1,81 @@
+#ifndef CLIPMAP_HPP
+#define CLIPMAP_HPP
+
+#include <memory>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+//Geometry clipmap terrain
+//Nested square rings of a fixed-size grid are centred on the camera. Every level keeps its heights
+//in one layer of a toroidally addressed texture array, so when the camera moves only the rows and
+//columns that became visible are uploaded. Per-frame cost does not depend on the terrain size.
+
+static const int CLIPMAP_TEXTURE_SIZE = 128; //Texels per side of a level (power of two so the shader can wrap with &)
+static const int CLIPMAP_GRID_CELLS = 122; //Cells per side of a level's window (must be 2 mod 4 so levels nest)
+
+struct ClipmapLevel
+{
+	int originX = 0; //Grid coordinate of the window's corner, in units of this level's spacing
+	int originZ = 0;
+	float spacing = 0.0f;
+	bool valid = false; //False until the whole level has been uploaded once
+};
+
+//Height field mip chain (level 0 is the decoded heightmap), sampled with mirrored repeat
+//Pure CPU data, so it can be built on a loader thread and shared between clipmaps
+struct ClipmapHeights
+{
+	float worldSize = 0.0f; //World size covered by one repeat of the height field
+	std::vector<std::vector<float>> mips; //Mips finer than the finest level's spacing are left empty
+	std::vector<int> mipWidths;
+	std::vector<int> mipHeights;
+};
+
+struct Clipmap
+{
+	int numLevels = 0;
+	std::vector<ClipmapLevel> levels;
+	std::shared_ptr<const ClipmapHeights> source;
+
+	//GL resources
+	GLuint heightTexture = 0; //GL_TEXTURE_2D_ARRAY, one R32F layer per level
+	GLuint vertexArray = 0;
+	GLuint vertexBuffer = 0;
+	GLuint elementBuffer = 0;
+
+	//Index ranges: [0] is the full grid (finest level), [1..4] are rings for each hole offset
+	GLsizei indexCounts[5] = {};
+	size_t indexOffsets[5] = {};
+
+	//Texels uploaded by the last update (stays small and constant while flying)
+	int texelsUpdated = 0;
+};
+
+//Build the mip chain for a decoded height field; baseSpacing is the finest grid spacing in world units
+std::shared_ptr<const ClipmapHeights> buildClipmapHeights(const std::vector<float>& heights, int width, int height, float worldSize, float baseSpacing);
+
+//Copy of a height field's mips with the finest ones kept too, so edits of the heights can be propagated by region
+std::shared_ptr<ClipmapHeights> editableClipmapHeights(const ClipmapHeights& source, const std::vector<float>& heights);
+
+//Rebuild the mips under the changed texels [x0, x1] x [z0, z1] of heights (every mip past the first must be allocated)
+void updateClipmapHeights(ClipmapHeights& source, const std::vector<float>& heights, int x0, int z0, int x1, int z1);
+
+bool initClipmap(Clipmap& clipmap, std::shared_ptr<const ClipmapHeights> source, float baseSpacing, int numLevels);
+
+//Switch to another height field; every level is re-uploaded on the next update
+void setClipmapHeights(Clipmap& clipmap, std::shared_ptr<const ClipmapHeights> source);
+
+//Move the levels to follow the camera and upload the newly exposed rows/columns
+void updateClipmap(Clipmap& clipmap, glm::vec3 cameraPos);
+
+//Upload the window texels of every level that sample the changed height field texels [x0, x1] x [z0, z1]
+void updateClipmapRegion(Clipmap& clipmap, int x0, int z0, int x1, int z1);
+
+//Draw every level with the given program (uniforms shared with Basic.vert must already be set)
+void drawClipmap(const Clipmap& clipmap, GLuint program, GLenum textureUnit);
+
+void destroyClipmap(Clipmap& clipmap);
+
+#endif
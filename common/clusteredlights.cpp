@@ -0,0 +1,312 @@
+#include "clusteredlights.hpp"
+#include "framememory.hpp"
+#include "glcapture.hpp"
+#include "jobs.hpp"
+#include "terrainquery.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+using namespace std;
+
+static_assert(sizeof(LocalLight) == 48, "LocalLight must match the shader's std430 layout");
+static_assert(sizeof(LightCluster) == 8, "LightCluster must match the shader's uvec2");
+
+static int clusterIndex(int x, int y, int slice)
+{
+	return (slice * CLUSTER_TILES_Y + y) * CLUSTER_TILES_X + x;
+}
+
+//Near and far planes of a perspective projection
+static void projectionPlanes(const glm::mat4& projection, float& nearPlane, float& farPlane)
+{
+	nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+	farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+}
+
+static float sliceDepth(float nearPlane, float farPlane, int slice)
+{
+	return nearPlane * pow(farPlane / nearPlane, float(slice) / CLUSTER_SLICES);
+}
+
+//View space boxes around every froxel: the corners of its tile at both of its slice depths
+static void buildClusterBounds(ClusteredLights& clustered, const glm::mat4& projection)
+{
+	float nearPlane, farPlane;
+	projectionPlanes(projection, nearPlane, farPlane);
+	glm::mat4 inverseProjection = glm::inverse(projection);
+
+	clustered.boundsMin.resize(CLUSTER_COUNT);
+	clustered.boundsMax.resize(CLUSTER_COUNT);
+	for (int y = 0; y < CLUSTER_TILES_Y; y++)
+	{
+		for (int x = 0; x < CLUSTER_TILES_X; x++)
+		{
+			//Directions through the tile corners, scaled to a view depth of 1
+			glm::vec3 corners[4];
+			for (int i = 0; i < 4; i++)
+			{
+				float ndcX = float(x + (i & 1)) / CLUSTER_TILES_X * 2.0f - 1.0f;
+				float ndcY = float(y + (i >> 1)) / CLUSTER_TILES_Y * 2.0f - 1.0f;
+				glm::vec4 point = inverseProjection * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+				corners[i] = glm::vec3(point) / -point.z;
+			}
+
+			for (int slice = 0; slice < CLUSTER_SLICES; slice++)
+			{
+				float depths[2] = { sliceDepth(nearPlane, farPlane, slice), sliceDepth(nearPlane, farPlane, slice + 1) };
+				glm::vec3 boxMin(FLT_MAX), boxMax(-FLT_MAX);
+				for (float depth : depths)
+				{
+					for (const glm::vec3& corner : corners)
+					{
+						boxMin = glm::min(boxMin, corner * depth);
+						boxMax = glm::max(boxMax, corner * depth);
+					}
+				}
+				clustered.boundsMin[clusterIndex(x, y, slice)] = boxMin;
+				clustered.boundsMax[clusterIndex(x, y, slice)] = boxMax;
+			}
+		}
+	}
+	clustered.boundsProjection = projection;
+}
+
+void binLights(ClusteredLights& clustered, const glm::mat4& view, const glm::mat4& projection)
+{
+	auto start = chrono::steady_clock::now();
+
+	if (clustered.clusters.size() != size_t(CLUSTER_COUNT))
+	{
+		clustered.clusters.assign(CLUSTER_COUNT, LightCluster());
+		clustered.clusterLights.assign(CLUSTER_COUNT, vector<uint32_t>());
+	}
+	if (projection != clustered.boundsProjection)
+		buildClusterBounds(clustered, projection);
+
+	float nearPlane, farPlane;
+	projectionPlanes(projection, nearPlane, farPlane);
+	float logScale = CLUSTER_SLICES / log(farPlane / nearPlane);
+	clustered.depthScale = glm::vec2(logScale, -log(nearPlane) * logScale);
+
+	//Sphere bounds of every light in front of the camera
+	vector<LightRange>& ranges = clustered.ranges;
+	ranges.clear();
+	for (size_t i = 0; i < clustered.lights.size(); i++)
+	{
+		const LocalLight& light = clustered.lights[i];
+		glm::vec3 center = glm::vec3(view * glm::vec4(light.position, 1.0f));
+		float radius = light.radius;
+		float depth = -center.z;
+		if (depth + radius < nearPlane || depth - radius > farPlane)
+			continue;
+
+		LightRange range;
+		range.light = uint32_t(i);
+		range.center = center;
+		float nearDepth = max(depth - radius, nearPlane), farDepth = min(depth + radius, farPlane);
+		range.slice0 = glm::clamp(int(log(nearDepth) * clustered.depthScale.x + clustered.depthScale.y), 0, CLUSTER_SLICES - 1);
+		range.slice1 = glm::clamp(int(log(farDepth) * clustered.depthScale.x + clustered.depthScale.y), 0, CLUSTER_SLICES - 1);
+
+		if (depth - radius <= nearPlane)
+		{
+			//The sphere reaches the camera: any tile may see it
+			range.x0 = range.y0 = 0;
+			range.x1 = CLUSTER_TILES_X - 1;
+			range.y1 = CLUSTER_TILES_Y - 1;
+		}
+		else
+		{
+			//Screen bounds of the sphere's box: its sides are furthest out at its nearest or its furthest depth
+			float ndcMinX = FLT_MAX, ndcMaxX = -FLT_MAX, ndcMinY = FLT_MAX, ndcMaxY = -FLT_MAX;
+			for (float boxDepth : { depth - radius, depth + radius })
+			{
+				for (float side : { -radius, radius })
+				{
+					float ndcX = (projection[0][0] * (center.x + side) - projection[2][0] * boxDepth) / boxDepth;
+					float ndcY = (projection[1][1] * (center.y + side) - projection[2][1] * boxDepth) / boxDepth;
+					ndcMinX = min(ndcMinX, ndcX);
+					ndcMaxX = max(ndcMaxX, ndcX);
+					ndcMinY = min(ndcMinY, ndcY);
+					ndcMaxY = max(ndcMaxY, ndcY);
+				}
+			}
+			if (ndcMaxX < -1.0f || ndcMinX > 1.0f || ndcMaxY < -1.0f || ndcMinY > 1.0f)
+				continue;
+
+			range.x0 = glm::clamp(int((ndcMinX * 0.5f + 0.5f) * CLUSTER_TILES_X), 0, CLUSTER_TILES_X - 1);
+			range.x1 = glm::clamp(int((ndcMaxX * 0.5f + 0.5f) * CLUSTER_TILES_X), 0, CLUSTER_TILES_X - 1);
+			range.y0 = glm::clamp(int((ndcMinY * 0.5f + 0.5f) * CLUSTER_TILES_Y), 0, CLUSTER_TILES_Y - 1);
+			range.y1 = glm::clamp(int((ndcMaxY * 0.5f + 0.5f) * CLUSTER_TILES_Y), 0, CLUSTER_TILES_Y - 1);
+		}
+		ranges.push_back(range);
+	}
+
+	//Every slice is binned by its own job: a light goes into the froxels of its range whose box its sphere touches
+	vector<uint32_t>& sliceTotals = clustered.sliceTotals;
+	sliceTotals.assign(CLUSTER_SLICES, 0);
+	parallelFor(0, CLUSTER_SLICES, 1, [&](int first, int last)
+	{
+		for (int slice = first; slice < last; slice++)
+		{
+			for (int cluster = clusterIndex(0, 0, slice); cluster < clusterIndex(0, 0, slice + 1); cluster++)
+				clustered.clusterLights[cluster].clear();
+
+			for (const LightRange& range : ranges)
+			{
+				if (slice < range.slice0 || slice > range.slice1)
+					continue;
+
+				float radius = clustered.lights[range.light].radius;
+				for (int y = range.y0; y <= range.y1; y++)
+				{
+					for (int x = range.x0; x <= range.x1; x++)
+					{
+						int cluster = clusterIndex(x, y, slice);
+						glm::vec3 closest = glm::clamp(range.center, clustered.boundsMin[cluster], clustered.boundsMax[cluster]);
+						glm::vec3 offset = closest - range.center;
+						if (glm::dot(offset, offset) <= radius * radius)
+							clustered.clusterLights[cluster].push_back(range.light);
+					}
+				}
+			}
+
+			uint32_t total = 0;
+			for (int cluster = clusterIndex(0, 0, slice); cluster < clusterIndex(0, 0, slice + 1); cluster++)
+				total += uint32_t(clustered.clusterLights[cluster].size());
+			sliceTotals[slice] = total;
+		}
+	});
+
+	//Offsets of the slices in the index list, then every slice copies its lists into place
+	vector<uint32_t>& sliceOffsets = clustered.sliceOffsets;
+	sliceOffsets.assign(CLUSTER_SLICES, 0);
+	uint32_t indexCount = 0;
+	for (int slice = 0; slice < CLUSTER_SLICES; slice++)
+	{
+		sliceOffsets[slice] = indexCount;
+		indexCount += sliceTotals[slice];
+	}
+	clustered.indices.resize(indexCount);
+
+	parallelFor(0, CLUSTER_SLICES, 1, [&](int first, int last)
+	{
+		for (int slice = first; slice < last; slice++)
+		{
+			uint32_t offset = sliceOffsets[slice];
+			for (int cluster = clusterIndex(0, 0, slice); cluster < clusterIndex(0, 0, slice + 1); cluster++)
+			{
+				const vector<uint32_t>& lights = clustered.clusterLights[cluster];
+				clustered.clusters[cluster].offset = offset;
+				clustered.clusters[cluster].count = uint32_t(lights.size());
+				if (!lights.empty())
+					memcpy(&clustered.indices[offset], lights.data(), lights.size() * sizeof(uint32_t));
+				offset += uint32_t(lights.size());
+			}
+		}
+	});
+
+	clustered.visibleLights = int(ranges.size());
+	clustered.occupiedClusters = 0;
+	clustered.maxClusterLights = 0;
+	for (const LightCluster& cluster : clustered.clusters)
+	{
+		clustered.occupiedClusters += cluster.count > 0;
+		clustered.maxClusterLights = max(clustered.maxClusterLights, int(cluster.count));
+	}
+	clustered.binMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+//Copies the data into the upload ring and binds its range (never empty, so the binding stays valid)
+static size_t uploadStorage(GLuint binding, const void* data, size_t size)
+{
+	UploadAllocation upload = uploadAllocate(max(size, size_t(16)));
+	if (size > 0)
+		memcpy(upload.data, data, size);
+	else
+		memset(upload.data, 0, upload.bytes);
+	finishUpload(upload);
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, upload.buffer, GLintptr(upload.offset), GLsizeiptr(upload.bytes));
+	return upload.bytes;
+}
+
+void uploadClusteredLights(ClusteredLights& clustered)
+{
+	clustered.uploadBytes = uploadStorage(LIGHT_BUFFER_BINDING, clustered.lights.data(), clustered.lights.size() * sizeof(LocalLight));
+	clustered.uploadBytes += uploadStorage(CLUSTER_BUFFER_BINDING, clustered.clusters.data(), clustered.clusters.size() * sizeof(LightCluster));
+	clustered.uploadBytes += uploadStorage(LIGHT_INDEX_BUFFER_BINDING, clustered.indices.data(), clustered.indices.size() * sizeof(uint32_t));
+}
+
+void setClusterUniforms(const ClusteredLights& clustered, GLuint program, int width, int height)
+{
+	glUniform2f(glGetUniformLocation(program, "clusterScreenSize"), float(width), float(height));
+	glUniform2f(glGetUniformLocation(program, "clusterDepthScale"), clustered.depthScale.x, clustered.depthScale.y);
+}
+
+void destroyClusteredLights(ClusteredLights& clustered)
+{
+	clustered.uploadBytes = 0;
+	clustered.lights.clear();
+	clustered.clusters.clear();
+	clustered.indices.clear();
+	clustered.clusterLights.clear();
+}
+
+//Deterministic random number in [0, 1) for light i (a hash, so the scene needs no stored state)
+static float lightRandom(unsigned seed, int i, int channel)
+{
+	uint32_t h = seed * 0x9E3779B9u ^ uint32_t(i) * 0x85EBCA6Bu ^ uint32_t(channel) * 0xC2B2AE35u;
+	h ^= h >> 16;
+	h *= 0x7FEB352Du;
+	h ^= h >> 15;
+	h *= 0x846CA68Bu;
+	h ^= h >> 16;
+	return float(h >> 8) / 16777216.0f;
+}
+
+void buildLightStressScene(vector<LocalLight>& lights, const TerrainQuery& query, float worldSize, int count, float radius,
+						   unsigned seed, double time)
+{
+	lights.resize(count);
+	FrameVector<glm::vec2> positions(count);
+	for (int i = 0; i < count; i++)
+	{
+		//Anchors spread over the terrain, circled at a light-specific speed
+		float angle = float(time) * (0.5f + lightRandom(seed, i, 0)) + 6.2831853f * lightRandom(seed, i, 1);
+		float circle = 0.05f + 0.15f * lightRandom(seed, i, 2);
+		glm::vec2 anchor = (glm::vec2(lightRandom(seed, i, 3), lightRandom(seed, i, 4)) - 0.5f) * worldSize;
+		positions[i] = anchor + circle * glm::vec2(cos(angle), sin(angle));
+	}
+
+	FrameVector<float> heights(count);
+	terrainHeights(query, positions.data(), heights.data(), size_t(count));
+
+	for (int i = 0; i < count; i++)
+	{
+		LocalLight& light = lights[i];
+		light.radius = radius * (0.5f + lightRandom(seed, i, 5));
+		light.position = glm::vec3(positions[i].x, heights[i] + 0.25f * light.radius, positions[i].y);
+
+		//Saturated colours of any hue
+		glm::vec3 hue = glm::clamp(glm::abs(glm::mod(lightRandom(seed, i, 6) * 6.0f + glm::vec3(0.0f, 4.0f, 2.0f), 6.0f) - 3.0f) - 1.0f, 0.0f, 1.0f);
+		light.colour = 2.0f * hue;
+
+		if (i % 4 == 0)
+		{
+			//Spot lights hang higher and shine down
+			light.position.y += 0.5f * light.radius;
+			light.spotDirection = glm::vec3(0.0f, -1.0f, 0.0f);
+			light.spotOuterCos = cos(glm::radians(40.0f));
+			light.spotInnerCos = cos(glm::radians(25.0f));
+		}
+		else
+		{
+			light.spotOuterCos = -2.0f;
+			light.spotInnerCos = -2.0f;
+		}
+	}
+}
@@ -0,0 +1,103 @@
+#ifndef CLUSTEREDLIGHTS_HPP
+#define CLUSTEREDLIGHTS_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+struct TerrainQuery;
+
+//Clustered forward lighting
+//The view frustum is split into a froxel grid (screen tiles times logarithmic depth slices). Every frame
+//the local lights are binned into the froxels they touch on the CPU (one job per depth slice), and the
+//lights, the per-froxel ranges and the light index lists are written into the upload ring and bound as
+//shader storage buffer ranges. The terrain shader looks up the froxel of each fragment and only loops over
+//its lights, so its cost follows the lights around a fragment rather than the total number of lights.
+
+//Must match the defines in Texture.frag
+static const int CLUSTER_TILES_X = 16;
+static const int CLUSTER_TILES_Y = 12;
+static const int CLUSTER_SLICES = 24;
+static const int CLUSTER_COUNT = CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES;
+
+//Shader storage binding points
+static const GLuint LIGHT_BUFFER_BINDING = 0;
+static const GLuint CLUSTER_BUFFER_BINDING = 1;
+static const GLuint LIGHT_INDEX_BUFFER_BINDING = 2;
+
+//Laid out as the shader's std430 struct (three vec4s)
+struct LocalLight
+{
+	glm::vec3 position = glm::vec3(0.0f); //World space
+	float radius = 1.0f; //No effect beyond this distance
+	glm::vec3 colour = glm::vec3(1.0f);
+	float spotOuterCos = -2.0f; //Spot lights: cosine of the cone's half angle (below -1 for point lights)
+	glm::vec3 spotDirection = glm::vec3(0.0f, -1.0f, 0.0f);
+	float spotInnerCos = -2.0f; //Full intensity inside this cosine
+};
+
+//Range of a froxel's lights in the index list
+struct LightCluster
+{
+	uint32_t offset = 0;
+	uint32_t count = 0;
+};
+
+//Froxels a light may touch: a range of slices and of tiles, from the screen bounds of its sphere
+struct LightRange
+{
+	uint32_t light;
+	glm::vec3 center; //View space
+	int slice0, slice1;
+	int x0, x1, y0, y1;
+};
+
+struct ClusteredLights
+{
+	std::vector<LocalLight> lights; //Filled by the application before binning
+
+	//Binning results, in the layout uploaded (froxel index = (slice * CLUSTER_TILES_Y + y) * CLUSTER_TILES_X + x)
+	std::vector<LightCluster> clusters;
+	std::vector<uint32_t> indices;
+	glm::vec2 depthScale = glm::vec2(0.0f); //slice = log(view depth) * x + y
+
+	//View space bounds of every froxel, rebuilt when the projection changes
+	std::vector<glm::vec3> boundsMin;
+	std::vector<glm::vec3> boundsMax;
+	glm::mat4 boundsProjection = glm::mat4(0.0f);
+
+	//Scratch of the binning, reused between frames
+	std::vector<std::vector<uint32_t>> clusterLights; //Per froxel
+	std::vector<LightRange> ranges;
+	std::vector<uint32_t> sliceTotals;
+	std::vector<uint32_t> sliceOffsets;
+
+	size_t uploadBytes = 0; //Of the last upload, in the upload ring
+
+	//Statistics of the last binning
+	int visibleLights = 0;
+	int occupiedClusters = 0;
+	int maxClusterLights = 0;
+	double binMs = 0.0;
+};
+
+//Bins lights into the froxels of this camera (CPU only, spread over the job system; needs no GL context)
+void binLights(ClusteredLights& clustered, const glm::mat4& view, const glm::mat4& projection);
+
+//Writes the lights and the binning results into the upload ring, and binds their ranges as the storage buffers
+void uploadClusteredLights(ClusteredLights& clustered);
+
+//Uniforms a program needs to find its froxels (width and height of the target it renders to)
+void setClusterUniforms(const ClusteredLights& clustered, GLuint program, int width, int height);
+
+void destroyClusteredLights(ClusteredLights& clustered);
+
+//Stress scene: count lights scattered over the terrain (a quarter of them spot lights pointing down), each
+//circling its own anchor over time. The same seed always gives the same scene (its scratch comes from the
+//frame arena)
+void buildLightStressScene(std::vector<LocalLight>& lights, const TerrainQuery& query, float worldSize, int count, float radius,
+						   unsigned seed, double time);
+
+#endif
@@ -7,10 +7,15 @@ extern GLFWwindow* window; // The "extern" keyword here is to access the variabl
 #include <glm/gtc/matrix_transform.hpp>
 using namespace glm;
 
+#include <cfloat>
+
 #include "controls.hpp"
+#include "simulation.hpp"
 
 glm::mat4 ViewMatrix;
 glm::mat4 ProjectionMatrix;
+glm::mat4 UnjitteredProjectionMatrix;
+glm::vec2 projectionJitter = glm::vec2(0.0f);
 
 glm::mat4 getViewMatrix() {
 	return ViewMatrix;
@@ -18,6 +23,17 @@ glm::mat4 getViewMatrix() {
 glm::mat4 getProjectionMatrix() {
 	return ProjectionMatrix;
 }
+glm::mat4 getUnjitteredProjectionMatrix() {
+	return UnjitteredProjectionMatrix;
+}
+void setProjectionJitter(glm::vec2 offset) {
+	projectionJitter = offset;
+}
+
+float (*cameraGroundHeight)(float x, float z) = nullptr;
+void setCameraGroundFunction(float (*groundHeight)(float x, float z)) {
+	cameraGroundHeight = groundHeight;
+}
 
 
 // Initial position : on +Z
@@ -32,50 +48,18 @@ float initialFoV = 45.0f;
 glm::vec3 getCameraPosition() {
 	return position;
 }
-float speed = 3.0f; // 3 units / second
-float mouseSpeed = 0.005f;
-
-
 
-void computeMatricesFromInputs(bool cursorOff, bool wasJustOff, bool wasJustOn) {
-
-	// glfwGetTime is called only once, the first time this function is called
-	static double lastTime = glfwGetTime();
-
-	// Compute time difference between current and last frame
-	double currentTime = glfwGetTime();
-	float deltaTime = float(currentTime - lastTime);
-
-	if (cursorOff)
-	{
-		int width, height;
-		glfwGetWindowSize(window, &width, &height);
-
-		// Get mouse position
-		double xpos, ypos;
-		glfwGetCursorPos(window, &xpos, &ypos);
-
-		if (wasJustOff)
-		{
-			// Reset mouse position for next frame
-			glfwSetCursorPos(window, width / 2, height / 2);
+// Light direction from the simulation
+glm::vec3 lightPosition = glm::vec3(0, -0.5, -0.5);
+glm::vec3 getLightPosition() {
+	return lightPosition;
+}
 
-			xpos = width / 2;
-			ypos = height / 2;
-		}
 
-		else
-		{
-			// Compute new orientation
-			horizontalAngle += mouseSpeed * float(width / 2 - xpos);
-			verticalAngle += mouseSpeed * float(height / 2 - ypos);
 
-			// Reset mouse position for next frame
-			glfwSetCursorPos(window, width / 2, height / 2);
-		}
+void computeCameraMatrices(glm::vec3 position, float horizontalAngle, float verticalAngle, float fov, glm::vec2 jitter,
+						   glm::mat4& view, glm::mat4& projection, glm::mat4& unjitteredProjection) {
 
-	}
-	
 	// Direction : Spherical coordinates to Cartesian coordinates conversion
 	glm::vec3 direction(
 		cos(verticalAngle) * sin(horizontalAngle),
@@ -93,36 +77,80 @@ void computeMatricesFromInputs(bool cursorOff, bool wasJustOff, bool wasJustOn)
 	// Up vector
 	glm::vec3 up = glm::cross(right, direction);
 
-	// Move forward
-	if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) {
-		position += direction * deltaTime * speed;
-	}
-	// Move backward
-	if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) {
-		position -= direction * deltaTime * speed;
-	}
-	// Strafe right
-	if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) {
-		position += right * deltaTime * speed;
+	// Projection matrix : 45� Field of View, 4:3 ratio, display range : 0.1 unit <-> 100 units
+	unjitteredProjection = glm::perspective(glm::radians(fov), 4.0f / 3.0f, 0.1f, 500.0f);
+	// Sub-pixel jitter for temporal anti-aliasing : clip w is -z, so this shifts the whole image by the offset in NDC
+	projection = unjitteredProjection;
+	projection[2][0] -= jitter.x;
+	projection[2][1] -= jitter.y;
+	// Camera matrix
+	view = glm::lookAt(
+		position,           // Camera is here
+		position + direction, // and looks here : at the same position, plus "direction"
+		up                  // Head is up (set to 0,-1,0 to look upside-down)
+	);
+}
+
+double computeMatricesFromInputs(bool cursorOff, bool wasJustOff, bool wasJustOn) {
+
+	// Input is only sampled here; the simulation thread applies it at its fixed rate
+	double currentTime = glfwGetTime();
+
+	if (cursorOff)
+	{
+		int width, height;
+		glfwGetWindowSize(window, &width, &height);
+
+		// Get mouse position
+		double xpos, ypos;
+		glfwGetCursorPos(window, &xpos, &ypos);
+
+		// The first frame only recenters the cursor
+		if (!wasJustOff)
+			addSimulationLook(float(xpos - width / 2), float(ypos - height / 2), currentTime);
+
+		// Reset mouse position for next frame
+		glfwSetCursorPos(window, width / 2, height / 2);
 	}
-	// Strafe left
-	if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) {
-		position -= right * deltaTime * speed;
+
+	// Movement keys, and the keys turning the light
+	uint32_t keys = 0;
+	if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS) keys |= SIM_KEY_FORWARD;
+	if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS) keys |= SIM_KEY_BACKWARD;
+	if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS) keys |= SIM_KEY_RIGHT;
+	if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS) keys |= SIM_KEY_LEFT;
+	if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) keys |= SIM_KEY_LIGHT_X_POSITIVE;
+	if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) keys |= SIM_KEY_LIGHT_X_NEGATIVE;
+	if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) keys |= SIM_KEY_LIGHT_Z_POSITIVE;
+	if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) keys |= SIM_KEY_LIGHT_Z_NEGATIVE;
+	setSimulationKeys(keys, currentTime);
+
+	// Newest simulation state, interpolated to now
+	static SimulationSnapshot snapshot;
+	double inputTime = 0.0;
+	if (readSimulation(snapshot))
+		inputTime = snapshot.current.inputTime;
+	SimulationState state = interpolateSimulation(snapshot, currentTime);
+
+	position = state.cameraPosition;
+	horizontalAngle = state.horizontalAngle;
+	verticalAngle = state.verticalAngle;
+	lightPosition = state.lightPos;
+
+	// Don't fly through the terrain (the simulation clamps to the ground under its newest position)
+	if (cameraGroundHeight)
+	{
+		position.y = glm::max(position.y, cameraGroundHeight(position.x, position.z));
+		setSimulationGround(cameraGroundHeight(snapshot.current.cameraPosition.x, snapshot.current.cameraPosition.z));
 	}
+	else
+		setSimulationGround(-FLT_MAX);
 
 
 
 	float FoV = initialFoV;// - 5 * glfwGetMouseWheel(); // Now GLFW 3 requires setting up a callback for this. It's a bit too complicated for this beginner's tutorial, so it's disabled instead.
 
-	// Projection matrix : 45� Field of View, 4:3 ratio, display range : 0.1 unit <-> 100 units
-	ProjectionMatrix = glm::perspective(glm::radians(FoV), 4.0f / 3.0f, 0.1f, 500.0f);
-	// Camera matrix
-	ViewMatrix = glm::lookAt(
-		position,           // Camera is here
-		position + direction, // and looks here : at the same position, plus "direction"
-		up                  // Head is up (set to 0,-1,0 to look upside-down)
-	);
+	computeCameraMatrices(position, horizontalAngle, verticalAngle, FoV, projectionJitter, ViewMatrix, ProjectionMatrix, UnjitteredProjectionMatrix);
 
-	// For the next frame, the "last time" will be "now"
-	lastTime = currentTime;
-}
\ No newline at end of file
+	return inputTime;
+}
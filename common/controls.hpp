@@ -1,8 +1,17 @@
 #ifndef CONTROLS_HPP
 #define CONTROLS_HPP
 
-void computeMatricesFromInputs(bool cursorOff, bool wasJustOff, bool wasJustOn);
+// Hands this frame's input to the simulation thread and computes the matrices from its state interpolated
+// to now. Returns when the input first shown by this frame was sampled (glfwGetTime), 0 if none
+double computeMatricesFromInputs(bool cursorOff, bool wasJustOff, bool wasJustOn);
+// The matrices computeMatricesFromInputs produces for a camera, without reading any input
+void computeCameraMatrices(glm::vec3 position, float horizontalAngle, float verticalAngle, float fov, glm::vec2 jitter,
+						   glm::mat4& view, glm::mat4& projection, glm::mat4& unjitteredProjection);
 glm::mat4 getViewMatrix();
 glm::mat4 getProjectionMatrix();
+glm::mat4 getUnjitteredProjectionMatrix();
+void setProjectionJitter(glm::vec2 offset); // Offset in NDC, applied from the next computeMatricesFromInputs
+void setCameraGroundFunction(float (*groundHeight)(float x, float z)); // The camera is kept above the returned height (nullptr to fly freely)
 glm::vec3 getCameraPosition();
+glm::vec3 getLightPosition();
 #endif
\ No newline at end of file
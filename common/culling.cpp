@@ -0,0 +1,106 @@
+#include "culling.hpp"
+#include "jobs.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+using namespace std;
+
+Frustum extractFrustum(const glm::mat4& viewProjection)
+{
+	//Rows of the matrix (glm is column major)
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; i++)
+		rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+
+	Frustum frustum;
+	frustum.planes[0] = rows[3] + rows[0]; //Left
+	frustum.planes[1] = rows[3] - rows[0]; //Right
+	frustum.planes[2] = rows[3] + rows[1]; //Bottom
+	frustum.planes[3] = rows[3] - rows[1]; //Top
+	frustum.planes[4] = rows[3] + rows[2]; //Near
+	frustum.planes[5] = rows[3] - rows[2]; //Far
+	return frustum;
+}
+
+bool boxInFrustum(const Frustum& frustum, glm::vec3 boxMin, glm::vec3 boxMax)
+{
+	for (const glm::vec4& plane : frustum.planes)
+	{
+		//The corner furthest along the plane normal
+		glm::vec3 corner = glm::vec3(plane.x > 0.0f ? boxMax.x : boxMin.x, plane.y > 0.0f ? boxMax.y : boxMin.y, plane.z > 0.0f ? boxMax.z : boxMin.z);
+		if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+			return false;
+	}
+	return true;
+}
+
+//Box of a tile: its grid cells horizontally, the cached heights vertically
+static void tileBox(const TerrainDerived& derived, int tile, glm::vec3& boxMin, glm::vec3& boxMax)
+{
+	int n = derived.resolution;
+	int cells = derived.tileSize - 1;
+	float spacing = derived.worldSize / (n - 1);
+	float half = 0.5f * derived.worldSize;
+	const float margin = 0.01f; //The GPU filters the height map at slightly different positions
+
+	int tx = tile / derived.tilesPerSide, tz = tile % derived.tilesPerSide;
+	const TileBounds& bounds = derived.tileBounds[tile];
+	boxMin = glm::vec3(tx * cells * spacing - half, bounds.minHeight - margin, tz * cells * spacing - half);
+	boxMax = glm::vec3(min((tx + 1) * cells, n - 1) * spacing - half, bounds.maxHeight + margin, min((tz + 1) * cells, n - 1) * spacing - half);
+}
+
+int cullTerrainTiles(const Frustum& frustum, const TerrainDerived& derived, vector<unsigned char>& visible)
+{
+	return cullTerrainTiles(&frustum, 1, derived, visible);
+}
+
+int cullTerrainTiles(const Frustum* frusta, int frustumCount, const TerrainDerived& derived, vector<unsigned char>& visible, int* tests)
+{
+	int tiles = derived.tilesPerSide * derived.tilesPerSide;
+	visible.assign(derived.tileBounds.size() == size_t(tiles) ? tiles : 0, 0);
+	if (visible.empty())
+		return 0;
+
+	atomic<int> count{ 0 }, testCount{ 0 };
+	parallelFor(0, tiles, 16, [&](int first, int last)
+	{
+		int visibleHere = 0, testsHere = 0;
+		for (int tile = first; tile < last; tile++)
+		{
+			glm::vec3 boxMin, boxMax;
+			tileBox(derived, tile, boxMin, boxMax);
+
+			for (int i = 0; i < frustumCount && !visible[tile]; i++, testsHere++)
+				visible[tile] = boxInFrustum(frusta[i], boxMin, boxMax);
+			visibleHere += visible[tile];
+		}
+		count += visibleHere;
+		testCount += testsHere;
+	});
+	if (tests)
+		*tests = testCount;
+	return count;
+}
+
+int cullOccludedTiles(OcclusionBuffer& occlusion, const TerrainDerived& derived, vector<unsigned char>& visible)
+{
+	auto start = chrono::steady_clock::now();
+	int culled = 0;
+	for (int tile = 0; tile < int(visible.size()); tile++)
+	{
+		if (!visible[tile])
+			continue;
+		glm::vec3 boxMin, boxMax;
+		tileBox(derived, tile, boxMin, boxMax);
+		occlusion.tested++;
+		if (boxOccluded(occlusion, boxMin, boxMax))
+		{
+			visible[tile] = 0;
+			culled++;
+		}
+	}
+	occlusion.culledTiles += culled;
+	occlusion.testMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	return culled;
+}
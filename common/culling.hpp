@@ -0,0 +1,39 @@
+#ifndef CULLING_HPP
+#define CULLING_HPP
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "derived.hpp"
+#include "occlusion.hpp"
+
+//View frustum culling of the base mesh tiles
+//Each tile's box spans its grid cells horizontally and its cached min/max height (times scaleValue)
+//vertically, so the test matches the displaced mesh. Tiles are tested in parallel on the job system.
+//The tiles left can then be tested against the software occlusion buffer (occlusion.hpp).
+
+struct Frustum
+{
+	glm::vec4 planes[6]; //xyz = inward normal, w = distance (not normalised)
+};
+
+Frustum extractFrustum(const glm::mat4& viewProjection);
+
+//Whether any part of the box is inside (conservative: boxes crossing two planes near a corner may pass)
+bool boxInFrustum(const Frustum& frustum, glm::vec3 boxMin, glm::vec3 boxMax);
+
+//visible[tx * tilesPerSide + tz] for every tile of derived. Returns how many are visible
+//(visible is left empty while the tile bounds have not been built yet)
+int cullTerrainTiles(const Frustum& frustum, const TerrainDerived& derived, std::vector<unsigned char>& visible);
+
+//The same for several views at once: a tile is visible when any frustum holds it, and the frusta after the
+//first one that does are not tested, so views that overlap share their results. tests counts the box tests
+int cullTerrainTiles(const Frustum* frusta, int frustumCount, const TerrainDerived& derived, std::vector<unsigned char>& visible,
+					 int* tests = nullptr);
+
+//Clears visible[tile] of the visible tiles hidden in the occlusion buffer, and counts them as culled tiles.
+//Returns how many were culled
+int cullOccludedTiles(OcclusionBuffer& occlusion, const TerrainDerived& derived, std::vector<unsigned char>& visible);
+
+#endif
@@ -0,0 +1,358 @@
+#include "datasets.hpp"
+#include "glcapture.hpp"
+#include "heightfile.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+using namespace std;
+
+float sampleDatasetHeight(const Dataset& dataset, float u, float v)
+{
+	float fx = u * dataset.width - 0.5f;
+	float fy = v * dataset.height - 0.5f;
+	fx = glm::clamp(fx, 0.0f, float(dataset.width - 1));
+	fy = glm::clamp(fy, 0.0f, float(dataset.height - 1));
+
+	int x0 = int(fx), y0 = int(fy);
+	int x1 = min(x0 + 1, dataset.width - 1), y1 = min(y0 + 1, dataset.height - 1);
+	float tx = fx - x0, ty = fy - y0;
+
+	const float* h = &dataset.heights[0];
+	float top = h[size_t(y0) * dataset.width + x0] * (1 - tx) + h[size_t(y0) * dataset.width + x1] * tx;
+	float bottom = h[size_t(y1) * dataset.width + x0] * (1 - tx) + h[size_t(y1) * dataset.width + x1] * tx;
+	return top * (1 - ty) + bottom * ty;
+}
+
+//Normal of grid vertex (i, j) with the Sobel filter of Basic.vert (including its doubled up/down taps)
+static glm::vec3 datasetNormal(const Dataset& dataset, int resolution, int i, int j)
+{
+	float offset = 1.0f / resolution;
+	float u = (i + 0.5f) / float(resolution - 1);
+	float v = (j + 0.5f) / float(resolution - 1);
+
+	float topLeft = sampleDatasetHeight(dataset, u - offset, v + offset);
+	float centerLeft = sampleDatasetHeight(dataset, u - offset, v);
+	float bottomLeft = sampleDatasetHeight(dataset, u - offset, v - offset);
+	float topRight = sampleDatasetHeight(dataset, u + offset, v + offset);
+	float centerRight = sampleDatasetHeight(dataset, u + offset, v);
+	float bottomRight = sampleDatasetHeight(dataset, u + offset, v - offset);
+	float down = sampleDatasetHeight(dataset, u, v - offset) * 2;
+	float up = sampleDatasetHeight(dataset, u, v + offset) * 2;
+
+	float xNormal = (topLeft - topRight) + 2 * (centerLeft - centerRight) + (bottomLeft - bottomRight);
+	float yNormal = 0.035f; //35000 in the shader's undivided units
+	float zNormal = (topLeft - bottomLeft) + 2 * (up - down) + (topRight - bottomRight);
+	return glm::normalize(glm::vec3(xNormal, yNormal, zNormal));
+}
+
+void computeDatasetNormals(Dataset& dataset, int resolution)
+{
+	dataset.normals.resize(size_t(resolution) * resolution);
+	updateDatasetNormals(dataset, resolution, 0, resolution - 1, 0, resolution - 1);
+}
+
+void updateDatasetNormals(Dataset& dataset, int resolution, int i0, int i1, int j0, int j1)
+{
+	parallelFor(i0, i1 + 1, 16, [&](int first, int last)
+	{
+		//Same vertex order as LoadModel (x outer, z inner)
+		for (int i = first; i < last; i++)
+			for (int j = j0; j <= j1; j++)
+				dataset.normals[size_t(i) * resolution + j] = datasetNormal(dataset, resolution, i, j);
+	});
+}
+
+void datasetVertexRange(int resolution, int size, int first, int last, int& firstVertex, int& lastVertex)
+{
+	//A texel affects the bilinear samples within one texel of it; the normal taps reach 1 / resolution further
+	float reach = float(size) / resolution;
+	float lower = (first - 0.5f - reach) / size, upper = (last + 1.5f + reach) / size;
+	firstVertex = max(int(floor(lower * (resolution - 1) - 0.5f)), 0);
+	lastVertex = min(int(ceil(upper * (resolution - 1) - 0.5f)), resolution - 1);
+}
+
+//Decode a dataset and everything derived from it (runs in a load job, or once at startup)
+static bool loadDataset(DatasetManager& manager, Dataset& dataset)
+{
+	int width, height;
+	if (filesystem::path(dataset.path).extension() == ".hmap")
+	{
+		//Native heights, tiles decompressed in parallel
+		if (!loadHeightFile(dataset.path.c_str(), width, height, dataset.heights))
+			return false;
+	}
+	else
+	{
+		unsigned char* data = nullptr;
+		if (!loadBMP_custom(dataset.path.c_str(), width, height, data))
+			return false;
+
+		dataset.heights.resize(size_t(width) * height);
+		float* heights = dataset.heights.data();
+		parallelFor(0, height, 64, [&](int first, int last) { decodeHeightRows(data, width, first, last - first, heights); });
+		delete[] data;
+	}
+	dataset.width = width;
+	dataset.height = height;
+
+	auto bounds = minmax_element(dataset.heights.begin(), dataset.heights.end());
+	dataset.minHeight = *bounds.first;
+	dataset.maxHeight = *bounds.second;
+
+	//Everything below only reads the heights, so the mips and the pyramid are built next to the normals
+	JobHandle clipmapJob = runJob([&] { dataset.clipmapHeights = buildClipmapHeights(dataset.heights, width, height, manager.worldSize, manager.clipmapSpacing); });
+	JobHandle pyramidJob = runJob([&] { dataset.heightPyramid = buildHeightPyramid(dataset.heights, width, height); });
+	computeDatasetNormals(dataset, manager.normalResolution);
+	waitForJob(clipmapJob);
+	waitForJob(pyramidJob);
+
+	dataset.bytes = dataset.heights.size() * sizeof(float) + dataset.normals.size() * sizeof(glm::vec3);
+	for (const vector<float>& mip : dataset.clipmapHeights->mips)
+		dataset.bytes += mip.size() * sizeof(float);
+	for (const vector<float>& level : dataset.heightPyramid->levels)
+		dataset.bytes += level.size() * sizeof(float);
+
+	return true;
+}
+
+static void freeDataset(DatasetManager& manager, Dataset& dataset)
+{
+	vector<float>().swap(dataset.heights);
+	vector<glm::vec3>().swap(dataset.normals);
+	dataset.clipmapHeights.reset();
+	dataset.heightPyramid.reset();
+	manager.residentBytes -= dataset.bytes;
+	dataset.bytes = 0;
+	dataset.state = DATASET_UNLOADED;
+}
+
+//Preloads only take queued datasets and stop at the budget; selections also take a dataset a preload skipped.
+//Whichever job claims the dataset first loads it
+static void loadJob(DatasetManager* manager, int index, bool preload)
+{
+	if (manager->quit)
+		return;
+
+	Dataset& dataset = *manager->datasets[index];
+	if (preload && manager->residentBytes >= manager->budgetBytes)
+	{
+		int queued = DATASET_QUEUED;
+		dataset.state.compare_exchange_strong(queued, DATASET_UNLOADED);
+		return;
+	}
+
+	int expected = DATASET_QUEUED;
+	if (!dataset.state.compare_exchange_strong(expected, DATASET_LOADING))
+	{
+		expected = DATASET_UNLOADED;
+		if (preload || !dataset.state.compare_exchange_strong(expected, DATASET_LOADING))
+			return;
+	}
+
+	if (loadDataset(*manager, dataset))
+	{
+		manager->residentBytes += dataset.bytes;
+		dataset.state = DATASET_READY;
+	}
+	else
+	{
+		dataset.state = DATASET_FAILED;
+	}
+}
+
+static JobHandle startLoad(DatasetManager& manager, int index, bool preload, const vector<JobHandle>& dependencies = {})
+{
+	DatasetManager* target = &manager;
+	JobHandle job = runJob([target, index, preload] { loadJob(target, index, preload); }, dependencies);
+
+	manager.loads.erase(remove_if(manager.loads.begin(), manager.loads.end(), isJobFinished), manager.loads.end());
+	manager.loads.push_back(job);
+	return job;
+}
+
+//Drop least recently used datasets until the budget is met (the active, pending and edited ones are kept)
+static void enforceBudget(DatasetManager& manager)
+{
+	while (manager.residentBytes > manager.budgetBytes)
+	{
+		int victim = -1;
+		for (int i = 0; i < int(manager.datasets.size()); i++)
+		{
+			const Dataset& dataset = *manager.datasets[i];
+			if (i == manager.active || i == manager.pending || dataset.state != DATASET_READY || dataset.edited)
+				continue;
+			if (victim < 0 || dataset.lastUsed < manager.datasets[victim]->lastUsed)
+				victim = i;
+		}
+
+		if (victim < 0)
+			return;
+
+		freeDataset(manager, *manager.datasets[victim]);
+	}
+}
+
+bool initDatasets(DatasetManager& manager, const char* directory, const vector<string>& excluded, const char* initialName)
+{
+	error_code error;
+	vector<string> names;
+	for (const filesystem::directory_entry& entry : filesystem::directory_iterator(directory, error))
+	{
+		string name = entry.path().filename().string();
+		bool heightmap = entry.path().extension() == ".bmp" || entry.path().extension() == ".hmap";
+		if (!heightmap || find(excluded.begin(), excluded.end(), name) != excluded.end())
+			continue;
+		names.push_back(name);
+	}
+	sort(names.begin(), names.end());
+
+	for (const string& name : names)
+	{
+		unique_ptr<Dataset> dataset(new Dataset());
+		dataset->name = name;
+		dataset->path = (filesystem::path(directory) / name).string();
+		manager.datasets.push_back(move(dataset));
+	}
+
+	//The initial dataset is needed before the first frame, so it is loaded right away
+	manager.active = findDataset(manager, initialName);
+	if (manager.active < 0)
+	{
+		cout << "Heightmap " << initialName << " not found in " << directory << endl;
+		return false;
+	}
+
+	Dataset& initial = *manager.datasets[manager.active];
+	if (!loadDataset(manager, initial))
+	{
+		initial.state = DATASET_FAILED;
+		manager.active = -1;
+		return false;
+	}
+	manager.residentBytes += initial.bytes;
+	initial.state = DATASET_READY;
+
+	//Preload the rest in the background, one after another
+	for (int i = 0; i < int(manager.datasets.size()); i++)
+	{
+		if (i == manager.active)
+			continue;
+		manager.datasets[i]->state = DATASET_QUEUED;
+		manager.lastPreload = startLoad(manager, i, true, { manager.lastPreload });
+	}
+	return true;
+}
+
+int findDataset(const DatasetManager& manager, const string& name)
+{
+	for (int i = 0; i < int(manager.datasets.size()); i++)
+		if (manager.datasets[i]->name == name)
+			return i;
+	return -1;
+}
+
+void selectDataset(DatasetManager& manager, int index)
+{
+	if (index < 0 || index >= int(manager.datasets.size()) || index == manager.pending)
+		return;
+
+	//Abandon an unfinished upload
+	if (manager.uploadTexture)
+	{
+		glDeleteTextures(1, &manager.uploadTexture);
+		manager.uploadTexture = 0;
+	}
+	manager.pending = index == manager.active ? -1 : index;
+	manager.uploadedRows = 0;
+	if (manager.pending < 0)
+		return;
+
+	//A queued preload may be far down the chain, so the selection gets a job of its own
+	Dataset& dataset = *manager.datasets[index];
+	int unloaded = DATASET_UNLOADED, failed = DATASET_FAILED;
+	dataset.state.compare_exchange_strong(unloaded, DATASET_QUEUED);
+	dataset.state.compare_exchange_strong(failed, DATASET_QUEUED);
+	if (dataset.state == DATASET_QUEUED)
+		startLoad(manager, index, false);
+}
+
+bool updateDatasets(DatasetManager& manager, GLuint& heightMapTexture)
+{
+	manager.frame++;
+	if (manager.active >= 0)
+		manager.datasets[manager.active]->lastUsed = manager.frame;
+
+	enforceBudget(manager);
+
+	if (manager.pending < 0)
+		return false;
+
+	Dataset& dataset = *manager.datasets[manager.pending];
+	if (dataset.state == DATASET_FAILED)
+	{
+		cout << "Failed to load heightmap " << dataset.path << endl;
+		manager.pending = -1;
+		return false;
+	}
+	if (dataset.state != DATASET_READY)
+		return false;
+
+	dataset.lastUsed = manager.frame;
+
+	//Upload a slice of rows per frame into a texture that is not in use yet
+	if (!manager.uploadTexture)
+	{
+		int levels = 1 + int(floor(log2(max(dataset.width, dataset.height))));
+		glGenTextures(1, &manager.uploadTexture);
+		glBindTexture(GL_TEXTURE_2D, manager.uploadTexture);
+		glTexStorage2D(GL_TEXTURE_2D, levels, GL_R32F, dataset.width, dataset.height);
+		manager.uploadedRows = 0;
+	}
+
+	int rows = min(manager.uploadRowsPerFrame, dataset.height - manager.uploadedRows);
+	glBindTexture(GL_TEXTURE_2D, manager.uploadTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, manager.uploadedRows, dataset.width, rows, GL_RED, GL_FLOAT, &dataset.heights[size_t(manager.uploadedRows) * dataset.width]);
+	manager.uploadedRows += rows;
+
+	if (manager.uploadedRows < dataset.height)
+	{
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return false;
+	}
+
+	//Complete -> same sampling as LoadTextures, then swap
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glDeleteTextures(1, &heightMapTexture);
+	heightMapTexture = manager.uploadTexture;
+	manager.uploadTexture = 0;
+	manager.active = manager.pending;
+	manager.pending = -1;
+	return true;
+}
+
+void destroyDatasets(DatasetManager& manager)
+{
+	//Preloads that have not started return straight away
+	manager.quit = true;
+	waitForJobs(manager.loads);
+	manager.loads.clear();
+	manager.lastPreload.reset();
+	manager.quit = false;
+
+	glDeleteTextures(1, &manager.uploadTexture);
+	manager.uploadTexture = 0;
+	manager.datasets.clear();
+	manager.residentBytes = 0;
+	manager.active = -1;
+	manager.pending = -1;
+}
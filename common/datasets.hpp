@@ -0,0 +1,103 @@
+#ifndef DATASETS_HPP
+#define DATASETS_HPP
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "clipmap.hpp"
+#include "jobs.hpp"
+#include "terrainquery.hpp"
+
+//Runtime-selectable heightmaps
+//Every heightmap (BMP or .hmap) in a directory is decoded, together with its derived normals and bounds, by
+//load jobs (preloads one after another, selections right away). A selected dataset is uploaded into a fresh texture a few rows per frame and only
+//swapped in once complete, so switching never stalls a frame. CPU copies are evicted least recently
+//used first when the memory budget is exceeded.
+
+enum DatasetState
+{
+	DATASET_UNLOADED,
+	DATASET_QUEUED,
+	DATASET_LOADING,
+	DATASET_READY,
+	DATASET_FAILED
+};
+
+struct Dataset
+{
+	std::string name;
+	std::string path;
+	std::atomic<int> state{ DATASET_UNLOADED };
+
+	//Written by the load job, only read once state is DATASET_READY
+	int width = 0;
+	int height = 0;
+	std::vector<float> heights; //Decoded heights in world units (before scaleValue), also what the height map texture holds
+	std::vector<glm::vec3> normals; //One per grid vertex (normalResolution^2), same filter as Basic.vert
+	float minHeight = 0.0f;
+	float maxHeight = 0.0f;
+	std::shared_ptr<const ClipmapHeights> clipmapHeights;
+	std::shared_ptr<const HeightPyramid> heightPyramid; //For CPU ray casts
+	size_t bytes = 0;
+	bool edited = false; //Changed by the terrain editor, so never evicted (loading it again would lose the edits)
+
+	unsigned long long lastUsed = 0; //Frame the dataset was last active (for LRU eviction)
+};
+
+struct DatasetManager
+{
+	std::vector<std::unique_ptr<Dataset>> datasets;
+	int active = -1; //Dataset bound to the height map texture
+	int pending = -1; //Dataset being uploaded, swapped in once complete
+
+	//Settings shared by every dataset
+	float worldSize = 10.0f;
+	float clipmapSpacing = 0.025f;
+	int normalResolution = 200;
+	size_t budgetBytes = size_t(512) << 20;
+	int uploadRowsPerFrame = 256;
+
+	//Incremental upload of the pending dataset
+	GLuint uploadTexture = 0;
+	int uploadedRows = 0;
+	unsigned long long frame = 0;
+
+	//Load jobs
+	std::atomic<size_t> residentBytes{ 0 };
+	std::vector<JobHandle> loads;
+	JobHandle lastPreload; //Preloads are chained so they stop at the budget
+	std::atomic<bool> quit{ false };
+};
+
+//Scan directory for heightmap BMPs and .hmap files (skipping the excluded material textures), load initialName
+//synchronously as the active dataset and start preloading the others in the background
+bool initDatasets(DatasetManager& manager, const char* directory, const std::vector<std::string>& excluded, const char* initialName);
+
+int findDataset(const DatasetManager& manager, const std::string& name);
+
+//Bilinear height (clamped to the edge, like the GL_LINEAR height map) at texture coordinate (u, v)
+float sampleDatasetHeight(const Dataset& dataset, float u, float v);
+
+//Fill dataset.normals for a resolution x resolution vertex grid from its heights
+void computeDatasetNormals(Dataset& dataset, int resolution);
+
+//Recompute the normals of grid vertices [i0, i1] x [j0, j1] only (after an edit of the heights under them)
+void updateDatasetNormals(Dataset& dataset, int resolution, int i0, int i1, int j0, int j1);
+
+//Grid vertices whose normals read any of the texels [first, last] along an axis of size texels
+void datasetVertexRange(int resolution, int size, int first, int last, int& firstVertex, int& lastVertex);
+
+//Request a switch; the dataset is loaded (if evicted) and uploaded over the following frames
+void selectDataset(DatasetManager& manager, int index);
+
+//Call once per frame from the GL thread. Returns true on the frame the pending dataset is swapped into heightMapTexture
+bool updateDatasets(DatasetManager& manager, GLuint& heightMapTexture);
+
+void destroyDatasets(DatasetManager& manager);
+
+#endif
@@ -0,0 +1,361 @@
+#include "derived.hpp"
+#include "terrainquery.hpp"
+
+#include <algorithm>
+#include <cmath>
+using namespace std;
+
+//Products built directly from each node
+static const unsigned dependents[DERIVED_NODE_COUNT] = {
+	(1u << DERIVED_HEIGHTS) | (1u << DERIVED_NORMALS) | (1u << DERIVED_VEGETATION), //DERIVED_DATASET
+	(1u << DERIVED_HEIGHTS) | (1u << DERIVED_NORMALS) | (1u << DERIVED_VEGETATION), //DERIVED_SCALE
+	(1u << DERIVED_MACRO_MATERIAL), //DERIVED_MATERIALS
+	(1u << DERIVED_WATER), //DERIVED_WATER_MASKS
+	(1u << DERIVED_TILE_BOUNDS) | (1u << DERIVED_AO) | (1u << DERIVED_MACRO_MATERIAL) | (1u << DERIVED_OCCLUDER) | (1u << DERIVED_WATER), //DERIVED_HEIGHTS
+	(1u << DERIVED_MACRO_MATERIAL), //DERIVED_NORMALS
+	0, //DERIVED_TILE_BOUNDS
+	0, //DERIVED_VEGETATION
+	0, //DERIVED_AO
+	0, //DERIVED_MACRO_MATERIAL
+	0, //DERIVED_OCCLUDER
+	0 //DERIVED_WATER
+};
+
+//The job of a product built in the background (nullptr for the others)
+static DerivedJob* backgroundJob(TerrainDerived& derived, int product)
+{
+	if (product == DERIVED_AO)
+		return &derived.aoJob;
+	if (product == DERIVED_MACRO_MATERIAL)
+		return &derived.macroJob;
+	return nullptr;
+}
+
+static void invalidate(TerrainDerived& derived, int node)
+{
+	for (int product = 0; product < DERIVED_NODE_COUNT; product++)
+	{
+		if (!(dependents[node] & (1u << product)))
+			continue;
+
+		//A running background job was started from inputs that are now stale
+		if (DerivedJob* job = backgroundJob(derived, product))
+			job->generation++;
+
+		if (derived.dirty[product])
+			continue;
+		derived.dirty[product] = true;
+		invalidate(derived, product);
+	}
+}
+
+//Horizon-based ambient occlusion: how much of the sky each vertex sees along 8 directions
+static void computeAmbientOcclusion(const vector<float>& heights, int resolution, float spacing, vector<float>& occlusion)
+{
+	static const int directions = 8;
+	static const int steps = 8;
+
+	occlusion.assign(heights.size(), 1.0f);
+	parallelFor(0, resolution, 8, [&](int first, int last)
+	{
+		for (int i = first; i < last; i++)
+		{
+			for (int j = 0; j < resolution; j++)
+			{
+				float height = heights[size_t(i) * resolution + j];
+				float visibility = 0.0f;
+
+				for (int d = 0; d < directions; d++)
+				{
+					float angle = 6.2831853f * d / directions;
+					float dx = cos(angle), dz = sin(angle);
+					float maxSlope = 0.0f;
+
+					//Steps double in length so distant ridges are still found
+					for (int s = 0, distance = 1; s < steps; s++, distance *= 2)
+					{
+						int x = i + int(round(dx * distance));
+						int z = j + int(round(dz * distance));
+						if (x < 0 || z < 0 || x >= resolution || z >= resolution)
+							break;
+						float slope = (heights[size_t(x) * resolution + z] - height) / (distance * spacing);
+						maxSlope = max(maxSlope, slope);
+					}
+
+					//cos of the horizon elevation angle
+					visibility += 1.0f / sqrt(1.0f + maxSlope * maxSlope);
+				}
+
+				occlusion[size_t(i) * resolution + j] = visibility / directions;
+			}
+		}
+	});
+}
+
+static void build(TerrainDerived& derived, DerivedNode product)
+{
+	const Dataset& dataset = *derived.dataset;
+	int n = derived.resolution;
+
+	switch (product)
+	{
+	case DERIVED_HEIGHTS:
+		//Sample at the grid's UVs (same layout as LoadModel: x outer, z inner)
+		derived.heights.resize(size_t(n) * n);
+		parallelFor(0, n, 16, [&](int first, int last)
+		{
+			for (int i = first; i < last; i++)
+				for (int j = 0; j < n; j++)
+					derived.heights[size_t(i) * n + j] = sampleDatasetHeight(dataset, (i + 0.5f) / float(n - 1), (j + 0.5f) / float(n - 1)) * derived.scale;
+		});
+		break;
+
+	case DERIVED_NORMALS:
+		//Dataset normals are for scale 1; scaling the heights scales the slopes
+		derived.normals.resize(dataset.normals.size());
+		for (size_t v = 0; v < dataset.normals.size(); v++)
+		{
+			glm::vec3 normal = dataset.normals[v];
+			derived.normals[v] = glm::normalize(glm::vec3(normal.x * derived.scale, normal.y, normal.z * derived.scale));
+		}
+		break;
+
+	case DERIVED_TILE_BOUNDS:
+		derived.tilesPerSide = (n - 1 + derived.tileSize - 2) / (derived.tileSize - 1);
+		derived.tileBounds.assign(size_t(derived.tilesPerSide) * derived.tilesPerSide, TileBounds{ INFINITY, -INFINITY });
+		for (int i = 0; i < n; i++)
+		{
+			for (int j = 0; j < n; j++)
+			{
+				//Vertices on a tile edge belong to both neighbouring tiles
+				float height = derived.heights[size_t(i) * n + j];
+				int tx0 = max(0, (i - 1) / (derived.tileSize - 1)), tx1 = min(derived.tilesPerSide - 1, i / (derived.tileSize - 1));
+				int tz0 = max(0, (j - 1) / (derived.tileSize - 1)), tz1 = min(derived.tilesPerSide - 1, j / (derived.tileSize - 1));
+				for (int tx = tx0; tx <= tx1; tx++)
+				{
+					for (int tz = tz0; tz <= tz1; tz++)
+					{
+						TileBounds& bounds = derived.tileBounds[size_t(tx) * derived.tilesPerSide + tz];
+						bounds.minHeight = min(bounds.minHeight, height);
+						bounds.maxHeight = max(bounds.maxHeight, height);
+					}
+				}
+			}
+		}
+		break;
+
+	case DERIVED_OCCLUDER:
+		buildTerrainOccluder(derived.occluder, derived.heights, n, derived.worldSize);
+		break;
+
+	case DERIVED_WATER:
+		if (derived.waterMasks)
+			buildWaterMesh(derived.water, *derived.waterMasks, derived.heights, n, derived.worldSize);
+		else
+			derived.water = WaterMesh();
+		break;
+
+	case DERIVED_VEGETATION:
+	{
+		//Ground heights under every site in one batch, with the base mesh's mapping
+		TerrainQuery query;
+		initTerrainQuery(query, derived.worldSize, 0.5f / (derived.resolution - 1));
+		setTerrainQuery(query, &dataset, derived.scale);
+
+		vector<glm::vec2> positions;
+		for (const VegetationSite& site : derived.vegetationSites)
+			positions.push_back(glm::vec2(site.position.x, site.position.z));
+		vector<float> ground(positions.size());
+		parallelFor(0, int(positions.size()), 4096, [&](int first, int last)
+		{
+			terrainHeights(query, &positions[first], &ground[first], last - first);
+		});
+
+		derived.vegetation.clear();
+		for (size_t i = 0; i < derived.vegetationSites.size(); i++)
+		{
+			const VegetationSite& site = derived.vegetationSites[i];
+			derived.vegetation.push_back(glm::vec3(site.position.x, ground[i] + site.position.y, site.position.z));
+		}
+		break;
+	}
+
+	default:
+		break;
+	}
+
+	derived.rebuilds[product]++;
+}
+
+void initDerived(TerrainDerived& derived, int resolution, float worldSize, const vector<VegetationSite>& vegetationSites)
+{
+	derived.resolution = resolution;
+	derived.worldSize = worldSize;
+	derived.vegetationSites = vegetationSites;
+	derived.dataset = nullptr;
+	invalidate(derived, DERIVED_DATASET);
+}
+
+void setDerivedDataset(TerrainDerived& derived, const Dataset* dataset)
+{
+	if (derived.dataset == dataset)
+		return;
+	derived.dataset = dataset;
+	invalidate(derived, DERIVED_DATASET);
+}
+
+void setDerivedScale(TerrainDerived& derived, float scale)
+{
+	if (derived.scale == scale)
+		return;
+	derived.scale = scale;
+	invalidate(derived, DERIVED_SCALE);
+}
+
+void setDerivedMaterials(TerrainDerived& derived, const MaterialAverages& materials)
+{
+	if (sameMaterialAverages(derived.materials, materials))
+		return;
+	derived.materials = materials;
+	invalidate(derived, DERIVED_MATERIALS);
+}
+
+void setDerivedWaterMasks(TerrainDerived& derived, const WaterMasks* masks)
+{
+	if (derived.waterMasks == masks)
+		return;
+	derived.waterMasks = masks;
+	invalidate(derived, DERIVED_WATER_MASKS);
+}
+
+bool requireDerived(TerrainDerived& derived, DerivedNode product)
+{
+	if (!derived.dirty[product] || !derived.dataset)
+		return false;
+
+	//Bring the products this one is built from up to date first
+	for (int node = DERIVED_HEIGHTS; node < DERIVED_NODE_COUNT; node++)
+		if (dependents[node] & (1u << product))
+			requireDerived(derived, DerivedNode(node));
+
+	DerivedJob* job = backgroundJob(derived, product);
+	if (!job)
+	{
+		build(derived, product);
+		derived.dirty[product] = false;
+		return true;
+	}
+
+	//Background products: the previous result stays in use until the job finishes
+	if (job->job)
+	{
+		if (!isJobFinished(job->job))
+			return false;
+
+		job->job.reset();
+		bool current = job->jobGeneration == job->generation;
+		if (product == DERIVED_AO)
+		{
+			if (current)
+				derived.ambientOcclusion = move(*derived.aoResult);
+			derived.aoResult.reset();
+		}
+		else
+		{
+			if (current)
+				derived.macroMaterial = move(*derived.macroResult);
+			derived.macroResult.reset();
+		}
+		if (current)
+		{
+			derived.dirty[product] = false;
+			derived.rebuilds[product]++;
+			return true;
+		}
+	}
+
+	//Start (or restart, if the inputs changed while it ran) the job from copies of its inputs
+	job->jobGeneration = job->generation;
+	int resolution = derived.resolution;
+	shared_ptr<vector<float>> heights = make_shared<vector<float>>(derived.heights);
+	if (product == DERIVED_AO)
+	{
+		float spacing = derived.worldSize / (derived.resolution - 1);
+		shared_ptr<vector<float>> result = make_shared<vector<float>>();
+		derived.aoResult = result;
+		job->job = runJob([heights, result, resolution, spacing] { computeAmbientOcclusion(*heights, resolution, spacing, *result); });
+		return false;
+	}
+
+	//The macro material waits for the material averages (read once the textures are loaded)
+	if (!derived.materials.valid)
+		return false;
+	shared_ptr<vector<glm::vec3>> normals = make_shared<vector<glm::vec3>>(derived.normals);
+	shared_ptr<MacroMaterial> result = make_shared<MacroMaterial>();
+	MaterialAverages materials = derived.materials;
+	derived.macroResult = result;
+	job->job = runJob([heights, normals, result, resolution, materials]
+	{
+		bakeMacroMaterial(*result, MACRO_MATERIAL_SIZE, *heights, *normals, resolution, materials);
+	});
+	return false;
+}
+
+void updateDerivedRegion(TerrainDerived& derived, int i0, int i1, int j0, int j1)
+{
+	//A pending full rebuild covers the region anyway
+	if (!derived.dataset || derived.dirty[DERIVED_HEIGHTS] || derived.dirty[DERIVED_NORMALS] || derived.dirty[DERIVED_TILE_BOUNDS])
+		return;
+
+	const Dataset& dataset = *derived.dataset;
+	int n = derived.resolution;
+	for (int i = i0; i <= i1; i++)
+	{
+		for (int j = j0; j <= j1; j++)
+		{
+			size_t v = size_t(i) * n + j;
+			derived.heights[v] = sampleDatasetHeight(dataset, (i + 0.5f) / float(n - 1), (j + 0.5f) / float(n - 1)) * derived.scale;
+			glm::vec3 normal = dataset.normals[v];
+			derived.normals[v] = glm::normalize(glm::vec3(normal.x * derived.scale, normal.y, normal.z * derived.scale));
+		}
+	}
+
+	//Tiles holding a changed vertex are bounded again from all of their vertices
+	int cells = derived.tileSize - 1;
+	for (int tx = max(0, (i0 - 1) / cells); tx <= min(derived.tilesPerSide - 1, i1 / cells); tx++)
+	{
+		for (int tz = max(0, (j0 - 1) / cells); tz <= min(derived.tilesPerSide - 1, j1 / cells); tz++)
+		{
+			TileBounds bounds = { INFINITY, -INFINITY };
+			for (int i = tx * cells; i <= min((tx + 1) * cells, n - 1); i++)
+			{
+				for (int j = tz * cells; j <= min((tz + 1) * cells, n - 1); j++)
+				{
+					bounds.minHeight = min(bounds.minHeight, derived.heights[size_t(i) * n + j]);
+					bounds.maxHeight = max(bounds.maxHeight, derived.heights[size_t(i) * n + j]);
+				}
+			}
+			derived.tileBounds[size_t(tx) * derived.tilesPerSide + tz] = bounds;
+		}
+	}
+
+	derived.regionFirst = min(derived.regionFirst, i0);
+	derived.regionLast = max(derived.regionLast, i1);
+
+	//Occlusion, vegetation and the lakes' levels depend on heights all over the terrain, so they are rebuilt as
+	//usual (and the macro material and the occluder are only ever built whole)
+	derived.dirty[DERIVED_VEGETATION] = true;
+	derived.dirty[DERIVED_OCCLUDER] = true;
+	derived.dirty[DERIVED_WATER] = true;
+	derived.dirty[DERIVED_AO] = true;
+	derived.aoJob.generation++;
+	derived.dirty[DERIVED_MACRO_MATERIAL] = true;
+	derived.macroJob.generation++;
+}
+
+void destroyDerived(TerrainDerived& derived)
+{
+	waitForJob(derived.aoJob.job);
+	waitForJob(derived.macroJob.job);
+	derived = TerrainDerived();
+}
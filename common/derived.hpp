@@ -0,0 +1,115 @@
+#ifndef DERIVED_HPP
+#define DERIVED_HPP
+
+#include <climits>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "datasets.hpp"
+#include "jobs.hpp"
+#include "materiallod.hpp"
+#include "occlusion.hpp"
+#include "water.hpp"
+
+//Derived terrain data cache
+//Everything computed from the heightmap and scaleValue is built once and kept until one of its
+//inputs changes. Changing an input only marks the products downstream of it as stale; they are
+//rebuilt the next time they are requested (ambient occlusion and the macro material are rebuilt by
+//background jobs).
+//Frames where neither the dataset nor the scale changes do no derived-data work at all.
+
+enum DerivedNode
+{
+	//Inputs
+	DERIVED_DATASET,
+	DERIVED_SCALE,
+	DERIVED_MATERIALS, //Average of each material's textures
+	DERIVED_WATER_MASKS, //Lake and river cells (water.hpp)
+
+	//Products
+	DERIVED_HEIGHTS, //Scaled height of every grid vertex
+	DERIVED_NORMALS, //Scaled normal of every grid vertex
+	DERIVED_TILE_BOUNDS, //Min/max height of every tile of grid cells
+	DERIVED_VEGETATION, //Billboard positions resting on the terrain
+	DERIVED_AO, //Horizon-based ambient occlusion of every grid vertex
+	DERIVED_MACRO_MATERIAL, //Far-distance colour and normal textures (materiallod.hpp)
+	DERIVED_OCCLUDER, //Coarse grid below the terrain for software occlusion culling (occlusion.hpp)
+	DERIVED_WATER, //Lake and river surfaces (water.hpp)
+
+	DERIVED_NODE_COUNT
+};
+
+struct TileBounds
+{
+	float minHeight;
+	float maxHeight;
+};
+
+struct VegetationSite
+{
+	glm::vec3 position; //y is the offset above the ground
+};
+
+//A product built by a background job; the previous result stays in use until the job finishes
+struct DerivedJob
+{
+	unsigned generation = 0; //Bumped whenever the product's inputs change
+	unsigned jobGeneration = 0; //The generation the running job started from
+	JobHandle job;
+};
+
+struct TerrainDerived
+{
+	//Inputs
+	const Dataset* dataset = nullptr;
+	float scale = 1.0f;
+	int resolution = 0; //Grid vertices per side (n_points)
+	float worldSize = 0.0f;
+	int tileSize = 25; //Grid vertices per tile side
+	std::vector<VegetationSite> vegetationSites;
+	MaterialAverages materials;
+	const WaterMasks* waterMasks = nullptr; //Not copied (owned by the caller)
+
+	//Products
+	std::vector<float> heights;
+	std::vector<glm::vec3> normals;
+	std::vector<TileBounds> tileBounds;
+	int tilesPerSide = 0;
+	std::vector<glm::vec3> vegetation;
+	std::vector<float> ambientOcclusion;
+	MacroMaterial macroMaterial;
+	TerrainOccluder occluder;
+	WaterMesh water;
+
+	//Bookkeeping
+	bool dirty[DERIVED_NODE_COUNT] = {};
+	int rebuilds[DERIVED_NODE_COUNT] = {}; //How often each product has been built (shown in the UI)
+	int regionFirst = INT_MAX; //Grid rows (outer index) patched by updateDerivedRegion, to be uploaded
+	int regionLast = -1;
+	DerivedJob aoJob;
+	std::shared_ptr<std::vector<float>> aoResult; //Written by aoJob
+	DerivedJob macroJob;
+	std::shared_ptr<MacroMaterial> macroResult; //Written by macroJob
+};
+
+void initDerived(TerrainDerived& derived, int resolution, float worldSize, const std::vector<VegetationSite>& vegetationSites);
+
+//Input changes (no-ops when the value is unchanged)
+void setDerivedDataset(TerrainDerived& derived, const Dataset* dataset);
+void setDerivedScale(TerrainDerived& derived, float scale);
+void setDerivedMaterials(TerrainDerived& derived, const MaterialAverages& materials);
+void setDerivedWaterMasks(TerrainDerived& derived, const WaterMasks* masks);
+
+//Make sure a product is up to date. Returns true when it changed since the last call (so it must be re-uploaded)
+bool requireDerived(TerrainDerived& derived, DerivedNode product);
+
+//The dataset's heights and normals changed under grid vertices [i0, i1] x [j0, j1] (an edit): patch the heights,
+//normals and tile bounds there only. Occlusion, vegetation, water and the macro material are marked stale and rebuilt as usual
+void updateDerivedRegion(TerrainDerived& derived, int i0, int i1, int j0, int j1);
+
+//Wait for the background work
+void destroyDerived(TerrainDerived& derived);
+
+#endif
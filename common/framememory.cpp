@@ -0,0 +1,229 @@
+#include "framememory.hpp"
+#include "glcapture.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <mutex>
+using namespace std;
+
+//Constant initialised, so counting works for allocations made before main (the application's operator new
+//calls countedMalloc)
+static atomic<unsigned long long> heapAllocations{ 0 };
+static atomic<size_t> heapBytes{ 0 };
+
+void* countedMalloc(size_t bytes, void*)
+{
+	heapAllocations.fetch_add(1, memory_order_relaxed);
+	heapBytes.fetch_add(bytes, memory_order_relaxed);
+	return malloc(bytes ? bytes : 1);
+}
+
+void countedFree(void* pointer, void*)
+{
+	free(pointer);
+}
+
+unsigned long long getHeapAllocationCount()
+{
+	return heapAllocations;
+}
+
+//Arena
+static unsigned char* arena = nullptr;
+static size_t arenaCapacity = 0;
+static atomic<size_t> arenaUsed{ 0 }; //May run past the capacity: the overflow is this frame's shortfall
+static mutex overflowMutex;
+static vector<void*> overflowBlocks;
+
+//Upload ring
+struct UploadRing
+{
+	GLuint buffer = 0;
+	unsigned char* mapped = nullptr;
+	size_t regionBytes = 0;
+};
+
+static UploadRing ring;
+static int region = 0;
+static size_t regionUsed = 0;
+static GLsync fences[UPLOAD_RING_FRAMES] = {};
+static vector<GLuint> retiredBuffers; //Replaced this frame, deleted at its end
+static size_t uploadAlignment = 16;
+
+static FrameMemoryStats stats;
+static unsigned long long frameStartAllocations = 0;
+static size_t frameStartBytes = 0;
+static size_t frameUploadBytes = 0;
+
+static void* alignPointer(void* pointer, size_t alignment)
+{
+	uintptr_t address = uintptr_t(pointer);
+	return (void*)((address + alignment - 1) / alignment * alignment);
+}
+
+static void createRing(size_t regionBytes)
+{
+	ring.regionBytes = (regionBytes + uploadAlignment - 1) / uploadAlignment * uploadAlignment;
+	size_t bytes = ring.regionBytes * UPLOAD_RING_FRAMES;
+
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &ring.buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, ring.buffer);
+	glBufferStorage(GL_COPY_WRITE_BUFFER, bytes, nullptr, flags);
+	ring.mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, bytes, flags);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	stats.uploadBuffer = ring.buffer;
+	stats.uploadRegionBytes = ring.regionBytes;
+}
+
+void initFrameMemory(size_t regionBytes, size_t arenaBytes)
+{
+	GLint storageAlignment = 16, uniformAlignment = 16;
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storageAlignment);
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+	uploadAlignment = size_t(max(max(storageAlignment, uniformAlignment), 16));
+	createRing(regionBytes);
+
+	arenaCapacity = arenaBytes;
+	arena = (unsigned char*)countedMalloc(arenaCapacity, nullptr);
+	stats.arenaCapacity = arenaCapacity;
+}
+
+void beginFrameMemory()
+{
+	frameStartAllocations = heapAllocations;
+	frameStartBytes = heapBytes;
+	frameUploadBytes = 0;
+
+	//Only waits when the GPU is still reading what was written UPLOAD_RING_FRAMES frames ago
+	region = (region + 1) % UPLOAD_RING_FRAMES;
+	regionUsed = 0;
+	if (fences[region])
+	{
+		if (glClientWaitSync(fences[region], 0, 0) == GL_TIMEOUT_EXPIRED)
+		{
+			auto start = chrono::steady_clock::now();
+			GLenum status;
+			do
+				status = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+			while (status == GL_TIMEOUT_EXPIRED);
+			stats.fenceWaits++;
+			stats.fenceWaitMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		}
+		glDeleteSync(fences[region]);
+		fences[region] = nullptr;
+	}
+}
+
+void endFrameMemory()
+{
+	if (ring.buffer)
+		fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	//GL keeps a deleted buffer alive until the draws already submitted have read it
+	if (!retiredBuffers.empty())
+	{
+		glDeleteBuffers(GLsizei(retiredBuffers.size()), retiredBuffers.data());
+		retiredBuffers.clear();
+	}
+
+	stats.uploadBytes = frameUploadBytes;
+	stats.heapAllocations = heapAllocations - frameStartAllocations;
+	stats.heapBytes = heapBytes - frameStartBytes;
+	stats.totalHeapAllocations = heapAllocations;
+	stats.steadyFrames = stats.heapAllocations == 0 ? stats.steadyFrames + 1 : 0;
+
+	//Grow to this frame's peak (with some headroom) so the next one fits
+	size_t used = arenaUsed;
+	stats.arenaBytes = used;
+	for (void* block : overflowBlocks)
+		free(block);
+	overflowBlocks.clear();
+	if (used > arenaCapacity)
+	{
+		free(arena);
+		arenaCapacity = used + used / 2;
+		arena = (unsigned char*)countedMalloc(arenaCapacity, nullptr);
+		stats.arenaCapacity = arenaCapacity;
+		stats.arenaGrowths++;
+	}
+	arenaUsed = 0;
+}
+
+void* frameAllocate(size_t bytes, size_t alignment)
+{
+	size_t reserved = bytes + alignment - 1;
+	size_t offset = arenaUsed.fetch_add(reserved);
+	if (offset + reserved <= arenaCapacity)
+		return alignPointer(arena + offset, alignment);
+
+	//Past the end: from the heap until the frame ends
+	void* block = countedMalloc(reserved, nullptr);
+	lock_guard<mutex> lock(overflowMutex);
+	overflowBlocks.push_back(block);
+	return alignPointer(block, alignment);
+}
+
+UploadAllocation uploadAllocate(size_t bytes, size_t alignment)
+{
+	alignment = max(alignment, uploadAlignment);
+	size_t offset = (regionUsed + alignment - 1) / alignment * alignment;
+	if (offset + bytes > ring.regionBytes)
+	{
+		//Too small for this frame: a new ring, fresh for every region, and the old one goes at the end of the frame
+		retiredBuffers.push_back(ring.buffer);
+		for (GLsync& fence : fences)
+		{
+			glDeleteSync(fence);
+			fence = nullptr;
+		}
+		createRing(max(ring.regionBytes * 2, bytes));
+		stats.uploadGrowths++;
+		offset = 0;
+	}
+	regionUsed = offset + bytes;
+	frameUploadBytes += bytes;
+
+	UploadAllocation upload;
+	upload.offset = region * ring.regionBytes + offset;
+	upload.data = ring.mapped + upload.offset;
+	upload.buffer = ring.buffer;
+	upload.bytes = bytes;
+	return upload;
+}
+
+void finishUpload(const UploadAllocation& upload)
+{
+	captureMappedWrite(upload.buffer, GLintptr(upload.offset), GLsizeiptr(upload.bytes), upload.data);
+}
+
+const FrameMemoryStats& getFrameMemoryStats()
+{
+	return stats;
+}
+
+void destroyFrameMemory()
+{
+	for (GLsync& fence : fences)
+	{
+		glDeleteSync(fence);
+		fence = nullptr;
+	}
+	retiredBuffers.push_back(ring.buffer);
+	glDeleteBuffers(GLsizei(retiredBuffers.size()), retiredBuffers.data());
+	retiredBuffers.clear();
+	ring = UploadRing();
+
+	for (void* block : overflowBlocks)
+		free(block);
+	overflowBlocks.clear();
+	free(arena);
+	arena = nullptr;
+	arenaCapacity = 0;
+	arenaUsed = 0;
+	stats = FrameMemoryStats();
+}
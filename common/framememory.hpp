@@ -0,0 +1,104 @@
+#ifndef FRAMEMEMORY_HPP
+#define FRAMEMEMORY_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include <GL/glew.h>
+
+//Per-frame memory
+//Scratch memory that only lives for one frame comes from a linear arena: an allocation is a pointer bump
+//(thread-safe, so jobs can use it too) and the whole arena is released at once when the frame ends. What
+//does not fit goes to the heap until the end of the frame, which then grows the arena to the frame's peak,
+//so a steady frame never touches the heap.
+//Data the GPU reads once per frame (draw commands, light lists) is written straight into an upload ring:
+//one persistently mapped buffer split into UPLOAD_RING_FRAMES regions, one per frame in flight. A fence
+//at the end of every frame guards its region, and the CPU only waits on it when it comes round again
+//while the GPU is still reading it. A ring that overflows is replaced by one twice the size, and the old
+//buffer is deleted at the end of the frame (GL keeps it alive for the draws already reading it).
+//Heap allocations are counted too, so the UI and the frame memory benchmark can show those of every frame:
+//the application replaces the global operator new with countedMalloc (not this library, or every tool
+//linking it would get the replacement) and hands the same functions to ImGui.
+
+static const int UPLOAD_RING_FRAMES = 3;
+
+//A block of the upload ring for this frame: write up to bytes at data before the draws that read it
+struct UploadAllocation
+{
+	void* data = nullptr;
+	GLuint buffer = 0;
+	size_t offset = 0; //Into buffer
+	size_t bytes = 0;
+};
+
+struct FrameMemoryStats
+{
+	//Last finished frame
+	size_t arenaBytes = 0; //Peak use
+	size_t uploadBytes = 0;
+	unsigned long long heapAllocations = 0; //Through operator new and the counted malloc
+	size_t heapBytes = 0;
+	int steadyFrames = 0; //Consecutive frames without heap allocations
+
+	//Totals
+	size_t arenaCapacity = 0;
+	int arenaGrowths = 0;
+	size_t uploadRegionBytes = 0; //Per frame
+	GLuint uploadBuffer = 0;
+	int uploadGrowths = 0;
+	int fenceWaits = 0; //Frames that found their region still in use by the GPU
+	double fenceWaitMs = 0.0;
+	unsigned long long totalHeapAllocations = 0;
+};
+
+//Creates the upload ring with regionBytes per frame (needs a GL 4.4 context) and the arena with arenaBytes
+void initFrameMemory(size_t regionBytes = 1 << 20, size_t arenaBytes = 1 << 20);
+
+//Bracket every frame (end after swapping buffers): begin waits for this frame's ring region, end fences
+//it and releases the arena
+void beginFrameMemory();
+void endFrameMemory();
+
+//Arena memory valid until endFrameMemory
+void* frameAllocate(size_t bytes, size_t alignment = alignof(std::max_align_t));
+
+//A block of this frame's ring region (GL thread only), aligned for any buffer binding unless a larger
+//alignment is given. Call finishUpload once it is written (it only matters to GL captures, the mapping
+//is coherent)
+UploadAllocation uploadAllocate(size_t bytes, size_t alignment = 0);
+void finishUpload(const UploadAllocation& upload);
+
+const FrameMemoryStats& getFrameMemoryStats();
+
+//Heap allocations so far (operator new and the counted malloc)
+unsigned long long getHeapAllocationCount();
+
+//Counting malloc and free, in the signature ImGui::SetAllocatorFunctions takes
+void* countedMalloc(size_t bytes, void* user);
+void countedFree(void* pointer, void* user);
+
+void destroyFrameMemory();
+
+//Allocator for containers that only live for the frame (deallocation is a no-op)
+template <typename T>
+struct FrameAllocator
+{
+	typedef T value_type;
+
+	FrameAllocator() = default;
+	template <typename U>
+	FrameAllocator(const FrameAllocator<U>&) {}
+
+	T* allocate(size_t count) { return static_cast<T*>(frameAllocate(count * sizeof(T), alignof(T))); }
+	void deallocate(T*, size_t) {}
+
+	template <typename U>
+	bool operator==(const FrameAllocator<U>&) const { return true; }
+	template <typename U>
+	bool operator!=(const FrameAllocator<U>&) const { return false; }
+};
+
+template <typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+
+#endif
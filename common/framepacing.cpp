@@ -0,0 +1,158 @@
+#include "framepacing.hpp"
+#include "glcapture.hpp"
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+using namespace std;
+
+//Frames to wait between resolution changes so one slow frame does not make the image flicker
+static const int resolutionCooldown = 15;
+
+static bool createSceneFramebuffer(FramePacing& pacing, int width, int height)
+{
+	glGenFramebuffers(1, &pacing.sceneFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, pacing.sceneFramebuffer);
+
+	glGenTextures(1, &pacing.sceneColour);
+	glBindTexture(GL_TEXTURE_2D, pacing.sceneColour);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, width, height); //HDR so lighting above 1 survives until post processing
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pacing.sceneColour, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	//Depth is a texture so post processing can reproject pixels
+	glGenTextures(1, &pacing.sceneDepth);
+	glBindTexture(GL_TEXTURE_2D, pacing.sceneDepth);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, pacing.sceneDepth, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	pacing.framebufferWidth = width;
+	pacing.framebufferHeight = height;
+	return complete;
+}
+
+static void deleteSceneFramebuffer(FramePacing& pacing)
+{
+	glDeleteFramebuffers(1, &pacing.sceneFramebuffer);
+	glDeleteTextures(1, &pacing.sceneColour);
+	glDeleteTextures(1, &pacing.sceneDepth);
+	pacing.sceneFramebuffer = pacing.sceneColour = pacing.sceneDepth = 0;
+}
+
+bool initFramePacing(FramePacing& pacing, int width, int height)
+{
+	if (!createSceneFramebuffer(pacing, width, height))
+	{
+		cout << "Scene framebuffer is incomplete" << endl;
+		return false;
+	}
+
+	pacing.renderWidth = width;
+	pacing.renderHeight = height;
+	return true;
+}
+
+void beginScenePass(FramePacing& pacing, int windowWidth, int windowHeight)
+{
+	//Resized window -> reallocate at the new full size
+	if (windowWidth != pacing.framebufferWidth || windowHeight != pacing.framebufferHeight)
+	{
+		deleteSceneFramebuffer(pacing);
+		createSceneFramebuffer(pacing, windowWidth, windowHeight);
+	}
+
+	pacing.renderWidth = max(1, int(windowWidth * pacing.resolutionScale));
+	pacing.renderHeight = max(1, int(windowHeight * pacing.resolutionScale));
+
+	glBindFramebuffer(GL_FRAMEBUFFER, pacing.sceneFramebuffer);
+	glViewport(0, 0, pacing.renderWidth, pacing.renderHeight);
+}
+
+void endScenePass(FramePacing& pacing, int windowWidth, int windowHeight, GLuint target)
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, pacing.sceneFramebuffer);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+
+	glBlitFramebuffer(0, 0, pacing.renderWidth, pacing.renderHeight, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT,
+					  pacing.renderWidth == windowWidth && pacing.renderHeight == windowHeight ? GL_NEAREST : GL_LINEAR);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, target);
+	glViewport(0, 0, windowWidth, windowHeight);
+}
+
+void endFramePacing(FramePacing& pacing, double gpuFrameMs)
+{
+	if (pacing.swapInterval != pacing.appliedSwapInterval)
+	{
+		glfwSwapInterval(pacing.swapInterval);
+		pacing.appliedSwapInterval = pacing.swapInterval;
+	}
+
+	//Bound the number of queued frames (the driver's own limit applies otherwise)
+	int allowed = pacing.lowLatency ? max(1, min(pacing.maxFramesInFlight, MAX_FRAMES_IN_FLIGHT)) : 0;
+	if (pacing.lowLatency)
+	{
+		pacing.fences[(pacing.fenceHead + pacing.fenceCount) % MAX_FRAMES_IN_FLIGHT] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		pacing.fenceCount++;
+	}
+
+	double waitStart = glfwGetTime();
+	while (pacing.fenceCount > allowed)
+	{
+		GLsync oldest = pacing.fences[pacing.fenceHead];
+		if (pacing.lowLatency)
+			glClientWaitSync(oldest, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull); //1 second timeout
+		glDeleteSync(oldest);
+		pacing.fenceHead = (pacing.fenceHead + 1) % MAX_FRAMES_IN_FLIGHT;
+		pacing.fenceCount--;
+	}
+	pacing.fenceWaitMs = (glfwGetTime() - waitStart) * 1000.0;
+
+	//Dynamic resolution: scale the pixel count by the ratio of target to measured time
+	pacing.framesSinceChange++;
+	if (!pacing.adaptiveResolution)
+	{
+		pacing.resolutionScale = 1.0f;
+		return;
+	}
+	if (gpuFrameMs <= 0.0 || pacing.framesSinceChange < resolutionCooldown)
+		return;
+
+	float scale = pacing.resolutionScale;
+	if (gpuFrameMs > pacing.targetFrameMs * 0.95)
+		scale *= float(sqrt(pacing.targetFrameMs * 0.9 / gpuFrameMs)); //Pixel count is proportional to scale squared
+	else if (gpuFrameMs < pacing.targetFrameMs * 0.75)
+		scale += 0.05f; //Grow slowly to avoid oscillating
+
+	scale = min(max(scale, pacing.minResolutionScale), 1.0f);
+	if (fabs(scale - pacing.resolutionScale) > 0.01f)
+	{
+		pacing.resolutionScale = scale;
+		pacing.framesSinceChange = 0;
+	}
+}
+
+void destroyFramePacing(FramePacing& pacing)
+{
+	while (pacing.fenceCount > 0)
+	{
+		glDeleteSync(pacing.fences[pacing.fenceHead]);
+		pacing.fenceHead = (pacing.fenceHead + 1) % MAX_FRAMES_IN_FLIGHT;
+		pacing.fenceCount--;
+	}
+	deleteSceneFramebuffer(pacing);
+}
@@ -0,0 +1,57 @@
+#ifndef FRAMEPACING_HPP
+#define FRAMEPACING_HPP
+
+#include <GL/glew.h>
+
+//Frame pacing
+//The scene is drawn into an offscreen framebuffer whose used area shrinks or grows to keep the
+//GPU frame time under the target, then upscaled to the window with a linear blit. In low-latency
+//mode a fence is inserted after every swap and the CPU waits until no more than maxFramesInFlight
+//frames are queued, so input is never sampled several frames ahead of what is on screen.
+
+static const int MAX_FRAMES_IN_FLIGHT = 4;
+
+struct FramePacing
+{
+	//Settings
+	float targetFrameMs = 16.6f;
+	bool adaptiveResolution = true;
+	float minResolutionScale = 0.5f;
+	int swapInterval = 1; //0 = vsync off, 1 = every refresh, 2 = every other refresh
+	bool lowLatency = false;
+	int maxFramesInFlight = 1;
+
+	//Current state
+	float resolutionScale = 1.0f;
+	int renderWidth = 0;
+	int renderHeight = 0;
+	int appliedSwapInterval = -1;
+	int framesSinceChange = 0;
+	double fenceWaitMs = 0.0; //Time the CPU spent waiting for fences last frame
+
+	//Scene framebuffer (allocated at the full window size, the render area is a sub-rectangle)
+	GLuint sceneFramebuffer = 0;
+	GLuint sceneColour = 0; //RGBA16F
+	GLuint sceneDepth = 0; //Depth texture
+	int framebufferWidth = 0;
+	int framebufferHeight = 0;
+
+	GLsync fences[MAX_FRAMES_IN_FLIGHT] = {};
+	int fenceHead = 0; //Oldest fence
+	int fenceCount = 0;
+};
+
+bool initFramePacing(FramePacing& pacing, int width, int height);
+
+//Bind the scene framebuffer and set the viewport to the current render resolution
+void beginScenePass(FramePacing& pacing, int windowWidth, int windowHeight);
+
+//Upscale the rendered area into the target, the default framebuffer unless given (leaves it bound, with a full window viewport)
+void endScenePass(FramePacing& pacing, int windowWidth, int windowHeight, GLuint target = 0);
+
+//Call right after swapping buffers; gpuFrameMs is the measured GPU time of the scene
+void endFramePacing(FramePacing& pacing, double gpuFrameMs);
+
+void destroyFramePacing(FramePacing& pacing);
+
+#endif
@@ -0,0 +1,1393 @@
+#define GLCAPTURE_NO_REDIRECT
+#include "glcapture.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <set>
+using namespace std;
+
+struct CaptureState
+{
+	//Requested capture
+	string path;
+	int framesRequested = 0;
+	int width = 0;
+	int height = 0;
+
+	bool recording = false;
+	int framesRecorded = 0;
+	vector<uint8_t> stream;
+
+	//Kept up to date outside captures too, so a snapshot can be taken at any frame
+	set<GLuint> textures;
+	set<GLuint> buffers;
+	set<GLuint> vertexArrays;
+	set<GLuint> framebuffers;
+	set<GLuint> renderbuffers;
+	set<GLuint> programs;
+	map<GLuint, pair<GLenum, string>> shaders; //Stage and source
+	map<GLuint, vector<GLuint>> attachedShaders;
+	map<GLuint, vector<pair<GLenum, string>>> programSources; //As of the last link
+	set<GLuint> generatedMipmaps; //Textures whose mip chain comes from glGenerateMipmap (only level 0 is stored)
+	int unpackAlignment = 4;
+	int unpackRowLength = 0;
+	GLuint unpackBuffer = 0;
+	map<GLenum, pair<GLintptr, GLsizeiptr>> mappedWrites; //Ranges mapped for writing, by target
+	GLenum polygonMode = GL_FILL;
+	GLuint nextSnapshotShader = 0x70000000; //Names of the shaders the snapshot recreates programs with
+
+	CaptureStats stats;
+};
+
+static CaptureState capture;
+
+//
+//Stream writing
+//
+template <typename T>
+static void put(const T& value)
+{
+	const uint8_t* bytes = (const uint8_t*)&value;
+	capture.stream.insert(capture.stream.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename... T>
+static void putAll(const T&... values)
+{
+	(put(values), ...);
+}
+
+static void putBlob(const void* data, size_t size)
+{
+	put(uint32_t(size));
+	if (size > 0)
+		capture.stream.insert(capture.stream.end(), (const uint8_t*)data, (const uint8_t*)data + size);
+}
+
+static void putString(const string& text)
+{
+	putBlob(text.data(), text.size());
+}
+
+//Starts a record; false (and nothing written) outside a capture
+static bool record(CaptureOp op)
+{
+	if (!capture.recording)
+		return false;
+	put(uint16_t(op));
+	capture.stats.calls++;
+	return true;
+}
+
+static void recordNames(CaptureOp op, GLsizei n, const GLuint* names)
+{
+	if (!record(op))
+		return;
+	put(uint32_t(n));
+	for (GLsizei i = 0; i < n; i++)
+		put(names[i]);
+}
+
+size_t capturePixelBytes(GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, int alignment, int rowLength)
+{
+	if (width <= 0 || height <= 0 || depth <= 0)
+		return 0;
+
+	size_t components = 1;
+	switch (format)
+	{
+	case GL_RG: case GL_RG_INTEGER: components = 2; break;
+	case GL_RGB: case GL_BGR: case GL_RGB_INTEGER: components = 3; break;
+	case GL_RGBA: case GL_BGRA: case GL_RGBA_INTEGER: components = 4; break;
+	}
+
+	size_t texelBytes;
+	switch (type)
+	{
+	case GL_UNSIGNED_BYTE: case GL_BYTE: texelBytes = components; break;
+	case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT: texelBytes = 2 * components; break;
+	case GL_FLOAT_32_UNSIGNED_INT_24_8_REV: texelBytes = 8; break;
+	case GL_UNSIGNED_INT: case GL_INT: case GL_FLOAT: texelBytes = 4 * components; break;
+	default: texelBytes = 4; break; //Packed formats hold a whole texel
+	}
+
+	size_t rowBytes = size_t(rowLength > 0 ? rowLength : width) * texelBytes;
+	rowBytes = (rowBytes + alignment - 1) / alignment * alignment;
+	return rowBytes * (size_t(height) * depth - 1) + size_t(width) * texelBytes;
+}
+
+//Pixel data of a transfer: an offset into the bound unpack buffer, or the bytes themselves
+static void putPixels(GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const void* pixels)
+{
+	if (capture.unpackBuffer)
+	{
+		putAll(uint8_t(1), uint64_t(uintptr_t(pixels)));
+		return;
+	}
+	put(uint8_t(0));
+	putBlob(pixels, pixels ? capturePixelBytes(width, height, depth, format, type, capture.unpackAlignment, capture.unpackRowLength) : 0);
+}
+
+static void recordUniform(CaptureUniformKind kind, int components, GLint location, GLsizei count, GLboolean transpose, const void* values)
+{
+	if (!record(CAPTURE_UNIFORM))
+		return;
+	putAll(uint8_t(kind), uint8_t(components), location, count, uint8_t(transpose));
+	putBlob(values, size_t(count) * components * 4);
+}
+
+//Recreates a program from its sources (snapshot, and programs loaded from binaries during a capture)
+static void recordProgramSources(GLuint program)
+{
+	auto sources = capture.programSources.find(program);
+	if (sources == capture.programSources.end())
+	{
+		cout << "Capture: no sources for program " << program << ", draws using it will fail to replay" << endl;
+		return;
+	}
+
+	vector<GLuint> shaders;
+	for (const pair<GLenum, string>& stage : sources->second)
+	{
+		GLuint shader = capture.nextSnapshotShader++;
+		shaders.push_back(shader);
+		if (record(CAPTURE_CREATE_SHADER))
+			putAll(stage.first, shader);
+		if (record(CAPTURE_SHADER_SOURCE))
+		{
+			put(shader);
+			putString(stage.second);
+		}
+		if (record(CAPTURE_COMPILE_SHADER))
+			put(shader);
+		if (record(CAPTURE_ATTACH_SHADER))
+			putAll(program, shader);
+	}
+	if (record(CAPTURE_LINK_PROGRAM))
+		put(program);
+	for (GLuint shader : shaders)
+		if (record(CAPTURE_DELETE_SHADER))
+			put(shader);
+}
+
+//
+//Snapshot of the live objects and bound state, written at the start of a capture
+//
+static GLenum bindingQuery(GLenum target)
+{
+	switch (target)
+	{
+	case GL_TEXTURE_2D: return GL_TEXTURE_BINDING_2D;
+	case GL_TEXTURE_2D_ARRAY: return GL_TEXTURE_BINDING_2D_ARRAY;
+	case GL_TEXTURE_3D: return GL_TEXTURE_BINDING_3D;
+	case GL_TEXTURE_CUBE_MAP: return GL_TEXTURE_BINDING_CUBE_MAP;
+	case GL_TEXTURE_2D_MULTISAMPLE: return GL_TEXTURE_BINDING_2D_MULTISAMPLE;
+	}
+	return 0;
+}
+
+//Format and type the contents of a texture are read back (and uploaded again) in
+static bool readbackFormat(GLint internalFormat, GLenum& format, GLenum& type)
+{
+	type = GL_FLOAT;
+	switch (internalFormat)
+	{
+	case GL_R8: format = GL_RED; type = GL_UNSIGNED_BYTE; return true;
+	case GL_RG8: format = GL_RG; type = GL_UNSIGNED_BYTE; return true;
+	case GL_RGB: case GL_RGB8: case GL_SRGB8: format = GL_RGB; type = GL_UNSIGNED_BYTE; return true;
+	case GL_RGBA: case GL_RGBA8: case GL_SRGB8_ALPHA8: format = GL_RGBA; type = GL_UNSIGNED_BYTE; return true;
+	case GL_R16F: case GL_R32F: format = GL_RED; return true;
+	case GL_RG16F: case GL_RG32F: format = GL_RG; return true;
+	case GL_RGB16F: case GL_RGB32F: case GL_R11F_G11F_B10F: format = GL_RGB; return true;
+	case GL_RGBA16F: case GL_RGBA32F: format = GL_RGBA; return true;
+	case GL_DEPTH_COMPONENT: case GL_DEPTH_COMPONENT16: case GL_DEPTH_COMPONENT24: case GL_DEPTH_COMPONENT32F: format = GL_DEPTH_COMPONENT; return true;
+	case GL_DEPTH24_STENCIL8: format = GL_DEPTH_STENCIL; type = GL_UNSIGNED_INT_24_8; return true;
+	}
+	return false;
+}
+
+static void snapshotBuffers()
+{
+	for (GLuint buffer : capture.buffers)
+	{
+		recordNames(CAPTURE_GEN_BUFFERS, 1, &buffer);
+		if (!glIsBuffer(buffer)) //Generated but never bound
+			continue;
+
+		GLint size = 0, usage = GL_STATIC_DRAW, mapped = GL_FALSE;
+		glGetNamedBufferParameteriv(buffer, GL_BUFFER_SIZE, &size);
+		glGetNamedBufferParameteriv(buffer, GL_BUFFER_USAGE, &usage);
+		glGetNamedBufferParameteriv(buffer, GL_BUFFER_MAPPED, &mapped);
+		vector<uint8_t> data;
+		if (size > 0 && !mapped)
+		{
+			data.resize(size);
+			glGetNamedBufferSubData(buffer, 0, size, &data[0]);
+		}
+
+		if (record(CAPTURE_BIND_BUFFER))
+			putAll(GLenum(GL_ARRAY_BUFFER), buffer);
+		if (record(CAPTURE_BUFFER_DATA))
+		{
+			putAll(GLenum(GL_ARRAY_BUFFER), int64_t(size), GLenum(usage));
+			putBlob(data.empty() ? nullptr : &data[0], data.size());
+		}
+	}
+}
+
+static void snapshotTextures()
+{
+	//Contents are read back tightly packed and uploaded the same way
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	if (record(CAPTURE_PIXEL_STORE))
+		putAll(GLenum(GL_UNPACK_ALIGNMENT), GLint(1));
+	if (record(CAPTURE_PIXEL_STORE))
+		putAll(GLenum(GL_UNPACK_ROW_LENGTH), GLint(0));
+	if (record(CAPTURE_BIND_BUFFER))
+		putAll(GLenum(GL_PIXEL_UNPACK_BUFFER), GLuint(0));
+	if (record(CAPTURE_ACTIVE_TEXTURE))
+		put(GLenum(GL_TEXTURE0));
+
+	const GLenum parameters[] = { GL_TEXTURE_MIN_FILTER, GL_TEXTURE_MAG_FILTER, GL_TEXTURE_WRAP_S, GL_TEXTURE_WRAP_T, GL_TEXTURE_WRAP_R,
+								  GL_TEXTURE_BASE_LEVEL, GL_TEXTURE_MAX_LEVEL, GL_TEXTURE_COMPARE_MODE, GL_TEXTURE_COMPARE_FUNC };
+
+	vector<uint8_t> pixels;
+	for (GLuint texture : capture.textures)
+	{
+		recordNames(CAPTURE_GEN_TEXTURES, 1, &texture);
+		if (!glIsTexture(texture))
+			continue;
+
+		GLint target = 0;
+		glGetTextureParameteriv(texture, GL_TEXTURE_TARGET, &target);
+		if (target != GL_TEXTURE_2D && target != GL_TEXTURE_2D_ARRAY && target != GL_TEXTURE_3D && target != GL_TEXTURE_CUBE_MAP)
+		{
+			cout << "Capture: texture " << texture << " has an unsupported target, only its name is recorded" << endl;
+			continue;
+		}
+		if (record(CAPTURE_BIND_TEXTURE))
+			putAll(GLenum(target), texture);
+
+		GLint immutable = GL_FALSE, levels = 0, internalFormat = 0;
+		glGetTextureParameteriv(texture, GL_TEXTURE_IMMUTABLE_FORMAT, &immutable);
+		glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_INTERNAL_FORMAT, &internalFormat);
+		if (immutable)
+			glGetTextureParameteriv(texture, GL_TEXTURE_IMMUTABLE_LEVELS, &levels);
+		else
+		{
+			GLint width = 1;
+			while (levels < 16 && width > 0)
+			{
+				glGetTextureLevelParameteriv(texture, levels, GL_TEXTURE_WIDTH, &width);
+				levels += width > 0;
+			}
+		}
+
+		GLenum format, type;
+		bool readable = readbackFormat(internalFormat, format, type);
+		if (!readable)
+			format = GL_RED, type = GL_UNSIGNED_BYTE; //Storage only
+		bool generated = capture.generatedMipmaps.count(texture) > 0;
+		int faces = target == GL_TEXTURE_CUBE_MAP ? 6 : 1;
+
+		GLint width0 = 0, height0 = 0;
+		glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_WIDTH, &width0);
+		glGetTextureLevelParameteriv(texture, 0, GL_TEXTURE_HEIGHT, &height0);
+		if (immutable && target != GL_TEXTURE_2D_ARRAY && target != GL_TEXTURE_3D && record(CAPTURE_TEX_STORAGE_2D))
+			putAll(GLenum(target), GLsizei(levels), GLenum(internalFormat), width0, height0);
+
+		for (int level = 0; level < levels; level++)
+		{
+			GLint width = 0, height = 0, depth = 0;
+			glGetTextureLevelParameteriv(texture, level, GL_TEXTURE_WIDTH, &width);
+			glGetTextureLevelParameteriv(texture, level, GL_TEXTURE_HEIGHT, &height);
+			glGetTextureLevelParameteriv(texture, level, GL_TEXTURE_DEPTH, &depth);
+			bool withContents = readable && (level == 0 || !generated);
+			if (!withContents && immutable)
+				continue;
+
+			//Arrays and volumes as a whole, cube maps face by face
+			int layers = faces == 6 ? 1 : depth;
+			size_t bytes = capturePixelBytes(width, height, layers, format, type, 1, 0);
+			for (int face = 0; face < faces; face++)
+			{
+				const void* data = nullptr;
+				if (withContents)
+				{
+					pixels.resize(bytes);
+					glGetTextureSubImage(texture, level, 0, 0, face, width, height, layers, format, type, GLsizei(bytes), &pixels[0]);
+					data = &pixels[0];
+				}
+
+				GLenum faceTarget = faces == 6 ? GLenum(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face) : GLenum(target);
+				if (target == GL_TEXTURE_2D_ARRAY || target == GL_TEXTURE_3D)
+				{
+					if (record(CAPTURE_TEX_IMAGE_3D))
+					{
+						putAll(GLenum(target), GLint(level), internalFormat, width, height, depth, GLint(0), format, type);
+						put(uint8_t(0));
+						putBlob(data, data ? bytes : 0);
+					}
+				}
+				else if (immutable)
+				{
+					if (record(CAPTURE_TEX_SUB_IMAGE_2D))
+					{
+						putAll(faceTarget, GLint(level), GLint(0), GLint(0), width, height, format, type);
+						put(uint8_t(0));
+						putBlob(data, bytes);
+					}
+				}
+				else if (record(CAPTURE_TEX_IMAGE_2D))
+				{
+					putAll(faceTarget, GLint(level), internalFormat, width, height, GLint(0), format, type);
+					put(uint8_t(0));
+					putBlob(data, data ? bytes : 0);
+				}
+			}
+		}
+
+		for (GLenum parameter : parameters)
+		{
+			GLint value = 0;
+			glGetTextureParameteriv(texture, parameter, &value);
+			if (record(CAPTURE_TEX_PARAMETER))
+				putAll(GLenum(target), parameter, value);
+		}
+		if (generated && readable && record(CAPTURE_GENERATE_MIPMAP))
+			put(GLenum(target));
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+}
+
+static void snapshotRenderTargets()
+{
+	for (GLuint renderbuffer : capture.renderbuffers)
+	{
+		recordNames(CAPTURE_GEN_RENDERBUFFERS, 1, &renderbuffer);
+		if (!glIsRenderbuffer(renderbuffer))
+			continue;
+
+		GLint width = 0, height = 0, format = GL_RGBA8, samples = 0;
+		glGetNamedRenderbufferParameteriv(renderbuffer, GL_RENDERBUFFER_WIDTH, &width);
+		glGetNamedRenderbufferParameteriv(renderbuffer, GL_RENDERBUFFER_HEIGHT, &height);
+		glGetNamedRenderbufferParameteriv(renderbuffer, GL_RENDERBUFFER_INTERNAL_FORMAT, &format);
+		glGetNamedRenderbufferParameteriv(renderbuffer, GL_RENDERBUFFER_SAMPLES, &samples);
+		if (record(CAPTURE_BIND_RENDERBUFFER))
+			putAll(GLenum(GL_RENDERBUFFER), renderbuffer);
+		if (width > 0 && record(CAPTURE_RENDERBUFFER_STORAGE_MULTISAMPLE))
+			putAll(GLenum(GL_RENDERBUFFER), GLsizei(samples), GLenum(format), GLsizei(width), GLsizei(height));
+	}
+
+	vector<GLenum> attachments = { GL_DEPTH_ATTACHMENT, GL_STENCIL_ATTACHMENT };
+	for (int i = 0; i < 8; i++)
+		attachments.push_back(GL_COLOR_ATTACHMENT0 + i);
+
+	for (GLuint framebuffer : capture.framebuffers)
+	{
+		recordNames(CAPTURE_GEN_FRAMEBUFFERS, 1, &framebuffer);
+		if (!glIsFramebuffer(framebuffer))
+			continue;
+		if (record(CAPTURE_BIND_FRAMEBUFFER))
+			putAll(GLenum(GL_FRAMEBUFFER), framebuffer);
+
+		for (GLenum attachment : attachments)
+		{
+			GLint type = GL_NONE, name = 0;
+			glGetNamedFramebufferAttachmentParameteriv(framebuffer, attachment, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &type);
+			if (type == GL_NONE)
+				continue;
+			glGetNamedFramebufferAttachmentParameteriv(framebuffer, attachment, GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &name);
+
+			if (type == GL_RENDERBUFFER)
+			{
+				if (record(CAPTURE_FRAMEBUFFER_RENDERBUFFER))
+					putAll(GLenum(GL_FRAMEBUFFER), attachment, GLenum(GL_RENDERBUFFER), GLuint(name));
+				continue;
+			}
+
+			GLint level = 0, face = 0, target = 0;
+			glGetNamedFramebufferAttachmentParameteriv(framebuffer, attachment, GL_FRAMEBUFFER_ATTACHMENT_TEXTURE_LEVEL, &level);
+			glGetNamedFramebufferAttachmentParameteriv(framebuffer, attachment, GL_FRAMEBUFFER_ATTACHMENT_TEXTURE_CUBE_MAP_FACE, &face);
+			glGetTextureParameteriv(name, GL_TEXTURE_TARGET, &target);
+			if (target != GL_TEXTURE_2D && target != GL_TEXTURE_2D_MULTISAMPLE && target != GL_TEXTURE_CUBE_MAP)
+			{
+				cout << "Capture: layered attachment of framebuffer " << framebuffer << " is not recorded" << endl;
+				continue;
+			}
+			if (record(CAPTURE_FRAMEBUFFER_TEXTURE_2D))
+				putAll(GLenum(GL_FRAMEBUFFER), attachment, GLenum(face ? face : target), GLuint(name), level);
+		}
+	}
+}
+
+static void snapshotVertexArrays()
+{
+	GLint bound = 0, maxAttributes = 16;
+	glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &bound);
+	glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &maxAttributes);
+
+	for (GLuint vertexArray : capture.vertexArrays)
+	{
+		recordNames(CAPTURE_GEN_VERTEX_ARRAYS, 1, &vertexArray);
+		if (!glIsVertexArray(vertexArray))
+			continue;
+
+		glBindVertexArray(vertexArray);
+		if (record(CAPTURE_BIND_VERTEX_ARRAY))
+			put(vertexArray);
+
+		for (GLuint index = 0; index < GLuint(min(maxAttributes, 16)); index++)
+		{
+			GLint enabled = 0, buffer = 0, size = 4, type = GL_FLOAT, normalized = 0, stride = 0;
+			void* pointer = nullptr;
+			glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_ENABLED, &enabled);
+			glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_BUFFER_BINDING, &buffer);
+			if (buffer)
+			{
+				glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_SIZE, &size);
+				glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_TYPE, &type);
+				glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_NORMALIZED, &normalized);
+				glGetVertexAttribiv(index, GL_VERTEX_ATTRIB_ARRAY_STRIDE, &stride);
+				glGetVertexAttribPointerv(index, GL_VERTEX_ATTRIB_ARRAY_POINTER, &pointer);
+				if (record(CAPTURE_BIND_BUFFER))
+					putAll(GLenum(GL_ARRAY_BUFFER), GLuint(buffer));
+				if (record(CAPTURE_VERTEX_ATTRIB_POINTER))
+					putAll(index, size, GLenum(type), GLboolean(normalized), GLsizei(stride), uint64_t(uintptr_t(pointer)));
+			}
+			if (enabled && record(CAPTURE_ENABLE_VERTEX_ATTRIB_ARRAY))
+				put(index);
+		}
+
+		GLint elements = 0;
+		glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &elements);
+		if (record(CAPTURE_BIND_BUFFER))
+			putAll(GLenum(GL_ELEMENT_ARRAY_BUFFER), GLuint(elements));
+	}
+	glBindVertexArray(bound);
+}
+
+static void snapshotPrograms()
+{
+	for (GLuint program : capture.programs)
+	{
+		if (record(CAPTURE_CREATE_PROGRAM))
+			put(program);
+		recordProgramSources(program);
+
+		GLint linked = GL_FALSE, uniforms = 0;
+		glGetProgramiv(program, GL_LINK_STATUS, &linked);
+		if (!linked)
+			continue;
+		if (record(CAPTURE_USE_PROGRAM))
+			put(program);
+
+		//Current uniform values (set in earlier frames, or never and still at their defaults)
+		glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &uniforms);
+		for (GLint i = 0; i < uniforms; i++)
+		{
+			char name[256];
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(program, i, sizeof(name), &length, &size, &type, name);
+
+			CaptureUniformKind kind = CAPTURE_UNIFORM_INT;
+			int components = 1;
+			switch (type)
+			{
+			case GL_FLOAT: kind = CAPTURE_UNIFORM_FLOAT; break;
+			case GL_FLOAT_VEC2: kind = CAPTURE_UNIFORM_FLOAT; components = 2; break;
+			case GL_FLOAT_VEC3: kind = CAPTURE_UNIFORM_FLOAT; components = 3; break;
+			case GL_FLOAT_VEC4: kind = CAPTURE_UNIFORM_FLOAT; components = 4; break;
+			case GL_FLOAT_MAT3: kind = CAPTURE_UNIFORM_FLOAT; components = 9; break;
+			case GL_FLOAT_MAT4: kind = CAPTURE_UNIFORM_FLOAT; components = 16; break;
+			case GL_INT_VEC2: case GL_BOOL_VEC2: components = 2; break;
+			case GL_INT_VEC3: case GL_BOOL_VEC3: components = 3; break;
+			case GL_INT_VEC4: case GL_BOOL_VEC4: components = 4; break;
+			case GL_UNSIGNED_INT: kind = CAPTURE_UNIFORM_UINT; break;
+			case GL_INT: case GL_BOOL:
+			case GL_SAMPLER_2D: case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE: case GL_SAMPLER_2D_SHADOW:
+			case GL_SAMPLER_2D_ARRAY_SHADOW: case GL_SAMPLER_2D_MULTISAMPLE: case GL_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_2D:
+				break;
+			default:
+				continue;
+			}
+
+			//Arrays are reported as name[0]; every element has its own location
+			string base = name;
+			if (size > 1 && base.size() > 3 && base.compare(base.size() - 3, 3, "[0]") == 0)
+				base.resize(base.size() - 3);
+			for (GLint element = 0; element < size; element++)
+			{
+				string elementName = size > 1 ? base + "[" + to_string(element) + "]" : base;
+				GLint location = glGetUniformLocation(program, elementName.c_str());
+				if (location < 0)
+					continue;
+
+				uint32_t values[16] = {};
+				if (kind == CAPTURE_UNIFORM_FLOAT)
+					glGetUniformfv(program, location, (GLfloat*)values);
+				else if (kind == CAPTURE_UNIFORM_UINT)
+					glGetUniformuiv(program, location, (GLuint*)values);
+				else
+					glGetUniformiv(program, location, (GLint*)values);
+
+				if (record(CAPTURE_UNIFORM_LOCATION))
+				{
+					put(program);
+					putString(elementName);
+					put(location);
+				}
+				recordUniform(kind, components, location, 1, GL_FALSE, values);
+			}
+		}
+	}
+}
+
+static void snapshotBoundState()
+{
+	GLint value = 0;
+	if (record(CAPTURE_PIXEL_STORE))
+		putAll(GLenum(GL_UNPACK_ALIGNMENT), GLint(capture.unpackAlignment));
+	if (record(CAPTURE_PIXEL_STORE))
+		putAll(GLenum(GL_UNPACK_ROW_LENGTH), GLint(capture.unpackRowLength));
+
+	//Texture units (unit 0 also has the textures the snapshot bound while creating them)
+	GLint activeTexture = GL_TEXTURE0, units = 16;
+	glGetIntegerv(GL_ACTIVE_TEXTURE, &activeTexture);
+	glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &units);
+	const GLenum targets[] = { GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_3D, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_2D_MULTISAMPLE };
+	for (int unit = 0; unit < min(units, 32); unit++)
+	{
+		glActiveTexture(GL_TEXTURE0 + unit);
+		if (record(CAPTURE_ACTIVE_TEXTURE))
+			put(GLenum(GL_TEXTURE0 + unit));
+		for (GLenum target : targets)
+		{
+			glGetIntegerv(bindingQuery(target), &value);
+			if ((value || unit == 0) && record(CAPTURE_BIND_TEXTURE))
+				putAll(target, GLuint(value));
+		}
+	}
+	glActiveTexture(activeTexture);
+	if (record(CAPTURE_ACTIVE_TEXTURE))
+		put(GLenum(activeTexture));
+
+	const pair<GLenum, GLenum> buffers[] = { { GL_ARRAY_BUFFER, GL_ARRAY_BUFFER_BINDING }, { GL_PIXEL_UNPACK_BUFFER, GL_PIXEL_UNPACK_BUFFER_BINDING } };
+	for (const pair<GLenum, GLenum>& buffer : buffers)
+	{
+		glGetIntegerv(buffer.second, &value);
+		if (record(CAPTURE_BIND_BUFFER))
+			putAll(buffer.first, GLuint(value));
+	}
+
+	//Shader storage binding points
+	GLint storageBindings = 8;
+	glGetIntegerv(GL_MAX_SHADER_STORAGE_BUFFER_BINDINGS, &storageBindings);
+	for (int index = 0; index < min(storageBindings, 8); index++)
+	{
+		GLint64 start = 0, size = 0;
+		glGetIntegeri_v(GL_SHADER_STORAGE_BUFFER_BINDING, index, &value);
+		glGetInteger64i_v(GL_SHADER_STORAGE_BUFFER_START, index, &start);
+		glGetInteger64i_v(GL_SHADER_STORAGE_BUFFER_SIZE, index, &size);
+		if (value && size > 0 && record(CAPTURE_BIND_BUFFER_RANGE))
+			putAll(GLenum(GL_SHADER_STORAGE_BUFFER), GLuint(index), GLuint(value), int64_t(start), int64_t(size));
+		else if (value && record(CAPTURE_BIND_BUFFER_BASE))
+			putAll(GLenum(GL_SHADER_STORAGE_BUFFER), GLuint(index), GLuint(value));
+	}
+
+	const pair<GLenum, CaptureOp> bindings[] = {
+		{ GL_VERTEX_ARRAY_BINDING, CAPTURE_BIND_VERTEX_ARRAY },
+		{ GL_CURRENT_PROGRAM, CAPTURE_USE_PROGRAM }
+	};
+	for (const pair<GLenum, CaptureOp>& binding : bindings)
+	{
+		glGetIntegerv(binding.first, &value);
+		if (record(binding.second))
+			put(GLuint(value));
+	}
+
+	const pair<GLenum, GLenum> framebuffers[] = { { GL_DRAW_FRAMEBUFFER, GL_DRAW_FRAMEBUFFER_BINDING }, { GL_READ_FRAMEBUFFER, GL_READ_FRAMEBUFFER_BINDING } };
+	for (const pair<GLenum, GLenum>& framebuffer : framebuffers)
+	{
+		glGetIntegerv(framebuffer.second, &value);
+		if (record(CAPTURE_BIND_FRAMEBUFFER))
+			putAll(framebuffer.first, GLuint(value));
+	}
+	glGetIntegerv(GL_RENDERBUFFER_BINDING, &value);
+	if (record(CAPTURE_BIND_RENDERBUFFER))
+		putAll(GLenum(GL_RENDERBUFFER), GLuint(value));
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	if (record(CAPTURE_VIEWPORT))
+		putAll(viewport[0], viewport[1], GLsizei(viewport[2]), GLsizei(viewport[3]));
+
+	GLfloat clearColour[4];
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColour);
+	if (record(CAPTURE_CLEAR_COLOR))
+		putAll(clearColour[0], clearColour[1], clearColour[2], clearColour[3]);
+
+	glGetIntegerv(GL_DEPTH_FUNC, &value);
+	if (record(CAPTURE_DEPTH_FUNC))
+		put(GLenum(value));
+	GLboolean depthMask = GL_TRUE;
+	glGetBooleanv(GL_DEPTH_WRITEMASK, &depthMask);
+	if (record(CAPTURE_DEPTH_MASK))
+		put(depthMask);
+	glGetIntegerv(GL_PRIMITIVE_RESTART_INDEX, &value);
+	if (record(CAPTURE_PRIMITIVE_RESTART_INDEX))
+		put(GLuint(value));
+	if (record(CAPTURE_POLYGON_MODE))
+		putAll(GLenum(GL_FRONT_AND_BACK), capture.polygonMode);
+
+	const GLenum capabilities[] = { GL_DEPTH_TEST, GL_CULL_FACE, GL_BLEND, GL_SCISSOR_TEST, GL_STENCIL_TEST, GL_PRIMITIVE_RESTART,
+									GL_SAMPLE_ALPHA_TO_COVERAGE, GL_MULTISAMPLE, GL_FRAMEBUFFER_SRGB, GL_PROGRAM_POINT_SIZE };
+	for (GLenum capability : capabilities)
+		if (record(glIsEnabled(capability) ? CAPTURE_ENABLE : CAPTURE_DISABLE))
+			put(capability);
+}
+
+static void writeSnapshot()
+{
+	snapshotBuffers();
+	snapshotTextures();
+	snapshotRenderTargets();
+	snapshotVertexArrays();
+	snapshotPrograms();
+	snapshotBoundState();
+	record(CAPTURE_SNAPSHOT_END);
+}
+
+static void finishCapture()
+{
+	CaptureHeader header;
+	header.frames = capture.framesRecorded;
+	header.width = capture.width;
+	header.height = capture.height;
+
+	FILE* file = fopen(capture.path.c_str(), "wb");
+	bool written = file && fwrite(&header, sizeof(header), 1, file) == 1 &&
+				   fwrite(&capture.stream[0], 1, capture.stream.size(), file) == capture.stream.size();
+	if (file)
+		fclose(file);
+
+	if (written)
+	{
+		capture.stats.path = capture.path;
+		capture.stats.bytes = sizeof(header) + capture.stream.size();
+		capture.stats.frames = capture.framesRecorded;
+		cout << "Captured " << capture.framesRecorded << " frame(s) to " << capture.path << " (" << (capture.stats.bytes >> 10) << " KB)" << endl;
+	}
+	else
+		cout << "Failed to write the capture " << capture.path << endl;
+
+	capture.recording = false;
+	capture.framesRequested = 0;
+	vector<uint8_t>().swap(capture.stream);
+}
+
+//
+//Control
+//
+void requestCapture(const char* path, int frames, int width, int height)
+{
+	if (capture.recording || frames <= 0)
+		return;
+	capture.path = path;
+	capture.framesRequested = frames;
+	capture.width = width;
+	capture.height = height;
+}
+
+bool isCapturing()
+{
+	return capture.recording || capture.framesRequested > 0;
+}
+
+const CaptureStats& getCaptureStats()
+{
+	return capture.stats;
+}
+
+void captureBeginFrame()
+{
+	if (capture.recording || capture.framesRequested <= 0)
+		return;
+
+	capture.recording = true;
+	capture.framesRecorded = 0;
+	capture.stream.clear();
+	capture.stats.calls = 0;
+	writeSnapshot();
+	capture.stats.snapshotBytes = capture.stream.size();
+}
+
+void captureEndFrame()
+{
+	if (!record(CAPTURE_FRAME_END))
+		return;
+	if (++capture.framesRecorded >= capture.framesRequested)
+		finishCapture();
+}
+
+void captureBeginGroup(const char* name)
+{
+	if (record(CAPTURE_GROUP_BEGIN))
+		putString(name);
+}
+
+void captureEndGroup()
+{
+	record(CAPTURE_GROUP_END);
+}
+
+void setCapturedProgramSources(GLuint program, const vector<pair<GLenum, string>>& stages)
+{
+	capture.programSources[program] = stages;
+	if (capture.recording)
+		recordProgramSources(program);
+}
+
+//
+//Wrappers: call GL, then track and record
+//
+void captureGenTextures(GLsizei n, GLuint* textures)
+{
+	glGenTextures(n, textures);
+	capture.textures.insert(textures, textures + n);
+	recordNames(CAPTURE_GEN_TEXTURES, n, textures);
+}
+
+void captureDeleteTextures(GLsizei n, const GLuint* textures)
+{
+	glDeleteTextures(n, textures);
+	for (GLsizei i = 0; i < n; i++)
+	{
+		capture.textures.erase(textures[i]);
+		capture.generatedMipmaps.erase(textures[i]);
+	}
+	recordNames(CAPTURE_DELETE_TEXTURES, n, textures);
+}
+
+void captureBindTexture(GLenum target, GLuint texture)
+{
+	glBindTexture(target, texture);
+	if (record(CAPTURE_BIND_TEXTURE))
+		putAll(target, texture);
+}
+
+void captureActiveTexture(GLenum texture)
+{
+	glActiveTexture(texture);
+	if (record(CAPTURE_ACTIVE_TEXTURE))
+		put(texture);
+}
+
+void captureTexParameteri(GLenum target, GLenum pname, GLint param)
+{
+	glTexParameteri(target, pname, param);
+	if (record(CAPTURE_TEX_PARAMETER))
+		putAll(target, pname, param);
+}
+
+void captureTexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels)
+{
+	glTexImage2D(target, level, internalFormat, width, height, border, format, type, pixels);
+	if (record(CAPTURE_TEX_IMAGE_2D))
+	{
+		putAll(target, level, internalFormat, width, height, border, format, type);
+		putPixels(width, height, 1, format, type, pixels);
+	}
+}
+
+void captureTexImage3D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLsizei depth, GLint border, GLenum format, GLenum type, const void* pixels)
+{
+	glTexImage3D(target, level, internalFormat, width, height, depth, border, format, type, pixels);
+	if (record(CAPTURE_TEX_IMAGE_3D))
+	{
+		putAll(target, level, internalFormat, width, height, depth, border, format, type);
+		putPixels(width, height, depth, format, type, pixels);
+	}
+}
+
+void captureTexStorage2D(GLenum target, GLsizei levels, GLenum internalFormat, GLsizei width, GLsizei height)
+{
+	glTexStorage2D(target, levels, internalFormat, width, height);
+	if (record(CAPTURE_TEX_STORAGE_2D))
+		putAll(target, levels, internalFormat, width, height);
+}
+
+void captureTexSubImage2D(GLenum target, GLint level, GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, const void* pixels)
+{
+	glTexSubImage2D(target, level, x, y, width, height, format, type, pixels);
+	if (record(CAPTURE_TEX_SUB_IMAGE_2D))
+	{
+		putAll(target, level, x, y, width, height, format, type);
+		putPixels(width, height, 1, format, type, pixels);
+	}
+}
+
+void captureTexSubImage3D(GLenum target, GLint level, GLint x, GLint y, GLint z, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const void* pixels)
+{
+	glTexSubImage3D(target, level, x, y, z, width, height, depth, format, type, pixels);
+	if (record(CAPTURE_TEX_SUB_IMAGE_3D))
+	{
+		putAll(target, level, x, y, z, width, height, depth, format, type);
+		putPixels(width, height, depth, format, type, pixels);
+	}
+}
+
+void captureGenerateMipmap(GLenum target)
+{
+	glGenerateMipmap(target);
+	GLint texture = 0;
+	glGetIntegerv(bindingQuery(target), &texture);
+	capture.generatedMipmaps.insert(GLuint(texture));
+	if (record(CAPTURE_GENERATE_MIPMAP))
+		put(target);
+}
+
+void capturePixelStorei(GLenum pname, GLint param)
+{
+	glPixelStorei(pname, param);
+	if (pname == GL_UNPACK_ALIGNMENT)
+		capture.unpackAlignment = param;
+	else if (pname == GL_UNPACK_ROW_LENGTH)
+		capture.unpackRowLength = param;
+	if (record(CAPTURE_PIXEL_STORE))
+		putAll(pname, param);
+}
+
+void captureGenBuffers(GLsizei n, GLuint* buffers)
+{
+	glGenBuffers(n, buffers);
+	capture.buffers.insert(buffers, buffers + n);
+	recordNames(CAPTURE_GEN_BUFFERS, n, buffers);
+}
+
+void captureDeleteBuffers(GLsizei n, const GLuint* buffers)
+{
+	glDeleteBuffers(n, buffers);
+	for (GLsizei i = 0; i < n; i++)
+	{
+		capture.buffers.erase(buffers[i]);
+		if (capture.unpackBuffer == buffers[i])
+			capture.unpackBuffer = 0;
+	}
+	recordNames(CAPTURE_DELETE_BUFFERS, n, buffers);
+}
+
+void captureBindBuffer(GLenum target, GLuint buffer)
+{
+	glBindBuffer(target, buffer);
+	if (target == GL_PIXEL_UNPACK_BUFFER)
+		capture.unpackBuffer = buffer;
+	if (record(CAPTURE_BIND_BUFFER))
+		putAll(target, buffer);
+}
+
+void captureBindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+	glBindBufferBase(target, index, buffer);
+	if (record(CAPTURE_BIND_BUFFER_BASE))
+		putAll(target, index, buffer);
+}
+
+void captureBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	glBindBufferRange(target, index, buffer, offset, size);
+	if (record(CAPTURE_BIND_BUFFER_RANGE))
+		putAll(target, index, buffer, int64_t(offset), int64_t(size));
+}
+
+//Recorded as mutable storage: the replay never maps it, and fills it through sub data instead
+void captureBufferStorage(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags)
+{
+	glBufferStorage(target, size, data, flags);
+	if (record(CAPTURE_BUFFER_DATA))
+	{
+		putAll(target, int64_t(size), GLenum(GL_DYNAMIC_DRAW));
+		putBlob(data, data ? size_t(size) : 0);
+	}
+}
+
+void captureBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage)
+{
+	glBufferData(target, size, data, usage);
+	if (record(CAPTURE_BUFFER_DATA))
+	{
+		putAll(target, int64_t(size), usage);
+		putBlob(data, data ? size_t(size) : 0);
+	}
+}
+
+void captureBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data)
+{
+	glBufferSubData(target, offset, size, data);
+	if (record(CAPTURE_BUFFER_SUB_DATA))
+	{
+		putAll(target, int64_t(offset));
+		putBlob(data, size_t(size));
+	}
+}
+
+void* captureMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access)
+{
+	//Writes through persistent mappings are handed over by captureMappedWrite
+	void* pointer = glMapBufferRange(target, offset, length, access);
+	if (pointer && (access & GL_MAP_WRITE_BIT) && !(access & GL_MAP_PERSISTENT_BIT))
+		capture.mappedWrites[target] = make_pair(offset, length);
+	return pointer;
+}
+
+//Mapped writes are recorded as the sub data they left in the buffer (read back, so only while capturing)
+GLboolean captureUnmapBuffer(GLenum target)
+{
+	GLboolean result = glUnmapBuffer(target);
+	auto mapped = capture.mappedWrites.find(target);
+	if (mapped == capture.mappedWrites.end())
+		return result;
+
+	pair<GLintptr, GLsizeiptr> range = mapped->second;
+	capture.mappedWrites.erase(mapped);
+	if (result && capture.recording)
+	{
+		vector<uint8_t> contents(size_t(range.second));
+		glGetBufferSubData(target, range.first, range.second, contents.data());
+		record(CAPTURE_BUFFER_SUB_DATA);
+		putAll(target, int64_t(range.first));
+		putBlob(contents.data(), contents.size());
+	}
+	return result;
+}
+
+void captureMappedWrite(GLuint buffer, GLintptr offset, GLsizeiptr size, const void* data)
+{
+	if (!capture.recording)
+		return;
+
+	//The replay's copy is not mapped, so the bytes go in through the copy write binding
+	if (record(CAPTURE_BIND_BUFFER))
+		putAll(GLenum(GL_COPY_WRITE_BUFFER), buffer);
+	if (record(CAPTURE_BUFFER_SUB_DATA))
+	{
+		putAll(GLenum(GL_COPY_WRITE_BUFFER), int64_t(offset));
+		putBlob(data, size_t(size));
+	}
+}
+
+void captureGenVertexArrays(GLsizei n, GLuint* arrays)
+{
+	glGenVertexArrays(n, arrays);
+	capture.vertexArrays.insert(arrays, arrays + n);
+	recordNames(CAPTURE_GEN_VERTEX_ARRAYS, n, arrays);
+}
+
+void captureDeleteVertexArrays(GLsizei n, const GLuint* arrays)
+{
+	glDeleteVertexArrays(n, arrays);
+	for (GLsizei i = 0; i < n; i++)
+		capture.vertexArrays.erase(arrays[i]);
+	recordNames(CAPTURE_DELETE_VERTEX_ARRAYS, n, arrays);
+}
+
+void captureBindVertexArray(GLuint array)
+{
+	glBindVertexArray(array);
+	if (record(CAPTURE_BIND_VERTEX_ARRAY))
+		put(array);
+}
+
+void captureVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer)
+{
+	glVertexAttribPointer(index, size, type, normalized, stride, pointer);
+	if (record(CAPTURE_VERTEX_ATTRIB_POINTER))
+		putAll(index, size, type, normalized, stride, uint64_t(uintptr_t(pointer)));
+}
+
+void captureEnableVertexAttribArray(GLuint index)
+{
+	glEnableVertexAttribArray(index);
+	if (record(CAPTURE_ENABLE_VERTEX_ATTRIB_ARRAY))
+		put(index);
+}
+
+void captureGenFramebuffers(GLsizei n, GLuint* framebuffers)
+{
+	glGenFramebuffers(n, framebuffers);
+	capture.framebuffers.insert(framebuffers, framebuffers + n);
+	recordNames(CAPTURE_GEN_FRAMEBUFFERS, n, framebuffers);
+}
+
+void captureDeleteFramebuffers(GLsizei n, const GLuint* framebuffers)
+{
+	glDeleteFramebuffers(n, framebuffers);
+	for (GLsizei i = 0; i < n; i++)
+		capture.framebuffers.erase(framebuffers[i]);
+	recordNames(CAPTURE_DELETE_FRAMEBUFFERS, n, framebuffers);
+}
+
+void captureBindFramebuffer(GLenum target, GLuint framebuffer)
+{
+	glBindFramebuffer(target, framebuffer);
+	if (record(CAPTURE_BIND_FRAMEBUFFER))
+		putAll(target, framebuffer);
+}
+
+void captureFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textureTarget, GLuint texture, GLint level)
+{
+	glFramebufferTexture2D(target, attachment, textureTarget, texture, level);
+	if (record(CAPTURE_FRAMEBUFFER_TEXTURE_2D))
+		putAll(target, attachment, textureTarget, texture, level);
+}
+
+void captureGenRenderbuffers(GLsizei n, GLuint* renderbuffers)
+{
+	glGenRenderbuffers(n, renderbuffers);
+	capture.renderbuffers.insert(renderbuffers, renderbuffers + n);
+	recordNames(CAPTURE_GEN_RENDERBUFFERS, n, renderbuffers);
+}
+
+void captureDeleteRenderbuffers(GLsizei n, const GLuint* renderbuffers)
+{
+	glDeleteRenderbuffers(n, renderbuffers);
+	for (GLsizei i = 0; i < n; i++)
+		capture.renderbuffers.erase(renderbuffers[i]);
+	recordNames(CAPTURE_DELETE_RENDERBUFFERS, n, renderbuffers);
+}
+
+void captureBindRenderbuffer(GLenum target, GLuint renderbuffer)
+{
+	glBindRenderbuffer(target, renderbuffer);
+	if (record(CAPTURE_BIND_RENDERBUFFER))
+		putAll(target, renderbuffer);
+}
+
+void captureRenderbufferStorage(GLenum target, GLenum internalFormat, GLsizei width, GLsizei height)
+{
+	glRenderbufferStorage(target, internalFormat, width, height);
+	if (record(CAPTURE_RENDERBUFFER_STORAGE))
+		putAll(target, internalFormat, width, height);
+}
+
+void captureRenderbufferStorageMultisample(GLenum target, GLsizei samples, GLenum internalFormat, GLsizei width, GLsizei height)
+{
+	glRenderbufferStorageMultisample(target, samples, internalFormat, width, height);
+	if (record(CAPTURE_RENDERBUFFER_STORAGE_MULTISAMPLE))
+		putAll(target, samples, internalFormat, width, height);
+}
+
+void captureFramebufferRenderbuffer(GLenum target, GLenum attachment, GLenum renderbufferTarget, GLuint renderbuffer)
+{
+	glFramebufferRenderbuffer(target, attachment, renderbufferTarget, renderbuffer);
+	if (record(CAPTURE_FRAMEBUFFER_RENDERBUFFER))
+		putAll(target, attachment, renderbufferTarget, renderbuffer);
+}
+
+void captureBlitFramebuffer(GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter)
+{
+	glBlitFramebuffer(srcX0, srcY0, srcX1, srcY1, dstX0, dstY0, dstX1, dstY1, mask, filter);
+	if (record(CAPTURE_BLIT_FRAMEBUFFER))
+		putAll(srcX0, srcY0, srcX1, srcY1, dstX0, dstY0, dstX1, dstY1, mask, filter);
+}
+
+GLuint captureCreateProgram()
+{
+	GLuint program = glCreateProgram();
+	capture.programs.insert(program);
+	if (record(CAPTURE_CREATE_PROGRAM))
+		put(program);
+	return program;
+}
+
+void captureDeleteProgram(GLuint program)
+{
+	glDeleteProgram(program);
+	capture.programs.erase(program);
+	capture.attachedShaders.erase(program);
+	capture.programSources.erase(program);
+	if (record(CAPTURE_DELETE_PROGRAM))
+		put(program);
+}
+
+GLuint captureCreateShader(GLenum type)
+{
+	GLuint shader = glCreateShader(type);
+	capture.shaders[shader] = make_pair(type, string());
+	if (record(CAPTURE_CREATE_SHADER))
+		putAll(type, shader);
+	return shader;
+}
+
+void captureDeleteShader(GLuint shader)
+{
+	glDeleteShader(shader);
+	capture.shaders.erase(shader);
+	if (record(CAPTURE_DELETE_SHADER))
+		put(shader);
+}
+
+void captureShaderSource(GLuint shader, GLsizei count, const GLchar* const* strings, const GLint* lengths)
+{
+	glShaderSource(shader, count, strings, lengths);
+
+	string source;
+	for (GLsizei i = 0; i < count; i++)
+		source += lengths && lengths[i] >= 0 ? string(strings[i], lengths[i]) : string(strings[i]);
+	capture.shaders[shader].second = source;
+
+	if (record(CAPTURE_SHADER_SOURCE))
+	{
+		put(shader);
+		putString(source);
+	}
+}
+
+void captureCompileShader(GLuint shader)
+{
+	glCompileShader(shader);
+	if (record(CAPTURE_COMPILE_SHADER))
+		put(shader);
+}
+
+void captureAttachShader(GLuint program, GLuint shader)
+{
+	glAttachShader(program, shader);
+	capture.attachedShaders[program].push_back(shader);
+	if (record(CAPTURE_ATTACH_SHADER))
+		putAll(program, shader);
+}
+
+void captureLinkProgram(GLuint program)
+{
+	glLinkProgram(program);
+
+	vector<pair<GLenum, string>>& sources = capture.programSources[program];
+	sources.clear();
+	for (GLuint shader : capture.attachedShaders[program])
+	{
+		auto found = capture.shaders.find(shader);
+		if (found != capture.shaders.end())
+			sources.push_back(found->second);
+	}
+
+	if (record(CAPTURE_LINK_PROGRAM))
+		put(program);
+}
+
+void captureProgramBinary(GLuint program, GLenum format, const void* binary, GLsizei length)
+{
+	//Not recorded: binaries only load on the driver that wrote them (the loader passes the sources instead)
+	glProgramBinary(program, format, binary, length);
+}
+
+void captureUseProgram(GLuint program)
+{
+	glUseProgram(program);
+	if (record(CAPTURE_USE_PROGRAM))
+		put(program);
+}
+
+GLint captureGetUniformLocation(GLuint program, const GLchar* name)
+{
+	GLint location = glGetUniformLocation(program, name);
+	if (location >= 0 && record(CAPTURE_UNIFORM_LOCATION))
+	{
+		put(program);
+		putString(name);
+		put(location);
+	}
+	return location;
+}
+
+void captureUniform1i(GLint location, GLint v0)
+{
+	glUniform1i(location, v0);
+	recordUniform(CAPTURE_UNIFORM_INT, 1, location, 1, GL_FALSE, &v0);
+}
+
+void captureUniform2i(GLint location, GLint v0, GLint v1)
+{
+	glUniform2i(location, v0, v1);
+	GLint values[] = { v0, v1 };
+	recordUniform(CAPTURE_UNIFORM_INT, 2, location, 1, GL_FALSE, values);
+}
+
+void captureUniform1f(GLint location, GLfloat v0)
+{
+	glUniform1f(location, v0);
+	recordUniform(CAPTURE_UNIFORM_FLOAT, 1, location, 1, GL_FALSE, &v0);
+}
+
+void captureUniform2f(GLint location, GLfloat v0, GLfloat v1)
+{
+	glUniform2f(location, v0, v1);
+	GLfloat values[] = { v0, v1 };
+	recordUniform(CAPTURE_UNIFORM_FLOAT, 2, location, 1, GL_FALSE, values);
+}
+
+void captureUniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2)
+{
+	glUniform3f(location, v0, v1, v2);
+	GLfloat values[] = { v0, v1, v2 };
+	recordUniform(CAPTURE_UNIFORM_FLOAT, 3, location, 1, GL_FALSE, values);
+}
+
+void captureUniform3fv(GLint location, GLsizei count, const GLfloat* value)
+{
+	glUniform3fv(location, count, value);
+	recordUniform(CAPTURE_UNIFORM_FLOAT, 3, location, count, GL_FALSE, value);
+}
+
+void captureUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value)
+{
+	glUniformMatrix4fv(location, count, transpose, value);
+	recordUniform(CAPTURE_UNIFORM_FLOAT, 16, location, count, transpose, value);
+}
+
+void captureEnable(GLenum cap)
+{
+	glEnable(cap);
+	if (record(CAPTURE_ENABLE))
+		put(cap);
+}
+
+void captureDisable(GLenum cap)
+{
+	glDisable(cap);
+	if (record(CAPTURE_DISABLE))
+		put(cap);
+}
+
+void captureViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+	glViewport(x, y, width, height);
+	if (record(CAPTURE_VIEWPORT))
+		putAll(x, y, width, height);
+}
+
+void captureViewportIndexedf(GLuint index, GLfloat x, GLfloat y, GLfloat width, GLfloat height)
+{
+	glViewportIndexedf(index, x, y, width, height);
+	if (record(CAPTURE_VIEWPORT_INDEXED))
+		putAll(index, x, y, width, height);
+}
+
+void capturePolygonMode(GLenum face, GLenum mode)
+{
+	glPolygonMode(face, mode);
+	capture.polygonMode = mode;
+	if (record(CAPTURE_POLYGON_MODE))
+		putAll(face, mode);
+}
+
+void captureDepthMask(GLboolean flag)
+{
+	glDepthMask(flag);
+	if (record(CAPTURE_DEPTH_MASK))
+		put(flag);
+}
+
+void captureDepthFunc(GLenum func)
+{
+	glDepthFunc(func);
+	if (record(CAPTURE_DEPTH_FUNC))
+		put(func);
+}
+
+void captureClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
+{
+	glClearColor(red, green, blue, alpha);
+	if (record(CAPTURE_CLEAR_COLOR))
+		putAll(red, green, blue, alpha);
+}
+
+void captureClear(GLbitfield mask)
+{
+	glClear(mask);
+	if (record(CAPTURE_CLEAR))
+		put(mask);
+}
+
+void capturePrimitiveRestartIndex(GLuint index)
+{
+	glPrimitiveRestartIndex(index);
+	if (record(CAPTURE_PRIMITIVE_RESTART_INDEX))
+		put(index);
+}
+
+void captureDrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+	glDrawArrays(mode, first, count);
+	if (record(CAPTURE_DRAW_ARRAYS))
+		putAll(mode, first, count);
+}
+
+void captureMultiDrawArrays(GLenum mode, const GLint* firsts, const GLsizei* counts, GLsizei drawCount)
+{
+	glMultiDrawArrays(mode, firsts, counts, drawCount);
+	if (record(CAPTURE_MULTI_DRAW_ARRAYS))
+	{
+		putAll(mode, drawCount);
+		for (GLsizei i = 0; i < drawCount; i++)
+			putAll(firsts[i], counts[i]);
+	}
+}
+
+void captureDrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices)
+{
+	glDrawElements(mode, count, type, indices);
+	if (record(CAPTURE_DRAW_ELEMENTS))
+		putAll(mode, count, type, uint64_t(uintptr_t(indices)));
+}
+
+void captureMultiDrawElements(GLenum mode, const GLsizei* counts, GLenum type, const void* const* indices, GLsizei drawCount)
+{
+	glMultiDrawElements(mode, counts, type, indices, drawCount);
+	if (record(CAPTURE_MULTI_DRAW_ELEMENTS))
+	{
+		putAll(mode, type, drawCount);
+		for (GLsizei i = 0; i < drawCount; i++)
+			putAll(counts[i], uint64_t(uintptr_t(indices[i])));
+	}
+}
+
+void captureDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances)
+{
+	glDrawArraysInstanced(mode, first, count, instances);
+	if (record(CAPTURE_DRAW_ARRAYS_INSTANCED))
+		putAll(mode, first, count, instances);
+}
+
+//The commands themselves live in the bound draw indirect buffer, whose contents are captured as any other buffer's
+void captureMultiDrawElementsIndirect(GLenum mode, GLenum type, const void* indirect, GLsizei drawCount, GLsizei stride)
+{
+	glMultiDrawElementsIndirect(mode, type, indirect, drawCount, stride);
+	if (record(CAPTURE_MULTI_DRAW_ELEMENTS_INDIRECT))
+		putAll(mode, type, uint64_t(uintptr_t(indirect)), drawCount, stride);
+}
+
+void captureBindImageTexture(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format)
+{
+	glBindImageTexture(unit, texture, level, layered, layer, access, format);
+	if (record(CAPTURE_BIND_IMAGE_TEXTURE))
+		putAll(unit, texture, level, uint8_t(layered), layer, access, format);
+}
+
+void captureDispatchCompute(GLuint groupsX, GLuint groupsY, GLuint groupsZ)
+{
+	glDispatchCompute(groupsX, groupsY, groupsZ);
+	if (record(CAPTURE_DISPATCH_COMPUTE))
+		putAll(groupsX, groupsY, groupsZ);
+}
+
+void captureMemoryBarrier(GLbitfield barriers)
+{
+	glMemoryBarrier(barriers);
+	if (record(CAPTURE_MEMORY_BARRIER))
+		put(barriers);
+}
@@ -0,0 +1,409 @@
+#ifndef GLCAPTURE_HPP
+#define GLCAPTURE_HPP
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <GL/glew.h>
+
+//GL command capture
+//Every GL call that creates objects, changes state or draws goes through a thin wrapper (the macros at
+//the end of this header redirect them in every file that includes it). Outside a capture the wrappers
+//only keep track of which objects exist and of the shader sources of each program. When a capture
+//starts, a snapshot of every live object (texture and buffer contents are read back from the GPU) and
+//of the bound state is written as ordinary calls, followed by the calls of the captured frames, so
+//tools/glreplay can re-issue them without the application. Profiler sections become named call groups.
+
+//File layout: CaptureHeader, then records of a uint16 opcode followed by its arguments. Blobs and
+//strings are a uint32 byte count followed by the bytes. Object names are the application's; the
+//replay maps them to its own.
+static const uint32_t CAPTURE_VERSION = 6;
+
+struct CaptureHeader
+{
+	char magic[4] = { 'G', 'L', 'C', 'P' };
+	uint32_t version = CAPTURE_VERSION;
+	uint32_t frames = 0;
+	int32_t width = 0; //Default framebuffer
+	int32_t height = 0;
+};
+
+enum CaptureOp : uint16_t
+{
+	//Structure
+	CAPTURE_SNAPSHOT_END = 1, //Everything before this recreates the state at the start of the first frame
+	CAPTURE_FRAME_END,
+	CAPTURE_GROUP_BEGIN, //string name
+	CAPTURE_GROUP_END,
+
+	//Objects
+	CAPTURE_GEN_TEXTURES, //uint32 count, names
+	CAPTURE_DELETE_TEXTURES,
+	CAPTURE_GEN_BUFFERS,
+	CAPTURE_DELETE_BUFFERS,
+	CAPTURE_GEN_VERTEX_ARRAYS,
+	CAPTURE_DELETE_VERTEX_ARRAYS,
+	CAPTURE_GEN_FRAMEBUFFERS,
+	CAPTURE_DELETE_FRAMEBUFFERS,
+	CAPTURE_GEN_RENDERBUFFERS,
+	CAPTURE_DELETE_RENDERBUFFERS,
+	CAPTURE_CREATE_PROGRAM, //name
+	CAPTURE_DELETE_PROGRAM,
+	CAPTURE_CREATE_SHADER, //stage, name
+	CAPTURE_DELETE_SHADER,
+	CAPTURE_SHADER_SOURCE, //shader, string
+	CAPTURE_COMPILE_SHADER,
+	CAPTURE_ATTACH_SHADER,
+	CAPTURE_LINK_PROGRAM,
+
+	//Bindings and fixed state
+	CAPTURE_USE_PROGRAM,
+	CAPTURE_BIND_TEXTURE,
+	CAPTURE_ACTIVE_TEXTURE,
+	CAPTURE_BIND_BUFFER,
+	CAPTURE_BIND_BUFFER_BASE, //target, index, buffer
+	CAPTURE_BIND_VERTEX_ARRAY,
+	CAPTURE_BIND_FRAMEBUFFER,
+	CAPTURE_BIND_RENDERBUFFER,
+	CAPTURE_ENABLE,
+	CAPTURE_DISABLE,
+	CAPTURE_VIEWPORT,
+	CAPTURE_POLYGON_MODE,
+	CAPTURE_DEPTH_MASK,
+	CAPTURE_DEPTH_FUNC,
+	CAPTURE_CLEAR_COLOR,
+	CAPTURE_CLEAR,
+	CAPTURE_PIXEL_STORE,
+	CAPTURE_PRIMITIVE_RESTART_INDEX,
+	CAPTURE_TEX_PARAMETER,
+
+	//Resource contents (pixel blobs are empty for null pointers and hold an offset while a pixel unpack buffer is bound)
+	CAPTURE_BUFFER_DATA,
+	CAPTURE_BUFFER_SUB_DATA,
+	CAPTURE_TEX_IMAGE_2D,
+	CAPTURE_TEX_IMAGE_3D,
+	CAPTURE_TEX_STORAGE_2D,
+	CAPTURE_TEX_SUB_IMAGE_2D,
+	CAPTURE_TEX_SUB_IMAGE_3D,
+	CAPTURE_GENERATE_MIPMAP,
+	CAPTURE_RENDERBUFFER_STORAGE_MULTISAMPLE,
+	CAPTURE_FRAMEBUFFER_TEXTURE_2D,
+	CAPTURE_FRAMEBUFFER_RENDERBUFFER,
+	CAPTURE_VERTEX_ATTRIB_POINTER,
+	CAPTURE_ENABLE_VERTEX_ATTRIB_ARRAY,
+
+	//Uniforms: locations are looked up again by name in the replay
+	CAPTURE_UNIFORM_LOCATION, //program, string name, location
+	CAPTURE_UNIFORM, //uint8 kind, uint8 components, location, count, uint8 transpose, values
+
+	//Draws
+	CAPTURE_DRAW_ARRAYS,
+	CAPTURE_DRAW_ELEMENTS,
+	CAPTURE_MULTI_DRAW_ELEMENTS,
+	CAPTURE_BLIT_FRAMEBUFFER,
+
+	//Multi-view rendering
+	CAPTURE_VIEWPORT_INDEXED, //index, x, y, width, height (floats)
+	CAPTURE_DRAW_ARRAYS_INSTANCED,
+	CAPTURE_MULTI_DRAW_ELEMENTS_INDIRECT, //mode, type, uint64 offset into the draw indirect buffer, draw count, stride
+
+	//Single sampled targets and batched point draws
+	CAPTURE_RENDERBUFFER_STORAGE, //target, internal format, width, height
+	CAPTURE_MULTI_DRAW_ARRAYS, //mode, draw count, then first and count of each draw
+
+	//Upload ring
+	CAPTURE_BIND_BUFFER_RANGE, //target, index, buffer, int64 offset, int64 size
+
+	//Compute
+	CAPTURE_BIND_IMAGE_TEXTURE, //unit, texture, level, uint8 layered, layer, access, format
+	CAPTURE_DISPATCH_COMPUTE, //groups x, y, z
+	CAPTURE_MEMORY_BARRIER, //barrier bits
+
+	CAPTURE_OP_COUNT
+};
+
+enum CaptureUniformKind : uint8_t
+{
+	CAPTURE_UNIFORM_FLOAT, //components 1-4, or 9/16 for matrices
+	CAPTURE_UNIFORM_INT,
+	CAPTURE_UNIFORM_UINT
+};
+
+struct CaptureStats
+{
+	std::string path; //Last capture written
+	size_t bytes = 0;
+	size_t snapshotBytes = 0;
+	unsigned long long calls = 0;
+	int frames = 0;
+};
+
+//Records the next given number of frames into path; width and height are the window's framebuffer size
+void requestCapture(const char* path, int frames, int width, int height);
+bool isCapturing();
+const CaptureStats& getCaptureStats();
+
+//Frame and group boundaries (called by the profiler, so groups match its sections)
+void captureBeginFrame();
+void captureEndFrame();
+void captureBeginGroup(const char* name);
+void captureEndGroup();
+
+//Programs loaded with glProgramBinary have no sources the capture could see; the loader hands them
+//over so captures stay replayable on other drivers
+void setCapturedProgramSources(GLuint program, const std::vector<std::pair<GLenum, std::string>>& stages);
+
+//Wrappers
+void captureGenTextures(GLsizei n, GLuint* textures);
+void captureDeleteTextures(GLsizei n, const GLuint* textures);
+void captureBindTexture(GLenum target, GLuint texture);
+void captureActiveTexture(GLenum texture);
+void captureTexParameteri(GLenum target, GLenum pname, GLint param);
+void captureTexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border, GLenum format, GLenum type, const void* pixels);
+void captureTexImage3D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLsizei depth, GLint border, GLenum format, GLenum type, const void* pixels);
+void captureTexStorage2D(GLenum target, GLsizei levels, GLenum internalFormat, GLsizei width, GLsizei height);
+void captureTexSubImage2D(GLenum target, GLint level, GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, const void* pixels);
+void captureTexSubImage3D(GLenum target, GLint level, GLint x, GLint y, GLint z, GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, const void* pixels);
+void captureGenerateMipmap(GLenum target);
+void capturePixelStorei(GLenum pname, GLint param);
+
+void captureGenBuffers(GLsizei n, GLuint* buffers);
+void captureDeleteBuffers(GLsizei n, const GLuint* buffers);
+void captureBindBuffer(GLenum target, GLuint buffer);
+void captureBindBufferBase(GLenum target, GLuint index, GLuint buffer);
+void captureBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage);
+void captureBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data);
+void captureBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+void captureBufferStorage(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags);
+void* captureMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+GLboolean captureUnmapBuffer(GLenum target);
+
+//Writes through a persistent mapping, which the capture cannot see otherwise (recorded as sub data)
+void captureMappedWrite(GLuint buffer, GLintptr offset, GLsizeiptr size, const void* data);
+
+void captureGenVertexArrays(GLsizei n, GLuint* arrays);
+void captureDeleteVertexArrays(GLsizei n, const GLuint* arrays);
+void captureBindVertexArray(GLuint array);
+void captureVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer);
+void captureEnableVertexAttribArray(GLuint index);
+
+void captureGenFramebuffers(GLsizei n, GLuint* framebuffers);
+void captureDeleteFramebuffers(GLsizei n, const GLuint* framebuffers);
+void captureBindFramebuffer(GLenum target, GLuint framebuffer);
+void captureFramebufferTexture2D(GLenum target, GLenum attachment, GLenum textureTarget, GLuint texture, GLint level);
+void captureGenRenderbuffers(GLsizei n, GLuint* renderbuffers);
+void captureDeleteRenderbuffers(GLsizei n, const GLuint* renderbuffers);
+void captureBindRenderbuffer(GLenum target, GLuint renderbuffer);
+void captureRenderbufferStorage(GLenum target, GLenum internalFormat, GLsizei width, GLsizei height);
+void captureRenderbufferStorageMultisample(GLenum target, GLsizei samples, GLenum internalFormat, GLsizei width, GLsizei height);
+void captureFramebufferRenderbuffer(GLenum target, GLenum attachment, GLenum renderbufferTarget, GLuint renderbuffer);
+void captureBlitFramebuffer(GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0, GLint dstY0, GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter);
+
+GLuint captureCreateProgram();
+void captureDeleteProgram(GLuint program);
+GLuint captureCreateShader(GLenum type);
+void captureDeleteShader(GLuint shader);
+void captureShaderSource(GLuint shader, GLsizei count, const GLchar* const* strings, const GLint* lengths);
+void captureCompileShader(GLuint shader);
+void captureAttachShader(GLuint program, GLuint shader);
+void captureLinkProgram(GLuint program);
+void captureProgramBinary(GLuint program, GLenum format, const void* binary, GLsizei length);
+void captureUseProgram(GLuint program);
+GLint captureGetUniformLocation(GLuint program, const GLchar* name);
+void captureUniform1i(GLint location, GLint v0);
+void captureUniform2i(GLint location, GLint v0, GLint v1);
+void captureUniform1f(GLint location, GLfloat v0);
+void captureUniform2f(GLint location, GLfloat v0, GLfloat v1);
+void captureUniform3f(GLint location, GLfloat v0, GLfloat v1, GLfloat v2);
+void captureUniform3fv(GLint location, GLsizei count, const GLfloat* value);
+void captureUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value);
+
+void captureEnable(GLenum cap);
+void captureDisable(GLenum cap);
+void captureViewport(GLint x, GLint y, GLsizei width, GLsizei height);
+void captureViewportIndexedf(GLuint index, GLfloat x, GLfloat y, GLfloat width, GLfloat height);
+void capturePolygonMode(GLenum face, GLenum mode);
+void captureDepthMask(GLboolean flag);
+void captureDepthFunc(GLenum func);
+void captureClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha);
+void captureClear(GLbitfield mask);
+void capturePrimitiveRestartIndex(GLuint index);
+
+void captureDrawArrays(GLenum mode, GLint first, GLsizei count);
+void captureMultiDrawArrays(GLenum mode, const GLint* firsts, const GLsizei* counts, GLsizei drawCount);
+void captureDrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices);
+void captureMultiDrawElements(GLenum mode, const GLsizei* counts, GLenum type, const void* const* indices, GLsizei drawCount);
+void captureDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instances);
+void captureMultiDrawElementsIndirect(GLenum mode, GLenum type, const void* indirect, GLsizei drawCount, GLsizei stride);
+
+void captureBindImageTexture(GLuint unit, GLuint texture, GLint level, GLboolean layered, GLint layer, GLenum access, GLenum format);
+void captureDispatchCompute(GLuint groupsX, GLuint groupsY, GLuint groupsZ);
+void captureMemoryBarrier(GLbitfield barriers);
+
+//Bytes of pixel data a transfer reads with the given unpack alignment and row length (0 = width)
+size_t capturePixelBytes(GLsizei width, GLsizei height, GLsizei depth, GLenum format, GLenum type, int alignment, int rowLength);
+
+//Redirect the GL calls of the including file (the capture itself and the replay call GL directly)
+#ifndef GLCAPTURE_NO_REDIRECT
+#undef glGenTextures
+#define glGenTextures captureGenTextures
+#undef glDeleteTextures
+#define glDeleteTextures captureDeleteTextures
+#undef glBindTexture
+#define glBindTexture captureBindTexture
+#undef glActiveTexture
+#define glActiveTexture captureActiveTexture
+#undef glTexParameteri
+#define glTexParameteri captureTexParameteri
+#undef glTexImage2D
+#define glTexImage2D captureTexImage2D
+#undef glTexImage3D
+#define glTexImage3D captureTexImage3D
+#undef glTexStorage2D
+#define glTexStorage2D captureTexStorage2D
+#undef glTexSubImage2D
+#define glTexSubImage2D captureTexSubImage2D
+#undef glTexSubImage3D
+#define glTexSubImage3D captureTexSubImage3D
+#undef glGenerateMipmap
+#define glGenerateMipmap captureGenerateMipmap
+#undef glPixelStorei
+#define glPixelStorei capturePixelStorei
+
+#undef glGenBuffers
+#define glGenBuffers captureGenBuffers
+#undef glDeleteBuffers
+#define glDeleteBuffers captureDeleteBuffers
+#undef glBindBuffer
+#define glBindBuffer captureBindBuffer
+#undef glBindBufferBase
+#define glBindBufferBase captureBindBufferBase
+#undef glBindBufferRange
+#define glBindBufferRange captureBindBufferRange
+#undef glBufferData
+#define glBufferData captureBufferData
+#undef glBufferStorage
+#define glBufferStorage captureBufferStorage
+#undef glBufferSubData
+#define glBufferSubData captureBufferSubData
+#undef glMapBufferRange
+#define glMapBufferRange captureMapBufferRange
+#undef glUnmapBuffer
+#define glUnmapBuffer captureUnmapBuffer
+
+#undef glGenVertexArrays
+#define glGenVertexArrays captureGenVertexArrays
+#undef glDeleteVertexArrays
+#define glDeleteVertexArrays captureDeleteVertexArrays
+#undef glBindVertexArray
+#define glBindVertexArray captureBindVertexArray
+#undef glVertexAttribPointer
+#define glVertexAttribPointer captureVertexAttribPointer
+#undef glEnableVertexAttribArray
+#define glEnableVertexAttribArray captureEnableVertexAttribArray
+
+#undef glGenFramebuffers
+#define glGenFramebuffers captureGenFramebuffers
+#undef glDeleteFramebuffers
+#define glDeleteFramebuffers captureDeleteFramebuffers
+#undef glBindFramebuffer
+#define glBindFramebuffer captureBindFramebuffer
+#undef glFramebufferTexture2D
+#define glFramebufferTexture2D captureFramebufferTexture2D
+#undef glGenRenderbuffers
+#define glGenRenderbuffers captureGenRenderbuffers
+#undef glDeleteRenderbuffers
+#define glDeleteRenderbuffers captureDeleteRenderbuffers
+#undef glBindRenderbuffer
+#define glBindRenderbuffer captureBindRenderbuffer
+#undef glRenderbufferStorage
+#define glRenderbufferStorage captureRenderbufferStorage
+#undef glRenderbufferStorageMultisample
+#define glRenderbufferStorageMultisample captureRenderbufferStorageMultisample
+#undef glFramebufferRenderbuffer
+#define glFramebufferRenderbuffer captureFramebufferRenderbuffer
+#undef glBlitFramebuffer
+#define glBlitFramebuffer captureBlitFramebuffer
+
+#undef glCreateProgram
+#define glCreateProgram captureCreateProgram
+#undef glDeleteProgram
+#define glDeleteProgram captureDeleteProgram
+#undef glCreateShader
+#define glCreateShader captureCreateShader
+#undef glDeleteShader
+#define glDeleteShader captureDeleteShader
+#undef glShaderSource
+#define glShaderSource captureShaderSource
+#undef glCompileShader
+#define glCompileShader captureCompileShader
+#undef glAttachShader
+#define glAttachShader captureAttachShader
+#undef glLinkProgram
+#define glLinkProgram captureLinkProgram
+#undef glProgramBinary
+#define glProgramBinary captureProgramBinary
+#undef glUseProgram
+#define glUseProgram captureUseProgram
+#undef glGetUniformLocation
+#define glGetUniformLocation captureGetUniformLocation
+#undef glUniform1i
+#define glUniform1i captureUniform1i
+#undef glUniform2i
+#define glUniform2i captureUniform2i
+#undef glUniform1f
+#define glUniform1f captureUniform1f
+#undef glUniform2f
+#define glUniform2f captureUniform2f
+#undef glUniform3f
+#define glUniform3f captureUniform3f
+#undef glUniform3fv
+#define glUniform3fv captureUniform3fv
+#undef glUniformMatrix4fv
+#define glUniformMatrix4fv captureUniformMatrix4fv
+
+#undef glEnable
+#define glEnable captureEnable
+#undef glDisable
+#define glDisable captureDisable
+#undef glViewport
+#define glViewport captureViewport
+#undef glViewportIndexedf
+#define glViewportIndexedf captureViewportIndexedf
+#undef glPolygonMode
+#define glPolygonMode capturePolygonMode
+#undef glDepthMask
+#define glDepthMask captureDepthMask
+#undef glDepthFunc
+#define glDepthFunc captureDepthFunc
+#undef glClearColor
+#define glClearColor captureClearColor
+#undef glClear
+#define glClear captureClear
+#undef glPrimitiveRestartIndex
+#define glPrimitiveRestartIndex capturePrimitiveRestartIndex
+
+#undef glDrawArrays
+#define glDrawArrays captureDrawArrays
+#undef glMultiDrawArrays
+#define glMultiDrawArrays captureMultiDrawArrays
+#undef glDrawElements
+#define glDrawElements captureDrawElements
+#undef glMultiDrawElements
+#define glMultiDrawElements captureMultiDrawElements
+#undef glDrawArraysInstanced
+#define glDrawArraysInstanced captureDrawArraysInstanced
+#undef glMultiDrawElementsIndirect
+#define glMultiDrawElementsIndirect captureMultiDrawElementsIndirect
+
+#undef glBindImageTexture
+#define glBindImageTexture captureBindImageTexture
+#undef glDispatchCompute
+#define glDispatchCompute captureDispatchCompute
+#undef glMemoryBarrier
+#define glMemoryBarrier captureMemoryBarrier
+#endif
+
+#endif
@@ -0,0 +1,503 @@
+#include "heightfile.hpp"
+#include "jobs.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+using namespace std;
+
+static const uint32_t HEIGHT_FILE_VERSION = 1;
+
+enum TileEncoding
+{
+	TILE_LZ = 0,
+	TILE_STORED = 1 //Used when compression does not pay off
+};
+
+static bool seekFile(FILE* file, uint64_t position)
+{
+#ifdef _WIN32
+	return _fseeki64(file, int64_t(position), SEEK_SET) == 0;
+#else
+	return fseeko(file, off_t(position), SEEK_SET) == 0;
+#endif
+}
+
+//Size of the whole file (the position is left at its end)
+static bool fileLength(FILE* file, uint64_t& length)
+{
+#ifdef _WIN32
+	if (_fseeki64(file, 0, SEEK_END) != 0)
+		return false;
+	int64_t position = _ftelli64(file);
+#else
+	if (fseeko(file, 0, SEEK_END) != 0)
+		return false;
+	int64_t position = int64_t(ftello(file));
+#endif
+	length = uint64_t(position);
+	return position >= 0;
+}
+
+/*
+	LZ compression (LZ4 style sequences)
+	token (literal count << 4 | match length - 4), [more literal count], literals,
+	offset (2 bytes), [more match length]; the last sequence has literals only.
+	A count nibble of 15 is continued by bytes that are added up until one is below 255.
+*/
+
+static const int MIN_MATCH = 4;
+static const int HASH_BITS = 14;
+
+static void writeLength(vector<uint8_t>& out, size_t length)
+{
+	while (length >= 255)
+	{
+		out.push_back(255);
+		length -= 255;
+	}
+	out.push_back(uint8_t(length));
+}
+
+static void emitSequence(vector<uint8_t>& out, const uint8_t* literals, size_t literalCount, size_t matchLength, size_t offset)
+{
+	size_t extraMatch = matchLength ? matchLength - MIN_MATCH : 0;
+	out.push_back(uint8_t((min(literalCount, size_t(15)) << 4) | min(extraMatch, size_t(15))));
+	if (literalCount >= 15)
+		writeLength(out, literalCount - 15);
+	out.insert(out.end(), literals, literals + literalCount);
+
+	if (matchLength == 0)
+		return;
+	out.push_back(uint8_t(offset & 0xff));
+	out.push_back(uint8_t(offset >> 8));
+	if (extraMatch >= 15)
+		writeLength(out, extraMatch - 15);
+}
+
+static void lzCompress(const uint8_t* in, size_t size, vector<uint8_t>& out)
+{
+	vector<int32_t> table(size_t(1) << HASH_BITS, -1);
+	size_t anchor = 0;
+	size_t i = 0;
+	while (i + MIN_MATCH <= size)
+	{
+		uint32_t sequence;
+		memcpy(&sequence, in + i, 4);
+		uint32_t hash = (sequence * 2654435761u) >> (32 - HASH_BITS);
+		int32_t candidate = table[hash];
+		table[hash] = int32_t(i);
+
+		if (candidate < 0 || i - candidate > 65535 || memcmp(in + candidate, in + i, MIN_MATCH) != 0)
+		{
+			i++;
+			continue;
+		}
+
+		size_t length = MIN_MATCH;
+		while (i + length < size && in[candidate + length] == in[i + length])
+			length++;
+
+		emitSequence(out, in + anchor, i - anchor, length, i - candidate);
+		i += length;
+		anchor = i;
+	}
+	emitSequence(out, in + anchor, size - anchor, 0, 0);
+}
+
+static bool readLength(const uint8_t* in, size_t size, size_t& position, size_t& length)
+{
+	uint8_t byte;
+	do
+	{
+		if (position >= size)
+			return false;
+		byte = in[position++];
+		length += byte;
+	} while (byte == 255);
+	return true;
+}
+
+//Fails (rather than overrunning) on corrupt input
+static bool lzDecompress(const uint8_t* in, size_t size, uint8_t* out, size_t outSize)
+{
+	size_t ip = 0, op = 0;
+	while (ip < size)
+	{
+		uint8_t token = in[ip++];
+		size_t literals = token >> 4;
+		if (literals == 15 && !readLength(in, size, ip, literals))
+			return false;
+		if (literals > size - ip || literals > outSize - op)
+			return false;
+		memcpy(out + op, in + ip, literals);
+		ip += literals;
+		op += literals;
+
+		if (ip == size)
+			break;
+
+		if (size - ip < 2)
+			return false;
+		size_t offset = in[ip] | (size_t(in[ip + 1]) << 8);
+		ip += 2;
+		size_t length = (token & 15) + MIN_MATCH;
+		if ((token & 15) == 15 && !readLength(in, size, ip, length))
+			return false;
+		if (offset == 0 || offset > op || length > outSize - op)
+			return false;
+
+		//A match may overlap its own output (runs), which has to be copied byte by byte
+		if (offset >= length)
+			memcpy(out + op, out + op - offset, length);
+		else
+			for (size_t k = 0; k < length; k++)
+				out[op + k] = out[op - offset + k];
+		op += length;
+	}
+	return op == outSize;
+}
+
+/*
+	Tile coding
+*/
+
+static int sampleBytes(uint32_t format)
+{
+	return format == HEIGHT_UINT16 ? 2 : 4;
+}
+
+//Samples as unsigned codes that order the same way as the heights (so neighbours predict each other)
+static inline uint32_t toCode(float height, const HeightFileHeader& header)
+{
+	if (header.format == HEIGHT_UINT16)
+		return uint32_t(min(max((height - header.offset) / header.scale + 0.5f, 0.0f), 65535.0f));
+
+	uint32_t bits;
+	memcpy(&bits, &height, 4);
+	return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+static inline float fromCode(uint32_t code, const HeightFileHeader& header)
+{
+	if (header.format == HEIGHT_UINT16)
+		return header.offset + float(code) * header.scale;
+
+	uint32_t bits = (code & 0x80000000u) ? (code & 0x7fffffffu) : ~code;
+	float height;
+	memcpy(&height, &bits, 4);
+	return height;
+}
+
+//Median edge detector (LOCO-I): left, up or left + up - upLeft depending on the local gradient
+static inline uint32_t predict(const uint32_t* codes, int x, int y, int tileWidth)
+{
+	if (y == 0)
+		return x == 0 ? 0 : codes[x - 1];
+
+	uint32_t up = codes[size_t(y - 1) * tileWidth + x];
+	if (x == 0)
+		return up;
+
+	uint32_t left = codes[size_t(y) * tileWidth + x - 1];
+	uint32_t upLeft = codes[size_t(y - 1) * tileWidth + x - 1];
+	uint32_t low = min(left, up), high = max(left, up);
+	if (upLeft >= high)
+		return low;
+	if (upLeft <= low)
+		return high;
+	return left + up - upLeft;
+}
+
+//Wrapping difference in the sample width, zigzagged so small negative residuals stay small
+static inline uint32_t zigzag(uint32_t difference, int bytes)
+{
+	if (bytes == 2)
+	{
+		int16_t value = int16_t(uint16_t(difference));
+		return uint16_t((uint16_t(value) << 1) ^ uint16_t(value >> 15));
+	}
+	int32_t value = int32_t(difference);
+	return (uint32_t(value) << 1) ^ uint32_t(value >> 31);
+}
+
+static inline uint32_t unzigzag(uint32_t residual, int bytes)
+{
+	uint32_t value = (residual >> 1) ^ (0u - (residual & 1u));
+	return bytes == 2 ? (value & 0xffffu) : value;
+}
+
+static void encodeTile(const float* heights, size_t stride, int tileWidth, int tileHeight, const HeightFileHeader& header, vector<uint8_t>& out)
+{
+	int bytes = sampleBytes(header.format);
+	uint32_t mask = bytes == 2 ? 0xffffu : 0xffffffffu;
+	size_t count = size_t(tileWidth) * tileHeight;
+
+	vector<uint32_t> codes(count);
+	for (int y = 0; y < tileHeight; y++)
+		for (int x = 0; x < tileWidth; x++)
+			codes[size_t(y) * tileWidth + x] = toCode(heights[y * stride + x], header);
+
+	//Residuals split into byte planes: the high planes of smooth terrain are nearly all zero
+	vector<uint8_t> planes(count * bytes);
+	for (int y = 0; y < tileHeight; y++)
+	{
+		for (int x = 0; x < tileWidth; x++)
+		{
+			size_t i = size_t(y) * tileWidth + x;
+			uint32_t residual = zigzag((codes[i] - predict(&codes[0], x, y, tileWidth)) & mask, bytes);
+			for (int b = 0; b < bytes; b++)
+				planes[b * count + i] = uint8_t(residual >> (8 * b));
+		}
+	}
+
+	out.assign(1, uint8_t(TILE_LZ));
+	lzCompress(&planes[0], planes.size(), out);
+	if (out.size() - 1 >= planes.size())
+	{
+		out.assign(1, uint8_t(TILE_STORED));
+		out.insert(out.end(), planes.begin(), planes.end());
+	}
+}
+
+//Rebuilds the codes of a tile from its residual planes, row by row (the first row and column are
+//predicted from one neighbour only)
+template <int BYTES>
+static void reconstructTile(const uint8_t* planes, int tileWidth, int tileHeight, const HeightFileHeader& header, float* heights, size_t stride)
+{
+	size_t count = size_t(tileWidth) * tileHeight;
+	vector<uint32_t> rows(2 * size_t(tileWidth));
+	uint32_t* previous = &rows[0];
+	uint32_t* current = &rows[tileWidth];
+
+	for (int y = 0; y < tileHeight; y++)
+	{
+		const uint8_t* plane = planes + size_t(y) * tileWidth;
+		for (int x = 0; x < tileWidth; x++)
+		{
+			uint32_t residual = plane[x] | (uint32_t(plane[count + x]) << 8);
+			if (BYTES == 4)
+				residual |= (uint32_t(plane[2 * count + x]) << 16) | (uint32_t(plane[3 * count + x]) << 24);
+
+			uint32_t prediction;
+			if (y == 0)
+				prediction = x == 0 ? 0 : current[x - 1];
+			else if (x == 0)
+				prediction = previous[0];
+			else
+			{
+				uint32_t left = current[x - 1], up = previous[x], upLeft = previous[x - 1];
+				uint32_t low = min(left, up), high = max(left, up);
+				prediction = upLeft >= high ? low : (upLeft <= low ? high : left + up - upLeft);
+			}
+
+			uint32_t code = prediction + unzigzag(residual, BYTES);
+			current[x] = BYTES == 2 ? (code & 0xffffu) : code;
+		}
+
+		float* row = heights + y * stride;
+		for (int x = 0; x < tileWidth; x++)
+			row[x] = fromCode(current[x], header);
+		swap(previous, current);
+	}
+}
+
+static bool decodeTile(const uint8_t* data, size_t size, const HeightFileHeader& header, int tileWidth, int tileHeight, float* heights, size_t stride)
+{
+	int bytes = sampleBytes(header.format);
+	size_t count = size_t(tileWidth) * tileHeight;
+	if (size < 1)
+		return false;
+
+	const uint8_t* planes = data + 1;
+	vector<uint8_t> decompressed;
+	if (data[0] == TILE_STORED)
+	{
+		if (size - 1 != count * bytes)
+			return false;
+	}
+	else
+	{
+		decompressed.resize(count * bytes);
+		if (data[0] != TILE_LZ || !lzDecompress(data + 1, size - 1, &decompressed[0], decompressed.size()))
+			return false;
+		planes = &decompressed[0];
+	}
+
+	if (bytes == 2)
+		reconstructTile<2>(planes, tileWidth, tileHeight, header, heights, stride);
+	else
+		reconstructTile<4>(planes, tileWidth, tileHeight, header, heights, stride);
+	return true;
+}
+
+static void tileExtent(const HeightFileHeader& header, int tileX, int tileY, int& tileWidth, int& tileHeight)
+{
+	int tileSize = int(header.tileSize);
+	tileWidth = min(tileSize, int(header.width) - tileX * tileSize);
+	tileHeight = min(tileSize, int(header.height) - tileY * tileSize);
+}
+
+/*
+	Files
+*/
+
+bool writeHeightFile(const char* path, const float* heights, int width, int height, HeightSampleFormat format, int tileSize)
+{
+	HeightFileHeader header = {};
+	memcpy(header.magic, "HMAP", 4);
+	header.version = HEIGHT_FILE_VERSION;
+	header.width = uint32_t(width);
+	header.height = uint32_t(height);
+	header.tileSize = uint32_t(tileSize);
+	header.format = uint32_t(format);
+	header.scale = 1.0f;
+	header.offset = 0.0f;
+
+	//16-bit samples span exactly the range of the map
+	if (format == HEIGHT_UINT16)
+	{
+		auto bounds = minmax_element(heights, heights + size_t(width) * height);
+		header.offset = *bounds.first;
+		if (*bounds.second > *bounds.first)
+			header.scale = (*bounds.second - *bounds.first) / 65535.0f;
+	}
+
+	int tilesX = (width + tileSize - 1) / tileSize;
+	int tilesY = (height + tileSize - 1) / tileSize;
+	vector<vector<uint8_t>> tiles(size_t(tilesX) * tilesY);
+	parallelFor(0, int(tiles.size()), 1, [&](int first, int last)
+	{
+		for (int tile = first; tile < last; tile++)
+		{
+			int tileX = tile % tilesX, tileY = tile / tilesX;
+			int tileWidth, tileHeight;
+			tileExtent(header, tileX, tileY, tileWidth, tileHeight);
+			const float* origin = heights + size_t(tileY) * tileSize * width + size_t(tileX) * tileSize;
+			encodeTile(origin, size_t(width), tileWidth, tileHeight, header, tiles[tile]);
+		}
+	});
+
+	vector<uint64_t> offsets(tiles.size() + 1);
+	offsets[0] = sizeof(HeightFileHeader) + offsets.size() * sizeof(uint64_t);
+	for (size_t tile = 0; tile < tiles.size(); tile++)
+		offsets[tile + 1] = offsets[tile] + tiles[tile].size();
+
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(&offsets[0], sizeof(uint64_t), offsets.size(), file) == offsets.size();
+	for (size_t tile = 0; tile < tiles.size() && ok; tile++)
+		ok = fwrite(&tiles[tile][0], 1, tiles[tile].size(), file) == tiles[tile].size();
+	return fclose(file) == 0 && ok;
+}
+
+bool openHeightFile(const char* path, HeightFile& file)
+{
+	file.file = fopen(path, "rb");
+	if (!file.file)
+		return false;
+
+	HeightFileHeader& header = file.header;
+	if (fread(&header, sizeof(header), 1, file.file) != 1 || memcmp(header.magic, "HMAP", 4) != 0 || header.version != HEIGHT_FILE_VERSION ||
+		(header.format != HEIGHT_UINT16 && header.format != HEIGHT_FLOAT32) || header.tileSize == 0 || header.width == 0 || header.height == 0 ||
+		!(header.scale > 0.0f))
+	{
+		closeHeightFile(file);
+		return false;
+	}
+
+	//Offsets of a truncated or corrupt file could point past its end (or the table itself be too large for it):
+	//the table has to fit the file, the tiles follow it in order and the last one ends inside the file
+	uint64_t tilesX = (uint64_t(header.width) + header.tileSize - 1) / header.tileSize;
+	uint64_t tilesY = (uint64_t(header.height) + header.tileSize - 1) / header.tileSize;
+	uint64_t tableBytes = (tilesX * tilesY + 1) * sizeof(uint64_t);
+	uint64_t length;
+	if (header.width > INT32_MAX || header.height > INT32_MAX || !fileLength(file.file, length) || tilesX * tilesY >= length / sizeof(uint64_t) ||
+		sizeof(header) + tableBytes > length || !seekFile(file.file, sizeof(header)))
+	{
+		closeHeightFile(file);
+		return false;
+	}
+
+	file.tilesX = int(tilesX);
+	file.tilesY = int(tilesY);
+	file.tileOffsets.resize(size_t(tilesX * tilesY + 1));
+	if (fread(&file.tileOffsets[0], sizeof(uint64_t), file.tileOffsets.size(), file.file) != file.tileOffsets.size() ||
+		file.tileOffsets.front() != sizeof(header) + tableBytes || file.tileOffsets.back() > length ||
+		!is_sorted(file.tileOffsets.begin(), file.tileOffsets.end()))
+	{
+		closeHeightFile(file);
+		return false;
+	}
+	return true;
+}
+
+void heightTileSize(const HeightFile& file, int tileX, int tileY, int& tileWidth, int& tileHeight)
+{
+	tileExtent(file.header, tileX, tileY, tileWidth, tileHeight);
+}
+
+bool readHeightTile(HeightFile& file, int tileX, int tileY, float* heights)
+{
+	if (!file.file || tileX < 0 || tileY < 0 || tileX >= file.tilesX || tileY >= file.tilesY)
+		return false;
+
+	size_t tile = size_t(tileY) * file.tilesX + tileX;
+	vector<uint8_t> data(file.tileOffsets[tile + 1] - file.tileOffsets[tile]);
+	{
+		lock_guard<mutex> lock(file.fileMutex);
+		if (!seekFile(file.file, file.tileOffsets[tile]) || fread(data.data(), 1, data.size(), file.file) != data.size())
+			return false;
+	}
+
+	int tileWidth, tileHeight;
+	tileExtent(file.header, tileX, tileY, tileWidth, tileHeight);
+	return decodeTile(data.data(), data.size(), file.header, tileWidth, tileHeight, heights, size_t(tileWidth));
+}
+
+void closeHeightFile(HeightFile& file)
+{
+	if (file.file)
+		fclose(file.file);
+	file.file = nullptr;
+}
+
+bool loadHeightFile(const char* path, int& width, int& height, vector<float>& heights)
+{
+	HeightFile file;
+	if (!openHeightFile(path, file))
+		return false;
+
+	//All tiles in one read
+	uint64_t dataStart = file.tileOffsets.front();
+	vector<uint8_t> data(file.tileOffsets.back() - dataStart);
+	bool ok = seekFile(file.file, dataStart) && fread(data.data(), 1, data.size(), file.file) == data.size();
+	closeHeightFile(file);
+	if (!ok)
+		return false;
+
+	const HeightFileHeader& header = file.header;
+	width = int(header.width);
+	height = int(header.height);
+	heights.resize(size_t(width) * height);
+
+	atomic<bool> corrupt{ false };
+	parallelFor(0, file.tilesX * file.tilesY, 1, [&](int first, int last)
+	{
+		for (int tile = first; tile < last; tile++)
+		{
+			int tileX = tile % file.tilesX, tileY = tile / file.tilesX;
+			int tileWidth, tileHeight;
+			tileExtent(header, tileX, tileY, tileWidth, tileHeight);
+			float* origin = &heights[size_t(tileY) * header.tileSize * width + size_t(tileX) * header.tileSize];
+			const uint8_t* tileData = &data[file.tileOffsets[tile] - dataStart];
+			size_t tileBytes = file.tileOffsets[tile + 1] - file.tileOffsets[tile];
+			if (!decodeTile(tileData, tileBytes, header, tileWidth, tileHeight, origin, size_t(width)))
+				corrupt = true;
+		}
+	});
+	return !corrupt;
+}
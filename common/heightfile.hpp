@@ -0,0 +1,58 @@
+#ifndef HEIGHTFILE_HPP
+#define HEIGHTFILE_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+
+//Native heightmap container (.hmap)
+//Heights are stored directly (16-bit with a vertical scale and offset, or 32-bit float) in fixed-size
+//square tiles that are compressed independently, so any tile can be read on its own and a whole map
+//decompresses in parallel. Each tile is predicted from its left/upper neighbours (MED predictor),
+//the residuals are split into byte planes and the planes are LZ compressed.
+//
+//Layout (little endian): HeightFileHeader, uint64 tile offsets (tilesX * tilesY + 1, tile i is the
+//bytes [offsets[i], offsets[i + 1]) of the file, row-major tiles), tile data
+
+enum HeightSampleFormat
+{
+	HEIGHT_UINT16 = 1, //height = offset + sample * scale
+	HEIGHT_FLOAT32 = 2 //height = sample
+};
+
+struct HeightFileHeader
+{
+	char magic[4]; //"HMAP"
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t tileSize;
+	uint32_t format;
+	float scale;
+	float offset;
+};
+
+struct HeightFile
+{
+	HeightFileHeader header = {};
+	int tilesX = 0;
+	int tilesY = 0;
+	std::vector<uint64_t> tileOffsets;
+	FILE* file = nullptr;
+	std::mutex fileMutex; //Tiles may be read from several jobs
+};
+
+//Compresses the tiles in parallel on the job system. Returns false if the file cannot be written
+bool writeHeightFile(const char* path, const float* heights, int width, int height, HeightSampleFormat format, int tileSize = 256);
+
+//Random access: open once, then read any tile (heights in world units, tileWidth * tileHeight row-major)
+bool openHeightFile(const char* path, HeightFile& file);
+void heightTileSize(const HeightFile& file, int tileX, int tileY, int& tileWidth, int& tileHeight);
+bool readHeightTile(HeightFile& file, int tileX, int tileY, float* heights);
+void closeHeightFile(HeightFile& file);
+
+//Whole map: one read, then every tile decompressed in parallel
+bool loadHeightFile(const char* path, int& width, int& height, std::vector<float>& heights);
+
+#endif
@@ -0,0 +1,473 @@
+#include "jobs.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+using namespace std;
+
+//A deque as a ring that only grows, so a steady load of jobs never allocates
+struct WorkerQueue
+{
+	mutex queueMutex;
+	vector<JobHandle> jobs;
+	size_t head = 0; //Oldest job
+	size_t count = 0;
+
+	void pushBack(const JobHandle& job)
+	{
+		if (count == jobs.size())
+		{
+			vector<JobHandle> grown(max(jobs.size() * 2, size_t(64)));
+			for (size_t i = 0; i < count; i++)
+				grown[i] = move(jobs[(head + i) % jobs.size()]);
+			jobs.swap(grown);
+			head = 0;
+		}
+		jobs[(head + count) % jobs.size()] = job;
+		count++;
+	}
+
+	JobHandle popBack()
+	{
+		count--;
+		return move(jobs[(head + count) % jobs.size()]);
+	}
+
+	JobHandle popFront()
+	{
+		JobHandle job = move(jobs[head]);
+		head = (head + 1) % jobs.size();
+		count--;
+		return job;
+	}
+};
+
+struct WorkerCounters
+{
+	atomic<long long> busyNanoseconds{ 0 };
+	atomic<long long> idleNanoseconds{ 0 };
+	atomic<unsigned long long> jobsRun{ 0 };
+	atomic<unsigned long long> steals{ 0 };
+};
+
+static vector<unique_ptr<WorkerQueue>> queues;
+static vector<unique_ptr<WorkerCounters>> counters;
+static vector<thread> threads;
+static atomic<bool> running{ false };
+
+//Ready jobs in all deques, so sleeping workers know when to look again
+static atomic<int> queuedJobs{ 0 };
+static mutex sleepMutex;
+static condition_variable wake;
+
+static mutex mainThreadMutex;
+static deque<JobHandle> mainThreadJobs;
+
+static thread_local int workerIndex = -1;
+static thread_local int jobDepth = 0; //Jobs run from inside a job (while it waits) are not timed twice
+static thread_local long long idleInsideJob = 0;
+
+static long long nanosecondsSince(chrono::steady_clock::time_point start)
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
+static void execute(const JobHandle& job);
+
+static void enqueue(const JobHandle& job)
+{
+	//Without a pool everything runs inline, in submission order
+	if (!running)
+	{
+		execute(job);
+		return;
+	}
+
+	if (job->mainThread)
+	{
+		lock_guard<mutex> lock(mainThreadMutex);
+		mainThreadJobs.push_back(job);
+		return;
+	}
+
+	//Threads outside the pool hand their jobs to the main thread's deque, where workers steal them
+	WorkerQueue& queue = *queues[max(workerIndex, 0)];
+	{
+		lock_guard<mutex> lock(queue.queueMutex);
+		queue.pushBack(job);
+	}
+	queuedJobs++;
+
+	//Not under sleepMutex, so a worker may miss this; it looks again after its 1 ms timeout at the latest
+	wake.notify_one();
+}
+
+static void execute(const JobHandle& job)
+{
+	job->task();
+	job->task = nullptr; //Release whatever the task captured
+
+	vector<JobHandle> ready;
+	{
+		lock_guard<mutex> lock(job->continuationMutex);
+		job->finished = true;
+		ready.swap(job->continuations);
+	}
+	for (const JobHandle& continuation : ready)
+		if (--continuation->unfinishedDependencies == 0)
+			enqueue(continuation);
+}
+
+static void runTimed(const JobHandle& job, bool stolen)
+{
+	if (workerIndex < 0)
+	{
+		execute(job);
+		return;
+	}
+
+	WorkerCounters& stats = *counters[workerIndex];
+	stats.jobsRun++;
+	if (stolen)
+		stats.steals++;
+
+	auto start = chrono::steady_clock::now();
+	jobDepth++;
+	execute(job);
+	jobDepth--;
+	if (jobDepth == 0)
+	{
+		//Time spent waiting inside the job was already counted as idle
+		stats.busyNanoseconds += nanosecondsSince(start) - idleInsideJob;
+		idleInsideJob = 0;
+	}
+}
+
+//Own deque first (newest job, its data is most likely still in cache), then the oldest job of another worker
+static JobHandle takeJob(bool& stolen)
+{
+	stolen = false;
+	if (!running)
+		return nullptr;
+
+	int self = max(workerIndex, 0);
+	{
+		WorkerQueue& queue = *queues[self];
+		lock_guard<mutex> lock(queue.queueMutex);
+		if (queue.count > 0)
+		{
+			queuedJobs--;
+			return queue.popBack();
+		}
+	}
+
+	int count = int(queues.size());
+	for (int k = 1; k < count; k++)
+	{
+		WorkerQueue& queue = *queues[(self + k) % count];
+		unique_lock<mutex> lock(queue.queueMutex, try_to_lock);
+		if (!lock.owns_lock() || queue.count == 0)
+			continue;
+
+		queuedJobs--;
+		stolen = true;
+		return queue.popFront();
+	}
+	return nullptr;
+}
+
+static JobHandle takeMainThreadJob()
+{
+	lock_guard<mutex> lock(mainThreadMutex);
+	if (mainThreadJobs.empty())
+		return nullptr;
+	JobHandle job = mainThreadJobs.front();
+	mainThreadJobs.pop_front();
+	return job;
+}
+
+//Nothing to run right now
+static void idle()
+{
+	auto start = chrono::steady_clock::now();
+	this_thread::yield();
+	long long elapsed = nanosecondsSince(start);
+	if (workerIndex >= 0)
+		counters[workerIndex]->idleNanoseconds += elapsed;
+	if (jobDepth > 0)
+		idleInsideJob += elapsed;
+}
+
+static void workerLoop(int index)
+{
+	workerIndex = index;
+	WorkerCounters& stats = *counters[index];
+
+	while (running)
+	{
+		bool stolen;
+		JobHandle job = takeJob(stolen);
+		if (job)
+		{
+			runTimed(job, stolen);
+			continue;
+		}
+
+		auto start = chrono::steady_clock::now();
+		{
+			unique_lock<mutex> lock(sleepMutex);
+			wake.wait_for(lock, chrono::milliseconds(1), [] { return !running || queuedJobs > 0; });
+		}
+		stats.idleNanoseconds += nanosecondsSince(start);
+	}
+}
+
+void initJobSystem(int workerThreads)
+{
+	if (running)
+		return;
+
+	if (workerThreads < 0)
+		workerThreads = max(1, int(thread::hardware_concurrency()) - 1);
+
+	for (int i = 0; i <= workerThreads; i++)
+	{
+		queues.push_back(unique_ptr<WorkerQueue>(new WorkerQueue()));
+		counters.push_back(unique_ptr<WorkerCounters>(new WorkerCounters()));
+	}
+
+	workerIndex = 0;
+	running = true;
+	for (int i = 1; i <= workerThreads; i++)
+		threads.push_back(thread(workerLoop, i));
+}
+
+int getWorkerCount()
+{
+	return running ? int(queues.size()) : 1;
+}
+
+static JobHandle submit(function<void()> task, const vector<JobHandle>& dependencies, bool mainThread)
+{
+	JobHandle job = make_shared<Job>();
+	job->task = move(task);
+	job->mainThread = mainThread;
+
+	//One extra count so the job cannot be queued before every dependency has been registered
+	job->unfinishedDependencies = int(dependencies.size()) + 1;
+	for (const JobHandle& dependency : dependencies)
+	{
+		if (dependency)
+		{
+			lock_guard<mutex> lock(dependency->continuationMutex);
+			if (!dependency->finished)
+			{
+				dependency->continuations.push_back(job);
+				continue;
+			}
+		}
+		job->unfinishedDependencies--;
+	}
+
+	if (--job->unfinishedDependencies == 0)
+		enqueue(job);
+	return job;
+}
+
+JobHandle runJob(function<void()> task, const vector<JobHandle>& dependencies)
+{
+	return submit(move(task), dependencies, false);
+}
+
+JobHandle runOnMainThread(function<void()> task, const vector<JobHandle>& dependencies)
+{
+	return submit(move(task), dependencies, true);
+}
+
+bool isJobFinished(const JobHandle& job)
+{
+	return !job || job->finished;
+}
+
+void waitForJob(const JobHandle& job)
+{
+	while (!isJobFinished(job))
+	{
+		bool stolen = false;
+		JobHandle other = workerIndex == 0 ? takeMainThreadJob() : nullptr;
+		if (!other)
+			other = takeJob(stolen);
+
+		if (other)
+			runTimed(other, stolen);
+		else
+			idle();
+	}
+}
+
+void waitForJobs(const vector<JobHandle>& jobs)
+{
+	for (const JobHandle& job : jobs)
+		waitForJob(job);
+}
+
+struct ParallelFor
+{
+	void (*call)(const void*, int, int) = nullptr;
+	const void* body = nullptr;
+	int begin = 0;
+	int end = 0;
+	int grain = 1;
+	int chunks = 0;
+	atomic<int> next{ 0 };
+	atomic<int> done{ 0 };
+};
+
+enum HelperState
+{
+	HELPER_QUEUED,
+	HELPER_RUNNING,
+	HELPER_DONE //Ran, or was called off before it started
+};
+
+//A parallelFor helper job. They are kept per thread and used again once the queue has let go of them,
+//and their task only captures a pointer, so a parallelFor allocates nothing after the first few
+struct HelperJob
+{
+	JobHandle job;
+	ParallelFor* range = nullptr;
+	atomic<int> state{ HELPER_DONE };
+};
+
+static thread_local vector<unique_ptr<HelperJob>> helperJobs;
+static thread_local vector<HelperJob*> activeHelpers; //Of the parallelFor calls in progress on this thread, innermost last
+
+static void runChunks(ParallelFor& range)
+{
+	int chunk;
+	while ((chunk = range.next++) < range.chunks)
+	{
+		int first = range.begin + chunk * range.grain;
+		range.call(range.body, first, min(range.end, first + range.grain));
+		range.done++;
+	}
+}
+
+void parallelFor(int begin, int end, int grain, void (*call)(const void* body, int first, int last), const void* body)
+{
+	if (end <= begin)
+		return;
+	grain = max(grain, 1);
+
+	ParallelFor range;
+	range.call = call;
+	range.body = body;
+	range.begin = begin;
+	range.end = end;
+	range.grain = grain;
+	range.chunks = (end - begin + grain - 1) / grain;
+
+	//Helpers share the chunk counter with the caller
+	size_t firstHelper = activeHelpers.size();
+	int helpers = min(range.chunks - 1, getWorkerCount() - 1);
+	for (int i = 0; i < helpers; i++)
+	{
+		HelperJob* helper = nullptr;
+		for (const unique_ptr<HelperJob>& pooled : helperJobs)
+		{
+			if (pooled->state == HELPER_DONE && pooled->job.use_count() == 1)
+			{
+				atomic_thread_fence(memory_order_acquire); //After whoever ran it last let go
+				helper = pooled.get();
+				break;
+			}
+		}
+		if (!helper)
+		{
+			helperJobs.push_back(unique_ptr<HelperJob>(new HelperJob()));
+			helper = helperJobs.back().get();
+			helper->job = make_shared<Job>();
+		}
+
+		helper->range = &range;
+		helper->state = HELPER_QUEUED;
+		helper->job->finished = false;
+		helper->job->task = [helper]
+		{
+			int queued = HELPER_QUEUED;
+			if (helper->state.compare_exchange_strong(queued, HELPER_RUNNING))
+			{
+				runChunks(*helper->range);
+				helper->state = HELPER_DONE;
+			}
+		};
+		activeHelpers.push_back(helper);
+		enqueue(helper->job);
+	}
+
+	runChunks(range);
+	while (range.done < range.chunks)
+		idle();
+
+	//A helper that has not started is called off rather than waited for; one still running only has to
+	//notice that every chunk is taken
+	for (size_t i = firstHelper; i < activeHelpers.size(); i++)
+	{
+		HelperJob* helper = activeHelpers[i];
+		int queued = HELPER_QUEUED;
+		if (!helper->state.compare_exchange_strong(queued, HELPER_DONE))
+			while (helper->state != HELPER_DONE)
+				idle();
+	}
+	activeHelpers.resize(firstHelper);
+}
+
+void runMainThreadJobs()
+{
+	//Only the jobs ready now; continuations they queue run next frame
+	size_t ready;
+	{
+		lock_guard<mutex> lock(mainThreadMutex);
+		ready = mainThreadJobs.size();
+	}
+	for (size_t i = 0; i < ready; i++)
+	{
+		JobHandle job = takeMainThreadJob();
+		if (!job)
+			break;
+		runTimed(job, false);
+	}
+}
+
+vector<WorkerStats> getJobStats()
+{
+	vector<WorkerStats> stats(counters.size());
+	for (size_t i = 0; i < counters.size(); i++)
+	{
+		stats[i].busySeconds = counters[i]->busyNanoseconds * 1e-9;
+		stats[i].idleSeconds = counters[i]->idleNanoseconds * 1e-9;
+		stats[i].jobsRun = counters[i]->jobsRun;
+		stats[i].steals = counters[i]->steals;
+	}
+	return stats;
+}
+
+void destroyJobSystem()
+{
+	if (!running)
+		return;
+
+	running = false;
+	wake.notify_all();
+	for (thread& worker : threads)
+		worker.join();
+	threads.clear();
+
+	queues.clear();
+	counters.clear();
+	mainThreadJobs.clear();
+	queuedJobs = 0;
+	workerIndex = -1;
+}
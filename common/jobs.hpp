@@ -0,0 +1,76 @@
+#ifndef JOBS_HPP
+#define JOBS_HPP
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//Work-stealing job system
+//Every thread of the pool (the main thread is worker 0) owns a deque of ready jobs: it pushes and
+//pops its own work at the back, and idle threads steal the oldest jobs from the front of the others.
+//A job can depend on other jobs and is only queued once all of them have finished. Main thread jobs
+//(anything touching GL) go to a separate queue that the GL thread drains once per frame.
+
+struct Job
+{
+	std::function<void()> task;
+	bool mainThread = false;
+	std::atomic<int> unfinishedDependencies{ 0 };
+	std::atomic<bool> finished{ false };
+
+	//Jobs that depend on this one, queued when it finishes
+	std::mutex continuationMutex;
+	std::vector<std::shared_ptr<Job>> continuations;
+};
+
+typedef std::shared_ptr<Job> JobHandle;
+
+struct WorkerStats
+{
+	double busySeconds = 0.0; //Running jobs
+	double idleSeconds = 0.0; //Looking for or waiting on work
+	unsigned long long jobsRun = 0;
+	unsigned long long steals = 0; //Jobs taken from another worker's deque
+};
+
+//Starts workerThreads threads next to the main thread (-1 -> one per remaining hardware thread)
+void initJobSystem(int workerThreads = -1);
+
+//Threads in the pool, including the main thread (1 before initJobSystem: everything runs inline)
+int getWorkerCount();
+
+//Queue task once every dependency has finished (null handles count as finished)
+JobHandle runJob(std::function<void()> task, const std::vector<JobHandle>& dependencies = {});
+
+//Same, but the task only ever runs on the main thread (from runMainThreadJobs or waitForJob)
+JobHandle runOnMainThread(std::function<void()> task, const std::vector<JobHandle>& dependencies = {});
+
+bool isJobFinished(const JobHandle& job);
+
+//Runs other jobs until job has finished. Workers must not wait on main thread jobs
+void waitForJob(const JobHandle& job);
+void waitForJobs(const std::vector<JobHandle>& jobs);
+
+//Calls body(first, last) for chunks of at most grain indices covering [begin, end), spread over the
+//pool. The calling thread works on chunks too, so it can be used from inside jobs. The body is called
+//through a pointer rather than copied into a std::function, so a call allocates nothing
+void parallelFor(int begin, int end, int grain, void (*call)(const void* body, int first, int last), const void* body);
+
+template <typename Body>
+void parallelFor(int begin, int end, int grain, const Body& body)
+{
+	parallelFor(begin, end, grain, [](const void* pointer, int first, int last) { (*static_cast<const Body*>(pointer))(first, last); }, &body);
+}
+
+//Run the main thread jobs that are ready. Call once per frame from the GL thread
+void runMainThreadJobs();
+
+//Counters of every worker since initJobSystem (index 0 is the main thread)
+std::vector<WorkerStats> getJobStats();
+
+//Stops the workers. Jobs still queued are dropped, so wait for the ones that matter first
+void destroyJobSystem();
+
+#endif
@@ -0,0 +1,406 @@
+#include "maptiles.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+#endif
+using namespace std;
+
+//Coordinator -> worker; z < 0 tells the worker to exit
+struct TileRequest
+{
+	int32_t z;
+	int32_t x;
+	int32_t y;
+};
+
+//Worker -> coordinator, once a tile is done
+struct TileResult
+{
+	int32_t z;
+	int32_t x;
+	int32_t y;
+	int32_t written;
+	float renderMs;
+};
+
+vector<MapTile> mapTilesInBounds(float worldSize, float minX, float minZ, float maxX, float maxZ, int minZoom, int maxZoom)
+{
+	vector<MapTile> tiles;
+	float half = 0.5f * worldSize;
+	for (int zoom = max(minZoom, 0); zoom <= maxZoom; zoom++)
+	{
+		int count = 1 << zoom;
+		float tileSize = worldSize / count;
+		auto first = [&](float value) { return clamp(int(floor((value + half) / tileSize)), 0, count - 1); };
+		auto last = [&](float value) { return clamp(int(ceil((value + half) / tileSize)) - 1, 0, count - 1); };
+
+		int x0 = first(minX), x1 = last(maxX), y0 = first(minZ), y1 = last(maxZ);
+		for (int y = y0; y <= y1; y++)
+			for (int x = x0; x <= x1; x++)
+				tiles.push_back({ zoom, x, y });
+	}
+	return tiles;
+}
+
+glm::vec4 mapTileRect(const MapTile& tile, float worldSize)
+{
+	float tileSize = worldSize / float(1 << tile.z);
+	float minX = -0.5f * worldSize + tile.x * tileSize, minZ = -0.5f * worldSize + tile.y * tileSize;
+	return glm::vec4(minX, minZ, minX + tileSize, minZ + tileSize);
+}
+
+string mapTilePath(const string& directory, const MapTile& tile)
+{
+	filesystem::path folder = filesystem::path(directory) / to_string(tile.z) / to_string(tile.x);
+	error_code error; //Workers race to create the same folders; an existing one is fine
+	filesystem::create_directories(folder, error);
+	return (folder / (to_string(tile.y) + ".png")).string();
+}
+
+#ifndef _WIN32
+
+static bool sendAll(int socket, const void* data, size_t size)
+{
+	const char* bytes = (const char*)data;
+	while (size > 0)
+	{
+		ssize_t sent = send(socket, bytes, size, MSG_NOSIGNAL); //A dead peer is an error, not a SIGPIPE
+		if (sent < 0 && errno == EINTR)
+			continue;
+		if (sent <= 0)
+			return false;
+		bytes += sent;
+		size -= size_t(sent);
+	}
+	return true;
+}
+
+static bool receiveAll(int socket, void* data, size_t size)
+{
+	char* bytes = (char*)data;
+	while (size > 0)
+	{
+		ssize_t received = recv(socket, bytes, size, 0);
+		if (received < 0 && errno == EINTR)
+			continue;
+		if (received <= 0)
+			return false;
+		bytes += received;
+		size -= size_t(received);
+	}
+	return true;
+}
+
+static sockaddr_un socketAddress(const string& path)
+{
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", path.c_str());
+	return address;
+}
+
+struct TileWorker
+{
+	int connection = -1;
+	int assigned = -1; //Index of the tile being rendered
+	bool parked = false; //Idle while others still render (a tile they lose comes back to the queue)
+	int tiles = 0;
+};
+
+bool runMapTileBatch(const char* executable, const vector<string>& arguments, const vector<MapTile>& tiles, int workers, MapTileStats& stats)
+{
+	stats = MapTileStats();
+	workers = max(1, min(workers, int(tiles.size())));
+	if (tiles.empty())
+		return true;
+
+	//The workers are this program again (argv[0] may be relative to somewhere else)
+	error_code error;
+	string program = filesystem::read_symlink("/proc/self/exe", error).string();
+	if (error)
+		program = executable;
+
+	string socketPath = (filesystem::temp_directory_path() / ("maptiles_" + to_string(getpid()) + ".sock")).string();
+	sockaddr_un address = socketAddress(socketPath);
+	unlink(socketPath.c_str());
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0 || ::bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, workers) != 0)
+	{
+		cerr << "Could not listen on " << socketPath << endl;
+		if (listener >= 0)
+			close(listener);
+		return false;
+	}
+
+	//Spawn the workers (after listening, so they can connect straight away)
+	vector<pid_t> processes;
+	vector<string> workerArguments = arguments;
+	workerArguments.push_back("--tile-worker");
+	workerArguments.push_back(socketPath);
+	vector<char*> argv;
+	argv.push_back((char*)program.c_str());
+	for (string& argument : workerArguments)
+		argv.push_back((char*)argument.c_str());
+	argv.push_back(nullptr);
+	for (int i = 0; i < workers; i++)
+	{
+		pid_t pid;
+		if (posix_spawn(&pid, program.c_str(), nullptr, nullptr, argv.data(), environ) == 0)
+			processes.push_back(pid);
+	}
+	if (processes.empty())
+	{
+		cerr << "Could not start " << program << endl;
+		close(listener);
+		unlink(socketPath.c_str());
+		return false;
+	}
+	cout << "Rendering " << tiles.size() << " tiles with " << processes.size() << " workers" << endl;
+
+	deque<int> queue; //Tiles not handed out yet
+	for (int i = 0; i < int(tiles.size()); i++)
+		queue.push_back(i);
+	vector<TileWorker> pool;
+	vector<int> attempts(tiles.size(), 0);
+	int finished = 0, exited = 0;
+	double renderMsTotal = 0.0;
+	auto start = chrono::steady_clock::now();
+	auto lastProgress = start;
+
+	//Hands a worker its next tile, or parks it until one is given back (workers are only let go at the end)
+	auto assign = [&](TileWorker& worker)
+	{
+		worker.assigned = -1;
+		worker.parked = queue.empty();
+		if (worker.parked)
+			return;
+		worker.assigned = queue.front();
+		queue.pop_front();
+		const MapTile& tile = tiles[worker.assigned];
+		TileRequest request = { tile.z, tile.x, tile.y };
+		if (!sendAll(worker.connection, &request, sizeof(request)))
+		{
+			queue.push_front(worker.assigned);
+			worker.assigned = -1;
+		}
+	};
+
+	//A worker that died with a tile gives it back once (a tile that kills two workers is given up on)
+	auto lose = [&](TileWorker& worker)
+	{
+		close(worker.connection);
+		worker.connection = -1;
+		if (worker.assigned < 0)
+			return;
+		if (++attempts[worker.assigned] < 2)
+		{
+			queue.push_front(worker.assigned);
+			stats.retried++;
+		}
+		else
+		{
+			stats.failed++;
+			finished++;
+		}
+		worker.assigned = -1;
+	};
+
+	while (finished < int(tiles.size()))
+	{
+		//Every worker is gone (or never connected) with tiles left
+		int waitingFor = int(processes.size()) - exited;
+		if (waitingFor == 0)
+		{
+			int alive = 0;
+			for (TileWorker& worker : pool)
+				alive += worker.connection >= 0;
+			if (alive == 0)
+				break;
+		}
+
+		vector<pollfd> fds;
+		fds.push_back({ listener, POLLIN, 0 });
+		for (TileWorker& worker : pool)
+			if (worker.connection >= 0)
+				fds.push_back({ worker.connection, POLLIN, 0 });
+		int ready = poll(fds.data(), nfds_t(fds.size()), 1000);
+
+		//Reap workers that exited (a crash shows up as a closed connection as well)
+		int status;
+		while (waitpid(-1, &status, WNOHANG) > 0)
+			exited++;
+
+		if (ready > 0)
+		{
+			if (fds[0].revents & POLLIN)
+			{
+				int connection = accept(listener, nullptr, nullptr);
+				if (connection >= 0)
+				{
+					pool.push_back(TileWorker());
+					pool.back().connection = connection;
+					assign(pool.back());
+				}
+			}
+
+			for (size_t i = 1; i < fds.size(); i++)
+			{
+				if (!fds[i].revents)
+					continue;
+				TileWorker* worker = nullptr;
+				for (TileWorker& candidate : pool)
+					if (candidate.connection == fds[i].fd)
+						worker = &candidate;
+				if (!worker)
+					continue;
+
+				TileResult result;
+				if (!receiveAll(worker->connection, &result, sizeof(result)))
+				{
+					lose(*worker);
+					continue;
+				}
+				if (worker->assigned >= 0)
+				{
+					if (result.written)
+					{
+						stats.tiles++;
+						worker->tiles++;
+					}
+					else
+						stats.failed++;
+					renderMsTotal += result.renderMs;
+					finished++;
+				}
+				assign(*worker);
+			}
+		}
+
+		//Tiles given back by lost workers go to the parked ones
+		for (TileWorker& worker : pool)
+			if (worker.parked && worker.connection >= 0 && !queue.empty())
+				assign(worker);
+
+		//Progress once a second
+		auto now = chrono::steady_clock::now();
+		if (now - lastProgress >= chrono::seconds(1))
+		{
+			double seconds = chrono::duration<double>(now - start).count();
+			printf("%d/%zu tiles, %.1f tiles/s\n", finished, tiles.size(), finished / seconds);
+			fflush(stdout);
+			lastProgress = now;
+		}
+	}
+
+	//Whoever is still connected is idle now; let them go and wait for every process
+	for (TileWorker& worker : pool)
+	{
+		if (worker.connection < 0)
+			continue;
+		TileRequest request = { -1, 0, 0 };
+		sendAll(worker.connection, &request, sizeof(request));
+	}
+	for (size_t i = exited; i < processes.size(); i++)
+	{
+		int status;
+		if (wait(&status) < 0)
+			break;
+	}
+	for (TileWorker& worker : pool)
+	{
+		if (worker.connection >= 0)
+			close(worker.connection);
+		stats.tilesPerWorker.push_back(worker.tiles);
+	}
+	close(listener);
+	unlink(socketPath.c_str());
+
+	stats.failed += int(queue.size()); //Never handed out (every worker died)
+	stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	stats.tilesPerSecond = stats.tiles / max(stats.seconds, 1e-9);
+	stats.renderMs = finished > 0 ? renderMsTotal / finished : 0.0;
+	return stats.failed == 0;
+}
+
+int connectMapTileWorker(const char* socketPath)
+{
+	sockaddr_un address = socketAddress(socketPath);
+	int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (connection < 0)
+		return -1;
+	if (connect(connection, (sockaddr*)&address, sizeof(address)) != 0)
+	{
+		close(connection);
+		return -1;
+	}
+	return connection;
+}
+
+bool nextMapTile(int connection, MapTile& tile)
+{
+	TileRequest request;
+	if (!receiveAll(connection, &request, sizeof(request)) || request.z < 0)
+		return false;
+	tile = { request.z, request.x, request.y };
+	return true;
+}
+
+void finishMapTile(int connection, const MapTile& tile, bool written, double renderMs)
+{
+	TileResult result = { tile.z, tile.x, tile.y, written ? 1 : 0, float(renderMs) };
+	sendAll(connection, &result, sizeof(result));
+}
+
+void closeMapTileWorker(int connection)
+{
+	if (connection >= 0)
+		close(connection);
+}
+
+#else
+
+//Windows has no posix_spawn; the batch renderer is only built for Unix-like systems
+bool runMapTileBatch(const char*, const vector<string>&, const vector<MapTile>&, int, MapTileStats& stats)
+{
+	stats = MapTileStats();
+	cerr << "Batch tile rendering needs Unix sockets and posix_spawn" << endl;
+	return false;
+}
+
+int connectMapTileWorker(const char*)
+{
+	return -1;
+}
+
+bool nextMapTile(int, MapTile&)
+{
+	return false;
+}
+
+void finishMapTile(int, const MapTile&, bool, double)
+{
+}
+
+void closeMapTileWorker(int)
+{
+}
+
+#endif
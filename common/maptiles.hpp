@@ -0,0 +1,57 @@
+#ifndef MAPTILES_HPP
+#define MAPTILES_HPP
+
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+//Map tiles
+//Batch rendering of slippy-map tiles, written as z/x/y.png. Zoom 0 is a single tile covering the whole
+//terrain and every zoom level splits each tile into 2x2; x grows towards +x and y towards +z, so with
+//north at -z the layout matches the usual web map scheme. A coordinator process splits a bounding box
+//and zoom range into tiles and hands them out over a local Unix socket to worker processes (the
+//application started with --tile-worker), one tile at a time to whichever worker is idle, so a slow tile
+//never holds the others up. Workers load the terrain, textures and shaders once and keep them for every
+//tile they render.
+
+struct MapTile
+{
+	int z = 0;
+	int x = 0;
+	int y = 0;
+};
+
+struct MapTileStats
+{
+	int tiles = 0; //Written
+	int failed = 0;
+	int retried = 0; //Handed out again after their worker died
+	double seconds = 0.0;
+	double tilesPerSecond = 0.0;
+	double renderMs = 0.0; //Average time a worker spent on a tile (render, readback and PNG)
+	std::vector<int> tilesPerWorker;
+};
+
+//Tiles of zoom levels [minZoom, maxZoom] that overlap the world space box, coarsest zoom first
+std::vector<MapTile> mapTilesInBounds(float worldSize, float minX, float minZ, float maxX, float maxZ, int minZoom, int maxZoom);
+
+//World space rectangle of a tile: (minX, minZ, maxX, maxZ)
+glm::vec4 mapTileRect(const MapTile& tile, float worldSize);
+
+//directory/z/x/y.png, creating the directories
+std::string mapTilePath(const std::string& directory, const MapTile& tile);
+
+//Coordinator: starts workers processes of executable (arguments, then --tile-worker <socket>), hands
+//out every tile and waits for the workers to exit. Progress and the final throughput are printed
+bool runMapTileBatch(const char* executable, const std::vector<std::string>& arguments, const std::vector<MapTile>& tiles, int workers,
+					 MapTileStats& stats);
+
+//Worker side: connect to the coordinator's socket (-1 on failure), then take tiles until there are none
+//left, reporting each one back
+int connectMapTileWorker(const char* socketPath);
+bool nextMapTile(int connection, MapTile& tile);
+void finishMapTile(int connection, const MapTile& tile, bool written, double renderMs);
+void closeMapTileWorker(int connection);
+
+#endif
@@ -0,0 +1,190 @@
+#include "materiallod.hpp"
+#include "glcapture.hpp"
+#include "jobs.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+using namespace std;
+
+//Height blend thresholds of Texture.frag
+static const float grassThreshold = 0.0f;
+static const float rockThreshold = 1.0f;
+static const float snowThreshold = 2.5f;
+static const float maxShininess = 500.0f;
+
+//Last mip level of a texture, one texel holding the average of the whole image
+static glm::vec3 averageTexture(GLuint texture)
+{
+	GLint width = 0, height = 0;
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+	glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+
+	glm::vec3 average(0.0f);
+	if (width > 0 && height > 0)
+	{
+		int level = int(floor(log2(float(max(width, height)))));
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glGetTexImage(GL_TEXTURE_2D, level, GL_RGB, GL_FLOAT, &average[0]);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return average;
+}
+
+MaterialAverages readMaterialAverages(const GLuint diffuse[MATERIAL_INDEX_COUNT], const GLuint roughness[MATERIAL_INDEX_COUNT],
+									  const GLuint normals[MATERIAL_INDEX_COUNT], int count)
+{
+	MaterialAverages materials;
+	for (int i = 0; i < MATERIAL_INDEX_COUNT; i++)
+	{
+		materials.diffuse[i] = averageTexture(diffuse[i]);
+		float r = averageTexture(roughness[i]).r;
+		materials.shininess[i] = glm::clamp(2.0f / (r * r * r * r + 1e-2f) - 2.0f, 0.0f, maxShininess);
+		materials.normal[i] = averageTexture(normals[i]);
+	}
+	materials.count = count;
+	materials.valid = true;
+	return materials;
+}
+
+bool sameMaterialAverages(const MaterialAverages& a, const MaterialAverages& b)
+{
+	if (a.valid != b.valid || a.count != b.count)
+		return false;
+	for (int i = 0; i < MATERIAL_INDEX_COUNT; i++)
+		if (a.diffuse[i] != b.diffuse[i] || a.shininess[i] != b.shininess[i] || a.normal[i] != b.normal[i])
+			return false;
+	return true;
+}
+
+//Value at grid position (a, b) of the triangle of the cell it falls in. The base mesh's strips split
+//every cell along the diagonal from (i, j) to (i + 1, j + 1)
+template <typename T>
+static T interpolateGrid(const vector<T>& values, int resolution, float a, float b)
+{
+	a = glm::clamp(a, 0.0f, float(resolution - 1));
+	b = glm::clamp(b, 0.0f, float(resolution - 1));
+	int i = min(int(a), resolution - 2), j = min(int(b), resolution - 2);
+	a -= i;
+	b -= j;
+
+	const T& v00 = values[size_t(i) * resolution + j];
+	const T& v10 = values[size_t(i + 1) * resolution + j];
+	const T& v01 = values[size_t(i) * resolution + j + 1];
+	const T& v11 = values[size_t(i + 1) * resolution + j + 1];
+	if (a >= b)
+		return v00 + a * (v10 - v00) + b * (v11 - v10);
+	return v00 + b * (v01 - v00) + a * (v11 - v01);
+}
+
+static uint32_t packColour(glm::vec4 colour)
+{
+	glm::vec4 bytes = glm::round(glm::clamp(colour, 0.0f, 1.0f) * 255.0f);
+	return uint32_t(bytes.r) | uint32_t(bytes.g) << 8 | uint32_t(bytes.b) << 16 | uint32_t(bytes.a) << 24;
+}
+
+void bakeMacroMaterial(MacroMaterial& macro, int size, const vector<float>& heights, const vector<glm::vec3>& normals, int resolution,
+					   const MaterialAverages& materials)
+{
+	auto start = chrono::steady_clock::now();
+	macro.size = size;
+	macro.colour.resize(size_t(size) * size);
+	macro.normal.resize(size_t(size) * size);
+
+	parallelFor(0, size, 16, [&](int first, int last)
+	{
+		for (int t = first; t < last; t++)
+		{
+			for (int s = 0; s < size; s++)
+			{
+				//The base mesh's UV (i + 0.5) / (resolution - 1) of grid vertex i, inverted
+				float u = (s + 0.5f) / size, v = (t + 0.5f) / size;
+				float a = u * (resolution - 1) - 0.5f, b = v * (resolution - 1) - 0.5f;
+				float height = interpolateGrid(heights, resolution, a, b);
+				glm::vec3 vertexNormal = glm::normalize(interpolateGrid(normals, resolution, a, b));
+
+				//The same blend as Texture.frag, rock first
+				float rockToGrass = glm::clamp((height - grassThreshold) / (rockThreshold - grassThreshold), 0.0f, 1.0f);
+				float snowToRock = glm::clamp((height - rockThreshold) / (snowThreshold - rockThreshold), 0.0f, 1.0f);
+				glm::vec3 diffuse = materials.diffuse[MATERIAL_ROCK];
+				float shininess = materials.shininess[MATERIAL_ROCK];
+				glm::vec3 detailNormal = materials.normal[MATERIAL_ROCK];
+				if (materials.count >= 2)
+				{
+					diffuse = glm::mix(materials.diffuse[MATERIAL_GRASS], diffuse, rockToGrass);
+					shininess = glm::mix(materials.shininess[MATERIAL_GRASS], shininess, rockToGrass);
+					detailNormal = glm::mix(materials.normal[MATERIAL_GRASS], detailNormal, rockToGrass);
+				}
+				if (materials.count >= 3)
+				{
+					diffuse = glm::mix(diffuse, materials.diffuse[MATERIAL_SNOW], snowToRock);
+					shininess = glm::mix(shininess, materials.shininess[MATERIAL_SNOW], snowToRock);
+					detailNormal = glm::mix(detailNormal, materials.normal[MATERIAL_SNOW], snowToRock);
+				}
+
+				//The average detail normal through the vertex shaders' TBN (whose bitangent vanishes where the
+				//terrain is exactly flat, so the perpendicular is taken there)
+				glm::vec3 tangent = glm::normalize(glm::vec3(1, 0, 0) - vertexNormal.x * vertexNormal);
+				glm::vec3 bitangent = glm::vec3(0, 0, 1);
+				bitangent = (bitangent - glm::dot(bitangent, vertexNormal) * vertexNormal) - (bitangent - glm::dot(bitangent, tangent) * tangent);
+				float bitangentLength = glm::length(bitangent);
+				bitangent = bitangentLength > 1e-6f ? bitangent / bitangentLength : glm::cross(tangent, vertexNormal);
+				detailNormal = detailNormal * 2.0f - 1.0f;
+				glm::vec3 normal = glm::normalize(glm::mat3(tangent, bitangent, vertexNormal) * detailNormal);
+
+				size_t texel = size_t(t) * size + s;
+				macro.colour[texel] = packColour(glm::vec4(diffuse, shininess / maxShininess));
+				macro.normal[texel] = packColour(glm::vec4(normal * 0.5f + 0.5f, 1.0f));
+			}
+		}
+	});
+
+	macro.bakeMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+//The colour repeats mirrored beyond the terrain, the way the clipmap repeats its heights
+static void uploadMacroTexture(GLuint& texture, int size, bool allocate, GLint wrap, const vector<uint32_t>& texels)
+{
+	if (!texture)
+		glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if (allocate)
+	{
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels.data());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	}
+	else
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, size, size, GL_RGBA, GL_UNSIGNED_BYTE, texels.data());
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void uploadMacroMaterial(MaterialLod& lod, const MacroMaterial& macro)
+{
+	if (macro.size == 0)
+		return;
+
+	bool allocate = macro.size != lod.size || !lod.colourTexture;
+	uploadMacroTexture(lod.colourTexture, macro.size, allocate, GL_MIRRORED_REPEAT, macro.colour);
+	uploadMacroTexture(lod.normalTexture, macro.size, allocate, GL_CLAMP_TO_EDGE, macro.normal);
+	lod.size = macro.size;
+	lod.bakeMs = macro.bakeMs;
+}
+
+void setMaterialLodUniforms(const MaterialLod& lod, GLuint program)
+{
+	glUniform1f(glGetUniformLocation(program, "materialLodDistance"), lod.distance);
+	glUniform1f(glGetUniformLocation(program, "materialLodBand"), max(lod.band, 1e-3f));
+}
+
+void destroyMaterialLod(MaterialLod& lod)
+{
+	glDeleteTextures(1, &lod.colourTexture);
+	glDeleteTextures(1, &lod.normalTexture);
+	lod = MaterialLod();
+}
@@ -0,0 +1,80 @@
+#ifndef MATERIALLOD_HPP
+#define MATERIALLOD_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+//Material level of detail
+//Far away, the detail textures of the rock, grass and snow shrink to sub-pixel noise, but the full shading
+//still samples up to nine of them and blends them by height for every pixel. Beyond a configurable view
+//distance Texture.frag reads two macro textures instead. One holds albedo and shininess, the other the
+//normal, and both cover the whole terrain. They are baked in the background (as a derived product) with
+//the same height blend rules, from the per-vertex heights and normals and from each material's average.
+//Those averages are the last mip levels of the material textures, which is what the detail shading tends
+//to at a distance anyway. Before the switch distance a band of pixels is dithered between the two paths,
+//so no seam shows (TAA averages the noise away).
+
+static const int MACRO_MATERIAL_SIZE = 512; //Texels per side of the macro textures
+
+//Rock, grass and snow, in the order of Texture.frag's blend
+enum MaterialIndex
+{
+	MATERIAL_ROCK,
+	MATERIAL_GRASS,
+	MATERIAL_SNOW,
+	MATERIAL_INDEX_COUNT
+};
+
+struct MaterialAverages
+{
+	bool valid = false;
+	int count = 3; //MATERIAL_COUNT of the shading the macro textures stand in for
+	glm::vec3 diffuse[MATERIAL_INDEX_COUNT] = {};
+	float shininess[MATERIAL_INDEX_COUNT] = {}; //From the average roughness, as Texture.frag converts it
+	glm::vec3 normal[MATERIAL_INDEX_COUNT] = {}; //Tangent space, still encoded in [0, 1] (Texture.frag blends them encoded)
+};
+
+//RGBA8 texels, rows along v of the height map (the terrain's UVs)
+struct MacroMaterial
+{
+	int size = 0;
+	std::vector<uint32_t> colour; //Albedo, shininess / 500
+	std::vector<uint32_t> normal; //World space normal * 0.5 + 0.5
+	double bakeMs = 0.0;
+};
+
+struct MaterialLod
+{
+	//Settings
+	bool enabled = true;
+	float distance = 5.0f; //View distance from which only the macro textures are read
+	float band = 1.5f; //Width of the dithered transition before it
+
+	GLuint colourTexture = 0;
+	GLuint normalTexture = 0;
+	int size = 0;
+	double bakeMs = 0.0; //Of the textures in use
+};
+
+//Averages of the materials' textures (indexed by MaterialIndex), read back from their last mip levels
+MaterialAverages readMaterialAverages(const GLuint diffuse[MATERIAL_INDEX_COUNT], const GLuint roughness[MATERIAL_INDEX_COUNT],
+									  const GLuint normals[MATERIAL_INDEX_COUNT], int count);
+bool sameMaterialAverages(const MaterialAverages& a, const MaterialAverages& b);
+
+//Bakes the macro textures from the scaled heights and normals of a resolution^2 vertex grid (x outer, as
+//the base mesh), interpolated across the same two triangles per cell as the base mesh's strips
+void bakeMacroMaterial(MacroMaterial& macro, int size, const std::vector<float>& heights, const std::vector<glm::vec3>& normals,
+					   int resolution, const MaterialAverages& materials);
+
+//Replaces the textures' contents (and builds their mip chains)
+void uploadMacroMaterial(MaterialLod& lod, const MacroMaterial& macro);
+
+//materialLodDistance and materialLodBand of a program (the textures are read from units 12 and 13)
+void setMaterialLodUniforms(const MaterialLod& lod, GLuint program);
+
+void destroyMaterialLod(MaterialLod& lod);
+
+#endif
@@ -0,0 +1,149 @@
+#include "multiview.hpp"
+#include "glcapture.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include <glm/gtc/matrix_transform.hpp>
+using namespace std;
+
+//Layout of a glMultiDrawElementsIndirect command
+struct DrawElementsCommand
+{
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+bool initMultiView(MultiView& multi)
+{
+	GLint extensions = 0, viewports = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+	glGetIntegerv(GL_MAX_VIEWPORTS, &viewports);
+	multi.supported = false;
+	for (GLint i = 0; i < extensions; i++)
+		if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), "GL_ARB_shader_viewport_layer_array") == 0)
+			multi.supported = viewports >= MAX_VIEWS;
+	return multi.supported;
+}
+
+void buildMultiViews(MultiView& multi, const glm::mat4& view, const glm::mat4& projection, int width, int height)
+{
+	multi.count = 1;
+	if (multi.enabled)
+		multi.count = multi.layout == MULTI_VIEW_STEREO ? 2 : clamp(multi.views, 2, MAX_VIEWS);
+
+	//Columns of views, with a second row for split screens of more than two
+	int columns = multi.count, rows = 1;
+	if (multi.layout == MULTI_VIEW_SPLIT && multi.count > 2)
+		columns = rows = 2;
+
+	for (int i = 0; i < multi.count; i++)
+	{
+		int column = i % columns, row = i / columns;
+		int x = column * width / columns, y = (rows - 1 - row) * height / rows; //Row 0 at the top
+		multi.viewport[i] = glm::ivec4(x, y, (column + 1) * width / columns - x, (rows - row) * height / rows - y);
+
+		glm::mat4 eyeProjection = projection;
+		glm::mat4 eyeView = view;
+		if (multi.enabled)
+		{
+			//Same vertical field of view, with the aspect ratio of the viewport
+			eyeProjection[0][0] = projection[1][1] * multi.viewport[i].w / max(multi.viewport[i].z, 1);
+			float fieldOfView = 2.0f * atan(1.0f / eyeProjection[0][0]);
+
+			//Turning a view right by an angle rotates view space the same way about y
+			if (multi.layout == MULTI_VIEW_STEREO)
+				eyeView = glm::translate(glm::mat4(1.0f), glm::vec3((i == 0 ? 0.5f : -0.5f) * multi.eyeSeparation, 0.0f, 0.0f)) * view;
+			else if (multi.layout == MULTI_VIEW_PANORAMA)
+				eyeView = glm::rotate(glm::mat4(1.0f), (i - 0.5f * (multi.count - 1)) * fieldOfView, glm::vec3(0, 1, 0)) * view;
+			else
+				eyeView = glm::rotate(glm::mat4(1.0f), i * 2.0f * 3.14159265f / multi.count, glm::vec3(0, 1, 0)) * view;
+		}
+
+		multi.view[i] = eyeView;
+		multi.projection[i] = eyeProjection;
+		multi.viewProjection[i] = eyeProjection * eyeView;
+		multi.cameraPosition[i] = glm::vec3(glm::inverse(eyeView)[3]);
+	}
+
+	if (multi.enabled && multi.layout == MULTI_VIEW_STEREO)
+	{
+		//Both eyes look the same way, so one frustum holds them: the same field of view from a point far
+		//enough behind them that its sides pass outside both eyes' frusta (and its far plane as far beyond)
+		glm::mat4 combined = multi.projection[0];
+		float pushBack = 0.5f * multi.eyeSeparation * combined[0][0];
+		float nearPlane = combined[3][2] / (combined[2][2] - 1.0f), farPlane = combined[3][2] / (combined[2][2] + 1.0f) + pushBack;
+		combined[2][2] = -(farPlane + nearPlane) / (farPlane - nearPlane);
+		combined[3][2] = -2.0f * farPlane * nearPlane / (farPlane - nearPlane);
+		multi.cullFrusta[0] = extractFrustum(combined * glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -pushBack)) * view);
+		multi.cullFrustumCount = 1;
+	}
+	else
+	{
+		for (int i = 0; i < multi.count; i++)
+			multi.cullFrusta[i] = extractFrustum(multi.viewProjection[i]);
+		multi.cullFrustumCount = multi.count;
+	}
+}
+
+bool isMultiViewSinglePass(const MultiView& multi)
+{
+	return multi.supported && multi.singlePass && multi.count > 1;
+}
+
+void setMultiViewViewports(const MultiView& multi)
+{
+	for (int i = 0; i < multi.count; i++)
+	{
+		const glm::ivec4& viewport = multi.viewport[i];
+		glViewportIndexedf(i, float(viewport.x), float(viewport.y), float(viewport.z), float(viewport.w));
+	}
+}
+
+void setViewViewport(const MultiView& multi, int view)
+{
+	const glm::ivec4& viewport = multi.viewport[view];
+	glViewport(viewport.x, viewport.y, viewport.z, viewport.w);
+}
+
+void setMultiViewUniforms(const MultiView& multi, GLuint program, int firstView, int viewCount)
+{
+	glUniformMatrix4fv(glGetUniformLocation(program, "views"), multi.count, GL_FALSE, &multi.view[0][0][0]);
+	glUniformMatrix4fv(glGetUniformLocation(program, "projections"), multi.count, GL_FALSE, &multi.projection[0][0][0]);
+	glUniformMatrix4fv(glGetUniformLocation(program, "viewProjections"), multi.count, GL_FALSE, &multi.viewProjection[0][0][0]);
+	glUniform3fv(glGetUniformLocation(program, "cameraPositions"), multi.count, &multi.cameraPosition[0].x);
+	glUniform1i(glGetUniformLocation(program, "firstView"), firstView);
+	glUniform1i(glGetUniformLocation(program, "viewCount"), viewCount);
+}
+
+int cullMultiViewTiles(MultiView& multi, const TerrainDerived& derived, vector<unsigned char>& visible)
+{
+	return cullTerrainTiles(multi.cullFrusta, multi.cullFrustumCount, derived, visible, &multi.cullTests);
+}
+
+void drawMultiViewElements(MultiView& multi, GLenum mode, const FrameVector<GLsizei>& counts, const FrameVector<const void*>& offsets)
+{
+	if (counts.empty())
+		return;
+
+	//Written straight into this frame's region of the ring, which the previous frames' draws never read
+	multi.indirectBytes = counts.size() * sizeof(DrawElementsCommand);
+	UploadAllocation upload = uploadAllocate(multi.indirectBytes);
+	DrawElementsCommand* commands = static_cast<DrawElementsCommand*>(upload.data);
+	for (size_t i = 0; i < counts.size(); i++)
+		commands[i] = { GLuint(counts[i]), GLuint(multi.count), GLuint(uintptr_t(offsets[i]) / sizeof(GLuint)), 0, 0 };
+	finishUpload(upload);
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, upload.buffer);
+	glMultiDrawElementsIndirect(mode, GL_UNSIGNED_INT, (const void*)uintptr_t(upload.offset), GLsizei(counts.size()), 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void destroyMultiView(MultiView& multi)
+{
+	multi = MultiView();
+}
@@ -0,0 +1,86 @@
+#ifndef MULTIVIEW_HPP
+#define MULTIVIEW_HPP
+
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "culling.hpp"
+#include "framememory.hpp"
+
+//Multi-view rendering
+//Stereo pairs, panoramas across several displays and split screens are drawn as viewports of the one
+//render target. In a single pass every draw is submitted once and instanced per view: the shaders pick
+//the view's matrices by gl_InstanceID (gl_InvocationID in the billboards' geometry shader) and send the
+//primitive to its viewport through gl_ViewportIndex, so state changes, uniforms and draw calls cost the
+//CPU the same for any number of views. The base mesh tiles are culled once for all views: a stereo pair
+//shares one frustum enclosing both eyes, and otherwise a tile found in one view is not tested against the
+//next. Without GL_ARB_shader_viewport_layer_array (gl_ViewportIndex from a vertex shader), or with single
+//pass switched off, each view is drawn on its own, which is also what the benchmark compares against.
+
+static const int MAX_VIEWS = 4; //The size of the view arrays in the shaders
+
+enum MultiViewLayout
+{
+	MULTI_VIEW_STEREO, //Two eyes side by side
+	MULTI_VIEW_PANORAMA, //Displays side by side, each turned by its field of view
+	MULTI_VIEW_SPLIT, //Two halves or a 2x2 grid, looking in evenly spaced directions around the camera
+	MULTI_VIEW_LAYOUT_COUNT
+};
+
+static const char* const multiViewLayoutNames[MULTI_VIEW_LAYOUT_COUNT] = { "Stereo", "Panorama", "Split Screen" };
+
+struct MultiView
+{
+	//Settings
+	bool enabled = false;
+	int layout = MULTI_VIEW_STEREO;
+	int views = 3; //Panorama and split screen (stereo always has 2)
+	float eyeSeparation = 0.065f; //World units between the stereo eyes
+	bool singlePass = true;
+
+	bool supported = false; //gl_ViewportIndex can be written from a vertex shader
+
+	//This frame's views (a single one covering the target while disabled)
+	int count = 1;
+	glm::mat4 view[MAX_VIEWS];
+	glm::mat4 projection[MAX_VIEWS];
+	glm::mat4 viewProjection[MAX_VIEWS];
+	glm::vec3 cameraPosition[MAX_VIEWS];
+	glm::ivec4 viewport[MAX_VIEWS]; //x, y, width, height in the render target
+
+	//Frusta the tiles are culled against (fewer than the views when they share one)
+	Frustum cullFrusta[MAX_VIEWS];
+	int cullFrustumCount = 1;
+	int cullTests = 0; //Box tests of the last cull
+
+	size_t indirectBytes = 0; //Draw commands of the instanced tiles last submitted (in the upload ring)
+};
+
+bool initMultiView(MultiView& multi);
+
+//Derives this frame's views from the camera; width and height are the render target's
+void buildMultiViews(MultiView& multi, const glm::mat4& view, const glm::mat4& projection, int width, int height);
+
+//Whether this frame's views are drawn by single instanced submissions
+bool isMultiViewSinglePass(const MultiView& multi);
+
+//One viewport per view (single pass), or the target's viewport set to one view (drawing per view)
+void setMultiViewViewports(const MultiView& multi);
+void setViewViewport(const MultiView& multi, int view);
+
+//views[], projections[], viewProjections[] and cameraPositions[] of a program, with firstView and
+//viewCount: instance (or invocation) i draws view firstView + i into viewport i
+void setMultiViewUniforms(const MultiView& multi, GLuint program, int firstView, int viewCount);
+
+//Tiles of derived visible in any view (see cullTerrainTiles)
+int cullMultiViewTiles(MultiView& multi, const TerrainDerived& derived, std::vector<unsigned char>& visible);
+
+//glMultiDrawElements of GL_UNSIGNED_INT indices with every draw instanced once per view, through
+//indirect commands written into the upload ring
+void drawMultiViewElements(MultiView& multi, GLenum mode, const FrameVector<GLsizei>& counts, const FrameVector<const void*>& offsets);
+
+void destroyMultiView(MultiView& multi);
+
+#endif
@@ -0,0 +1,285 @@
+#include "occlusion.hpp"
+#include "framememory.hpp"
+#include "jobs.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+using namespace std;
+
+static const int LANES = 8; //Pixels of a row handled together (a vector register of floats)
+static const float heightMargin = 0.01f; //The GPU filters the height map at slightly different positions
+
+//A triangle set up for rasterising: edge functions a * x + b * y + c (positive inside) and the depth plane,
+//in pixels
+struct OccluderTriangle
+{
+	float a[3], b[3], c[3];
+	float depth, depthX, depthY;
+	float depthInset; //How far the depth rises from a pixel's centre to its farthest corner
+	int x0, y0, x1, y1; //Pixel bounds
+};
+
+void buildTerrainOccluder(TerrainOccluder& occluder, const vector<float>& heights, int resolution, float worldSize)
+{
+	int n = resolution;
+	int m = (n - 1 + OCCLUDER_STEP - 1) / OCCLUDER_STEP + 1;
+	float spacing = worldSize / (n - 1);
+	float half = 0.5f * worldSize;
+	auto gridIndex = [&](int coarse) { return glm::clamp(coarse * OCCLUDER_STEP, 0, n - 1); };
+
+	occluder.resolution = m;
+	occluder.vertices.resize(size_t(m) * m);
+	parallelFor(0, m, 8, [&](int first, int last)
+	{
+		for (int ci = first; ci < last; ci++)
+		{
+			for (int cj = 0; cj < m; cj++)
+			{
+				//Every coarse triangle touching this vertex then stays below the fine cells it covers
+				float lowest = INFINITY;
+				for (int i = gridIndex(ci - 1); i <= gridIndex(ci + 1); i++)
+					for (int j = gridIndex(cj - 1); j <= gridIndex(cj + 1); j++)
+						lowest = min(lowest, heights[size_t(i) * n + j]);
+
+				occluder.vertices[size_t(ci) * m + cj] = glm::vec3(gridIndex(ci) * spacing - half, lowest - heightMargin, gridIndex(cj) * spacing - half);
+			}
+		}
+	});
+}
+
+void resetOcclusion(OcclusionBuffer& occlusion)
+{
+	occlusion.ready = false;
+	occlusion.triangles = 0;
+	occlusion.tested = 0;
+	occlusion.culledTiles = 0;
+	occlusion.culledInstances = 0;
+	occlusion.rasteriseMs = 0.0;
+	occlusion.testMs = 0.0;
+}
+
+//Window position in pixels and depth, with w = 0 behind the near plane
+static glm::vec4 projectPoint(const OcclusionBuffer& occlusion, const glm::mat4& viewProjection, glm::vec3 point)
+{
+	glm::vec4 clip = viewProjection * glm::vec4(point, 1.0f);
+	if (clip.w <= 0.0f || clip.z < -clip.w)
+		return glm::vec4(0.0f);
+	glm::vec3 ndc = glm::vec3(clip) / clip.w;
+	return glm::vec4((ndc.x * 0.5f + 0.5f) * occlusion.width, (ndc.y * 0.5f + 0.5f) * occlusion.height, ndc.z * 0.5f + 0.5f, 1.0f);
+}
+
+static bool setupTriangle(const OcclusionBuffer& occlusion, glm::vec4 v0, glm::vec4 v1, glm::vec4 v2, OccluderTriangle& triangle)
+{
+	if (v0.w == 0.0f || v1.w == 0.0f || v2.w == 0.0f)
+		return false;
+
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+	if (fabs(area) < 1e-6f)
+		return false;
+
+	//Pixels whose squares overlap the triangle's bounds
+	triangle.x0 = max(0, int(floor(min({ v0.x, v1.x, v2.x }))));
+	triangle.y0 = max(0, int(floor(min({ v0.y, v1.y, v2.y }))));
+	triangle.x1 = min(occlusion.width - 1, int(floor(max({ v0.x, v1.x, v2.x }))));
+	triangle.y1 = min(occlusion.height - 1, int(floor(max({ v0.y, v1.y, v2.y }))));
+	if (triangle.x0 > triangle.x1 || triangle.y0 > triangle.y1)
+		return false;
+
+	//Both windings are rasterised (the camera is above the terrain, so hidden slopes are still in front of what they hide)
+	const glm::vec4* vertices[3] = { &v0, &v1, &v2 };
+	float sign = area > 0.0f ? 1.0f : -1.0f;
+	for (int e = 0; e < 3; e++)
+	{
+		const glm::vec4& from = *vertices[e];
+		const glm::vec4& to = *vertices[(e + 1) % 3];
+		triangle.a[e] = sign * (from.y - to.y);
+		triangle.b[e] = sign * (to.x - from.x);
+		triangle.c[e] = sign * (from.x * to.y - from.y * to.x);
+	}
+
+	triangle.depthX = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+	triangle.depthY = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / area;
+	triangle.depth = v0.z - triangle.depthX * v0.x - triangle.depthY * v0.y;
+	triangle.depthInset = 0.5f * (fabs(triangle.depthX) + fabs(triangle.depthY));
+	return true;
+}
+
+//Writes the triangle into the pixels of one screen tile whose centres it covers
+static void rasteriseTriangle(OcclusionBuffer& occlusion, const OccluderTriangle& triangle, int binX0, int binY0, int binX1, int binY1)
+{
+	int y0 = max(triangle.y0, binY0), y1 = min(triangle.y1, binY1);
+	for (int y = y0; y <= y1; y++)
+	{
+		float py = y + 0.5f;
+		float rowEdge[3], rowDepth = triangle.depth + triangle.depthY * py + triangle.depthInset;
+		for (int e = 0; e < 3; e++)
+			rowEdge[e] = triangle.b[e] * py + triangle.c[e];
+
+		//The row's span between the edges (a pixel wider, the lanes test every centre exactly)
+		float spanStart = float(max(triangle.x0, binX0)), spanEnd = float(min(triangle.x1, binX1));
+		for (int e = 0; e < 3; e++)
+		{
+			if (triangle.a[e] > 0.0f)
+				spanStart = max(spanStart, -rowEdge[e] / triangle.a[e] - 1.0f);
+			else if (triangle.a[e] < 0.0f)
+				spanEnd = min(spanEnd, -rowEdge[e] / triangle.a[e]);
+			else if (rowEdge[e] < 0.0f)
+				spanEnd = -1.0f;
+		}
+		if (spanStart > spanEnd)
+			continue;
+		int x0 = int(spanStart), x1 = int(spanEnd);
+		x0 -= (x0 - binX0) % LANES;
+
+		//Locals, so the compiler knows the row's writes leave them alone
+		float a0 = triangle.a[0], a1 = triangle.a[1], a2 = triangle.a[2];
+		float e0 = rowEdge[0], e1 = rowEdge[1], e2 = rowEdge[2];
+		float depthX = triangle.depthX;
+		float* row = &occlusion.depth[size_t(y) * occlusion.width];
+		for (int x = x0; x <= x1; x += LANES)
+		{
+			for (int lane = 0; lane < LANES; lane++)
+			{
+				float px = x + lane + 0.5f;
+				bool inside = (a0 * px + e0 >= 0.0f) & (a1 * px + e1 >= 0.0f) & (a2 * px + e2 >= 0.0f);
+				float depth = depthX * px + rowDepth;
+				row[x + lane] = inside ? min(row[x + lane], depth) : row[x + lane];
+			}
+		}
+	}
+}
+
+void rasteriseOccluder(OcclusionBuffer& occlusion, const TerrainOccluder& occluder, const glm::mat4& viewProjection, float aspect)
+{
+	auto start = chrono::steady_clock::now();
+
+	//Whole screen tiles across, so rows of lanes never run past the buffer
+	occlusion.width = max(OCCLUSION_BIN_SIZE, (occlusion.width + OCCLUSION_BIN_SIZE - 1) / OCCLUSION_BIN_SIZE * OCCLUSION_BIN_SIZE);
+	occlusion.height = max(1, int(round(occlusion.width / max(aspect, 1e-3f))));
+	occlusion.depth.resize(size_t(occlusion.width) * occlusion.height);
+	occlusion.viewProjection = viewProjection;
+
+	int binsX = occlusion.width / OCCLUSION_BIN_SIZE;
+	int binsY = (occlusion.height + OCCLUSION_BIN_SIZE - 1) / OCCLUSION_BIN_SIZE;
+	occlusion.bins.resize(size_t(binsX) * binsY);
+	for (vector<int>& bin : occlusion.bins)
+		bin.clear();
+
+	int m = occluder.resolution;
+	occlusion.projected.resize(occluder.vertices.size());
+	for (size_t v = 0; v < occluder.vertices.size(); v++)
+		occlusion.projected[v] = projectPoint(occlusion, viewProjection, occluder.vertices[v]);
+
+	//Two triangles per coarse cell, each listed in every screen tile its bounds touch
+	FrameVector<OccluderTriangle> triangles;
+	triangles.reserve(size_t(max(m - 1, 0)) * max(m - 1, 0) * 2);
+	for (int ci = 0; ci + 1 < m; ci++)
+	{
+		for (int cj = 0; cj + 1 < m; cj++)
+		{
+			const glm::vec4* p = &occlusion.projected[size_t(ci) * m + cj];
+			glm::vec4 corners[2][3] = { { p[0], p[m], p[m + 1] }, { p[0], p[m + 1], p[1] } };
+			for (const glm::vec4* corner : corners)
+			{
+				OccluderTriangle triangle;
+				if (!setupTriangle(occlusion, corner[0], corner[1], corner[2], triangle))
+					continue;
+
+				int index = int(triangles.size());
+				triangles.push_back(triangle);
+				for (int by = triangle.y0 / OCCLUSION_BIN_SIZE; by <= triangle.y1 / OCCLUSION_BIN_SIZE; by++)
+					for (int bx = triangle.x0 / OCCLUSION_BIN_SIZE; bx <= triangle.x1 / OCCLUSION_BIN_SIZE; bx++)
+						occlusion.bins[size_t(by) * binsX + bx].push_back(index);
+			}
+		}
+	}
+	occlusion.triangles = int(triangles.size());
+
+	//Screen tiles never share pixels, so each is cleared and filled by one worker
+	parallelFor(0, int(occlusion.bins.size()), 1, [&](int first, int last)
+	{
+		for (int bin = first; bin < last; bin++)
+		{
+			int binX0 = bin % binsX * OCCLUSION_BIN_SIZE, binY0 = bin / binsX * OCCLUSION_BIN_SIZE;
+			int binX1 = binX0 + OCCLUSION_BIN_SIZE - 1, binY1 = min(binY0 + OCCLUSION_BIN_SIZE, occlusion.height) - 1;
+			for (int y = binY0; y <= binY1; y++)
+				fill_n(&occlusion.depth[size_t(y) * occlusion.width + binX0], OCCLUSION_BIN_SIZE, 1.0f);
+
+			for (int index : occlusion.bins[bin])
+				rasteriseTriangle(occlusion, triangles[index], binX0, binY0, binX1, binY1);
+		}
+	});
+
+	occlusion.ready = true;
+	occlusion.rasteriseMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+bool boxOccluded(const OcclusionBuffer& occlusion, glm::vec3 boxMin, glm::vec3 boxMax)
+{
+	if (!occlusion.ready)
+		return false;
+
+	//Screen bounds and nearest depth of the corners
+	glm::vec2 low(INFINITY), high(-INFINITY);
+	float nearest = INFINITY;
+	for (int corner = 0; corner < 8; corner++)
+	{
+		glm::vec3 point(corner & 1 ? boxMax.x : boxMin.x, corner & 2 ? boxMax.y : boxMin.y, corner & 4 ? boxMax.z : boxMin.z);
+		glm::vec4 window = projectPoint(occlusion, occlusion.viewProjection, point);
+		if (window.w == 0.0f)
+			return false;
+		low = glm::min(low, glm::vec2(window));
+		high = glm::max(high, glm::vec2(window));
+		nearest = min(nearest, window.z);
+	}
+
+	int x0 = int(floor(low.x)), x1 = int(floor(high.x));
+	int y0 = int(floor(low.y)), y1 = int(floor(high.y));
+	if (x1 < 0 || y1 < 0 || x0 >= occlusion.width || y0 >= occlusion.height)
+		return false;
+
+	//Hidden while every pixel of the rectangle grown by one has an occluder in front of the box
+	x0 = max(0, x0 - 1);
+	y0 = max(0, y0 - 1);
+	x1 = min(occlusion.width - 1, x1 + 1);
+	y1 = min(occlusion.height - 1, y1 + 1);
+	for (int y = y0; y <= y1; y++)
+	{
+		const float* row = &occlusion.depth[size_t(y) * occlusion.width];
+		float farthest[LANES] = {};
+		for (int x = x0 - x0 % LANES; x <= x1; x += LANES)
+		{
+			for (int lane = 0; lane < LANES; lane++)
+			{
+				int px = x + lane;
+				bool covered = (px >= x0) & (px <= x1);
+				farthest[lane] = covered && row[px] > farthest[lane] ? row[px] : farthest[lane];
+			}
+		}
+		for (int lane = 0; lane < LANES; lane++)
+			if (farthest[lane] >= nearest)
+				return false;
+	}
+	return true;
+}
+
+int cullOccludedPoints(OcclusionBuffer& occlusion, const vector<glm::vec3>& points, float radius, vector<unsigned char>& visible)
+{
+	auto start = chrono::steady_clock::now();
+	int culled = 0;
+	for (size_t i = 0; i < points.size(); i++)
+	{
+		if (!visible[i])
+			continue;
+		occlusion.tested++;
+		if (boxOccluded(occlusion, points[i] - glm::vec3(radius), points[i] + glm::vec3(radius)))
+		{
+			visible[i] = 0;
+			culled++;
+		}
+	}
+	occlusion.culledInstances += culled;
+	occlusion.testMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	return culled;
+}
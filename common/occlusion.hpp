@@ -0,0 +1,71 @@
+#ifndef OCCLUSION_HPP
+#define OCCLUSION_HPP
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+//Software occlusion culling
+//Behind the nearest ridges most of the terrain and the billboards are hidden, yet frustum culling still
+//submits them. Once a frame a coarse copy of the terrain is rasterised on the CPU into a small depth buffer,
+//and the boxes of the tiles and instances left by frustum culling are tested against it before anything is
+//drawn. No GPU readback is involved, so it works the same on the headless software path.
+//The occluder mesh is conservative: every coarse vertex takes the minimum height of the fine cells around it,
+//so the mesh lies on or below the real terrain. A pixel keeps the farthest depth the nearest triangle covering
+//its centre reaches inside it, and a box is occluded when its nearest corner is behind every pixel of its
+//screen rectangle grown by one pixel, which keeps whatever peeks past a silhouette inside a pixel. The
+//triangles are binned by screen tile, and the tiles are rasterised in parallel on the job system, LANES
+//pixels at a time.
+
+static const int OCCLUDER_STEP = 4; //Grid vertices between the occluder's vertices
+static const int OCCLUSION_BIN_SIZE = 32; //Pixels per side of the screen tiles rasterised in parallel
+
+//A coarse grid under the terrain (x outer, as the base mesh)
+struct TerrainOccluder
+{
+	int resolution = 0; //Vertices per side
+	std::vector<glm::vec3> vertices;
+};
+
+struct OcclusionBuffer
+{
+	//Settings
+	bool enabled = true;
+	int width = 256; //The height follows the render target's aspect ratio
+
+	int height = 0;
+	std::vector<float> depth; //Window depth of the nearest occluder per pixel (rows from the bottom, 1 where there is none)
+	glm::mat4 viewProjection = glm::mat4(1.0f);
+	bool ready = false; //Rasterised this frame
+
+	//Statistics of the last frame
+	int triangles = 0; //Occluder triangles rasterised (in front of the near plane and on screen)
+	int tested = 0; //Boxes tested
+	int culledTiles = 0;
+	int culledInstances = 0;
+	double rasteriseMs = 0.0;
+	double testMs = 0.0;
+
+	//Scratch of the rasteriser
+	std::vector<glm::vec4> projected; //Window x, y, depth and whether it is in front of the near plane
+	std::vector<std::vector<int>> bins; //Triangles touching each screen tile
+};
+
+//Coarse occluder grid from the scaled heights of a resolution^2 vertex grid spanning worldSize
+void buildTerrainOccluder(TerrainOccluder& occluder, const std::vector<float>& heights, int resolution, float worldSize);
+
+//Clears the statistics (and the buffer's use) for a new frame
+void resetOcclusion(OcclusionBuffer& occlusion);
+
+//Rasterises the occluder as seen through viewProjection; aspect is the render target's width / height. Call
+//within a frame (the triangle list comes from the frame arena)
+void rasteriseOccluder(OcclusionBuffer& occlusion, const TerrainOccluder& occluder, const glm::mat4& viewProjection, float aspect);
+
+//Whether the box is certainly hidden (false for anything crossing the near plane or off screen)
+bool boxOccluded(const OcclusionBuffer& occlusion, glm::vec3 boxMin, glm::vec3 boxMax);
+
+//Clears visible[i] of the points whose boxes (radius around them) are hidden, and counts them as culled
+//instances. Returns how many were culled
+int cullOccludedPoints(OcclusionBuffer& occlusion, const std::vector<glm::vec3>& points, float radius, std::vector<unsigned char>& visible);
+
+#endif
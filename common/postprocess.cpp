@@ -0,0 +1,282 @@
+#include "postprocess.hpp"
+#include "glcapture.hpp"
+
+#include <algorithm>
+using namespace std;
+using namespace glm;
+
+#include "controls.hpp"
+
+//Radical inverse in the given base (Halton sequence), in [0, 1)
+static float halton(int index, int base)
+{
+	float result = 0.0f;
+	float fraction = 1.0f / base;
+	while (index > 0)
+	{
+		result += (index % base) * fraction;
+		index /= base;
+		fraction /= base;
+	}
+	return result;
+}
+
+static void deleteMultisampleTarget(PostProcess& post)
+{
+	glDeleteFramebuffers(1, &post.msaaFramebuffer);
+	glDeleteRenderbuffers(1, &post.msaaColour);
+	glDeleteRenderbuffers(1, &post.msaaDepth);
+	post.msaaFramebuffer = post.msaaColour = post.msaaDepth = 0;
+	post.msaaWidth = post.msaaHeight = post.msaaAllocatedSamples = 0;
+}
+
+static void createMultisampleTarget(PostProcess& post, int width, int height)
+{
+	GLint maxSamples = 1;
+	glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+	int samples = std::min(post.msaaSamples, int(maxSamples));
+
+	glGenFramebuffers(1, &post.msaaFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, post.msaaFramebuffer);
+
+	//Same formats as the frame pacing target so it can be resolved with a blit
+	glGenRenderbuffers(1, &post.msaaColour);
+	glBindRenderbuffer(GL_RENDERBUFFER, post.msaaColour);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA16F, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, post.msaaColour);
+
+	glGenRenderbuffers(1, &post.msaaDepth);
+	glBindRenderbuffer(GL_RENDERBUFFER, post.msaaDepth);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH_COMPONENT24, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, post.msaaDepth);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	post.msaaWidth = width;
+	post.msaaHeight = height;
+	post.msaaAllocatedSamples = post.msaaSamples;
+}
+
+static void deleteHistory(PostProcess& post)
+{
+	glDeleteFramebuffers(2, post.historyFramebuffers);
+	glDeleteTextures(2, post.historyTextures);
+	post.historyFramebuffers[0] = post.historyFramebuffers[1] = 0;
+	post.historyTextures[0] = post.historyTextures[1] = 0;
+	post.historyWidth = post.historyHeight = 0;
+	post.historyValid = false;
+}
+
+static void createHistory(PostProcess& post, int width, int height)
+{
+	glGenFramebuffers(2, post.historyFramebuffers);
+	glGenTextures(2, post.historyTextures);
+	for (int i = 0; i < 2; i++)
+	{
+		glBindTexture(GL_TEXTURE_2D, post.historyTextures[i]);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, post.historyFramebuffers[i]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, post.historyTextures[i], 0);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	post.historyWidth = width;
+	post.historyHeight = height;
+	post.historyValid = false;
+}
+
+static void deleteOutput(PostProcess& post)
+{
+	glDeleteFramebuffers(1, &post.outputFramebuffer);
+	glDeleteTextures(1, &post.outputColour);
+	post.outputFramebuffer = post.outputColour = 0;
+	post.outputWidth = post.outputHeight = 0;
+}
+
+//8 bits a channel, like the window it stands in for (screen capture reads it back as RGBA8)
+static void createOutput(PostProcess& post, int width, int height)
+{
+	glGenFramebuffers(1, &post.outputFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, post.outputFramebuffer);
+
+	glGenTextures(1, &post.outputColour);
+	glBindTexture(GL_TEXTURE_2D, post.outputColour);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, post.outputColour, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	post.outputWidth = width;
+	post.outputHeight = height;
+}
+
+//Fullscreen triangle over the current viewport (wireframe and culling must not affect it)
+static void drawFullscreenTriangle(PostProcess& post)
+{
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+
+	glBindVertexArray(post.emptyVertexArray);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(0);
+
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+}
+
+void initPostProcess(PostProcess& post)
+{
+	glGenVertexArrays(1, &post.emptyVertexArray);
+}
+
+void beginPostProcess(PostProcess& post, FramePacing& pacing, bool temporal)
+{
+	post.activeMode = post.mode == AA_TAA && !temporal ? AA_FXAA : post.mode;
+	if (post.activeMode == AA_MSAA)
+	{
+		if (post.msaaWidth != pacing.framebufferWidth || post.msaaHeight != pacing.framebufferHeight || post.msaaAllocatedSamples != post.msaaSamples)
+		{
+			deleteMultisampleTarget(post);
+			createMultisampleTarget(post, pacing.framebufferWidth, pacing.framebufferHeight);
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, post.msaaFramebuffer);
+	}
+	else if (post.msaaFramebuffer != 0)
+		deleteMultisampleTarget(post);
+
+	//A different sample pattern or resolution makes the history meaningless
+	if (post.activeMode != post.lastMode || pacing.renderWidth != post.lastRenderWidth || pacing.renderHeight != post.lastRenderHeight)
+		post.historyValid = false;
+	post.lastMode = post.activeMode;
+	post.lastRenderWidth = pacing.renderWidth;
+	post.lastRenderHeight = pacing.renderHeight;
+
+	//Halton(2, 3) offsets in [-0.5, 0.5] pixels, converted to NDC
+	vec2 jitter = vec2(0.0f);
+	if (post.activeMode == AA_TAA)
+	{
+		post.jitterIndex = (post.jitterIndex % TAA_JITTER_SAMPLES) + 1;
+		jitter.x = (halton(post.jitterIndex, 2) - 0.5f) * 2.0f / pacing.renderWidth;
+		jitter.y = (halton(post.jitterIndex, 3) - 0.5f) * 2.0f / pacing.renderHeight;
+	}
+	setProjectionJitter(jitter);
+}
+
+bool isMultisampled(const PostProcess& post)
+{
+	return post.msaaFramebuffer != 0;
+}
+
+void applyPostProcess(PostProcess& post, FramePacing& pacing, GLuint fxaaProgram, GLuint taaProgram,
+					  const mat4& viewProjection, int windowWidth, int windowHeight)
+{
+	//Fraction of the scene texture covered by the rendered area
+	vec2 uvScale = vec2(float(pacing.renderWidth) / pacing.framebufferWidth, float(pacing.renderHeight) / pacing.framebufferHeight);
+	vec2 texelSize = vec2(1.0f / pacing.framebufferWidth, 1.0f / pacing.framebufferHeight);
+
+	if (post.offscreen && (post.outputWidth != windowWidth || post.outputHeight != windowHeight))
+	{
+		deleteOutput(post);
+		createOutput(post, windowWidth, windowHeight);
+	}
+	else if (!post.offscreen && post.outputFramebuffer != 0)
+		deleteOutput(post);
+	GLuint target = presentedFramebuffer(post);
+
+	switch (post.activeMode)
+	{
+	case AA_MSAA:
+		//Resolve into the single sampled target (depth too, for passes that read it later)
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, post.msaaFramebuffer);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, pacing.sceneFramebuffer);
+		glBlitFramebuffer(0, 0, pacing.renderWidth, pacing.renderHeight, 0, 0, pacing.renderWidth, pacing.renderHeight,
+						  GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		endScenePass(pacing, windowWidth, windowHeight, target);
+		break;
+
+	case AA_FXAA:
+		glBindFramebuffer(GL_FRAMEBUFFER, target);
+		glViewport(0, 0, windowWidth, windowHeight);
+
+		glUseProgram(fxaaProgram);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, pacing.sceneColour);
+		glUniform1i(glGetUniformLocation(fxaaProgram, "sceneColour"), 0);
+		glUniform2f(glGetUniformLocation(fxaaProgram, "uvScale"), uvScale.x, uvScale.y);
+		glUniform2f(glGetUniformLocation(fxaaProgram, "texelSize"), texelSize.x, texelSize.y);
+		drawFullscreenTriangle(post);
+		break;
+
+	case AA_TAA:
+	{
+		if (post.historyWidth != pacing.framebufferWidth || post.historyHeight != pacing.framebufferHeight)
+		{
+			deleteHistory(post);
+			createHistory(post, pacing.framebufferWidth, pacing.framebufferHeight);
+		}
+
+		//Resolve into this frame's history at the render resolution
+		glBindFramebuffer(GL_FRAMEBUFFER, post.historyFramebuffers[post.historyIndex]);
+		glViewport(0, 0, pacing.renderWidth, pacing.renderHeight);
+
+		glUseProgram(taaProgram);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, pacing.sceneColour);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, pacing.sceneDepth);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, post.historyTextures[post.historyIndex ^ 1]);
+		glActiveTexture(GL_TEXTURE0);
+
+		mat4 inverseViewProjection = inverse(viewProjection);
+		glUniform1i(glGetUniformLocation(taaProgram, "sceneColour"), 0);
+		glUniform1i(glGetUniformLocation(taaProgram, "sceneDepth"), 1);
+		glUniform1i(glGetUniformLocation(taaProgram, "history"), 2);
+		glUniform2f(glGetUniformLocation(taaProgram, "uvScale"), uvScale.x, uvScale.y);
+		glUniform2f(glGetUniformLocation(taaProgram, "texelSize"), texelSize.x, texelSize.y);
+		glUniformMatrix4fv(glGetUniformLocation(taaProgram, "inverseViewProjection"), 1, GL_FALSE, &inverseViewProjection[0][0]);
+		glUniformMatrix4fv(glGetUniformLocation(taaProgram, "previousViewProjection"), 1, GL_FALSE, &post.previousViewProjection[0][0]);
+		glUniform1f(glGetUniformLocation(taaProgram, "blend"), post.historyValid ? post.taaBlend : 1.0f);
+		drawFullscreenTriangle(post);
+
+		//Upscale the accumulated image to the window
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, post.historyFramebuffers[post.historyIndex]);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target);
+		glBlitFramebuffer(0, 0, pacing.renderWidth, pacing.renderHeight, 0, 0, windowWidth, windowHeight, GL_COLOR_BUFFER_BIT,
+						  pacing.renderWidth == windowWidth && pacing.renderHeight == windowHeight ? GL_NEAREST : GL_LINEAR);
+		glBindFramebuffer(GL_FRAMEBUFFER, target);
+		glViewport(0, 0, windowWidth, windowHeight);
+
+		post.historyIndex ^= 1;
+		post.historyValid = true;
+		post.previousViewProjection = viewProjection;
+		break;
+	}
+
+	default:
+		endScenePass(pacing, windowWidth, windowHeight, target);
+		break;
+	}
+
+	//History is only kept alive while TAA is in use
+	if (post.activeMode != AA_TAA && post.historyFramebuffers[0] != 0)
+		deleteHistory(post);
+}
+
+GLuint presentedFramebuffer(const PostProcess& post)
+{
+	return post.offscreen ? post.outputFramebuffer : 0;
+}
+
+void destroyPostProcess(PostProcess& post)
+{
+	deleteMultisampleTarget(post);
+	deleteHistory(post);
+	deleteOutput(post);
+	glDeleteVertexArrays(1, &post.emptyVertexArray);
+	post.emptyVertexArray = 0;
+}
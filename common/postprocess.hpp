@@ -0,0 +1,91 @@
+#ifndef POSTPROCESS_HPP
+#define POSTPROCESS_HPP
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "framepacing.hpp"
+
+//Anti-aliasing
+//The scene is rendered into the HDR frame pacing target (or a multisampled copy of it for MSAA)
+//and is then presented to the window through the selected mode:
+//MSAA -> resolve blit, FXAA -> edge blur while upscaling, TAA -> jittered projection accumulated
+//into a reprojected history, clamped to the current neighbourhood to limit ghosting.
+
+enum AntiAliasingMode
+{
+	AA_NONE,
+	AA_MSAA,
+	AA_FXAA,
+	AA_TAA,
+	AA_MODE_COUNT
+};
+
+static const char* const antiAliasingNames[AA_MODE_COUNT] = { "No AA", "MSAA", "FXAA", "TAA" };
+static const int TAA_JITTER_SAMPLES = 8;
+
+struct PostProcess
+{
+	//Settings
+	int mode = AA_FXAA;
+	int activeMode = AA_FXAA; //Used this frame: mode, unless the frame cannot support it (set by beginPostProcess)
+	int msaaSamples = 4;
+	float taaBlend = 0.1f; //Weight of the current frame in the history
+
+	//GPU cost of the scene plus post processing, recorded while each mode was active
+	double modeCostMs[AA_MODE_COUNT] = {};
+
+	GLuint emptyVertexArray = 0; //The fullscreen triangle is generated from gl_VertexID
+
+	//Multisampled scene target (MSAA only), resolved into the frame pacing target
+	GLuint msaaFramebuffer = 0;
+	GLuint msaaColour = 0;
+	GLuint msaaDepth = 0;
+	int msaaWidth = 0;
+	int msaaHeight = 0;
+	int msaaAllocatedSamples = 0;
+
+	//TAA history, ping-ponged between frames
+	GLuint historyFramebuffers[2] = {};
+	GLuint historyTextures[2] = {};
+	int historyWidth = 0;
+	int historyHeight = 0;
+	int historyIndex = 0; //Written this frame
+	bool historyValid = false;
+	int jitterIndex = 0;
+	glm::mat4 previousViewProjection = glm::mat4(1.0f);
+
+	//History is discarded when any of these change
+	int lastMode = -1;
+	int lastRenderWidth = 0;
+	int lastRenderHeight = 0;
+
+	//Headless runs present into this target instead of the hidden window, whose pixels are undefined
+	bool offscreen = false;
+	GLuint outputFramebuffer = 0;
+	GLuint outputColour = 0;
+	int outputWidth = 0;
+	int outputHeight = 0;
+};
+
+void initPostProcess(PostProcess& post);
+
+//Call after beginScenePass and before computing the camera matrices:
+//redirects rendering to the multisampled target and sets the projection jitter
+//Without temporal (a single camera's history cannot be reprojected to several views) TAA falls back to FXAA
+void beginPostProcess(PostProcess& post, FramePacing& pacing, bool temporal = true);
+
+//Whether the scene is being drawn into the multisampled target (after beginPostProcess)
+bool isMultisampled(const PostProcess& post);
+
+//Replaces endScenePass: resolves the scene and presents it to the default framebuffer (or the offscreen target)
+//viewProjection is the current camera without jitter
+void applyPostProcess(PostProcess& post, FramePacing& pacing, GLuint fxaaProgram, GLuint taaProgram,
+					  const glm::mat4& viewProjection, int windowWidth, int windowHeight);
+
+//Framebuffer holding the presented image after applyPostProcess
+GLuint presentedFramebuffer(const PostProcess& post);
+
+void destroyPostProcess(PostProcess& post);
+
+#endif
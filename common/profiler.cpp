@@ -0,0 +1,223 @@
+#include "profiler.hpp"
+#include "glcapture.hpp"
+
+#include <GLFW/glfw3.h>
+
+#include <algorithm>
+#include <cstring>
+using namespace std;
+
+static vector<ProfilerSection> sections;
+static vector<int> openSections; //Stack of sections begun but not ended yet
+static FrameStats frameStats;
+static unsigned long long frameIndex = 0;
+static double lastFrameStart = 0.0;
+
+//End of every frame's GPU work, for the input latency
+static GLuint frameEndQueries[PROFILER_FRAMES];
+static double frameInputTimes[PROFILER_FRAMES]; //0 when the frame showed no new input
+static double currentInputTime = 0.0;
+
+static const double smoothing = 0.1;
+
+static int findSection(const char* name)
+{
+	for (int i = 0; i < int(sections.size()); i++)
+		if (strcmp(sections[i].name.c_str(), name) == 0)
+			return i;
+	return -1;
+}
+
+static void updateFrameStats(float frameMs)
+{
+	frameStats.history[frameStats.next] = frameMs;
+	frameStats.next = (frameStats.next + 1) % FRAME_HISTORY;
+	frameStats.count = min(frameStats.count + 1, FRAME_HISTORY);
+
+	float sorted[FRAME_HISTORY];
+	float sum = 0.0f;
+	for (int i = 0; i < frameStats.count; i++)
+	{
+		sorted[i] = frameStats.history[i];
+		sum += sorted[i];
+	}
+	sort(sorted, sorted + frameStats.count);
+
+	frameStats.averageMs = sum / frameStats.count;
+	frameStats.minMs = sorted[0];
+	frameStats.maxMs = sorted[frameStats.count - 1];
+	frameStats.p99Ms = sorted[min(frameStats.count - 1, int(frameStats.count * 0.99f))];
+}
+
+void initProfiler()
+{
+	sections.clear();
+	openSections.clear();
+	frameStats = FrameStats();
+	frameIndex = 0;
+	lastFrameStart = glfwGetTime();
+
+	glGenQueries(PROFILER_FRAMES, frameEndQueries);
+	fill(frameInputTimes, frameInputTimes + PROFILER_FRAMES, 0.0);
+	currentInputTime = 0.0;
+}
+
+static void collectInputLatency(int slot)
+{
+	double inputTime = frameInputTimes[slot];
+	frameInputTimes[slot] = 0.0;
+	if (inputTime == 0.0)
+		return;
+
+	GLint available = 0;
+	glGetQueryObjectiv(frameEndQueries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return;
+
+	//The GPU clock has its own origin: measure how long ago the frame finished against the current GPU time
+	GLuint64 end;
+	GLint64 gpuNow;
+	glGetQueryObjectui64v(frameEndQueries[slot], GL_QUERY_RESULT, &end);
+	glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+	double photonTime = glfwGetTime() - double(gpuNow - GLint64(end)) / 1000000000.0;
+
+	frameStats.lastInputLatencyMs = float(max(0.0, photonTime - inputTime) * 1000.0);
+	if (frameStats.inputLatencyMs == 0.0f)
+		frameStats.inputLatencyMs = frameStats.lastInputLatencyMs;
+	frameStats.inputLatencyMs += (frameStats.lastInputLatencyMs - frameStats.inputLatencyMs) * float(smoothing);
+	frameStats.maxInputLatencyMs = max(frameStats.maxInputLatencyMs, frameStats.lastInputLatencyMs);
+}
+
+void profilerBeginFrame()
+{
+	double now = glfwGetTime();
+	if (frameIndex > 0)
+		updateFrameStats(float((now - lastFrameStart) * 1000.0));
+	lastFrameStart = now;
+
+	//Collect the queries issued PROFILER_FRAMES frames ago (their slot is reused this frame)
+	int slot = int(frameIndex % PROFILER_FRAMES);
+	for (ProfilerSection& section : sections)
+	{
+		if (!section.pending[slot])
+			continue;
+		section.pending[slot] = false;
+
+		GLint available = 0;
+		glGetQueryObjectiv(section.queries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			continue; //Dropped rather than waited for
+
+		GLuint64 start, end;
+		glGetQueryObjectui64v(section.queries[slot][0], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(section.queries[slot][1], GL_QUERY_RESULT, &end);
+		section.lastGpuMs = double(end - start) / 1000000.0;
+		section.gpuMs += (section.lastGpuMs - section.gpuMs) * smoothing;
+	}
+	collectInputLatency(slot);
+
+	//A requested capture starts here, so it holds whole frames
+	captureBeginFrame();
+}
+
+void profilerEndFrame()
+{
+	//Unbalanced sections are closed so one mistake does not break every later frame
+	while (!openSections.empty())
+		profilerEndSection();
+
+	int slot = int(frameIndex % PROFILER_FRAMES);
+	glQueryCounter(frameEndQueries[slot], GL_TIMESTAMP);
+	frameInputTimes[slot] = currentInputTime;
+	currentInputTime = 0.0;
+
+	captureEndFrame();
+	frameIndex++;
+}
+
+void profilerInputSample(double inputTime)
+{
+	if (currentInputTime == 0.0 || inputTime < currentInputTime)
+		currentInputTime = inputTime;
+}
+
+void profilerBeginSection(const char* name)
+{
+	int index = findSection(name);
+	if (index < 0)
+	{
+		ProfilerSection section;
+		section.name = name;
+		glGenQueries(PROFILER_FRAMES * 2, &section.queries[0][0]);
+		sections.push_back(section);
+		index = int(sections.size()) - 1;
+	}
+
+	ProfilerSection& section = sections[index];
+	int slot = int(frameIndex % PROFILER_FRAMES);
+	section.depth = int(openSections.size());
+	section.cpuStart = glfwGetTime();
+	glQueryCounter(section.queries[slot][0], GL_TIMESTAMP);
+	openSections.push_back(index);
+	captureBeginGroup(name);
+}
+
+void profilerEndSection()
+{
+	if (openSections.empty())
+		return;
+
+	ProfilerSection& section = sections[openSections.back()];
+	openSections.pop_back();
+
+	int slot = int(frameIndex % PROFILER_FRAMES);
+	glQueryCounter(section.queries[slot][1], GL_TIMESTAMP);
+	section.pending[slot] = true;
+	captureEndGroup();
+
+	section.lastCpuMs = (glfwGetTime() - section.cpuStart) * 1000.0;
+	section.cpuMs += (section.lastCpuMs - section.cpuMs) * smoothing;
+}
+
+double getSectionCpuMs(const char* name)
+{
+	int index = findSection(name);
+	return index < 0 ? 0.0 : sections[index].cpuMs;
+}
+
+double getSectionGpuMs(const char* name)
+{
+	int index = findSection(name);
+	return index < 0 ? 0.0 : sections[index].gpuMs;
+}
+
+double getSectionLastCpuMs(const char* name)
+{
+	int index = findSection(name);
+	return index < 0 ? 0.0 : sections[index].lastCpuMs;
+}
+
+double getSectionLastGpuMs(const char* name)
+{
+	int index = findSection(name);
+	return index < 0 ? 0.0 : sections[index].lastGpuMs;
+}
+
+const vector<ProfilerSection>& getProfilerSections()
+{
+	return sections;
+}
+
+const FrameStats& getFrameStats()
+{
+	return frameStats;
+}
+
+void destroyProfiler()
+{
+	for (ProfilerSection& section : sections)
+		glDeleteQueries(PROFILER_FRAMES * 2, &section.queries[0][0]);
+	glDeleteQueries(PROFILER_FRAMES, frameEndQueries);
+	sections.clear();
+	openSections.clear();
+}
@@ -0,0 +1,74 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+//Frame profiler
+//Named sections are timed on the CPU with a high resolution clock and on the GPU with timestamp
+//queries. Query results are read PROFILER_FRAMES frames later so reading them never stalls, and
+//every section keeps an exponentially smoothed average for display.
+//Input-to-photon latency runs from when an input was sampled to when the GPU finished the first frame
+//showing it (a timestamp after the swap, converted to the CPU clock); the scan-out after that is not seen.
+
+static const int PROFILER_FRAMES = 4; //GPU frames in flight before a query is read back
+static const int FRAME_HISTORY = 240; //Frame times kept for the statistics
+
+struct ProfilerSection
+{
+	std::string name;
+	int depth = 0; //Nesting level (for indenting in the UI)
+	double cpuMs = 0.0; //Smoothed
+	double gpuMs = 0.0; //Smoothed
+	double lastCpuMs = 0.0;
+	double lastGpuMs = 0.0;
+
+	double cpuStart = 0.0;
+	GLuint queries[PROFILER_FRAMES][2] = {};
+	bool pending[PROFILER_FRAMES] = {};
+};
+
+struct FrameStats
+{
+	float history[FRAME_HISTORY] = {}; //Ring of milliseconds between frames (next is the oldest once full)
+	int count = 0;
+	int next = 0;
+	float averageMs = 0.0f;
+	float minMs = 0.0f;
+	float maxMs = 0.0f;
+	float p99Ms = 0.0f; //99th percentile
+
+	float inputLatencyMs = 0.0f; //Smoothed input-to-photon latency (0 until measured)
+	float lastInputLatencyMs = 0.0f;
+	float maxInputLatencyMs = 0.0f;
+};
+
+void initProfiler();
+
+//Bracket the whole frame (call end after swapping buffers)
+void profilerBeginFrame();
+void profilerEndFrame();
+
+//The frame being recorded is the first to show input sampled at inputTime (glfwGetTime)
+void profilerInputSample(double inputTime);
+
+//Sections may nest; every begin needs a matching end within the same frame
+void profilerBeginSection(const char* name);
+void profilerEndSection();
+
+//Smoothed timings of a section (0 when it has not run yet)
+double getSectionCpuMs(const char* name);
+double getSectionGpuMs(const char* name);
+
+//Latest (unsmoothed) times of a section, for controllers that must react quickly and benchmarks
+double getSectionLastCpuMs(const char* name);
+double getSectionLastGpuMs(const char* name);
+
+const std::vector<ProfilerSection>& getProfilerSections();
+const FrameStats& getFrameStats();
+
+void destroyProfiler();
+
+#endif
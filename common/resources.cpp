@@ -0,0 +1,356 @@
+#include "resources.hpp"
+#include "glcapture.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+using namespace std;
+
+static vector<ResourceInfo> resources;
+static unsigned long long currentFrame = 1;
+
+static const double restoreFraction = 0.8; //Reduced textures get their mips back while the total stays below this part of the budget
+
+static ResourceInfo* findResource(const char* name)
+{
+	for (ResourceInfo& resource : resources)
+		if (resource.name == name)
+			return &resource;
+	return nullptr;
+}
+
+//Entry of this name, created if needed (a replaced entry keeps its reload function and usage)
+static ResourceInfo& entry(const char* name, const char* category, ResourceKind kind, GLuint id)
+{
+	ResourceInfo* resource = findResource(name);
+	if (!resource)
+	{
+		resources.push_back(ResourceInfo());
+		resource = &resources.back();
+		resource->name = name;
+		resource->lastUsedFrame = currentFrame;
+	}
+	resource->category = category;
+	resource->kind = kind;
+	resource->id = id;
+	return *resource;
+}
+
+//Bytes per texel as drivers typically store the format (3 channel formats are padded to 4)
+static size_t texelBytes(GLenum internalFormat)
+{
+	switch (internalFormat)
+	{
+	case GL_R8: case GL_RED: return 1;
+	case GL_RG8: case GL_R16F: return 2;
+	case GL_RG16F: case GL_R32F: return 4;
+	case GL_RG32F: case GL_RGBA16F: case GL_RGB16F: return 8;
+	case GL_RGB32F: case GL_RGBA32F: return 16;
+	default: return 4; //GL_RGB(8), GL_RGBA(8), depth formats
+	}
+}
+
+static int mipCount(int width, int height)
+{
+	int levels = 1;
+	while (max(width, height) >> levels)
+		levels++;
+	return levels;
+}
+
+static size_t textureBytes(const ResourceInfo& texture)
+{
+	size_t bytes = 0;
+	for (int level = 0; level < texture.levels; level++)
+		bytes += size_t(max(texture.width >> level, 1)) * max(texture.height >> level, 1);
+	return bytes * texture.layers * texelBytes(texture.internalFormat);
+}
+
+//Client format to read a level back in and specify it again with
+static bool transferFormat(GLenum internalFormat, GLenum& format, GLenum& type, size_t& pixelBytes)
+{
+	switch (internalFormat)
+	{
+	case GL_RGB: case GL_RGB8: format = GL_RGB; type = GL_UNSIGNED_BYTE; pixelBytes = 3; return true;
+	case GL_RGBA: case GL_RGBA8: format = GL_RGBA; type = GL_UNSIGNED_BYTE; pixelBytes = 4; return true;
+	case GL_R32F: format = GL_RED; type = GL_FLOAT; pixelBytes = 4; return true;
+	default: return false;
+	}
+}
+
+void registerBuffer(const char* name, const char* category, GLuint buffer, size_t bytes, size_t cpuBytes)
+{
+	ResourceInfo& resource = entry(name, category, RESOURCE_BUFFER, buffer);
+	resource.gpuBytes = bytes;
+	resource.cpuBytes = cpuBytes;
+}
+
+void registerTexture(const char* name, const char* category, GLuint texture, GLenum target, int width, int height, int layers,
+					 GLenum internalFormat, bool mipmapped, size_t cpuBytes)
+{
+	ResourceInfo& resource = entry(name, category, RESOURCE_TEXTURE, texture);
+	resource.target = target;
+	resource.internalFormat = internalFormat;
+	resource.width = width;
+	resource.height = height;
+	resource.layers = target == GL_TEXTURE_CUBE_MAP ? 6 : layers;
+	resource.levels = mipmapped ? mipCount(width, height) : 1;
+	resource.droppedLevels = 0;
+	resource.evicted = false;
+	resource.reloading = false;
+	resource.gpuBytes = textureBytes(resource);
+	resource.cpuBytes = cpuBytes;
+}
+
+void registerProgram(const char* name, const char* category, GLuint program)
+{
+	//The linked binary is the best estimate of what the driver keeps
+	GLint length = 0;
+	if (program)
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	ResourceInfo& resource = entry(name, category, RESOURCE_PROGRAM, program);
+	resource.gpuBytes = size_t(max(length, 0));
+	resource.cpuBytes = 0;
+}
+
+void setResourceReload(const char* name, function<void()> reload)
+{
+	ResourceInfo* resource = findResource(name);
+	if (resource)
+		resource->reload = reload;
+}
+
+void unregisterResource(const char* name)
+{
+	resources.erase(remove_if(resources.begin(), resources.end(), [&](const ResourceInfo& resource) { return resource.name == name; }),
+					resources.end());
+}
+
+void unregisterCategory(const char* category)
+{
+	resources.erase(remove_if(resources.begin(), resources.end(), [&](const ResourceInfo& resource) { return resource.category == category; }),
+					resources.end());
+}
+
+//Starts re-creating the full texture (registerTexture clears the reduced state once it is done)
+static void reloadTexture(ResourceInfo& texture)
+{
+	texture.reloading = true;
+	texture.reload();
+}
+
+void touchResource(const char* name)
+{
+	ResourceInfo* resource = findResource(name);
+	if (!resource)
+		return;
+	resource->lastUsedFrame = currentFrame;
+	if (resource->evicted && !resource->reloading && resource->reload)
+		reloadTexture(*resource);
+}
+
+//Only plain 2D textures that can be loaded again are evicted or reduced
+static bool reducible(const ResourceInfo& resource)
+{
+	return resource.kind == RESOURCE_TEXTURE && resource.target == GL_TEXTURE_2D && resource.reload && !resource.reloading;
+}
+
+//Frees the levels from first on, which would otherwise stay allocated past GL_TEXTURE_MAX_LEVEL (a 0x0
+//image releases a level's storage); the texture must be bound
+static void releaseLevels(const ResourceInfo& texture, int first, GLenum format, GLenum type)
+{
+	for (int level = first; level < texture.levels; level++)
+		glTexImage2D(GL_TEXTURE_2D, level, texture.internalFormat, 0, 0, 0, format, type, nullptr);
+}
+
+//Replaces every level with the next smaller one, releasing the largest
+static bool dropTopLevel(ResourceInfo& texture, int minSize)
+{
+	GLenum format, type;
+	size_t pixelBytes;
+	if (texture.levels < 2 || min(texture.width, texture.height) / 2 < minSize || !transferFormat(texture.internalFormat, format, type, pixelBytes))
+		return false;
+
+	GLint previous = 0, packAlignment = 4, unpackAlignment = 4;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+	glGetIntegerv(GL_PACK_ALIGNMENT, &packAlignment);
+	glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpackAlignment);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glBindTexture(GL_TEXTURE_2D, texture.id);
+
+	vector<vector<unsigned char>> levels(texture.levels - 1);
+	for (int level = 1; level < texture.levels; level++)
+	{
+		int width = max(texture.width >> level, 1), height = max(texture.height >> level, 1);
+		levels[level - 1].resize(size_t(width) * height * pixelBytes);
+		glGetTexImage(GL_TEXTURE_2D, level, format, type, levels[level - 1].data());
+	}
+	for (int level = 0; level < texture.levels - 1; level++)
+	{
+		int width = max(texture.width >> (level + 1), 1), height = max(texture.height >> (level + 1), 1);
+		glTexImage2D(GL_TEXTURE_2D, level, texture.internalFormat, width, height, 0, format, type, levels[level].data());
+	}
+	releaseLevels(texture, texture.levels - 1, format, type);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture.levels - 2);
+
+	glBindTexture(GL_TEXTURE_2D, GLuint(previous));
+	glPixelStorei(GL_PACK_ALIGNMENT, packAlignment);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, unpackAlignment);
+
+	texture.width = max(texture.width >> 1, 1);
+	texture.height = max(texture.height >> 1, 1);
+	texture.levels--;
+	texture.droppedLevels++;
+	texture.gpuBytes = textureBytes(texture);
+	return true;
+}
+
+//Shrinks the texture to a single grey texel until it is needed again
+static void evictTexture(ResourceInfo& texture)
+{
+	GLenum format, type;
+	size_t pixelBytes;
+	if (!transferFormat(texture.internalFormat, format, type, pixelBytes))
+		return;
+
+	static const float grey[4] = { 0.5f, 0.5f, 0.5f, 1.0f };
+	GLint previous = 0;
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+	glBindTexture(GL_TEXTURE_2D, texture.id);
+	glTexImage2D(GL_TEXTURE_2D, 0, texture.internalFormat, 1, 1, 0, format == GL_RED ? GL_RED : GL_RGBA, GL_FLOAT, grey);
+	releaseLevels(texture, 1, format, type);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glBindTexture(GL_TEXTURE_2D, GLuint(previous));
+
+	texture.droppedLevels += texture.levels - 1;
+	texture.width = texture.height = 1;
+	texture.levels = 1;
+	texture.evicted = true;
+	texture.gpuBytes = textureBytes(texture);
+}
+
+void enforceResourceBudget(ResourceBudget& budget)
+{
+	currentFrame++;
+	if (budget.gpuBytes == 0)
+		return;
+
+	ResourceTotals totals = getResourceTotals();
+	size_t total = totals.gpuTotal;
+
+	//Textures nobody has used for a while go first, least recently used first
+	while (total > budget.gpuBytes)
+	{
+		ResourceInfo* oldest = nullptr;
+		for (ResourceInfo& resource : resources)
+			if (reducible(resource) && !resource.evicted && currentFrame - resource.lastUsedFrame > (unsigned long long)budget.evictAfterFrames &&
+				(!oldest || resource.lastUsedFrame < oldest->lastUsedFrame))
+				oldest = &resource;
+		if (!oldest)
+			break;
+
+		size_t before = oldest->gpuBytes;
+		evictTexture(*oldest);
+		if (!oldest->evicted)
+			break;
+		total -= before - oldest->gpuBytes;
+		budget.evictions++;
+	}
+
+	//Then the textures in use lose their largest level, the least recently used and biggest first
+	while (total > budget.gpuBytes)
+	{
+		ResourceInfo* candidate = nullptr;
+		for (ResourceInfo& resource : resources)
+		{
+			if (!reducible(resource) || resource.evicted || resource.levels < 2 || min(resource.width, resource.height) / 2 < budget.minTextureSize)
+				continue;
+			if (!candidate || resource.lastUsedFrame < candidate->lastUsedFrame ||
+				(resource.lastUsedFrame == candidate->lastUsedFrame && resource.gpuBytes > candidate->gpuBytes))
+				candidate = &resource;
+		}
+		if (!candidate)
+			break;
+
+		size_t before = candidate->gpuBytes;
+		if (!dropTopLevel(*candidate, budget.minTextureSize))
+			break;
+		total -= before - candidate->gpuBytes;
+		budget.mipsDropped++;
+	}
+
+	//With room to spare, one reduced texture a frame (the most recently used) is loaded at full size again
+	if (total < budget.gpuBytes * restoreFraction)
+	{
+		ResourceInfo* candidate = nullptr;
+		for (ResourceInfo& resource : resources)
+			if (reducible(resource) && !resource.evicted && resource.droppedLevels > 0 && (!candidate || resource.lastUsedFrame > candidate->lastUsedFrame))
+				candidate = &resource;
+
+		//A full texture is about 4^dropped times the reduced one
+		if (candidate && total + (candidate->gpuBytes << (2 * candidate->droppedLevels)) < budget.gpuBytes * restoreFraction)
+		{
+			reloadTexture(*candidate);
+			budget.restores++;
+		}
+	}
+}
+
+const vector<ResourceInfo>& getResources()
+{
+	return resources;
+}
+
+ResourceTotals getResourceTotals()
+{
+	ResourceTotals totals;
+	for (const ResourceInfo& resource : resources)
+	{
+		totals.gpuBytes[resource.kind] += resource.gpuBytes;
+		totals.cpuBytes[resource.kind] += resource.cpuBytes;
+		totals.gpuTotal += resource.gpuBytes;
+		totals.cpuTotal += resource.cpuBytes;
+	}
+	return totals;
+}
+
+bool dumpResources(const char* path)
+{
+	static const char* kinds[] = { "buffer", "texture", "program" };
+
+	string report;
+	char line[512];
+	snprintf(line, sizeof(line), "%-28s %-12s %-8s %6s %12s %12s  %s\n", "Name", "Category", "Kind", "GL id", "VRAM KB", "RAM KB", "Details");
+	report += line;
+
+	vector<const ResourceInfo*> sorted;
+	for (const ResourceInfo& resource : resources)
+		sorted.push_back(&resource);
+	sort(sorted.begin(), sorted.end(), [](const ResourceInfo* a, const ResourceInfo* b) { return a->gpuBytes > b->gpuBytes; });
+
+	for (const ResourceInfo* resource : sorted)
+	{
+		char details[160] = "";
+		if (resource->kind == RESOURCE_TEXTURE)
+			snprintf(details, sizeof(details), "%dx%dx%d, %d levels, format 0x%04x%s%s", resource->width, resource->height, resource->layers,
+					 resource->levels, resource->internalFormat, resource->droppedLevels ? ", reduced" : "", resource->evicted ? ", evicted" : "");
+		snprintf(line, sizeof(line), "%-28s %-12s %-8s %6u %12.1f %12.1f  %s\n", resource->name.c_str(), resource->category.c_str(),
+				 kinds[resource->kind], resource->id, resource->gpuBytes / 1024.0, resource->cpuBytes / 1024.0, details);
+		report += line;
+	}
+
+	ResourceTotals totals = getResourceTotals();
+	snprintf(line, sizeof(line), "Total: %.2f MB VRAM (buffers %.2f, textures %.2f, programs %.2f), %.2f MB RAM\n", totals.gpuTotal / 1048576.0,
+			 totals.gpuBytes[RESOURCE_BUFFER] / 1048576.0, totals.gpuBytes[RESOURCE_TEXTURE] / 1048576.0, totals.gpuBytes[RESOURCE_PROGRAM] / 1048576.0,
+			 totals.cpuTotal / 1048576.0);
+	report += line;
+
+	fputs(report.c_str(), stdout);
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+	bool written = fwrite(report.data(), 1, report.size(), file) == report.size();
+	fclose(file);
+	return written;
+}
@@ -0,0 +1,95 @@
+#ifndef RESOURCES_HPP
+#define RESOURCES_HPP
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+//Resource registry
+//Every buffer, texture and program the renderer creates is registered under a unique name with its
+//estimated video memory (full mip chains, cube faces and array layers included) and the RAM held by
+//CPU-side copies of it. A GPU budget is enforced once a frame: textures unused for a while are evicted
+//first (down to a 1x1 placeholder, reloaded when they are needed again), then the least recently used
+//textures lose their top mip level until the total fits. Both are undone once there is room again.
+
+enum ResourceKind
+{
+	RESOURCE_BUFFER,
+	RESOURCE_TEXTURE,
+	RESOURCE_PROGRAM
+};
+
+struct ResourceInfo
+{
+	std::string name;
+	std::string category;
+	ResourceKind kind = RESOURCE_BUFFER;
+	GLuint id = 0;
+	size_t gpuBytes = 0; //Estimated
+	size_t cpuBytes = 0; //CPU copies kept alongside (staging data, data the CPU queries)
+
+	//Textures
+	GLenum target = GL_TEXTURE_2D;
+	GLenum internalFormat = GL_RGBA8;
+	int width = 0;
+	int height = 0;
+	int layers = 1; //Array layers (6 faces for cube maps)
+	int levels = 1; //Mip levels allocated
+	int droppedLevels = 0; //Top levels released to meet the budget
+	bool evicted = false;
+	bool reloading = false;
+
+	//Recreates the full contents (textures without one are never evicted or reduced)
+	std::function<void()> reload;
+
+	unsigned long long lastUsedFrame = 0;
+};
+
+struct ResourceBudget
+{
+	size_t gpuBytes = 0; //0 for no limit
+	int minTextureSize = 64; //Mip levels are not dropped below this size
+	int evictAfterFrames = 300; //Only textures unused for this long are evicted
+
+	//Counters since startup
+	int mipsDropped = 0;
+	int evictions = 0;
+	int restores = 0;
+};
+
+struct ResourceTotals
+{
+	size_t gpuBytes[3] = {}; //By ResourceKind
+	size_t cpuBytes[3] = {};
+	size_t gpuTotal = 0;
+	size_t cpuTotal = 0;
+};
+
+//Register (or replace the entry of the same name)
+void registerBuffer(const char* name, const char* category, GLuint buffer, size_t bytes, size_t cpuBytes = 0);
+void registerTexture(const char* name, const char* category, GLuint texture, GLenum target, int width, int height, int layers,
+					 GLenum internalFormat, bool mipmapped, size_t cpuBytes = 0);
+void registerProgram(const char* name, const char* category, GLuint program);
+
+//Lets the budget evict or reduce a texture; reload must re-specify the same texture name at full size,
+//reset GL_TEXTURE_MAX_LEVEL and re-register it when done (it may finish in a later frame)
+void setResourceReload(const char* name, std::function<void()> reload);
+
+void unregisterResource(const char* name);
+void unregisterCategory(const char* category);
+
+//Marks a resource as used this frame (an evicted texture starts reloading)
+void touchResource(const char* name);
+
+//Once a frame, after the frame's resources were touched
+void enforceResourceBudget(ResourceBudget& budget);
+
+const std::vector<ResourceInfo>& getResources();
+ResourceTotals getResourceTotals();
+
+//Writes a table of every resource to path and stdout
+bool dumpResources(const char* path);
+
+#endif
@@ -0,0 +1,534 @@
+#include "screencapture.hpp"
+#include "glcapture.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+static const size_t maxQueuedFrames = 8; //About 8 MB each at 1920x1080
+static const double smoothing = 0.1;
+
+struct Recording
+{
+	string path;
+	ScreenCaptureFormat format = SCREEN_CAPTURE_PNG;
+	int frames = 0;
+	int frameRate = 60;
+	bool waitForEncoder = false;
+	int framesLeft = 0; //-1 until stopped (render thread only)
+	int nextFrame = 0;
+
+	//Encoder thread only
+	FILE* video = nullptr;
+	int videoWidth = 0;
+	int videoHeight = 0;
+
+	~Recording()
+	{
+		if (video)
+			fclose(video);
+	}
+};
+
+//RGBA rows, bottom up as glReadPixels returns them
+struct CapturedFrame
+{
+	shared_ptr<Recording> recording;
+	vector<uint8_t> pixels;
+	int width = 0;
+	int height = 0;
+	int index = 0;
+};
+
+//Render thread
+static shared_ptr<Recording> current;
+static GLuint buffers[SCREEN_CAPTURE_BUFFERS] = {};
+static size_t bufferBytes[SCREEN_CAPTURE_BUFFERS] = {};
+static GLsync fences[SCREEN_CAPTURE_BUFFERS] = {};
+static CapturedFrame inFlight[SCREEN_CAPTURE_BUFFERS];
+static int head = 0; //Oldest buffer in flight
+static int pending = 0;
+
+//Shared with the encoder thread (under queueMutex)
+static thread encoderThread;
+static mutex queueMutex;
+static condition_variable queueChanged;
+static deque<CapturedFrame> queue;
+static vector<vector<uint8_t>> sparePixels; //Recycled frame memory
+static bool encoding = false;
+static bool stopping = false;
+static ScreenCaptureStats stats;
+
+//PNG
+
+struct CrcTable
+{
+	uint32_t entries[256];
+
+	CrcTable()
+	{
+		for (uint32_t n = 0; n < 256; n++)
+		{
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			entries[n] = c;
+		}
+	}
+};
+
+static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size)
+{
+	static const CrcTable table;
+	const uint32_t* crcTable = table.entries;
+	for (size_t i = 0; i < size; i++)
+		crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	return crc;
+}
+
+static uint32_t adler32(const uint8_t* data, size_t size)
+{
+	uint32_t a = 1, b = 0;
+	while (size > 0)
+	{
+		size_t block = min(size, size_t(5552)); //Longest run before b can overflow
+		for (size_t i = 0; i < block; i++)
+		{
+			a += data[i];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+		data += block;
+		size -= block;
+	}
+	return (b << 16) | a;
+}
+
+static void putBigEndian(uint8_t* out, uint32_t value)
+{
+	out[0] = uint8_t(value >> 24);
+	out[1] = uint8_t(value >> 16);
+	out[2] = uint8_t(value >> 8);
+	out[3] = uint8_t(value);
+}
+
+static bool writeChunk(FILE* file, const char* type, const uint8_t* data, size_t size)
+{
+	uint8_t header[8];
+	putBigEndian(header, uint32_t(size));
+	memcpy(header + 4, type, 4);
+	uint8_t footer[4];
+	putBigEndian(footer, ~crc32(crc32(0xFFFFFFFFu, header + 4, 4), data, size));
+	return fwrite(header, 1, 8, file) == 8 && fwrite(data, 1, size, file) == size && fwrite(footer, 1, 4, file) == 4;
+}
+
+//8-bit RGB with no filtering, in stored deflate blocks (an encoder thread keeps up with a frame a
+//refresh this way; the files are about as large as the raw pixels)
+bool writePng(const char* path, const uint8_t* rgba, int width, int height)
+{
+	thread_local vector<uint8_t> rows, zlib;
+
+	size_t rowBytes = 1 + size_t(width) * 3;
+	rows.resize(rowBytes * height);
+	for (int y = 0; y < height; y++)
+	{
+		const uint8_t* in = &rgba[size_t(height - 1 - y) * width * 4];
+		uint8_t* out = &rows[y * rowBytes];
+		*out++ = 0; //Filter type None
+		for (int x = 0; x < width; x++, in += 4, out += 3)
+			out[0] = in[0], out[1] = in[1], out[2] = in[2];
+	}
+
+	size_t blocks = (rows.size() + 65534) / 65535;
+	zlib.resize(2 + rows.size() + blocks * 5 + 4);
+	uint8_t* out = zlib.data();
+	*out++ = 0x78; //Deflate, 32K window
+	*out++ = 0x01;
+	for (size_t offset = 0; offset < rows.size(); offset += 65535)
+	{
+		uint16_t length = uint16_t(min(rows.size() - offset, size_t(65535)));
+		*out++ = offset + length == rows.size() ? 1 : 0; //Final block bit, stored
+		*out++ = uint8_t(length), *out++ = uint8_t(length >> 8);
+		*out++ = uint8_t(~length), *out++ = uint8_t(~length >> 8);
+		memcpy(out, &rows[offset], length);
+		out += length;
+	}
+	putBigEndian(out, adler32(rows.data(), rows.size()));
+
+	FILE* file = fopen(path, "wb");
+	if (!file)
+		return false;
+
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	uint8_t header[13];
+	putBigEndian(header, width);
+	putBigEndian(header + 4, height);
+	header[8] = 8; //Bit depth
+	header[9] = 2; //Truecolour
+	header[10] = header[11] = header[12] = 0; //Deflate, adaptive filtering, no interlace
+
+	bool written = fwrite(signature, 1, 8, file) == 8 && writeChunk(file, "IHDR", header, 13) &&
+				   writeChunk(file, "IDAT", zlib.data(), zlib.size()) && writeChunk(file, "IEND", nullptr, 0);
+	return fclose(file) == 0 && written;
+}
+
+//Y4M
+
+//Full range BT.601 (C420jpeg) with chroma averaged over 2x2 blocks
+static bool writeY4mFrame(FILE* file, const CapturedFrame& frame)
+{
+	static vector<uint8_t> planes; //Encoder thread only
+
+	int width = frame.width, height = frame.height;
+	int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+	planes.resize(size_t(width) * height + 2 * size_t(chromaWidth) * chromaHeight);
+	uint8_t* luma = planes.data();
+	uint8_t* cb = luma + size_t(width) * height;
+	uint8_t* cr = cb + size_t(chromaWidth) * chromaHeight;
+
+	auto pixel = [&](int x, int y) { return &frame.pixels[(size_t(height - 1 - y) * width + x) * 4]; };
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			const uint8_t* p = pixel(x, y);
+			luma[size_t(y) * width + x] = uint8_t((77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8);
+		}
+	}
+	for (int y = 0; y < chromaHeight; y++)
+	{
+		int y0 = 2 * y, y1 = min(2 * y + 1, height - 1);
+		for (int x = 0; x < chromaWidth; x++)
+		{
+			int x0 = 2 * x, x1 = min(2 * x + 1, width - 1);
+			const uint8_t* a = pixel(x0, y0);
+			const uint8_t* b = pixel(x1, y0);
+			const uint8_t* c = pixel(x0, y1);
+			const uint8_t* d = pixel(x1, y1);
+			int r = (a[0] + b[0] + c[0] + d[0] + 2) >> 2;
+			int g = (a[1] + b[1] + c[1] + d[1] + 2) >> 2;
+			int bl = (a[2] + b[2] + c[2] + d[2] + 2) >> 2;
+			cb[size_t(y) * chromaWidth + x] = uint8_t(min((-43 * r - 85 * g + 128 * bl + 32896) >> 8, 255));
+			cr[size_t(y) * chromaWidth + x] = uint8_t(min((128 * r - 107 * g - 21 * bl + 32896) >> 8, 255));
+		}
+	}
+	return fputs("FRAME\n", file) >= 0 && fwrite(planes.data(), 1, planes.size(), file) == planes.size();
+}
+
+//Encoder thread
+
+static bool encodeFrame(CapturedFrame& frame, string& error)
+{
+	Recording& recording = *frame.recording;
+	if (recording.format == SCREEN_CAPTURE_PNG)
+	{
+		string path = recording.path;
+		if (recording.frames != 1)
+		{
+			char name[32];
+			snprintf(name, sizeof(name), "/frame_%06d.png", frame.index);
+			path += name;
+		}
+		if (!writePng(path.c_str(), frame.pixels.data(), frame.width, frame.height))
+		{
+			error = "Could not write " + path;
+			return false;
+		}
+		return true;
+	}
+
+	//A video keeps the size of its first frame
+	if (!recording.video)
+	{
+		recording.video = fopen(recording.path.c_str(), "wb");
+		if (!recording.video)
+		{
+			error = "Could not create " + recording.path;
+			return false;
+		}
+		fprintf(recording.video, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", frame.width, frame.height, recording.frameRate);
+		recording.videoWidth = frame.width;
+		recording.videoHeight = frame.height;
+	}
+	if (frame.width != recording.videoWidth || frame.height != recording.videoHeight)
+	{
+		error = "The window was resized during the video, later frames were dropped";
+		return false;
+	}
+	if (!writeY4mFrame(recording.video, frame))
+	{
+		error = "Could not write to " + recording.path;
+		return false;
+	}
+	return true;
+}
+
+static void encoderLoop()
+{
+	unique_lock<mutex> lock(queueMutex);
+	while (true)
+	{
+		queueChanged.wait(lock, [] { return stopping || !queue.empty(); });
+		if (queue.empty())
+			return;
+
+		CapturedFrame frame = move(queue.front());
+		queue.pop_front();
+		stats.queuedBytes -= frame.pixels.size();
+		encoding = true;
+		queueChanged.notify_all();
+		lock.unlock();
+
+		auto start = chrono::steady_clock::now();
+		string error;
+		bool written = encodeFrame(frame, error);
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		frame.recording.reset(); //Closes a finished video here rather than on the render thread
+
+		lock.lock();
+		encoding = false;
+		if (written)
+			stats.framesWritten++;
+		else
+		{
+			stats.framesDropped++;
+			stats.error = error;
+		}
+		stats.encodeMs += (ms - stats.encodeMs) * smoothing;
+		if (sparePixels.size() < maxQueuedFrames)
+			sparePixels.push_back(move(frame.pixels));
+		queueChanged.notify_all();
+	}
+}
+
+//Render thread
+
+static vector<uint8_t> takePixels(size_t bytes)
+{
+	vector<uint8_t> pixels;
+	{
+		lock_guard<mutex> lock(queueMutex);
+		if (!sparePixels.empty())
+		{
+			pixels = move(sparePixels.back());
+			sparePixels.pop_back();
+		}
+	}
+	pixels.resize(bytes);
+	return pixels;
+}
+
+static void enqueue(CapturedFrame&& frame)
+{
+	unique_lock<mutex> lock(queueMutex);
+	if (queue.size() >= maxQueuedFrames)
+	{
+		if (!frame.recording->waitForEncoder)
+		{
+			stats.framesDropped++;
+			sparePixels.push_back(move(frame.pixels));
+			return;
+		}
+		queueChanged.wait(lock, [] { return queue.size() < maxQueuedFrames; });
+	}
+	stats.queuedBytes += frame.pixels.size();
+	queue.push_back(move(frame));
+	queueChanged.notify_all();
+}
+
+//Maps the oldest buffer in flight (its transfer must have finished) and hands the frame to the encoder
+static void collectOldest()
+{
+	int slot = head;
+	head = (head + 1) % SCREEN_CAPTURE_BUFFERS;
+	pending--;
+	glDeleteSync(fences[slot]);
+	fences[slot] = nullptr;
+
+	CapturedFrame frame = move(inFlight[slot]);
+	inFlight[slot] = CapturedFrame();
+	size_t bytes = size_t(frame.width) * frame.height * 4;
+	frame.pixels = takePixels(bytes);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[slot]);
+	const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+	if (mapped)
+	{
+		memcpy(frame.pixels.data(), mapped, bytes);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	if (mapped)
+		enqueue(move(frame));
+	else
+	{
+		lock_guard<mutex> lock(queueMutex);
+		stats.framesDropped++;
+		stats.error = "Could not map a readback buffer";
+	}
+}
+
+void initScreenCapture()
+{
+	stopping = false;
+	encoderThread = thread(encoderLoop);
+}
+
+bool startScreenCapture(const char* path, ScreenCaptureFormat format, int frames, int frameRate, bool waitForEncoder)
+{
+	if (current)
+		return false;
+
+	//Sequences of PNG files go into a directory of their own
+	if (format == SCREEN_CAPTURE_PNG && frames != 1)
+	{
+		error_code error;
+		filesystem::create_directories(path, error);
+		if (error)
+		{
+			lock_guard<mutex> lock(queueMutex);
+			stats.error = string("Could not create ") + path;
+			return false;
+		}
+	}
+
+	current = make_shared<Recording>();
+	current->path = path;
+	current->format = format;
+	current->frames = frames;
+	current->frameRate = max(frameRate, 1);
+	current->waitForEncoder = waitForEncoder;
+	current->framesLeft = frames > 0 ? frames : -1;
+
+	lock_guard<mutex> lock(queueMutex);
+	stats.path = path;
+	stats.framesRead = stats.framesWritten = stats.framesDropped = stats.readbackWaits = 0;
+	stats.error.clear();
+	return true;
+}
+
+void stopScreenCapture()
+{
+	current.reset();
+}
+
+bool isScreenCapturing()
+{
+	if (current || pending > 0)
+		return true;
+	lock_guard<mutex> lock(queueMutex);
+	return encoding || !queue.empty();
+}
+
+void readScreenCapture(GLuint framebuffer, int width, int height)
+{
+	if (!current && pending == 0)
+		return;
+	auto start = chrono::steady_clock::now();
+
+	//Hand over every frame whose transfer has finished, oldest first
+	bool waited = false, read = false;
+	while (pending > 0 && glClientWaitSync(fences[head], 0, 0) != GL_TIMEOUT_EXPIRED)
+		collectOldest();
+
+	if (current && width > 0 && height > 0)
+	{
+		//Every buffer is still in flight: the GPU is a whole ring behind, so the oldest has to be waited for
+		if (pending == SCREEN_CAPTURE_BUFFERS)
+		{
+			glClientWaitSync(fences[head], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+			collectOldest();
+			waited = true;
+		}
+
+		//Copy the framebuffer into the next buffer (the transfer runs after the frame's commands)
+		int slot = (head + pending) % SCREEN_CAPTURE_BUFFERS;
+		size_t bytes = size_t(width) * height * 4;
+		if (!buffers[slot])
+			glGenBuffers(1, &buffers[slot]);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, buffers[slot]);
+		if (bufferBytes[slot] != bytes)
+		{
+			glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+			bufferBytes[slot] = bytes;
+		}
+		GLint readFramebuffer = 0;
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &readFramebuffer);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, GLuint(readFramebuffer));
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+		inFlight[slot].recording = current;
+		inFlight[slot].width = width;
+		inFlight[slot].height = height;
+		inFlight[slot].index = current->nextFrame++;
+		pending++;
+		read = true;
+
+		if (current->framesLeft > 0 && --current->framesLeft == 0)
+			current.reset();
+	}
+
+	double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	lock_guard<mutex> lock(queueMutex);
+	if (waited)
+		stats.readbackWaits++;
+	if (read)
+		stats.framesRead++;
+	stats.readbackMs += (ms - stats.readbackMs) * smoothing;
+}
+
+ScreenCaptureStats getScreenCaptureStats()
+{
+	lock_guard<mutex> lock(queueMutex);
+	ScreenCaptureStats result = stats;
+	result.recording = bool(current);
+	result.active = current || pending > 0 || encoding || !queue.empty();
+	result.queuedFrames = int(queue.size());
+	for (int i = 0; i < SCREEN_CAPTURE_BUFFERS; i++)
+	{
+		result.buffers[i] = buffers[i];
+		result.bufferBytes[i] = bufferBytes[i];
+	}
+	return result;
+}
+
+void destroyScreenCapture()
+{
+	//Frames already read back are still written
+	current.reset();
+	while (pending > 0)
+	{
+		glClientWaitSync(fences[head], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		collectOldest();
+	}
+
+	{
+		lock_guard<mutex> lock(queueMutex);
+		stopping = true;
+	}
+	queueChanged.notify_all();
+	if (encoderThread.joinable())
+		encoderThread.join();
+
+	glDeleteBuffers(SCREEN_CAPTURE_BUFFERS, buffers);
+	for (int i = 0; i < SCREEN_CAPTURE_BUFFERS; i++)
+	{
+		buffers[i] = 0;
+		bufferBytes[i] = 0;
+	}
+	sparePixels.clear();
+}
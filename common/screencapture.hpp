@@ -0,0 +1,68 @@
+#ifndef SCREENCAPTURE_HPP
+#define SCREENCAPTURE_HPP
+
+#include <cstdint>
+#include <string>
+
+#include <GL/glew.h>
+
+//Screen capture
+//Frames are read back without stalling the pipeline: glReadPixels writes into one of a ring of pixel
+//pack buffers with a fence behind it, and the buffer is only mapped frames later, once the fence has
+//signalled. The pixels are handed to an encoder thread that writes PNG files or a raw Y4M video, so the
+//render thread only pays for the copy out of the mapped buffer. Frames the encoder cannot keep up with
+//are dropped (and counted) rather than slowing the application down, unless told to wait for it.
+//Readbacks go around glcapture on purpose: they are output, not part of what a replay draws.
+
+static const int SCREEN_CAPTURE_BUFFERS = 3; //Frames read back but not mapped yet
+
+enum ScreenCaptureFormat
+{
+	SCREEN_CAPTURE_PNG, //One file per frame (uncompressed deflate blocks, no zlib needed)
+	SCREEN_CAPTURE_Y4M //A single raw 4:2:0 video any encoder can read
+};
+
+struct ScreenCaptureStats
+{
+	std::string path; //Current (or last) capture
+	bool recording = false; //Still reading back new frames
+	bool active = false; //Recording, or frames still being read back or encoded
+	int framesRead = 0;
+	int framesWritten = 0;
+	int framesDropped = 0; //The encoder queue was full, or the frame size changed during a video
+	int readbackWaits = 0; //Times a buffer was needed again before its fence had signalled
+	int queuedFrames = 0;
+	double readbackMs = 0.0; //Smoothed render thread cost per frame (polling, mapping and copying)
+	double encodeMs = 0.0; //Smoothed encoder thread time per frame
+	size_t queuedBytes = 0; //Frames waiting for the encoder
+	GLuint buffers[SCREEN_CAPTURE_BUFFERS] = {}; //Pixel pack buffers
+	size_t bufferBytes[SCREEN_CAPTURE_BUFFERS] = {};
+	std::string error;
+};
+
+//Starts the encoder thread
+void initScreenCapture();
+
+//Captures the next frames (0 = until stopped). PNG: a single frame is written to path, more go into the
+//directory path as frame_000000.png and so on. Y4M: path is the video, at frameRate frames a second.
+//waitForEncoder makes the render thread wait instead of dropping frames (for headless runs)
+bool startScreenCapture(const char* path, ScreenCaptureFormat format, int frames, int frameRate = 60, bool waitForEncoder = false);
+
+//Stops reading back new frames; the ones already read back are still written
+void stopScreenCapture();
+
+//True while recording or while frames are still being read back or encoded
+bool isScreenCapturing();
+
+//Once a frame, with the finished image (before the UI) in framebuffer (0 for the window)
+void readScreenCapture(GLuint framebuffer, int width, int height);
+
+ScreenCaptureStats getScreenCaptureStats();
+
+//Writes every frame already read back, then stops the encoder thread
+void destroyScreenCapture();
+
+//Writes RGBA pixels (rows bottom up, as glReadPixels returns them) as an RGB PNG
+bool writePng(const char* path, const uint8_t* rgba, int width, int height);
+
+#endif
@@ -0,0 +1,267 @@
+#include "shadervariants.hpp"
+#include "glcapture.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+using namespace std;
+
+static bool readSource(const string& path, string& source)
+{
+	ifstream stream(path, ios::in);
+	if (!stream.is_open())
+	{
+		cout << "Impossible to open " << path << ". Are you in the right directory?" << endl;
+		return false;
+	}
+
+	stringstream buffer;
+	buffer << stream.rdbuf();
+	source = buffer.str();
+	return true;
+}
+
+//The defines go right after #version (which has to stay first); #line keeps error messages pointing at the file's own lines
+static string insertDefines(const string& source, const string& defineBlock)
+{
+	size_t version = source.find("#version");
+	if (version == string::npos)
+		return defineBlock + "#line 1\n" + source;
+
+	size_t lineEnd = source.find('\n', version);
+	if (lineEnd == string::npos)
+		return source + "\n" + defineBlock;
+
+	int versionLine = 1;
+	for (size_t i = 0; i < lineEnd; i++)
+		versionLine += source[i] == '\n';
+	return source.substr(0, lineEnd + 1) + defineBlock + "#line " + to_string(versionLine + 1) + "\n" + source.substr(lineEnd + 1);
+}
+
+//FNV-1a
+static uint64_t hashText(const string& text, uint64_t hash = 14695981039346656037ull)
+{
+	for (unsigned char c : text)
+	{
+		hash ^= c;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static bool compileStage(GLenum stage, const string& source, const string& path, GLuint& shader)
+{
+	shader = glCreateShader(stage);
+	const char* sourcePointer = source.c_str();
+	glShaderSource(shader, 1, &sourcePointer, NULL);
+	glCompileShader(shader);
+
+	GLint result = GL_FALSE;
+	int infoLogLength;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
+	glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &infoLogLength);
+	if (infoLogLength > 1)
+	{
+		vector<char> message(infoLogLength + 1);
+		glGetShaderInfoLog(shader, infoLogLength, NULL, &message[0]);
+		cout << path << ": " << &message[0] << endl;
+	}
+	return result == GL_TRUE;
+}
+
+static bool linked(GLuint program)
+{
+	GLint result = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &result);
+	return result == GL_TRUE;
+}
+
+static GLuint loadCachedBinary(const string& path)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file)
+		return 0;
+
+	GLenum format = 0;
+	vector<char> binary;
+	bool ok = fread(&format, sizeof(format), 1, file) == 1;
+	if (ok)
+	{
+		fseek(file, 0, SEEK_END);
+		long size = ftell(file) - long(sizeof(format));
+		fseek(file, sizeof(format), SEEK_SET);
+		ok = size > 0;
+		if (ok)
+		{
+			binary.resize(size);
+			ok = fread(&binary[0], 1, size, file) == size_t(size);
+		}
+	}
+	fclose(file);
+	if (!ok)
+		return 0;
+
+	//A driver update invalidates binaries; the program is then simply built from source again
+	GLuint program = glCreateProgram();
+	glProgramBinary(program, format, &binary[0], GLsizei(binary.size()));
+	if (!linked(program))
+	{
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+static void storeCachedBinary(const string& path, GLuint program)
+{
+	GLint length = 0;
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0)
+		return;
+
+	vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(program, length, NULL, &format, &binary[0]);
+
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file)
+		return;
+	fwrite(&format, sizeof(format), 1, file);
+	fwrite(&binary[0], 1, binary.size(), file);
+	fclose(file);
+}
+
+static GLuint buildProgram(ShaderVariants& variants, const string& defineBlock)
+{
+	string vertexSource = insertDefines(variants.vertexSource, defineBlock);
+	string fragmentSource = insertDefines(variants.fragmentSource, defineBlock);
+	string geometrySource = variants.geometryPath.empty() ? string() : insertDefines(variants.geometrySource, defineBlock);
+
+	//The key covers everything the binary depends on: the generated sources and the driver that compiled them
+	string driver = string((const char*)glGetString(GL_VENDOR)) + (const char*)glGetString(GL_RENDERER) + (const char*)glGetString(GL_VERSION);
+	uint64_t key = hashText(geometrySource, hashText(fragmentSource, hashText(vertexSource, hashText(driver))));
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+	string cachePath = (filesystem::path(variants.cacheDirectory) / name).string();
+
+	GLuint program = loadCachedBinary(cachePath);
+	if (program)
+	{
+		vector<pair<GLenum, string>> stages = { { GL_VERTEX_SHADER, vertexSource }, { GL_FRAGMENT_SHADER, fragmentSource } };
+		if (!variants.geometryPath.empty())
+			stages.push_back({ GL_GEOMETRY_SHADER, geometrySource });
+		setCapturedProgramSources(program, stages);
+		variants.loadedFromCache++;
+		return program;
+	}
+
+	GLuint vertexShader = 0, fragmentShader = 0, geometryShader = 0;
+	bool ok = compileStage(GL_VERTEX_SHADER, vertexSource, variants.vertexPath, vertexShader);
+	ok = compileStage(GL_FRAGMENT_SHADER, fragmentSource, variants.fragmentPath, fragmentShader) && ok;
+	if (!variants.geometryPath.empty())
+		ok = compileStage(GL_GEOMETRY_SHADER, geometrySource, variants.geometryPath, geometryShader) && ok;
+
+	if (ok)
+	{
+		program = glCreateProgram();
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glAttachShader(program, vertexShader);
+		if (geometryShader)
+			glAttachShader(program, geometryShader);
+		glAttachShader(program, fragmentShader);
+		glLinkProgram(program);
+
+		int infoLogLength;
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLogLength);
+		if (infoLogLength > 1)
+		{
+			vector<char> message(infoLogLength + 1);
+			glGetProgramInfoLog(program, infoLogLength, NULL, &message[0]);
+			cout << &message[0];
+		}
+
+		if (linked(program))
+		{
+			error_code error;
+			filesystem::create_directories(variants.cacheDirectory, error);
+			storeCachedBinary(cachePath, program);
+			variants.compiled++;
+		}
+		else
+		{
+			glDeleteProgram(program);
+			program = 0;
+		}
+	}
+
+	if (!program)
+		cout << "Shader permutation of " << variants.vertexPath << " failed to build:\n" << defineBlock;
+
+	glDeleteShader(vertexShader);
+	glDeleteShader(fragmentShader);
+	if (geometryShader)
+		glDeleteShader(geometryShader);
+	return program;
+}
+
+void initShaderVariants(ShaderVariants& variants, const char* vertexPath, const char* fragmentPath, const char* geometryPath, const char* cacheDirectory)
+{
+	destroyShaderVariants(variants);
+	variants.vertexPath = vertexPath;
+	variants.fragmentPath = fragmentPath;
+	variants.geometryPath = geometryPath;
+	variants.cacheDirectory = cacheDirectory;
+}
+
+GLuint getShaderVariant(ShaderVariants& variants, const ShaderDefine* defines, int count)
+{
+	string& defineBlock = variants.key;
+	defineBlock.clear();
+	for (int i = 0; i < count; i++)
+	{
+		char value[16];
+		snprintf(value, sizeof(value), " %d\n", defines[i].value);
+		defineBlock.append("#define ").append(defines[i].name).append(value);
+	}
+
+	auto existing = variants.programs.find(defineBlock);
+	if (existing != variants.programs.end())
+		return existing->second;
+
+	auto start = chrono::steady_clock::now();
+	if (!variants.sourcesLoaded)
+	{
+		variants.sourcesLoaded = readSource(variants.vertexPath, variants.vertexSource);
+		variants.sourcesLoaded = readSource(variants.fragmentPath, variants.fragmentSource) && variants.sourcesLoaded;
+		if (!variants.geometryPath.empty())
+			variants.sourcesLoaded = readSource(variants.geometryPath, variants.geometrySource) && variants.sourcesLoaded;
+	}
+
+	//Missing sources count as a failed build until the next reload
+	GLuint program = variants.sourcesLoaded ? buildProgram(variants, defineBlock) : 0;
+	variants.programs[defineBlock] = program;
+	variants.buildMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	return program;
+}
+
+void reloadShaderVariants(ShaderVariants& variants)
+{
+	for (auto& entry : variants.programs)
+		glDeleteProgram(entry.second);
+	variants.programs.clear();
+	variants.vertexSource.clear();
+	variants.fragmentSource.clear();
+	variants.geometrySource.clear();
+	variants.sourcesLoaded = false;
+}
+
+void destroyShaderVariants(ShaderVariants& variants)
+{
+	reloadShaderVariants(variants);
+	variants.compiled = variants.loadedFromCache = 0;
+	variants.buildMs = 0.0;
+}
@@ -0,0 +1,56 @@
+#ifndef SHADERVARIANTS_HPP
+#define SHADERVARIANTS_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+
+//Shader permutations
+//One source file per stage is turned into a family of programs by inserting #define lines after its
+//#version directive. A permutation is only compiled the first time it is asked for, and its linked
+//binary is stored in a cache directory (keyed by the generated sources and the driver), so later
+//runs load it with glProgramBinary instead of compiling again.
+
+struct ShaderDefine
+{
+	const char* name; //Not copied (a string literal)
+	int value;
+};
+
+struct ShaderVariants
+{
+	std::string vertexPath;
+	std::string fragmentPath;
+	std::string geometryPath;
+	std::string cacheDirectory;
+
+	//Read on first use, dropped again by reloadShaderVariants
+	std::string vertexSource;
+	std::string fragmentSource;
+	std::string geometrySource;
+	bool sourcesLoaded = false;
+
+	//Programs by their define block (0 when the permutation failed to build, so it is not retried every frame)
+	std::map<std::string, GLuint> programs;
+	std::string key; //Scratch of the lookups, reused so finding a built permutation allocates nothing
+
+	//Statistics
+	int compiled = 0;
+	int loadedFromCache = 0;
+	double buildMs = 0.0; //Total time spent compiling and loading binaries
+};
+
+void initShaderVariants(ShaderVariants& variants, const char* vertexPath, const char* fragmentPath, const char* geometryPath = "",
+						const char* cacheDirectory = "shadercache");
+
+//The program for this set of defines, built (or loaded from the binary cache) on first use
+GLuint getShaderVariant(ShaderVariants& variants, const ShaderDefine* defines, int count);
+
+//Deletes every program and re-reads the sources on next use (cached binaries of edited sources no longer match)
+void reloadShaderVariants(ShaderVariants& variants);
+
+void destroyShaderVariants(ShaderVariants& variants);
+
+#endif
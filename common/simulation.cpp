@@ -0,0 +1,234 @@
+#include "simulation.hpp"
+
+#include <GLFW/glfw3.h>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <mutex>
+#include <thread>
+using namespace std;
+
+static const float cameraSpeed = 3.0f; //Units per second
+static const float mouseSpeed = 0.005f; //Radians per pixel
+static const float lightSpeed = glm::radians(60.0f); //Radians per second
+
+static thread simulationThread;
+static atomic<bool> running{ false };
+static double tickSeconds = 1.0 / 120.0;
+
+//Input written by the main thread
+static atomic<uint32_t> inputKeys{ 0 };
+static atomic<double> lookX{ 0.0 }, lookY{ 0.0 }; //Running totals in pixels (single writer)
+static atomic<double> pendingInputTime{ 0.0 }; //Oldest input not applied by a tick yet
+static atomic<float> groundHeight{ -FLT_MAX };
+
+//Triple buffer: the simulation writes into its back slot and swaps it with the middle one, the render
+//thread swaps its front slot with the middle one when the fresh bit is set
+static SimulationSnapshot slots[3];
+static const unsigned freshBit = 4;
+static atomic<unsigned> middleSlot{ 1 };
+static unsigned backSlot = 0; //Simulation thread only
+static unsigned frontSlot = 2; //Render thread only
+
+static mutex statsMutex;
+static SimulationStats stats;
+
+//Oldest of two input times (0 = none)
+static double earliest(double a, double b)
+{
+	if (a == 0.0)
+		return b;
+	if (b == 0.0)
+		return a;
+	return min(a, b);
+}
+
+static void publish(const SimulationState& previous, const SimulationState& current)
+{
+	slots[backSlot].previous = previous;
+	slots[backSlot].current = current;
+	unsigned old = middleSlot.exchange(backSlot | freshBit, memory_order_acq_rel);
+	backSlot = old & 3;
+
+	//The replaced snapshot was never read: its input only shows up from the next one on
+	if (old & freshBit)
+	{
+		double unseen = slots[backSlot].current.inputTime;
+		if (unseen != 0.0)
+		{
+			double expected = pendingInputTime.load();
+			while (!pendingInputTime.compare_exchange_weak(expected, earliest(expected, unseen)))
+				;
+		}
+	}
+}
+
+static void tick(SimulationState& state, double& lastLookX, double& lastLookY)
+{
+	float deltaTime = float(tickSeconds);
+	uint32_t keys = inputKeys.load(memory_order_relaxed);
+
+	//Mouse look since the last tick
+	double totalX = lookX.load(memory_order_relaxed), totalY = lookY.load(memory_order_relaxed);
+	state.horizontalAngle -= mouseSpeed * float(totalX - lastLookX);
+	state.verticalAngle -= mouseSpeed * float(totalY - lastLookY);
+	lastLookX = totalX;
+	lastLookY = totalY;
+
+	//Same basis as computeCameraMatrices
+	glm::vec3 direction(cos(state.verticalAngle) * sin(state.horizontalAngle), sin(state.verticalAngle), cos(state.verticalAngle) * cos(state.horizontalAngle));
+	glm::vec3 right(sin(state.horizontalAngle - 3.14f / 2.0f), 0, cos(state.horizontalAngle - 3.14f / 2.0f));
+
+	if (keys & SIM_KEY_FORWARD)
+		state.cameraPosition += direction * deltaTime * cameraSpeed;
+	if (keys & SIM_KEY_BACKWARD)
+		state.cameraPosition -= direction * deltaTime * cameraSpeed;
+	if (keys & SIM_KEY_RIGHT)
+		state.cameraPosition += right * deltaTime * cameraSpeed;
+	if (keys & SIM_KEY_LEFT)
+		state.cameraPosition -= right * deltaTime * cameraSpeed;
+	state.cameraPosition.y = max(state.cameraPosition.y, groundHeight.load(memory_order_relaxed));
+
+	//The light turns while its keys are held
+	float lightAngleX = lightSpeed * deltaTime * (((keys & SIM_KEY_LIGHT_X_POSITIVE) ? 1.0f : 0.0f) - ((keys & SIM_KEY_LIGHT_X_NEGATIVE) ? 1.0f : 0.0f));
+	float lightAngleZ = lightSpeed * deltaTime * (((keys & SIM_KEY_LIGHT_Z_POSITIVE) ? 1.0f : 0.0f) - ((keys & SIM_KEY_LIGHT_Z_NEGATIVE) ? 1.0f : 0.0f));
+	if (lightAngleX != 0.0f)
+		state.lightPos = glm::vec3(glm::rotate(glm::mat4(1.0f), lightAngleX, glm::vec3(1, 0, 0)) * glm::vec4(state.lightPos, 0.0f));
+	if (lightAngleZ != 0.0f)
+		state.lightPos = glm::vec3(glm::rotate(glm::mat4(1.0f), lightAngleZ, glm::vec3(0, 0, 1)) * glm::vec4(state.lightPos, 0.0f));
+}
+
+static void simulationLoop(SimulationState state)
+{
+	double lastLookX = lookX.load(), lastLookY = lookY.load();
+	double next = glfwGetTime();
+	state.time = next;
+	SimulationState previous = state;
+
+	while (running.load(memory_order_relaxed))
+	{
+		//Sleep until the tick is due (the last fraction of a millisecond is spun, sleeps overshoot)
+		double now = glfwGetTime();
+		if (now < next)
+		{
+			if (next - now > 0.002)
+				this_thread::sleep_for(chrono::duration<double>(next - now - 0.001));
+			else
+				this_thread::yield();
+			continue;
+		}
+
+		//Short stalls are caught up tick by tick so movement does not depend on timing; after a long one
+		//(a debugger break) the clock is resynchronised instead
+		bool late = now - next > tickSeconds;
+		if (now - next > 0.25)
+			next = now;
+
+		//The state at next covers the input sampled up to then
+		double start = now;
+		previous = state;
+		tick(state, lastLookX, lastLookY);
+		state.tick++;
+		state.time = next;
+		state.inputTime = pendingInputTime.exchange(0.0);
+		publish(previous, state);
+		next += tickSeconds;
+
+		lock_guard<mutex> lock(statsMutex);
+		stats.ticks++;
+		stats.lateTicks += late;
+		stats.tickMs += ((glfwGetTime() - start) * 1000.0 - stats.tickMs) * 0.05;
+	}
+}
+
+void startSimulation(double ticksPerSecond, const SimulationState& initial)
+{
+	stopSimulation();
+
+	tickSeconds = 1.0 / ticksPerSecond;
+	stats = SimulationStats();
+	stats.tickRate = ticksPerSecond;
+
+	//Both states of the first snapshot are the initial one, so the render thread has something to show
+	SimulationState state = initial;
+	state.time = glfwGetTime();
+	for (SimulationSnapshot& slot : slots)
+		slot.previous = slot.current = state;
+	middleSlot = 1;
+	backSlot = 0;
+	frontSlot = 2;
+
+	running = true;
+	simulationThread = thread(simulationLoop, state);
+}
+
+void stopSimulation()
+{
+	if (!running)
+		return;
+	running = false;
+	simulationThread.join();
+}
+
+void setSimulationKeys(uint32_t keys, double time)
+{
+	if (inputKeys.exchange(keys) == keys)
+		return;
+
+	double expected = pendingInputTime.load();
+	while (!pendingInputTime.compare_exchange_weak(expected, earliest(expected, time)))
+		;
+}
+
+void addSimulationLook(float deltaX, float deltaY, double time)
+{
+	if (deltaX == 0.0f && deltaY == 0.0f)
+		return;
+
+	//Only the main thread writes the totals
+	lookX.store(lookX.load(memory_order_relaxed) + deltaX, memory_order_relaxed);
+	lookY.store(lookY.load(memory_order_relaxed) + deltaY, memory_order_relaxed);
+
+	double expected = pendingInputTime.load();
+	while (!pendingInputTime.compare_exchange_weak(expected, earliest(expected, time)))
+		;
+}
+
+void setSimulationGround(float height)
+{
+	groundHeight.store(height, memory_order_relaxed);
+}
+
+bool readSimulation(SimulationSnapshot& snapshot)
+{
+	if (!(middleSlot.load(memory_order_acquire) & freshBit))
+		return false;
+	frontSlot = middleSlot.exchange(frontSlot, memory_order_acq_rel) & 3;
+	snapshot = slots[frontSlot];
+	return true;
+}
+
+SimulationState interpolateSimulation(const SimulationSnapshot& snapshot, double time)
+{
+	const SimulationState& a = snapshot.previous;
+	const SimulationState& b = snapshot.current;
+	double span = b.time - a.time;
+	float t = span > 0.0 ? float(glm::clamp((time - b.time) / span, 0.0, 1.0)) : 1.0f;
+
+	SimulationState state = b;
+	state.cameraPosition = glm::mix(a.cameraPosition, b.cameraPosition, t);
+	state.horizontalAngle = glm::mix(a.horizontalAngle, b.horizontalAngle, t);
+	state.verticalAngle = glm::mix(a.verticalAngle, b.verticalAngle, t);
+	state.lightPos = glm::mix(a.lightPos, b.lightPos, t);
+	state.time = a.time + t * span;
+	return state;
+}
+
+SimulationStats getSimulationStats()
+{
+	lock_guard<mutex> lock(statsMutex);
+	return stats;
+}
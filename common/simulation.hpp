@@ -0,0 +1,74 @@
+#ifndef SIMULATION_HPP
+#define SIMULATION_HPP
+
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+//Fixed-rate simulation
+//Camera movement and the light rotation run on their own thread at a fixed tick rate, from the input the
+//main thread samples (GLFW can only be polled there). Every tick publishes the previous and the new
+//state through a lock-free triple buffer; the render thread takes the newest pair and interpolates
+//between them at its own time, so motion stays smooth and input is applied at the same rate however
+//long a frame takes. Rendering runs one tick behind the simulation.
+
+enum SimulationKey
+{
+	SIM_KEY_FORWARD = 1 << 0,
+	SIM_KEY_BACKWARD = 1 << 1,
+	SIM_KEY_RIGHT = 1 << 2,
+	SIM_KEY_LEFT = 1 << 3,
+	SIM_KEY_LIGHT_X_POSITIVE = 1 << 4, //Light rotation around the x axis
+	SIM_KEY_LIGHT_X_NEGATIVE = 1 << 5,
+	SIM_KEY_LIGHT_Z_POSITIVE = 1 << 6, //Light rotation around the z axis
+	SIM_KEY_LIGHT_Z_NEGATIVE = 1 << 7
+};
+
+struct SimulationState
+{
+	glm::vec3 cameraPosition = glm::vec3(0, 2, 0);
+	float horizontalAngle = 0.0f;
+	float verticalAngle = 0.0f;
+	glm::vec3 lightPos = glm::vec3(0, -0.5, -0.5);
+
+	double time = 0.0; //glfwGetTime of the tick that produced this state
+	double inputTime = 0.0; //When the oldest input first applied in this state (and in no snapshot read before) was sampled, 0 if none
+	unsigned long long tick = 0;
+};
+
+struct SimulationSnapshot
+{
+	SimulationState previous;
+	SimulationState current;
+};
+
+struct SimulationStats
+{
+	double tickRate = 0.0; //Ticks per second
+	unsigned long long ticks = 0;
+	unsigned long long lateTicks = 0; //Ticks that started more than a whole tick late
+	double tickMs = 0.0; //Smoothed CPU time of a tick
+};
+
+//Starts the thread (ticksPerSecond ticks a second), beginning from initial
+void startSimulation(double ticksPerSecond, const SimulationState& initial);
+void stopSimulation();
+
+//Input from the main thread: the movement and light keys held (SimulationKey bits), and mouse look in
+//pixels. time is when the input was sampled (glfwGetTime)
+void setSimulationKeys(uint32_t keys, double time);
+void addSimulationLook(float deltaX, float deltaY, double time);
+
+//Height the camera has to stay above where it currently is (the render thread owns the terrain, so it
+//passes this every frame; -FLT_MAX for no limit)
+void setSimulationGround(float height);
+
+//Takes the newest snapshot if one was published since the last call; otherwise snapshot keeps the one it holds
+bool readSimulation(SimulationSnapshot& snapshot);
+
+//State at time, between the snapshot's two states (one tick behind the newest)
+SimulationState interpolateSimulation(const SimulationSnapshot& snapshot, double time);
+
+SimulationStats getSimulationStats();
+
+#endif
@@ -0,0 +1,382 @@
+#include "skylight.hpp"
+#include "glcapture.hpp"
+#include "jobs.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+#include <string>
+using namespace std;
+
+static const uint32_t SKY_CACHE_VERSION = 1;
+static const int LANES = 8; //Partial sums kept per coefficient (a vector register of floats)
+static const float PI = 3.14159265f;
+
+//Cosine lobe convolution of each band, divided by pi (Ramamoorthi and Hanrahan)
+static const float bandScale[3] = { 1.0f, 2.0f / 3.0f, 0.25f };
+static const int coefficientBand[SKY_SH_COEFFICIENTS] = { 0, 1, 1, 1, 2, 2, 2, 2, 2 };
+
+//Direction through (s, t) in [-1, 1] of a face in the GL cube map convention (row 0 of the image is t = -1)
+static glm::vec3 faceDirection(int face, float s, float t)
+{
+	switch (face)
+	{
+	case 0: return glm::vec3(1.0f, -t, -s);
+	case 1: return glm::vec3(-1.0f, -t, s);
+	case 2: return glm::vec3(s, 1.0f, t);
+	case 3: return glm::vec3(s, -1.0f, -t);
+	case 4: return glm::vec3(s, -t, 1.0f);
+	default: return glm::vec3(-s, -t, -1.0f);
+	}
+}
+
+//The basis in the order of skyAmbient in the shaders
+static void shBasis(float x, float y, float z, float* basis)
+{
+	basis[0] = 0.282095f;
+	basis[1] = 0.488603f * y;
+	basis[2] = 0.488603f * z;
+	basis[3] = 0.488603f * x;
+	basis[4] = 1.092548f * x * y;
+	basis[5] = 1.092548f * y * z;
+	basis[6] = 0.315392f * (3.0f * z * z - 1.0f);
+	basis[7] = 1.092548f * x * z;
+	basis[8] = 0.546274f * (x * x - y * y);
+}
+
+//One row of a face as structure of arrays, padded with zero weights to a multiple of LANES, so every
+//loop below is the same operation over consecutive floats
+struct FaceRow
+{
+	vector<float> x, y, z, weight;
+	vector<float> colour[3]; //Weighted by the texel's solid angle
+
+	void resize(int texels)
+	{
+		int padded = (texels + LANES - 1) / LANES * LANES;
+		for (vector<float>* lane : { &x, &y, &z, &weight, &colour[0], &colour[1], &colour[2] })
+			lane->assign(padded, 0.0f);
+	}
+};
+
+static void fillRow(FaceRow& row, const SkyFace& face, int faceIndex, int j, int size)
+{
+	//The face's plane: direction = centre + s * right + t * down
+	glm::vec3 centre = faceDirection(faceIndex, 0.0f, 0.0f);
+	glm::vec3 right = faceDirection(faceIndex, 1.0f, 0.0f) - centre;
+	glm::vec3 down = faceDirection(faceIndex, 0.0f, 1.0f) - centre;
+	float t = 2.0f * (j + 0.5f) / size - 1.0f;
+	glm::vec3 rowStart = centre + t * down;
+
+	float* x = row.x.data();
+	float* y = row.y.data();
+	float* z = row.z.data();
+	float* weight = row.weight.data();
+	for (int i = 0; i < size; i++)
+	{
+		float s = 2.0f * (i + 0.5f) / size - 1.0f;
+		float inverseLength = 1.0f / sqrt(1.0f + s * s + t * t);
+		x[i] = (rowStart.x + s * right.x) * inverseLength;
+		y[i] = (rowStart.y + s * right.y) * inverseLength;
+		z[i] = (rowStart.z + s * right.z) * inverseLength;
+		weight[i] = inverseLength * inverseLength * inverseLength; //Solid angle of the texel, up to a constant
+	}
+
+	const unsigned char* pixels = face.pixels + size_t(j) * size * face.channels;
+	int stride = face.channels, green = face.channels >= 3 ? 1 : 0, blue = face.channels >= 3 ? 2 : 0;
+	for (int i = 0; i < size; i++)
+	{
+		float w = weight[i] / 255.0f;
+		row.colour[0][i] = pixels[i * stride] * w;
+		row.colour[1][i] = pixels[i * stride + green] * w;
+		row.colour[2][i] = pixels[i * stride + blue] * w;
+	}
+}
+
+//Adds basis(x, y, z) times the colour over a row to one coefficient. Each channel is summed in LANES
+//independent partial sums, which the compiler keeps in the lanes of a vector register
+template <typename Basis>
+static void accumulateCoefficient(const FaceRow& row, Basis basis, double* coefficient)
+{
+	const float* x = row.x.data();
+	const float* y = row.y.data();
+	const float* z = row.z.data();
+	const float* red = row.colour[0].data();
+	const float* green = row.colour[1].data();
+	const float* blue = row.colour[2].data();
+	float r[LANES] = {}, g[LANES] = {}, b[LANES] = {};
+	for (int i = 0; i < int(row.x.size()); i += LANES)
+	{
+		for (int lane = 0; lane < LANES; lane++)
+		{
+			float value = basis(x[i + lane], y[i + lane], z[i + lane]);
+			r[lane] += value * red[i + lane];
+			g[lane] += value * green[i + lane];
+			b[lane] += value * blue[i + lane];
+		}
+	}
+	for (int lane = 0; lane < LANES; lane++)
+	{
+		coefficient[0] += r[lane];
+		coefficient[1] += g[lane];
+		coefficient[2] += b[lane];
+	}
+}
+
+static void projectFaces(SkyLighting& sky, const SkyFace faces[6], int size)
+{
+	double totals[SKY_SH_COEFFICIENTS * 3] = {};
+	double totalWeight = 0.0;
+	mutex totalsMutex;
+
+	parallelFor(0, 6 * size, 16, [&](int first, int last)
+	{
+		FaceRow row;
+		row.resize(size);
+		double chunk[SKY_SH_COEFFICIENTS * 3] = {};
+		double chunkWeight = 0.0;
+
+		for (int index = first; index < last; index++)
+		{
+			int face = index / size;
+			fillRow(row, faces[face], face, index % size, size);
+
+			//The same basis (and order) as skyAmbient in the shaders; a row's worth of float sums is folded into doubles
+			accumulateCoefficient(row, [](float, float, float) { return 0.282095f; }, &chunk[0]);
+			accumulateCoefficient(row, [](float, float y, float) { return 0.488603f * y; }, &chunk[3]);
+			accumulateCoefficient(row, [](float, float, float z) { return 0.488603f * z; }, &chunk[6]);
+			accumulateCoefficient(row, [](float x, float, float) { return 0.488603f * x; }, &chunk[9]);
+			accumulateCoefficient(row, [](float x, float y, float) { return 1.092548f * x * y; }, &chunk[12]);
+			accumulateCoefficient(row, [](float, float y, float z) { return 1.092548f * y * z; }, &chunk[15]);
+			accumulateCoefficient(row, [](float, float, float z) { return 0.315392f * (3.0f * z * z - 1.0f); }, &chunk[18]);
+			accumulateCoefficient(row, [](float x, float, float z) { return 1.092548f * x * z; }, &chunk[21]);
+			accumulateCoefficient(row, [](float x, float y, float) { return 0.546274f * (x * x - y * y); }, &chunk[24]);
+
+			float weights[LANES] = {};
+			for (int i = 0; i < int(row.weight.size()); i += LANES)
+				for (int lane = 0; lane < LANES; lane++)
+					weights[lane] += row.weight[i + lane];
+			for (int lane = 0; lane < LANES; lane++)
+				chunkWeight += weights[lane];
+		}
+
+		lock_guard<mutex> lock(totalsMutex);
+		for (int c = 0; c < SKY_SH_COEFFICIENTS * 3; c++)
+			totals[c] += chunk[c];
+		totalWeight += chunkWeight;
+	});
+
+	//The weights cover the whole sphere, so they normalise the solid angles to 4 pi
+	double scale = 4.0 * PI / max(totalWeight, 1e-9);
+	for (int k = 0; k < SKY_SH_COEFFICIENTS; k++)
+	{
+		float band = bandScale[coefficientBand[k]];
+		sky.irradiance[k] = glm::vec3(float(totals[k * 3] * scale), float(totals[k * 3 + 1] * scale), float(totals[k * 3 + 2] * scale)) * band;
+	}
+}
+
+//Box filters every face down to the specular size, then convolves the whole sphere with a Phong lobe
+static void prefilterSpecular(SkyLighting& sky, const SkyFace faces[6], int size)
+{
+	int target = max(1, min(sky.specularSize, size));
+	sky.specularSize = target;
+	int texels = target * target;
+
+	//Downsampled source, with the direction and solid angle of each texel
+	vector<glm::vec3> colour(6 * texels), direction(6 * texels);
+	vector<float> solidAngle(6 * texels);
+	parallelFor(0, 6 * target, 4, [&](int first, int last)
+	{
+		for (int index = first; index < last; index++)
+		{
+			int face = index / target, j = index % target;
+			int y0 = j * size / target, y1 = (j + 1) * size / target;
+			for (int i = 0; i < target; i++)
+			{
+				int x0 = i * size / target, x1 = (i + 1) * size / target;
+				glm::vec3 sum(0.0f);
+				for (int y = y0; y < y1; y++)
+				{
+					for (int x = x0; x < x1; x++)
+					{
+						const unsigned char* pixel = faces[face].pixels + (size_t(y) * size + x) * faces[face].channels;
+						int channels = faces[face].channels;
+						sum += glm::vec3(pixel[0], pixel[channels >= 3 ? 1 : 0], pixel[channels >= 3 ? 2 : 0]);
+					}
+				}
+				float s = 2.0f * (i + 0.5f) / target - 1.0f, t = 2.0f * (j + 0.5f) / target - 1.0f;
+				size_t texel = size_t(face) * texels + size_t(j) * target + i;
+				colour[texel] = sum / (255.0f * (x1 - x0) * (y1 - y0));
+				direction[texel] = glm::normalize(faceDirection(face, s, t));
+				solidAngle[texel] = pow(1.0f + s * s + t * t, -1.5f);
+			}
+		}
+	});
+
+	//Texels where the lobe has fallen below 1/1000 of its peak are skipped
+	float exponent = sky.specularExponent;
+	float cutoff = pow(0.001f, 1.0f / max(exponent, 1.0f));
+	sky.specular.assign(size_t(6) * texels * 3, 0.0f);
+	parallelFor(0, 6 * target, 1, [&](int first, int last)
+	{
+		for (int index = first; index < last; index++)
+		{
+			for (int i = 0; i < target; i++)
+			{
+				size_t texel = size_t(index) * target + i;
+				glm::vec3 reflected = direction[texel];
+				glm::vec3 sum(0.0f);
+				float weight = 0.0f;
+				for (size_t source = 0; source < direction.size(); source++)
+				{
+					float cosine = glm::dot(reflected, direction[source]);
+					if (cosine <= cutoff)
+						continue;
+					float w = pow(cosine, exponent) * solidAngle[source];
+					sum += colour[source] * w;
+					weight += w;
+				}
+				sum /= max(weight, 1e-9f);
+				sky.specular[texel * 3] = sum.r;
+				sky.specular[texel * 3 + 1] = sum.g;
+				sky.specular[texel * 3 + 2] = sum.b;
+			}
+		}
+	});
+}
+
+static uint64_t hashBytes(const void* data, size_t size, uint64_t hash = 14695981039346656037ull)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+uint64_t hashSkyFile(const vector<unsigned char>& bytes)
+{
+	return hashBytes(bytes.data(), bytes.size());
+}
+
+static string cachePath(const SkyLighting& sky, const SkyFace faces[6], const char* cacheDirectory)
+{
+	uint64_t key = hashBytes(&SKY_CACHE_VERSION, sizeof(SKY_CACHE_VERSION));
+	for (int face = 0; face < 6; face++)
+		key = hashBytes(&faces[face].fileHash, sizeof(uint64_t), key);
+	int specularSize = sky.bakeSpecular ? sky.specularSize : 0;
+	key = hashBytes(&specularSize, sizeof(specularSize), key);
+	key = hashBytes(&sky.specularExponent, sizeof(float), key);
+
+	char name[40];
+	snprintf(name, sizeof(name), "sky_%016llx.bin", (unsigned long long)key);
+	return (filesystem::path(cacheDirectory) / name).string();
+}
+
+//Irradiance coefficients, then the specular size and texels
+static bool loadCache(SkyLighting& sky, const string& path)
+{
+	FILE* file = fopen(path.c_str(), "rb");
+	if (!file)
+		return false;
+
+	int32_t specularSize = 0;
+	bool ok = fread(sky.irradiance, sizeof(glm::vec3), SKY_SH_COEFFICIENTS, file) == SKY_SH_COEFFICIENTS &&
+			  fread(&specularSize, sizeof(specularSize), 1, file) == 1 && specularSize >= 0 && specularSize <= 4096;
+	if (ok)
+	{
+		sky.specular.resize(size_t(6) * specularSize * specularSize * 3);
+		ok = fread(sky.specular.data(), sizeof(float), sky.specular.size(), file) == sky.specular.size();
+		sky.specularSize = specularSize;
+	}
+	fclose(file);
+	return ok;
+}
+
+static void storeCache(const SkyLighting& sky, const string& path)
+{
+	error_code error;
+	filesystem::create_directories(filesystem::path(path).parent_path(), error);
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file)
+		return;
+	int32_t specularSize = sky.specular.empty() ? 0 : sky.specularSize;
+	fwrite(sky.irradiance, sizeof(glm::vec3), SKY_SH_COEFFICIENTS, file);
+	fwrite(&specularSize, sizeof(specularSize), 1, file);
+	fwrite(sky.specular.data(), sizeof(float), sky.specular.size(), file);
+	fclose(file);
+}
+
+bool bakeSkyLighting(SkyLighting& sky, const SkyFace faces[6], const char* cacheDirectory)
+{
+	auto start = chrono::steady_clock::now();
+
+	//Square faces of one size only (as a cube map requires)
+	int size = faces[0].width;
+	for (int face = 0; face < 6; face++)
+		if (!faces[face].pixels || faces[face].width != size || faces[face].height != size)
+			return false;
+
+	string path = cachePath(sky, faces, cacheDirectory);
+	sky.fromCache = loadCache(sky, path);
+	if (!sky.fromCache)
+	{
+		projectFaces(sky, faces, size);
+		sky.specular.clear();
+		if (sky.bakeSpecular)
+			prefilterSpecular(sky, faces, size);
+		storeCache(sky, path);
+	}
+
+	if (!sky.specular.empty())
+	{
+		if (!sky.specularTexture)
+			glGenTextures(1, &sky.specularTexture);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, sky.specularTexture);
+		size_t faceFloats = size_t(sky.specularSize) * sky.specularSize * 3;
+		for (int face = 0; face < 6; face++)
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB16F, sky.specularSize, sky.specularSize, 0, GL_RGB, GL_FLOAT,
+						 &sky.specular[face * faceFloats]);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	}
+
+	sky.bakeMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	return true;
+}
+
+glm::vec3 evaluateSkyIrradiance(const SkyLighting& sky, glm::vec3 direction)
+{
+	float basis[SKY_SH_COEFFICIENTS];
+	shBasis(direction.x, direction.y, direction.z, basis);
+	glm::vec3 result(0.0f);
+	for (int k = 0; k < SKY_SH_COEFFICIENTS; k++)
+		result += sky.irradiance[k] * basis[k];
+	return glm::max(result, glm::vec3(0.0f));
+}
+
+void setSkyUniforms(const SkyLighting& sky, GLuint program, float ambientStrength)
+{
+	//Billboards are tinted by the sky they face, relative to its average so their brightness stays the same
+	glm::vec3 average = sky.irradiance[0] * 0.282095f;
+	float luminance = glm::dot(average, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+
+	glUniform3fv(glGetUniformLocation(program, "skyIrradiance"), SKY_SH_COEFFICIENTS, &sky.irradiance[0].x);
+	glUniform1f(glGetUniformLocation(program, "skyAmbientStrength"), ambientStrength);
+	glUniform1f(glGetUniformLocation(program, "skyTintScale"), luminance > 0.0f ? 1.0f / luminance : 0.0f);
+}
+
+void destroySkyLighting(SkyLighting& sky)
+{
+	glDeleteTextures(1, &sky.specularTexture);
+	sky = SkyLighting();
+}
@@ -0,0 +1,63 @@
+#ifndef SKYLIGHT_HPP
+#define SKYLIGHT_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+//Sky lighting
+//Image-based ambient light from the skybox faces, baked once at load time. Every texel of the six faces
+//is projected onto the first 9 real spherical harmonics (weighted by its solid angle) on the job system;
+//each chunk of rows is summed in fixed-width lanes the compiler turns into vector instructions, and the
+//partial sums are merged at the end. The coefficients are convolved with the cosine lobe, so a shader gets
+//the diffuse sky light for any normal from 9 multiply-adds. Optionally a small cube map prefiltered with a
+//Phong lobe is built as well, for glossy sky reflections. Results are cached on disk under a key made of
+//the hashes of the face files and the bake settings, so later runs skip the bake.
+
+static const int SKY_SH_COEFFICIENTS = 9;
+
+//One decoded face, in GL cube map face order (+x, -x, +y, -y, +z, -z)
+struct SkyFace
+{
+	const unsigned char* pixels = nullptr;
+	int width = 0;
+	int height = 0;
+	int channels = 3;
+	uint64_t fileHash = 0; //hashSkyFile of the encoded file
+};
+
+struct SkyLighting
+{
+	//Settings
+	bool bakeSpecular = true;
+	int specularSize = 32; //Texels per face side of the prefiltered cube map
+	float specularExponent = 64.0f; //Phong exponent of the prefilter lobe
+
+	//Irradiance divided by pi (the light a white diffuse surface reflects), as SH coefficients
+	glm::vec3 irradiance[SKY_SH_COEFFICIENTS] = {};
+
+	//Prefiltered radiance, RGB per texel, face after face
+	std::vector<float> specular;
+	GLuint specularTexture = 0;
+
+	bool fromCache = false;
+	double bakeMs = 0.0;
+};
+
+//FNV-1a of a face file's bytes
+uint64_t hashSkyFile(const std::vector<unsigned char>& bytes);
+
+//Projects the faces (or loads the projection cached in cacheDirectory), then uploads the specular cube map
+bool bakeSkyLighting(SkyLighting& sky, const SkyFace faces[6], const char* cacheDirectory);
+
+//Diffuse sky light for a unit direction (what the shaders evaluate)
+glm::vec3 evaluateSkyIrradiance(const SkyLighting& sky, glm::vec3 direction);
+
+//skyIrradiance[9], skyAmbientStrength and skyTintScale of a program using the sky lighting
+void setSkyUniforms(const SkyLighting& sky, GLuint program, float ambientStrength);
+
+void destroySkyLighting(SkyLighting& sky);
+
+#endif
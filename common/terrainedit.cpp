@@ -0,0 +1,458 @@
+#include "terrainedit.hpp"
+#include "clipmap.hpp"
+#include "datasets.hpp"
+#include "framememory.hpp"
+#include "glcapture.hpp"
+#include "jobs.hpp"
+#include "terrainquery.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <limits>
+using namespace std;
+
+static bool isEmpty(const EditRect& rect)
+{
+	return rect.x1 < rect.x0 || rect.z1 < rect.z0;
+}
+
+static void include(EditRect& rect, const EditRect& other)
+{
+	if (isEmpty(other))
+		return;
+	if (isEmpty(rect))
+	{
+		rect = other;
+		return;
+	}
+	rect.x0 = min(rect.x0, other.x0);
+	rect.z0 = min(rect.z0, other.z0);
+	rect.x1 = max(rect.x1, other.x1);
+	rect.z1 = max(rect.z1, other.z1);
+}
+
+static uint32_t floatBits(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static float bitsFloat(uint32_t bits)
+{
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+static void clearHistory(TerrainEditor& editor, vector<EditRecord>& records)
+{
+	for (const EditRecord& record : records)
+		editor.historyBytes -= record.bytes;
+	records.clear();
+}
+
+//Recompute the bounds of the blocks under rect, then the dataset's from every block's (lowering the
+//terrain can lower its minimum or its maximum too, which may lie in blocks outside rect)
+static void updateHeightBounds(TerrainEditor& editor, const EditRect& rect)
+{
+	Dataset& dataset = *editor.dataset;
+	int blocksX = (dataset.width + EDIT_BLOCK_SIZE - 1) / EDIT_BLOCK_SIZE;
+	for (int bz = rect.z0 / EDIT_BLOCK_SIZE; !isEmpty(rect) && bz <= rect.z1 / EDIT_BLOCK_SIZE; bz++)
+	{
+		for (int bx = rect.x0 / EDIT_BLOCK_SIZE; bx <= rect.x1 / EDIT_BLOCK_SIZE; bx++)
+		{
+			glm::vec2 bounds(numeric_limits<float>::max(), -numeric_limits<float>::max());
+			int x1 = min((bx + 1) * EDIT_BLOCK_SIZE, dataset.width), z1 = min((bz + 1) * EDIT_BLOCK_SIZE, dataset.height);
+			for (int z = bz * EDIT_BLOCK_SIZE; z < z1; z++)
+			{
+				const float* row = &dataset.heights[size_t(z) * dataset.width];
+				for (int x = bx * EDIT_BLOCK_SIZE; x < x1; x++)
+				{
+					bounds.x = min(bounds.x, row[x]);
+					bounds.y = max(bounds.y, row[x]);
+				}
+			}
+			editor.blockBounds[size_t(bz) * blocksX + bx] = bounds;
+		}
+	}
+
+	dataset.minHeight = numeric_limits<float>::max();
+	dataset.maxHeight = -numeric_limits<float>::max();
+	for (const glm::vec2& bounds : editor.blockBounds)
+	{
+		dataset.minHeight = min(dataset.minHeight, bounds.x);
+		dataset.maxHeight = max(dataset.maxHeight, bounds.y);
+	}
+}
+
+//Editable copies of what is built from the heights, so edits can patch them by region
+static void prepareDataset(TerrainEditor& editor)
+{
+	if (editor.clipmapHeights)
+		return;
+
+	Dataset& dataset = *editor.dataset;
+	editor.clipmapHeights = editableClipmapHeights(*dataset.clipmapHeights, dataset.heights);
+	editor.heightPyramid = make_shared<HeightPyramid>(*dataset.heightPyramid);
+	dataset.clipmapHeights = editor.clipmapHeights;
+	dataset.heightPyramid = editor.heightPyramid;
+	dataset.edited = true;
+
+	int blocksX = (dataset.width + EDIT_BLOCK_SIZE - 1) / EDIT_BLOCK_SIZE, blocksZ = (dataset.height + EDIT_BLOCK_SIZE - 1) / EDIT_BLOCK_SIZE;
+	editor.blockBounds.resize(size_t(blocksX) * blocksZ);
+	EditRect whole;
+	whole.x0 = whole.z0 = 0;
+	whole.x1 = dataset.width - 1;
+	whole.z1 = dataset.height - 1;
+	updateHeightBounds(editor, whole);
+}
+
+void setEditedDataset(TerrainEditor& editor, Dataset* dataset, int normalResolution)
+{
+	editor.normalResolution = normalResolution;
+	if (editor.dataset == dataset)
+		return;
+
+	editor.dataset = dataset;
+	editor.clipmapHeights.reset();
+	editor.heightPyramid.reset();
+	editor.blockBounds.clear();
+	editor.stroking = false;
+	editor.strokeOriginals.clear();
+	editor.dirty = EditRect();
+	clearHistory(editor, editor.undo);
+	clearHistory(editor, editor.redo);
+}
+
+//Copy the blocks under rect that the stroke has not touched yet
+static void keepOriginals(TerrainEditor& editor, const EditRect& rect)
+{
+	const Dataset& dataset = *editor.dataset;
+	for (int bz = rect.z0 / EDIT_BLOCK_SIZE; bz <= rect.z1 / EDIT_BLOCK_SIZE; bz++)
+	{
+		for (int bx = rect.x0 / EDIT_BLOCK_SIZE; bx <= rect.x1 / EDIT_BLOCK_SIZE; bx++)
+		{
+			vector<float>& original = editor.strokeOriginals[(uint64_t(bz) << 32) | uint32_t(bx)];
+			if (!original.empty())
+				continue;
+
+			int x = bx * EDIT_BLOCK_SIZE, z = bz * EDIT_BLOCK_SIZE;
+			int width = min(EDIT_BLOCK_SIZE, dataset.width - x), height = min(EDIT_BLOCK_SIZE, dataset.height - z);
+			original.resize(size_t(width) * height);
+			for (int row = 0; row < height; row++)
+				copy_n(&dataset.heights[size_t(z + row) * dataset.width + x], width, &original[size_t(row) * width]);
+		}
+	}
+}
+
+void applyTerrainBrush(TerrainEditor& editor, const TerrainQuery& query, glm::vec3 centre, float deltaTime)
+{
+	editor.texelsEdited = 0;
+	if (!editor.dataset || editor.dataset->heights.empty() || query.dataset != editor.dataset)
+		return;
+
+	auto start = chrono::steady_clock::now();
+	Dataset& dataset = *editor.dataset;
+	prepareDataset(editor);
+
+	//Heights are stored before scaleValue
+	float scale = max(query.scale, 1e-4f);
+	if (!editor.stroking)
+	{
+		editor.stroking = true;
+		editor.strokeRect = EditRect();
+		editor.flattenHeight = terrainHeightAt(query, centre.x, centre.z) / scale;
+	}
+
+	//World -> texel mapping of the base mesh (texel centres at integers), as in the terrain queries
+	glm::vec2 k = glm::vec2(dataset.width, dataset.height) / query.worldSize;
+	glm::vec2 b = (0.5f + query.uvOffset) * glm::vec2(dataset.width, dataset.height) - 0.5f;
+	glm::vec2 c = glm::vec2(centre.x, centre.z) * k + b;
+	glm::vec2 r = editor.radius * k;
+
+	EditRect rect;
+	rect.x0 = max(int(ceil(c.x - r.x)), 0);
+	rect.z0 = max(int(ceil(c.y - r.y)), 0);
+	rect.x1 = min(int(floor(c.x + r.x)), dataset.width - 1);
+	rect.z1 = min(int(floor(c.y + r.y)), dataset.height - 1);
+	if (isEmpty(rect))
+		return;
+
+	keepOriginals(editor, rect);
+
+	float amount = editor.strength * deltaTime;
+	float inverseRadius = 1.0f / editor.radius;
+	parallelFor(rect.z0, rect.z1 + 1, 8, [&](int first, int last)
+	{
+		for (int z = first; z < last; z++)
+		{
+			float dz = ((z - b.y) / k.y - centre.z) * inverseRadius;
+			float* row = &dataset.heights[size_t(z) * dataset.width];
+			for (int x = rect.x0; x <= rect.x1; x++)
+			{
+				float dx = ((x - b.x) / k.x - centre.x) * inverseRadius;
+				float distance = dx * dx + dz * dz;
+				if (distance >= 1.0f)
+					continue;
+
+				//Smooth falloff from the centre to the rim
+				float falloff = 1.0f - sqrt(distance);
+				falloff = falloff * falloff * (3.0f - 2.0f * falloff);
+
+				if (editor.brush == BRUSH_RAISE)
+					row[x] += amount * falloff / scale;
+				else if (editor.brush == BRUSH_LOWER)
+					row[x] -= amount * falloff / scale;
+				else
+					row[x] += (editor.flattenHeight - row[x]) * min(amount * falloff, 1.0f);
+			}
+		}
+	});
+
+	updateHeightBounds(editor, rect);
+
+	include(editor.dirty, rect);
+	include(editor.strokeRect, rect);
+	editor.texelsEdited = (rect.x1 - rect.x0 + 1) * (rect.z1 - rect.z0 + 1);
+	editor.brushMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+//XOR of the block's bits before and after, with the unchanged texels left out
+static EditDelta encodeBlock(const Dataset& dataset, uint64_t key, const vector<float>& original)
+{
+	EditDelta delta;
+	delta.x = int(key & 0xffffffffu) * EDIT_BLOCK_SIZE;
+	delta.z = int(key >> 32) * EDIT_BLOCK_SIZE;
+	delta.width = min(EDIT_BLOCK_SIZE, dataset.width - delta.x);
+	delta.height = min(EDIT_BLOCK_SIZE, dataset.height - delta.z);
+
+	uint32_t unchanged = 0;
+	size_t changedCount = 0; //Index of the open run's count, 0 while none is open
+	for (int row = 0; row < delta.height; row++)
+	{
+		const float* current = &dataset.heights[size_t(delta.z + row) * dataset.width + delta.x];
+		for (int x = 0; x < delta.width; x++)
+		{
+			uint32_t bits = floatBits(current[x]) ^ floatBits(original[size_t(row) * delta.width + x]);
+			if (!bits)
+			{
+				changedCount = 0;
+				unchanged++;
+				continue;
+			}
+
+			if (!changedCount)
+			{
+				delta.runs.push_back(unchanged);
+				delta.runs.push_back(0);
+				changedCount = delta.runs.size() - 1;
+				unchanged = 0;
+			}
+			delta.runs[changedCount]++;
+			delta.runs.push_back(bits);
+		}
+	}
+	return delta;
+}
+
+void endTerrainStroke(TerrainEditor& editor)
+{
+	if (!editor.stroking)
+		return;
+	editor.stroking = false;
+
+	EditRecord record;
+	record.rect = editor.strokeRect;
+	for (const auto& [key, original] : editor.strokeOriginals)
+	{
+		EditDelta delta = encodeBlock(*editor.dataset, key, original);
+		if (delta.runs.empty())
+			continue;
+		record.bytes += sizeof(EditDelta) + delta.runs.size() * sizeof(uint32_t);
+		record.blocks.push_back(move(delta));
+	}
+	editor.strokeOriginals.clear();
+	if (record.blocks.empty())
+		return;
+
+	//A new stroke replaces whatever could have been redone
+	clearHistory(editor, editor.redo);
+	editor.historyBytes += record.bytes;
+	editor.undo.push_back(move(record));
+	while (editor.historyBytes > editor.historyBudgetBytes && editor.undo.size() > 1)
+	{
+		editor.historyBytes -= editor.undo.front().bytes;
+		editor.undo.erase(editor.undo.begin());
+	}
+}
+
+//XOR is its own inverse, so the same delta takes the heights either way
+static void applyRecord(TerrainEditor& editor, const EditRecord& record)
+{
+	Dataset& dataset = *editor.dataset;
+	for (const EditDelta& delta : record.blocks)
+	{
+		size_t texel = 0;
+		for (size_t i = 0; i < delta.runs.size();)
+		{
+			texel += delta.runs[i++];
+			uint32_t changed = delta.runs[i++];
+			for (uint32_t c = 0; c < changed; c++, texel++)
+			{
+				int x = delta.x + int(texel % delta.width), z = delta.z + int(texel / delta.width);
+				float& height = dataset.heights[size_t(z) * dataset.width + x];
+				height = bitsFloat(floatBits(height) ^ delta.runs[i++]);
+			}
+		}
+	}
+	updateHeightBounds(editor, record.rect);
+	include(editor.dirty, record.rect);
+}
+
+bool undoTerrainEdit(TerrainEditor& editor)
+{
+	endTerrainStroke(editor);
+	if (editor.undo.empty())
+		return false;
+
+	applyRecord(editor, editor.undo.back());
+	editor.redo.push_back(move(editor.undo.back()));
+	editor.undo.pop_back();
+	return true;
+}
+
+bool redoTerrainEdit(TerrainEditor& editor)
+{
+	endTerrainStroke(editor);
+	if (editor.redo.empty())
+		return false;
+
+	applyRecord(editor, editor.redo.back());
+	editor.undo.push_back(move(editor.redo.back()));
+	editor.redo.pop_back();
+	return true;
+}
+
+//One mip level's part of the upload
+struct LevelUpload
+{
+	int level;
+	EditRect rect;
+	const float* data;
+	int width;
+	size_t offset;
+};
+
+//Upload the changed texels of every level through this frame's region of the upload ring (bound as the
+//pixel unpack buffer, so the copy into the texture happens on the GPU's time)
+static int uploadLevels(TerrainEditor& editor, GLuint heightMapTexture, const EditRect& rect)
+{
+	const Dataset& dataset = *editor.dataset;
+	const ClipmapHeights& mips = *editor.clipmapHeights;
+	int levels = 1 + int(floor(log2(max(dataset.width, dataset.height))));
+
+	//Levels past the end of the clipmap mips (one side already at a texel) are tiny and filtered here in full
+	vector<vector<float>> tail;
+
+	vector<LevelUpload> uploads;
+	size_t bytes = 0;
+	EditRect levelRect = rect;
+	for (int level = 0; level < levels; level++)
+	{
+		int width = max(dataset.width >> level, 1), height = max(dataset.height >> level, 1);
+		if (level > 0)
+		{
+			levelRect.x0 /= 2, levelRect.z0 /= 2;
+			levelRect.x1 = min(levelRect.x1 / 2, width - 1);
+			levelRect.z1 = min(levelRect.z1 / 2, height - 1);
+		}
+
+		const float* data;
+		if (level == 0)
+			data = &dataset.heights[0];
+		else if (level < int(mips.mips.size()))
+			data = &mips.mips[level][0];
+		else
+		{
+			const float* fine = tail.empty() ? &mips.mips.back()[0] : &tail.back()[0];
+			int fineWidth = max(dataset.width >> (level - 1), 1), fineHeight = max(dataset.height >> (level - 1), 1);
+			vector<float> coarse(size_t(width) * height);
+			for (int z = 0; z < height; z++)
+			{
+				int za = min(2 * z, fineHeight - 1), zb = min(2 * z + 1, fineHeight - 1);
+				for (int x = 0; x < width; x++)
+				{
+					int xa = min(2 * x, fineWidth - 1), xb = min(2 * x + 1, fineWidth - 1);
+					coarse[size_t(z) * width + x] = 0.25f * (fine[size_t(za) * fineWidth + xa] + fine[size_t(za) * fineWidth + xb] +
+															 fine[size_t(zb) * fineWidth + xa] + fine[size_t(zb) * fineWidth + xb]);
+				}
+			}
+			tail.push_back(move(coarse));
+			data = &tail.back()[0];
+			levelRect = EditRect();
+			levelRect.x1 = width - 1;
+			levelRect.z1 = height - 1;
+		}
+
+		uploads.push_back({ level, levelRect, data, width, bytes });
+		bytes += size_t(levelRect.x1 - levelRect.x0 + 1) * (levelRect.z1 - levelRect.z0 + 1) * sizeof(float);
+	}
+
+	UploadAllocation staging = uploadAllocate(bytes);
+	uint8_t* mapped = static_cast<uint8_t*>(staging.data);
+	for (const LevelUpload& upload : uploads)
+	{
+		int rowTexels = upload.rect.x1 - upload.rect.x0 + 1;
+		float* out = (float*)(mapped + upload.offset);
+		for (int z = upload.rect.z0; z <= upload.rect.z1; z++, out += rowTexels)
+			copy_n(upload.data + size_t(z) * upload.width + upload.rect.x0, rowTexels, out);
+	}
+	finishUpload(staging);
+
+	int texels = 0;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.buffer);
+	glBindTexture(GL_TEXTURE_2D, heightMapTexture);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	for (const LevelUpload& upload : uploads)
+	{
+		int width = upload.rect.x1 - upload.rect.x0 + 1, height = upload.rect.z1 - upload.rect.z0 + 1;
+		glTexSubImage2D(GL_TEXTURE_2D, upload.level, upload.rect.x0, upload.rect.z0, width, height, GL_RED, GL_FLOAT,
+						(const void*)uintptr_t(staging.offset + upload.offset));
+		texels += width * height;
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return texels;
+}
+
+bool flushTerrainEdits(TerrainEditor& editor, GLuint heightMapTexture, EditRect& texels, EditRect& vertices)
+{
+	editor.texelsUploaded = 0;
+	if (!editor.dataset || isEmpty(editor.dirty))
+		return false;
+
+	auto start = chrono::steady_clock::now();
+	Dataset& dataset = *editor.dataset;
+	texels = editor.dirty;
+	editor.dirty = EditRect();
+
+	//CPU copies first: the texture's mips are taken from the clipmap mips
+	updateClipmapHeights(*editor.clipmapHeights, dataset.heights, texels.x0, texels.z0, texels.x1, texels.z1);
+	updateHeightPyramid(*editor.heightPyramid, dataset.heights, dataset.width, texels.x0, texels.z0, texels.x1, texels.z1);
+
+	datasetVertexRange(editor.normalResolution, dataset.width, texels.x0, texels.x1, vertices.x0, vertices.x1);
+	datasetVertexRange(editor.normalResolution, dataset.height, texels.z0, texels.z1, vertices.z0, vertices.z1);
+	updateDatasetNormals(dataset, editor.normalResolution, vertices.x0, vertices.x1, vertices.z0, vertices.z1);
+
+	editor.texelsUploaded = uploadLevels(editor, heightMapTexture, texels);
+	editor.flushMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	return true;
+}
+
+void destroyTerrainEditor(TerrainEditor& editor)
+{
+	editor = TerrainEditor();
+}
@@ -0,0 +1,118 @@
+#ifndef TERRAINEDIT_HPP
+#define TERRAINEDIT_HPP
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+struct ClipmapHeights;
+struct Dataset;
+struct HeightPyramid;
+struct TerrainQuery;
+
+//Terrain editing
+//Brushes change the heights of the active dataset in place and only mark the rectangle of texels they
+//touched. Once a frame the marked rectangle is propagated to everything built from the heights, inside
+//that rectangle alone: the height map texture and its mips (uploaded with glTexSubImage2D from the frame's
+//upload ring), the clipmap mips, the ray cast pyramid and the grid normals. A stroke keeps the original
+//of every block of texels it touches; when it ends, the XOR of the old and new bits of each block is stored
+//run-length encoded, and undo and redo apply that same delta again. The cost of a stroke follows the
+//brush area, not the size of the height field.
+
+enum TerrainBrush
+{
+	BRUSH_RAISE,
+	BRUSH_LOWER,
+	BRUSH_FLATTEN
+};
+
+static const int EDIT_BLOCK_SIZE = 64; //Texels per side of the blocks a stroke keeps originals of
+
+//Inclusive rectangle of texels (or grid vertices), empty while x1 < x0
+struct EditRect
+{
+	int x0 = 0;
+	int z0 = 0;
+	int x1 = -1;
+	int z1 = -1;
+};
+
+//Changes of one block: alternating runs of unchanged texels and changed texels, each changed
+//texel followed by the XOR of its old and new bits
+struct EditDelta
+{
+	int x = 0;
+	int z = 0;
+	int width = 0;
+	int height = 0;
+	std::vector<uint32_t> runs;
+};
+
+//One stroke (or nothing but the rectangle it touched)
+struct EditRecord
+{
+	std::vector<EditDelta> blocks;
+	EditRect rect;
+	size_t bytes = 0;
+};
+
+struct TerrainEditor
+{
+	//Settings
+	int brush = BRUSH_RAISE;
+	float radius = 0.5f; //World units
+	float strength = 0.5f; //Raise/lower: height change per second at the centre (after scaleValue). Flatten: fraction per second
+	size_t historyBudgetBytes = size_t(64) << 20; //Oldest strokes are forgotten beyond this
+
+	//Dataset being edited; its clipmap mips and ray cast pyramid are replaced by these copies on the first stroke
+	Dataset* dataset = nullptr;
+	int normalResolution = 0;
+	std::shared_ptr<ClipmapHeights> clipmapHeights;
+	std::shared_ptr<HeightPyramid> heightPyramid;
+	std::vector<glm::vec2> blockBounds; //Lowest and highest height of every block, so the dataset's bounds can shrink
+
+	//Current stroke
+	bool stroking = false;
+	float flattenHeight = 0.0f; //Height under the first dab, before scaleValue
+	std::unordered_map<uint64_t, std::vector<float>> strokeOriginals; //Block -> its heights before the stroke
+	EditRect strokeRect;
+
+	std::vector<EditRecord> undo;
+	std::vector<EditRecord> redo;
+	size_t historyBytes = 0;
+
+	//Texels changed since the last flush
+	EditRect dirty;
+
+	//Statistics of the last dab and flush
+	int texelsEdited = 0;
+	int texelsUploaded = 0;
+	double brushMs = 0.0;
+	double flushMs = 0.0;
+};
+
+//Call once a frame with the active dataset; switching datasets ends the stroke and forgets the history
+void setEditedDataset(TerrainEditor& editor, Dataset* dataset, int normalResolution);
+
+//One dab of the brush centred on a terrain position, applied for deltaTime seconds (starts a stroke if needed).
+//The query gives the world -> texel mapping and scaleValue of what is drawn
+void applyTerrainBrush(TerrainEditor& editor, const TerrainQuery& query, glm::vec3 centre, float deltaTime);
+
+//Store the stroke's delta for undo (no-op without a stroke)
+void endTerrainStroke(TerrainEditor& editor);
+
+bool undoTerrainEdit(TerrainEditor& editor);
+bool redoTerrainEdit(TerrainEditor& editor);
+
+//Bring the heights' dependents up to date inside the changed rectangle and upload it into heightMapTexture.
+//Returns false when nothing changed; otherwise texels is the changed rectangle of the height field and vertices
+//the grid vertices (x = outer index) whose normals were recomputed
+bool flushTerrainEdits(TerrainEditor& editor, GLuint heightMapTexture, EditRect& texels, EditRect& vertices);
+
+void destroyTerrainEditor(TerrainEditor& editor);
+
+#endif
@@ -0,0 +1,167 @@
+#include "terraingen.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+//Integer hash of a lattice point (no lookup tables, so a row of lookups is plain vector arithmetic)
+static inline uint32_t hashLattice(uint32_t x, uint32_t y, uint32_t seed)
+{
+	uint32_t h = (x * 0x8da6b343u) ^ (y * 0xd8163841u) ^ (seed * 0xcb1ab31fu);
+	h ^= h >> 15;
+	h *= 0x2c1b3c6du;
+	h ^= h >> 12;
+	h *= 0x297a2d39u;
+	h ^= h >> 15;
+	return h;
+}
+
+//Dot product of the offset with a pseudo-random gradient in [-1, 1]^2
+static inline float gradient(uint32_t h, float dx, float dy)
+{
+	float gx = float(int(h & 0xffu) - 128) * (1.0f / 128.0f);
+	float gy = float(int((h >> 8) & 0xffu) - 128) * (1.0f / 128.0f);
+	return gx * dx + gy * dy;
+}
+
+static inline float fade(float t)
+{
+	return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+//Rows are processed in blocks of a fixed number of samples: with a known trip count the compiler
+//vectorises the loops without remainder handling (buffers are padded to a whole block)
+static const int BLOCK = 16;
+
+//Gradient noise (roughly [-1, 1]) along one row: x = (i + 0.5) * xScale, y fixed
+static void noiseRow(float y, float xScale, int paddedWidth, uint32_t seed, float* out)
+{
+	float fy = floorf(y);
+	uint32_t iy = uint32_t(int32_t(fy));
+	float ty = y - fy;
+	float sy = fade(ty);
+
+	for (int block = 0; block < paddedWidth; block += BLOCK)
+	{
+		float* blockOut = out + block;
+		for (int k = 0; k < BLOCK; k++)
+		{
+			float x = float(block + k) * xScale + 0.5f * xScale;
+			int32_t cell = int32_t(x); //x >= 0, so truncation is floor
+			uint32_t ix = uint32_t(cell);
+			float tx = x - float(cell);
+
+			float n00 = gradient(hashLattice(ix, iy, seed), tx, ty);
+			float n10 = gradient(hashLattice(ix + 1, iy, seed), tx - 1.0f, ty);
+			float n01 = gradient(hashLattice(ix, iy + 1, seed), tx, ty - 1.0f);
+			float n11 = gradient(hashLattice(ix + 1, iy + 1, seed), tx - 1.0f, ty - 1.0f);
+
+			float sx = fade(tx);
+			float bottom = n00 + (n10 - n00) * sx;
+			float top = n01 + (n11 - n01) * sx;
+			blockOut[k] = bottom + (top - bottom) * sy;
+		}
+	}
+}
+
+void generateHeightRows(const TerrainNoise& noise, int width, int firstRow, int rowCount, float* out)
+{
+	int paddedWidth = (width + BLOCK - 1) / BLOCK * BLOCK;
+	vector<float> octave(paddedWidth), weight(paddedWidth), sum(paddedWidth);
+
+	for (int row = 0; row < rowCount; row++)
+	{
+		fill(sum.begin(), sum.end(), 0.0f);
+		fill(weight.begin(), weight.end(), 1.0f);
+
+		//Same lattice scale on both axes, so non-square maps are not stretched
+		float frequency = noise.frequency;
+		float amplitude = 1.0f;
+		float totalAmplitude = 0.0f;
+		for (int o = 0; o < noise.octaves; o++)
+		{
+			float scale = frequency / width;
+			noiseRow((firstRow + row + 0.5f) * scale, scale, paddedWidth, noise.seed + uint32_t(o) * 0x9e3779b9u, &octave[0]);
+
+			for (int block = 0; block < paddedWidth; block += BLOCK)
+			{
+				if (noise.ridged)
+				{
+					//Musgrave's ridged multifractal: sharp crests, and detail only where the coarser octaves are high
+					for (int k = block; k < block + BLOCK; k++)
+					{
+						float signal = 1.0f - fabsf(octave[k]);
+						signal = signal * signal * weight[k];
+						weight[k] = min(max(signal * 2.0f, 0.0f), 1.0f);
+						sum[k] += signal * amplitude;
+					}
+				}
+				else
+				{
+					for (int k = block; k < block + BLOCK; k++)
+						sum[k] += octave[k] * amplitude;
+				}
+			}
+
+			totalAmplitude += amplitude;
+			frequency *= noise.lacunarity;
+			amplitude *= noise.gain;
+		}
+
+		//Ridged sums to [0, total]; fBm to [-total, total] but rarely beyond half of it, so it is stretched (and clamped)
+		float offset = noise.ridged ? 0.0f : 0.5f;
+		float factor = 1.0f / max(totalAmplitude, 1e-6f);
+		float* heights = out + size_t(row) * width;
+		for (int i = 0; i < width; i++)
+			heights[i] = min(max(offset + sum[i] * factor, 0.0f), 1.0f) * noise.heightScale;
+	}
+}
+
+void encodeHeightRows(const float* heights, int width, int rowCount, unsigned char* rows)
+{
+	int rowSize = (width * 3 + 3) & ~3;
+	for (int y = 0; y < rowCount; y++)
+	{
+		unsigned char* row = rows + size_t(y) * rowSize;
+		for (int x = 0; x < width; x++)
+		{
+			//r*2^16 + g*2^8 + b = height * 10^6, stored as BGR
+			float value = heights[size_t(y) * width + x] * 1000000.0f + 0.5f;
+			uint32_t encoded = uint32_t(min(max(value, 0.0f), 16777215.0f));
+			row[x * 3 + 0] = (unsigned char)(encoded & 0xff);
+			row[x * 3 + 1] = (unsigned char)((encoded >> 8) & 0xff);
+			row[x * 3 + 2] = (unsigned char)(encoded >> 16);
+		}
+		for (int x = width * 3; x < rowSize; x++)
+			row[x] = 0;
+	}
+}
+
+static void putLittleEndian(unsigned char* destination, uint32_t value)
+{
+	for (int i = 0; i < 4; i++)
+		destination[i] = (unsigned char)(value >> (8 * i));
+}
+
+bool writeBMPHeader(FILE* file, int width, int height)
+{
+	uint64_t imageSize = uint64_t((width * 3 + 3) & ~3) * uint64_t(height);
+	if (54 + imageSize > 0xffffffffull)
+		return false;
+
+	unsigned char header[54] = { 'B', 'M' };
+	putLittleEndian(header + 0x02, uint32_t(54 + imageSize)); //File size
+	putLittleEndian(header + 0x0A, 54); //Pixel data offset
+	putLittleEndian(header + 0x0E, 40); //BITMAPINFOHEADER size
+	putLittleEndian(header + 0x12, uint32_t(width));
+	putLittleEndian(header + 0x16, uint32_t(height));
+	header[0x1A] = 1; //Planes
+	header[0x1C] = 24; //Bits per pixel
+	putLittleEndian(header + 0x1E, 0); //No compression
+	putLittleEndian(header + 0x22, uint32_t(imageSize));
+	putLittleEndian(header + 0x26, 2835); //72 dpi
+	putLittleEndian(header + 0x2A, 2835);
+	return fwrite(header, 1, sizeof(header), file) == sizeof(header);
+}
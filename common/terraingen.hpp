@@ -0,0 +1,32 @@
+#ifndef TERRAINGEN_HPP
+#define TERRAINGEN_HPP
+
+#include <cstdio>
+
+//Procedural heightmaps
+//Seeded gradient noise summed into fBm or ridged multifractal octaves. Every row is computed on its
+//own from (seed, settings, row), so output does not depend on the thread count or on which rows
+//are generated together, and any band of rows can be produced without the rest of the image.
+//The inner loops work on whole rows with branch-free integer hashing so they vectorise.
+
+struct TerrainNoise
+{
+	unsigned seed = 1;
+	int octaves = 8;
+	float frequency = 4.0f; //Lattice cells across the map for the first octave
+	float lacunarity = 2.0f; //Frequency multiplier per octave
+	float gain = 0.5f; //Amplitude multiplier per octave
+	bool ridged = false;
+	float heightScale = 1.0f; //Height in world units (the decoded BMP value) of the highest possible point
+};
+
+//Heights of rows [firstRow, firstRow + rowCount) of a map width wide, in world units, into out (rowCount * width)
+void generateHeightRows(const TerrainNoise& noise, int width, int firstRow, int rowCount, float* out);
+
+//Inverse of decodeHeightRows: 24-bit BGR rows padded to 4 bytes (heights are clamped to what 24 bits can hold)
+void encodeHeightRows(const float* heights, int width, int rowCount, unsigned char* rows);
+
+//54 byte header of a 24-bit BMP that loadBMP_custom accepts; the pixel rows follow it
+bool writeBMPHeader(FILE* file, int width, int height);
+
+#endif
@@ -0,0 +1,74 @@
+#include "terrainmesh.hpp"
+#include "jobs.hpp"
+
+#include <algorithm>
+using namespace std;
+
+void buildTerrainMesh(TerrainMesh& mesh, int points, float scale, int tileSize)
+{
+	mesh.vertices.resize(size_t(points) * points);
+	mesh.uvs.resize(size_t(points) * points);
+
+	//Create points by mapping them to [-1, 1] interval and then multiply by scale factor
+	//(each job fills whole columns of the grid)
+	parallelFor(0, points, 16, [&](int first, int last)
+	{
+		for (int i = first; i < last; i++)
+		{
+			float x = scale * ((i / float(points - 1)) - 0.5f) * 2.0f;
+			for (int j = 0; j < points; j++)
+			{
+				float z = scale * ((j / float(points - 1)) - 0.5f) * 2.0f;
+				mesh.vertices[size_t(i) * points + j] = glm::vec3(x, 0, z);
+				mesh.uvs[size_t(i) * points + j] = glm::vec2(float(i + 0.5f) / float(points - 1),
+															 float(j + 0.5f) / float(points - 1));
+			}
+		}
+	});
+
+	buildTerrainLodIndices(mesh, points, tileSize, 1);
+}
+
+void buildTerrainLodIndices(TerrainMesh& mesh, int points, int tileSize, int step)
+{
+	int cells = tileSize - 1;
+	mesh.tilesPerSide = (points - 1 + cells - 1) / cells;
+	int tiles = mesh.tilesPerSide * mesh.tilesPerSide;
+	mesh.tileIndexCounts.resize(tiles);
+	mesh.tileFirstIndex.assign(tiles + 1, 0);
+	for (int tile = 0; tile < tiles; tile++)
+	{
+		int rows = (min(cells, points - 1 - (tile / mesh.tilesPerSide) * cells) + step - 1) / step;
+		int columns = (min(cells, points - 1 - (tile % mesh.tilesPerSide) * cells) + step - 1) / step + 1;
+		mesh.tileIndexCounts[tile] = rows * (2 * columns + 1);
+		mesh.tileFirstIndex[tile + 1] = mesh.tileFirstIndex[tile] + mesh.tileIndexCounts[tile];
+	}
+
+	//One strip of two vertices per column for each row, ended by a restart so rows are not connected
+	//(the last row and column of a tile are always included, so neighbouring tiles meet without cracks)
+	mesh.indices.resize(mesh.tileFirstIndex[tiles]);
+	parallelFor(0, tiles, 8, [&](int first, int last)
+	{
+		for (int tile = first; tile < last; tile++)
+		{
+			int i0 = (tile / mesh.tilesPerSide) * cells, j0 = (tile % mesh.tilesPerSide) * cells;
+			int i1 = min(i0 + cells, points - 1), j1 = min(j0 + cells, points - 1);
+			size_t n = mesh.tileFirstIndex[tile];
+			for (int i = i0; i < i1; i += step)
+			{
+				int next = min(i + step, i1);
+				for (int j = j0; ; j = min(j + step, j1))
+				{
+					unsigned int topLeft = i * points + j;
+					unsigned int bottomLeft = next * points + j;
+					mesh.indices[n++] = bottomLeft;
+					mesh.indices[n++] = topLeft;
+					if (j == j1)
+						break;
+				}
+
+				mesh.indices[n++] = terrainRestartIndex;
+			}
+		}
+	});
+}
@@ -0,0 +1,35 @@
+#ifndef TERRAINMESH_HPP
+#define TERRAINMESH_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+//Base terrain mesh
+//A points x points grid over [-scale, scale]^2 (x outer, z inner), drawn as one triangle strip per row
+//of cells with primitive restarts between them. The strips are grouped by tile (tileSize vertices per
+//side, the same tiles as the derived tile bounds) so tiles outside the view can be left out of the draw.
+//Only the CPU side: the caller uploads the arrays.
+
+static const unsigned int terrainRestartIndex = 0xffffffffu; //Largest index that can possibly be used
+
+struct TerrainMesh
+{
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec2> uvs;
+	std::vector<unsigned int> indices;
+
+	//Index range of tile tx * tilesPerSide + tz
+	int tilesPerSide = 0;
+	std::vector<int> tileIndexCounts;
+	std::vector<size_t> tileFirstIndex; //One more than there are tiles (the last is the total)
+};
+
+void buildTerrainMesh(TerrainMesh& mesh, int points, float scale, int tileSize);
+
+//Only the indices and tile ranges, of strips over every step-th vertex of the same grid and tiles (a lower
+//level of detail drawn from the same vertices)
+void buildTerrainLodIndices(TerrainMesh& mesh, int points, int tileSize, int step);
+
+#endif
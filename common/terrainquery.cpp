@@ -0,0 +1,351 @@
+#include "terrainquery.hpp"
+#include "datasets.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+using namespace std;
+
+//World position -> height field sample coordinates (sample centres at integers), s = world * k + b
+struct SampleMapping
+{
+	float kx, bx;
+	float kz, bz;
+	int width, height;
+	const float* heights;
+	float scale;
+};
+
+static SampleMapping makeMapping(const TerrainQuery& query)
+{
+	const Dataset& dataset = *query.dataset;
+	SampleMapping mapping;
+	mapping.kx = dataset.width / query.worldSize;
+	mapping.bx = (0.5f + query.uvOffset) * dataset.width - 0.5f;
+	mapping.kz = dataset.height / query.worldSize;
+	mapping.bz = (0.5f + query.uvOffset) * dataset.height - 0.5f;
+	mapping.width = dataset.width;
+	mapping.height = dataset.height;
+	mapping.heights = &dataset.heights[0];
+	mapping.scale = query.scale;
+	return mapping;
+}
+
+static inline float sampleHeight(const SampleMapping& mapping, float sx, float sz)
+{
+	sx = min(max(sx, 0.0f), float(mapping.width - 1));
+	sz = min(max(sz, 0.0f), float(mapping.height - 1));
+
+	int x0 = int(sx), z0 = int(sz);
+	int x1 = min(x0 + 1, mapping.width - 1), z1 = min(z0 + 1, mapping.height - 1);
+	float tx = sx - x0, tz = sz - z0;
+
+	const float* row0 = mapping.heights + size_t(z0) * mapping.width;
+	const float* row1 = mapping.heights + size_t(z1) * mapping.width;
+	float top = row0[x0] + (row0[x1] - row0[x0]) * tx;
+	float bottom = row1[x0] + (row1[x1] - row1[x0]) * tx;
+	return (top + (bottom - top) * tz) * mapping.scale;
+}
+
+static bool hasHeights(const TerrainQuery& query)
+{
+	return query.dataset && !query.dataset->heights.empty();
+}
+
+shared_ptr<const HeightPyramid> buildHeightPyramid(const vector<float>& heights, int width, int height)
+{
+	shared_ptr<HeightPyramid> pyramid = make_shared<HeightPyramid>();
+	if (width < 2 || height < 2)
+		return pyramid;
+
+	//Level 0: max over the four corners of every cell
+	int levelWidth = width - 1, levelHeight = height - 1;
+	vector<float> level(size_t(levelWidth) * levelHeight);
+	for (int z = 0; z < levelHeight; z++)
+	{
+		const float* row0 = &heights[size_t(z) * width];
+		const float* row1 = row0 + width;
+		float* out = &level[size_t(z) * levelWidth];
+		for (int x = 0; x < levelWidth; x++)
+			out[x] = max(max(row0[x], row0[x + 1]), max(row1[x], row1[x + 1]));
+	}
+	pyramid->levels.push_back(move(level));
+	pyramid->widths.push_back(levelWidth);
+	pyramid->heights.push_back(levelHeight);
+
+	//Coarser levels: max over 2x2 nodes (odd sizes keep the last row/column on its own)
+	while (levelWidth > 1 || levelHeight > 1)
+	{
+		const vector<float>& fine = pyramid->levels.back();
+		int fineWidth = levelWidth, fineHeight = levelHeight;
+		levelWidth = (levelWidth + 1) / 2;
+		levelHeight = (levelHeight + 1) / 2;
+
+		vector<float> coarse(size_t(levelWidth) * levelHeight);
+		for (int z = 0; z < levelHeight; z++)
+		{
+			int z0 = 2 * z, z1 = min(2 * z + 1, fineHeight - 1);
+			for (int x = 0; x < levelWidth; x++)
+			{
+				int x0 = 2 * x, x1 = min(2 * x + 1, fineWidth - 1);
+				coarse[size_t(z) * levelWidth + x] = max(max(fine[size_t(z0) * fineWidth + x0], fine[size_t(z0) * fineWidth + x1]),
+														 max(fine[size_t(z1) * fineWidth + x0], fine[size_t(z1) * fineWidth + x1]));
+			}
+		}
+		pyramid->levels.push_back(move(coarse));
+		pyramid->widths.push_back(levelWidth);
+		pyramid->heights.push_back(levelHeight);
+	}
+
+	return pyramid;
+}
+
+void updateHeightPyramid(HeightPyramid& pyramid, const vector<float>& heights, int width, int x0, int z0, int x1, int z1)
+{
+	if (pyramid.levels.empty())
+		return;
+
+	//Cells with one of the changed samples as a corner
+	int levelWidth = pyramid.widths[0];
+	x0 = max(x0 - 1, 0), z0 = max(z0 - 1, 0);
+	x1 = min(x1, levelWidth - 1), z1 = min(z1, pyramid.heights[0] - 1);
+	for (int z = z0; z <= z1; z++)
+	{
+		const float* row0 = &heights[size_t(z) * width];
+		const float* row1 = row0 + width;
+		float* out = &pyramid.levels[0][size_t(z) * levelWidth];
+		for (int x = x0; x <= x1; x++)
+			out[x] = max(max(row0[x], row0[x + 1]), max(row1[x], row1[x + 1]));
+	}
+
+	//Then the nodes above them, as buildHeightPyramid combines them
+	for (size_t l = 1; l < pyramid.levels.size(); l++)
+	{
+		const vector<float>& fine = pyramid.levels[l - 1];
+		int fineWidth = pyramid.widths[l - 1], fineHeight = pyramid.heights[l - 1];
+		levelWidth = pyramid.widths[l];
+		x0 /= 2, z0 /= 2, x1 /= 2, z1 /= 2;
+		for (int z = z0; z <= z1; z++)
+		{
+			int za = 2 * z, zb = min(2 * z + 1, fineHeight - 1);
+			for (int x = x0; x <= x1; x++)
+			{
+				int xa = 2 * x, xb = min(2 * x + 1, fineWidth - 1);
+				pyramid.levels[l][size_t(z) * levelWidth + x] = max(max(fine[size_t(za) * fineWidth + xa], fine[size_t(za) * fineWidth + xb]),
+																	 max(fine[size_t(zb) * fineWidth + xa], fine[size_t(zb) * fineWidth + xb]));
+			}
+		}
+	}
+}
+
+void initTerrainQuery(TerrainQuery& query, float worldSize, float uvOffset)
+{
+	query.worldSize = worldSize;
+	query.uvOffset = uvOffset;
+}
+
+void setTerrainQuery(TerrainQuery& query, const Dataset* dataset, float scale)
+{
+	query.dataset = dataset;
+	query.scale = scale;
+}
+
+bool insideTerrain(const TerrainQuery& query, float x, float z)
+{
+	float half = 0.5f * query.worldSize;
+	return x >= -half && x <= half && z >= -half && z <= half;
+}
+
+float terrainHeightAt(const TerrainQuery& query, float x, float z)
+{
+	if (!hasHeights(query))
+		return 0.0f;
+
+	SampleMapping mapping = makeMapping(query);
+	return sampleHeight(mapping, x * mapping.kx + mapping.bx, z * mapping.kz + mapping.bz);
+}
+
+void terrainHeights(const TerrainQuery& query, const glm::vec2* positions, float* heights, size_t count)
+{
+	if (!hasHeights(query))
+	{
+		fill(heights, heights + count, 0.0f);
+		return;
+	}
+
+	//The mapping is set up once for the whole batch
+	SampleMapping mapping = makeMapping(query);
+	for (size_t i = 0; i < count; i++)
+		heights[i] = sampleHeight(mapping, positions[i].x * mapping.kx + mapping.bx, positions[i].y * mapping.kz + mapping.bz);
+}
+
+size_t clampToTerrain(const TerrainQuery& query, glm::vec3* points, size_t count, float clearance)
+{
+	if (!hasHeights(query))
+		return 0;
+
+	SampleMapping mapping = makeMapping(query);
+	size_t moved = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		float ground = sampleHeight(mapping, points[i].x * mapping.kx + mapping.bx, points[i].z * mapping.kz + mapping.bz) + clearance;
+		if (points[i].y < ground)
+		{
+			points[i].y = ground;
+			moved++;
+		}
+	}
+	return moved;
+}
+
+//First t in [tStart, tEnd] where the ray is at or below the bilinear surface of cell (cellX, cellZ)
+static bool intersectCell(const SampleMapping& mapping, int cellX, int cellZ, const double sampleOrigin[2], const double sampleDirection[2],
+						  double originY, double directionY, double tStart, double tEnd, double& tHit)
+{
+	const float* row0 = mapping.heights + size_t(cellZ) * mapping.width + cellX;
+	const float* row1 = row0 + mapping.width;
+	double h00 = row0[0] * mapping.scale, h10 = row0[1] * mapping.scale;
+	double h01 = row1[0] * mapping.scale, h11 = row1[1] * mapping.scale;
+	double e = h00 - h10 - h01 + h11;
+
+	//Cell-local coordinates along the ray: fx = ax + bx t, fz = az + bz t
+	double ax = sampleOrigin[0] - cellX, bx = sampleDirection[0];
+	double az = sampleOrigin[1] - cellZ, bz = sampleDirection[1];
+
+	//Ray height minus surface height: f(t) = A t^2 + B t + C
+	double A = -e * bx * bz;
+	double B = directionY - (h10 - h00) * bx - (h01 - h00) * bz - e * (ax * bz + az * bx);
+	double C = originY - h00 - (h10 - h00) * ax - (h01 - h00) * az - e * ax * az;
+
+	//Already below the surface where the ray enters the cell
+	if ((A * tStart + B) * tStart + C <= 0.0)
+	{
+		tHit = tStart;
+		return true;
+	}
+
+	double roots[2];
+	int rootCount = 0;
+	if (fabs(A) < 1e-12)
+	{
+		if (B != 0.0)
+			roots[rootCount++] = -C / B;
+	}
+	else
+	{
+		double discriminant = B * B - 4.0 * A * C;
+		if (discriminant < 0.0)
+			return false;
+
+		//Numerically stable form of the quadratic formula
+		double q = -0.5 * (B + (B < 0.0 ? -sqrt(discriminant) : sqrt(discriminant)));
+		roots[rootCount++] = q / A;
+		if (q != 0.0)
+			roots[rootCount++] = C / q;
+		if (rootCount == 2 && roots[1] < roots[0])
+			swap(roots[0], roots[1]);
+	}
+
+	for (int i = 0; i < rootCount; i++)
+	{
+		if (roots[i] >= tStart && roots[i] <= tEnd)
+		{
+			tHit = roots[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+bool raycastTerrain(const TerrainQuery& query, glm::vec3 origin, glm::vec3 direction, float maxDistance, glm::vec3& hit)
+{
+	if (!hasHeights(query) || !query.dataset->heightPyramid || query.dataset->heightPyramid->levels.empty())
+		return false;
+	if (glm::length(direction) == 0.0f)
+		return false;
+
+	direction = glm::normalize(direction);
+	SampleMapping mapping = makeMapping(query);
+	mapping.scale = max(mapping.scale, 0.0f); //The pyramid bounds only hold for non-negative scales
+	const HeightPyramid& pyramid = *query.dataset->heightPyramid;
+
+	//Everything below is in sample coordinates, but t stays the world distance along the ray
+	//(in doubles, so stepping past node boundaries still makes progress far along the ray)
+	double sampleOrigin[2] = { origin.x * double(mapping.kx) + mapping.bx, origin.z * double(mapping.kz) + mapping.bz };
+	double sampleDirection[2] = { direction.x * double(mapping.kx), direction.z * double(mapping.kz) };
+
+	//Clip the ray to the part of the height field covered by the terrain
+	double half = 0.5 * query.worldSize;
+	double boxMin[2] = { max(0.0, -half * mapping.kx + mapping.bx), max(0.0, -half * mapping.kz + mapping.bz) };
+	double boxMax[2] = { min(double(mapping.width - 1), half * mapping.kx + mapping.bx), min(double(mapping.height - 1), half * mapping.kz + mapping.bz) };
+
+	double tStart = 0.0, tEnd = maxDistance;
+	for (int axis = 0; axis < 2; axis++)
+	{
+		if (sampleDirection[axis] == 0.0)
+		{
+			if (sampleOrigin[axis] < boxMin[axis] || sampleOrigin[axis] > boxMax[axis])
+				return false;
+			continue;
+		}
+		double t0 = (boxMin[axis] - sampleOrigin[axis]) / sampleDirection[axis];
+		double t1 = (boxMax[axis] - sampleOrigin[axis]) / sampleDirection[axis];
+		tStart = max(tStart, min(t0, t1));
+		tEnd = min(tEnd, max(t0, t1));
+	}
+	if (tStart > tEnd)
+		return false;
+
+	//Step a ten-thousandth of a sample past every node boundary
+	double epsilon = 1e-4 / max(max(fabs(sampleDirection[0]), fabs(sampleDirection[1])), 1e-6);
+	const double infinity = numeric_limits<double>::infinity();
+
+	int topLevel = int(pyramid.levels.size()) - 1;
+	int level = topLevel;
+	double t = tStart;
+	while (t <= tEnd)
+	{
+		double x = sampleOrigin[0] + sampleDirection[0] * t;
+		double z = sampleOrigin[1] + sampleDirection[1] * t;
+		int cellX = min(max(int(floor(x)), 0), mapping.width - 2);
+		int cellZ = min(max(int(floor(z)), 0), mapping.height - 2);
+		int nodeX = cellX >> level, nodeZ = cellZ >> level;
+
+		//Where the ray leaves the node
+		double nodeMinX = nodeX << level, nodeMaxX = min((nodeX + 1) << level, mapping.width - 1);
+		double nodeMinZ = nodeZ << level, nodeMaxZ = min((nodeZ + 1) << level, mapping.height - 1);
+		double exitX = sampleDirection[0] > 0.0 ? (nodeMaxX - sampleOrigin[0]) / sampleDirection[0] :
+					   sampleDirection[0] < 0.0 ? (nodeMinX - sampleOrigin[0]) / sampleDirection[0] : infinity;
+		double exitZ = sampleDirection[1] > 0.0 ? (nodeMaxZ - sampleOrigin[1]) / sampleDirection[1] :
+					   sampleDirection[1] < 0.0 ? (nodeMinZ - sampleOrigin[1]) / sampleDirection[1] : infinity;
+		double tExit = min(min(exitX, exitZ), tEnd);
+
+		//The ray is lowest at one of the ends of the segment; skip the node if both are above its max
+		double nodeMax = pyramid.levels[level][size_t(nodeZ) * pyramid.widths[level] + nodeX] * mapping.scale;
+		double lowest = min(origin.y + direction.y * t, origin.y + direction.y * tExit);
+		if (lowest > nodeMax)
+		{
+			t = max(tExit, t) + epsilon;
+			level = min(level + 1, topLevel);
+			continue;
+		}
+
+		if (level > 0)
+		{
+			level--;
+			continue;
+		}
+
+		double tHit;
+		if (intersectCell(mapping, cellX, cellZ, sampleOrigin, sampleDirection, origin.y, direction.y, t, tExit, tHit))
+		{
+			hit = origin + direction * float(tHit);
+			return true;
+		}
+
+		t = max(tExit, t) + epsilon;
+		level = min(level + 1, topLevel);
+	}
+
+	return false;
+}
@@ -0,0 +1,58 @@
+#ifndef TERRAINQUERY_HPP
+#define TERRAINQUERY_HPP
+
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+struct Dataset;
+
+//CPU terrain queries
+//Heights are read from the active dataset's decoded height field with the same world -> texture
+//mapping as the base mesh, so results agree with what is drawn. Rays are traced through a max-height
+//pyramid: whole nodes the ray passes over are skipped, and only the cells it may touch are
+//intersected exactly (the bilinear surface of a cell is quadratic along a ray).
+
+struct HeightPyramid
+{
+	//Level 0 has one value per cell of the height field (the max of its four corner samples),
+	//every further level halves the resolution until a single value is left
+	std::vector<std::vector<float>> levels;
+	std::vector<int> widths;
+	std::vector<int> heights;
+};
+
+//Built by the dataset load job, next to the clipmap mips
+std::shared_ptr<const HeightPyramid> buildHeightPyramid(const std::vector<float>& heights, int width, int height);
+
+//Rebuild the nodes over the changed samples [x0, x1] x [z0, z1] of heights (width samples per row)
+void updateHeightPyramid(HeightPyramid& pyramid, const std::vector<float>& heights, int width, int x0, int z0, int x1, int z1);
+
+struct TerrainQuery
+{
+	const Dataset* dataset = nullptr;
+	float scale = 1.0f; //scaleValue
+	float worldSize = 10.0f;
+	float uvOffset = 0.0f; //Texture coordinate offset of the base mesh (its UVs are shifted by half a vertex)
+};
+
+void initTerrainQuery(TerrainQuery& query, float worldSize, float uvOffset);
+void setTerrainQuery(TerrainQuery& query, const Dataset* dataset, float scale);
+
+//Whether (x, z) lies over the terrain
+bool insideTerrain(const TerrainQuery& query, float x, float z);
+
+//Bilinear height at world position (x, z), clamped to the edge like the GL_LINEAR height map
+float terrainHeightAt(const TerrainQuery& query, float x, float z);
+
+//Batched lookups: heights[i] is the height under positions[i] (world x, z)
+void terrainHeights(const TerrainQuery& query, const glm::vec2* positions, float* heights, size_t count);
+
+//Lift every point to at least clearance above the ground. Returns how many points were moved
+size_t clampToTerrain(const TerrainQuery& query, glm::vec3* points, size_t count, float clearance);
+
+//First intersection of a ray with the terrain within maxDistance (direction need not be normalised)
+bool raycastTerrain(const TerrainQuery& query, glm::vec3 origin, glm::vec3 direction, float maxDistance, glm::vec3& hit);
+
+#endif
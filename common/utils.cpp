@@ -1,4 +1,5 @@
 ﻿#include <iostream>
+#include <vector>
 using namespace std;
 
 bool loadBMP_custom(const char* imagepath, int& width, int& height, unsigned char* &data) {
@@ -55,4 +56,28 @@ bool loadBMP_custom(const char* imagepath, int& width, int& height, unsigned cha
 	// Everything is in memory now, the file can be closed.
 	fclose(file);
 	return true;
-}
\ No newline at end of file
+}
+
+void decodeHeightRows(const unsigned char* data, int width, int firstRow, int rowCount, float* heights) {
+
+	//BMP rows are padded to 4 bytes, the same as GL_UNPACK_ALIGNMENT 4 expects
+	int rowSize = (width * 3 + 3) & ~3;
+
+	for (int y = firstRow; y < firstRow + rowCount; y++)
+	{
+		const unsigned char* row = data + size_t(y) * rowSize;
+		for (int x = 0; x < width; x++)
+		{
+			//Pixels are stored as BGR
+			const unsigned char* pixel = row + x * 3;
+			float value = pixel[2] * 65536.0f + pixel[1] * 256.0f + pixel[0];
+			heights[size_t(y) * width + x] = value / 1000000.0f;
+		}
+	}
+}
+
+void decodeHeightBMP(const unsigned char* data, int width, int height, std::vector<float>& heights) {
+
+	heights.resize(size_t(width) * height);
+	decodeHeightRows(data, width, 0, height, heights.data());
+}
@@ -1,6 +1,14 @@
 #ifndef UTILS_HPP
 #define UTILS_HPP
 
+#include <vector>
+
 bool loadBMP_custom(const char* imagepath, int& width, int& height, unsigned char* &data);
 
+//Decode the 24-bit heights of a BMP (r*2^16 + g*2^8 + b) into world units, matching the shaders
+void decodeHeightBMP(const unsigned char* data, int width, int height, std::vector<float>& heights);
+
+//Decode rows [firstRow, firstRow + rowCount) only, into the full-size heights array (for decoding in parallel)
+void decodeHeightRows(const unsigned char* data, int width, int firstRow, int rowCount, float* heights);
+
 #endif
\ No newline at end of file
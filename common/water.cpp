@@ -0,0 +1,447 @@
+#include "water.hpp"
+#include "culling.hpp"
+#include "framememory.hpp"
+#include "glcapture.hpp"
+#include "jobs.hpp"
+#include "terrainmesh.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+using namespace std;
+
+static const float WATER_CLIP_BIAS = 0.01f; //The reflection keeps a little of what is below the water, so shores meet it without a gap
+
+bool loadWaterMask(WaterMasks& masks, const char* path, WaterKind kind, int resolution)
+{
+	int width, height;
+	unsigned char* data = nullptr;
+	if (!loadBMP_custom(path, width, height, data))
+		return false;
+
+	if (masks.resolution != resolution)
+	{
+		masks.resolution = resolution;
+		masks.cells.assign(size_t(resolution) * resolution, 0);
+	}
+
+	//Cell (i, j) covers its share of the columns (x) and rows (z) of the image, as the height map's texels do
+	int rowSize = (width * 3 + 3) & ~3;
+	parallelFor(0, resolution, 16, [&](int first, int last)
+	{
+		for (int i = first; i < last; i++)
+		{
+			int x0 = int(size_t(i) * width / resolution), x1 = max(x0 + 1, int(size_t(i + 1) * width / resolution));
+			for (int j = 0; j < resolution; j++)
+			{
+				int y0 = int(size_t(j) * height / resolution), y1 = max(y0 + 1, int(size_t(j + 1) * height / resolution));
+				int water = 0;
+				for (int y = y0; y < y1; y++)
+				{
+					const unsigned char* row = data + size_t(y) * rowSize;
+					for (int x = x0; x < x1; x++)
+						water += row[x * 3] + row[x * 3 + 1] + row[x * 3 + 2] > 3 * 128;
+				}
+				if (water >= WATER_COVERAGE * (x1 - x0) * (y1 - y0))
+					masks.cells[size_t(i) * resolution + j] |= kind;
+			}
+		}
+	});
+	delete[] data;
+
+	masks.lakeCells = int(count_if(masks.cells.begin(), masks.cells.end(), [](unsigned char cell) { return cell & WATER_LAKE; }));
+	masks.riverCells = int(count_if(masks.cells.begin(), masks.cells.end(), [](unsigned char cell) { return cell & WATER_RIVER; }));
+	return true;
+}
+
+//Two triangles over a rectangle of the xz plane, facing up
+static void addQuad(WaterMesh& mesh, unsigned int a, unsigned int b, unsigned int c, unsigned int d)
+{
+	mesh.indices.insert(mesh.indices.end(), { a, b, c, a, c, d });
+}
+
+static void addBounds(WaterBody& body, glm::vec3 point, bool first)
+{
+	body.boundsMin = first ? point : glm::min(body.boundsMin, point);
+	body.boundsMax = first ? point : glm::max(body.boundsMax, point);
+}
+
+void buildWaterMesh(WaterMesh& mesh, const WaterMasks& masks, const vector<float>& heights, int resolution, float worldSize)
+{
+	auto start = chrono::steady_clock::now();
+	mesh.vertices.clear();
+	mesh.indices.clear();
+	mesh.bodies.clear();
+
+	int n = masks.resolution;
+	if (n == 0 || heights.empty())
+		return;
+	float cellSize = worldSize / n;
+	float half = worldSize * 0.5f;
+
+	//Ground under every corner of the cells, interpolated across the base mesh's grid
+	vector<float> ground(size_t(n + 1) * (n + 1));
+	parallelFor(0, n + 1, 32, [&](int first, int last)
+	{
+		for (int i = first; i < last; i++)
+		{
+			float gx = i * float(resolution - 1) / n;
+			int x0 = min(int(gx), resolution - 2);
+			float tx = gx - x0;
+			for (int j = 0; j <= n; j++)
+			{
+				float gz = j * float(resolution - 1) / n;
+				int z0 = min(int(gz), resolution - 2);
+				float tz = gz - z0;
+				const float* h = &heights[size_t(x0) * resolution + z0];
+				float column0 = h[0] * (1 - tz) + h[1] * tz;
+				float column1 = h[resolution] * (1 - tz) + h[resolution + 1] * tz;
+				ground[size_t(i) * (n + 1) + j] = column0 * (1 - tx) + column1 * tx;
+			}
+		}
+	});
+	auto cell = [&](int i, int j) { return masks.cells[size_t(i) * n + j]; };
+	auto corner = [&](int i, int j) { return ground[size_t(i) * (n + 1) + j]; };
+
+	//Lakes: cells connected through their edges, flat at the lowest ground along their shore (the edges
+	//between them and dry cells or the end of the terrain)
+	vector<unsigned char> visited(masks.cells.size(), 0);
+	vector<int> lake;
+	for (int seed = 0; seed < int(masks.cells.size()); seed++)
+	{
+		if (!(masks.cells[seed] & WATER_LAKE) || visited[seed])
+			continue;
+
+		WaterBody body;
+		body.level = INFINITY;
+		lake.assign(1, seed);
+		visited[seed] = 1;
+		for (size_t next = 0; next < lake.size(); next++)
+		{
+			int i = lake[next] / n, j = lake[next] % n;
+			const int neighbours[4][2] = { { i - 1, j }, { i + 1, j }, { i, j - 1 }, { i, j + 1 } };
+			for (int k = 0; k < 4; k++)
+			{
+				int ni = neighbours[k][0], nj = neighbours[k][1];
+				bool inside = ni >= 0 && ni < n && nj >= 0 && nj < n;
+				if (inside && (cell(ni, nj) & WATER_LAKE))
+				{
+					if (!visited[ni * n + nj])
+					{
+						visited[ni * n + nj] = 1;
+						lake.push_back(ni * n + nj);
+					}
+					continue;
+				}
+
+				//The corners of the shared edge
+				int ci0 = k == 1 ? i + 1 : i, cj0 = k == 3 ? j + 1 : j;
+				int ci1 = k < 2 ? ci0 : i + 1, cj1 = k < 2 ? j + 1 : cj0;
+				body.level = min(body.level, min(corner(ci0, cj0), corner(ci1, cj1)));
+			}
+		}
+
+		//Runs of cells along z (the cells are sorted x outer, z inner) become one quad each
+		sort(lake.begin(), lake.end());
+		body.firstIndex = int(mesh.indices.size());
+		for (size_t first = 0; first < lake.size();)
+		{
+			size_t last = first;
+			while (last + 1 < lake.size() && lake[last + 1] == lake[last] + 1 && lake[last + 1] % n != 0)
+				last++;
+
+			int i = lake[first] / n, j0 = lake[first] % n, j1 = lake[last] % n + 1;
+			float x0 = -half + i * cellSize, x1 = x0 + cellSize;
+			float z0 = -half + j0 * cellSize, z1 = -half + j1 * cellSize;
+			unsigned int v = unsigned(mesh.vertices.size());
+			mesh.vertices.insert(mesh.vertices.end(), { glm::vec3(x0, body.level, z0), glm::vec3(x0, body.level, z1),
+														glm::vec3(x1, body.level, z1), glm::vec3(x1, body.level, z0) });
+			addQuad(mesh, v, v + 1, v + 2, v + 3);
+			addBounds(body, glm::vec3(x0, body.level, z0), first == 0);
+			addBounds(body, glm::vec3(x1, body.level, z1), false);
+			first = last + 1;
+		}
+		body.indexCount = int(mesh.indices.size()) - body.firstIndex;
+		mesh.bodies.push_back(body);
+	}
+
+	//Rivers (where no lake covers them): square pieces of cells, draped over the ground. Corners are shared
+	//inside a piece; the pieces' copies of the corners on their edges are at the same heights
+	int pieces = (n + WATER_RIVER_PIECE - 1) / WATER_RIVER_PIECE;
+	vector<int> corners;
+	for (int piece = 0; piece < pieces * pieces; piece++)
+	{
+		int pi = (piece / pieces) * WATER_RIVER_PIECE, pj = (piece % pieces) * WATER_RIVER_PIECE;
+		int pieceSize = WATER_RIVER_PIECE + 1;
+		corners.assign(size_t(pieceSize) * pieceSize, -1);
+		auto vertex = [&](int i, int j)
+		{
+			int& index = corners[size_t(i - pi) * pieceSize + (j - pj)];
+			if (index < 0)
+			{
+				index = int(mesh.vertices.size());
+				mesh.vertices.push_back(glm::vec3(-half + i * cellSize, corner(i, j) + WATER_RIVER_OFFSET, -half + j * cellSize));
+			}
+			return unsigned(index);
+		};
+
+		WaterBody body;
+		body.river = true;
+		body.firstIndex = int(mesh.indices.size());
+		size_t firstVertex = mesh.vertices.size();
+		for (int i = pi; i < min(pi + WATER_RIVER_PIECE, n); i++)
+		{
+			for (int j = pj; j < min(pj + WATER_RIVER_PIECE, n); j++)
+			{
+				if ((cell(i, j) & (WATER_LAKE | WATER_RIVER)) == WATER_RIVER)
+					addQuad(mesh, vertex(i, j), vertex(i, j + 1), vertex(i + 1, j + 1), vertex(i + 1, j));
+			}
+		}
+		body.indexCount = int(mesh.indices.size()) - body.firstIndex;
+		if (body.indexCount == 0)
+			continue;
+
+		for (size_t v = firstVertex; v < mesh.vertices.size(); v++)
+		{
+			body.level += mesh.vertices[v].y;
+			addBounds(body, mesh.vertices[v], v == firstVertex);
+		}
+		body.level /= float(mesh.vertices.size() - firstVertex);
+		mesh.bodies.push_back(body);
+	}
+
+	mesh.buildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+void initWater(Water& water)
+{
+	glGenVertexArrays(1, &water.vertexArray);
+	glBindVertexArray(water.vertexArray);
+	glGenBuffers(1, &water.vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, water.vertexBuffer);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glGenBuffers(1, &water.indexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, water.indexBuffer);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glGenBuffers(1, &water.terrainIndexBuffer);
+}
+
+void uploadWaterMesh(Water& water, const WaterMesh& mesh)
+{
+	water.vertexBytes = mesh.vertices.size() * sizeof(glm::vec3);
+	water.indexBytes = mesh.indices.size() * sizeof(unsigned int);
+	glBindVertexArray(water.vertexArray);
+	glBindBuffer(GL_ARRAY_BUFFER, water.vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, water.vertexBytes, mesh.vertices.data(), GL_STATIC_DRAW);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, water.indexBytes, mesh.indices.data(), GL_STATIC_DRAW);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	water.bodyVisible.assign(mesh.bodies.size(), 0);
+}
+
+void updateWaterTerrainLod(Water& water, int points, int tileSize)
+{
+	if (water.terrainLodStep == water.reflectionLodStep)
+		return;
+
+	TerrainMesh lod;
+	buildTerrainLodIndices(lod, points, tileSize, water.reflectionLodStep);
+	int tiles = lod.tilesPerSide * lod.tilesPerSide;
+	water.terrainTileCounts.resize(tiles);
+	water.terrainTileOffsets.resize(tiles);
+	for (int tile = 0; tile < tiles; tile++)
+	{
+		water.terrainTileCounts[tile] = lod.tileIndexCounts[tile];
+		water.terrainTileOffsets[tile] = (const void*)(lod.tileFirstIndex[tile] * sizeof(unsigned int));
+	}
+
+	//Not part of a vertex array: the reflection binds it over the base mesh's indices while it draws
+	water.terrainIndexBytes = lod.indices.size() * sizeof(unsigned int);
+	glBindBuffer(GL_ARRAY_BUFFER, water.terrainIndexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, water.terrainIndexBytes, lod.indices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	water.terrainLodStep = water.reflectionLodStep;
+}
+
+int cullWaterBodies(Water& water, const WaterMesh& mesh, const Frustum& frustum, glm::vec3 camera)
+{
+	water.bodyVisible.resize(mesh.bodies.size());
+	water.visibleBodies = 0;
+	int nearest = -1;
+	float nearestDistance = INFINITY;
+	for (size_t b = 0; b < mesh.bodies.size(); b++)
+	{
+		const WaterBody& body = mesh.bodies[b];
+		water.bodyVisible[b] = boxInFrustum(frustum, body.boundsMin, body.boundsMax);
+		if (!water.bodyVisible[b])
+			continue;
+		water.visibleBodies++;
+		if (body.level >= camera.y)
+			continue;
+
+		//Horizontal distance to the body's bounds (lakes first, as the flat ones, when the camera is over several)
+		glm::vec2 position(camera.x, camera.z);
+		glm::vec2 closest = glm::clamp(position, glm::vec2(body.boundsMin.x, body.boundsMin.z), glm::vec2(body.boundsMax.x, body.boundsMax.z));
+		float distance = glm::length(closest - position);
+		if (distance < nearestDistance || (distance == nearestDistance && !body.river && mesh.bodies[nearest].river))
+		{
+			nearest = int(b);
+			nearestDistance = distance;
+		}
+	}
+
+	//Nothing to reflect: the surface falls back to the sky until a body below the camera is in view again
+	if (nearest < 0)
+		water.reflectionValid = false;
+	return nearest;
+}
+
+static void createReflectionTarget(Water& water, int width, int height)
+{
+	glDeleteFramebuffers(1, &water.reflectionFramebuffer);
+	glDeleteTextures(1, &water.reflectionColour);
+	glDeleteRenderbuffers(1, &water.reflectionDepth);
+
+	glGenTextures(1, &water.reflectionColour);
+	glBindTexture(GL_TEXTURE_2D, water.reflectionColour);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &water.reflectionFramebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, water.reflectionFramebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, water.reflectionColour, 0);
+
+	glGenRenderbuffers(1, &water.reflectionDepth);
+	glBindRenderbuffer(GL_RENDERBUFFER, water.reflectionDepth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, water.reflectionDepth);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	water.reflectionWidth = width;
+	water.reflectionHeight = height;
+	water.reflectionValid = false;
+}
+
+//Lengyel's oblique near plane: moves the near plane of an OpenGL projection onto a view space plane (facing
+//away from the camera), and the far plane with it, so nothing behind the plane survives clipping
+static glm::mat4 obliqueProjection(glm::mat4 projection, glm::vec4 plane)
+{
+	//The far corner of the frustum on the plane's side, in view space
+	glm::vec4 corner;
+	corner.x = (glm::sign(plane.x) + projection[2][0]) / projection[0][0];
+	corner.y = (glm::sign(plane.y) + projection[2][1]) / projection[1][1];
+	corner.z = -1.0f;
+	corner.w = (1.0f + projection[2][2]) / projection[3][2];
+
+	//Replaces the third row
+	glm::vec4 scaled = plane * (2.0f / glm::dot(plane, corner));
+	projection[0][2] = scaled.x;
+	projection[1][2] = scaled.y;
+	projection[2][2] = scaled.z + 1.0f;
+	projection[3][2] = scaled.w;
+	return projection;
+}
+
+bool beginWaterReflection(Water& water, float level, const glm::mat4& view, const glm::mat4& projection, glm::vec3 camera, int width,
+						  int height, WaterReflectionView& mirrored)
+{
+	water.framesSinceReflection++;
+
+	//From below (or level with) the water, there is nothing to reflect
+	if (!water.reflections || camera.y <= level + WATER_CLIP_BIAS)
+	{
+		water.reflectionValid = false;
+		return false;
+	}
+
+	int targetWidth = max(1, width / water.reflectionDivisor), targetHeight = max(1, height / water.reflectionDivisor);
+	bool resized = targetWidth != water.reflectionWidth || targetHeight != water.reflectionHeight;
+	if (water.reflectionValid && !resized && level == water.reflectionLevel && water.framesSinceReflection < water.reflectionInterval)
+		return false;
+
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &water.sceneFramebuffer);
+	glGetIntegerv(GL_VIEWPORT, water.sceneViewport);
+	if (resized)
+		createReflectionTarget(water, targetWidth, targetHeight);
+
+	//Mirrored about y = level
+	glm::mat4 mirror(1.0f);
+	mirror[1][1] = -1.0f;
+	mirror[3][1] = 2.0f * level;
+	mirrored.view = view * mirror;
+	mirrored.projection = projection;
+	mirrored.cameraPosition = glm::vec3(camera.x, 2.0f * level - camera.y, camera.z);
+	glm::vec4 plane = glm::transpose(glm::inverse(mirrored.view)) * glm::vec4(0.0f, 1.0f, 0.0f, WATER_CLIP_BIAS - level);
+	mirrored.clippedProjection = obliqueProjection(projection, plane);
+
+	//Points on the water land where they are on screen, so the surface samples it by its own projection
+	water.reflectionLevel = level;
+	water.reflectionViewProjection = projection * view;
+	water.reflectionValid = true;
+	water.framesSinceReflection = 0;
+	water.reflectionDraws++;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, water.reflectionFramebuffer);
+	glViewport(0, 0, water.reflectionWidth, water.reflectionHeight);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	//Mirroring turns the triangles' winding around
+	glDisable(GL_CULL_FACE);
+	return true;
+}
+
+void endWaterReflection(Water& water)
+{
+	glEnable(GL_CULL_FACE);
+	glBindFramebuffer(GL_FRAMEBUFFER, water.sceneFramebuffer);
+	glViewport(water.sceneViewport[0], water.sceneViewport[1], water.sceneViewport[2], water.sceneViewport[3]);
+}
+
+void drawWaterSurface(Water& water, const WaterMesh& mesh, GLuint program, const glm::mat4& viewProjection, glm::vec3 camera,
+					  glm::vec3 light, float time)
+{
+	FrameVector<GLsizei> counts;
+	FrameVector<const void*> offsets;
+	for (size_t b = 0; b < mesh.bodies.size(); b++)
+	{
+		if (b >= water.bodyVisible.size() || !water.bodyVisible[b])
+			continue;
+		counts.push_back(mesh.bodies[b].indexCount);
+		offsets.push_back((const void*)(size_t(mesh.bodies[b].firstIndex) * sizeof(unsigned int)));
+	}
+	if (counts.empty())
+		return;
+
+	glUniformMatrix4fv(glGetUniformLocation(program, "MVP"), 1, GL_FALSE, &viewProjection[0][0]);
+	glUniformMatrix4fv(glGetUniformLocation(program, "reflectionViewProjection"), 1, GL_FALSE, &water.reflectionViewProjection[0][0]);
+	glUniform1i(glGetUniformLocation(program, "reflectionValid"), water.reflectionValid);
+	glUniform3f(glGetUniformLocation(program, "cameraPos"), camera.x, camera.y, camera.z);
+	glUniform3f(glGetUniformLocation(program, "lightPos"), light.x, light.y, light.z);
+	glUniform1f(glGetUniformLocation(program, "time"), time);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, water.reflectionColour);
+
+	glBindVertexArray(water.vertexArray);
+	glMultiDrawElements(GL_TRIANGLES, &counts[0], GL_UNSIGNED_INT, &offsets[0], GLsizei(counts.size()));
+	glBindVertexArray(0);
+}
+
+void destroyWater(Water& water)
+{
+	glDeleteVertexArrays(1, &water.vertexArray);
+	glDeleteBuffers(1, &water.vertexBuffer);
+	glDeleteBuffers(1, &water.indexBuffer);
+	glDeleteBuffers(1, &water.terrainIndexBuffer);
+	glDeleteFramebuffers(1, &water.reflectionFramebuffer);
+	glDeleteTextures(1, &water.reflectionColour);
+	glDeleteRenderbuffers(1, &water.reflectionDepth);
+	water = Water();
+}
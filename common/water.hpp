@@ -0,0 +1,151 @@
+#ifndef WATER_HPP
+#define WATER_HPP
+
+#include <vector>
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+struct Frustum; //culling.hpp (which includes derived.hpp, and that includes this)
+
+//Water
+//Lakes and rivers come from two masks covering the whole terrain (great_lakes.bmp and rivers.bmp, bright
+//where there is water), reduced once at load to a grid of cells. The water mesh is extracted from the cells
+//on the CPU as a derived product of the heights: every lake is flat at its spill height (the lowest ground
+//along its shore), so the ground inside is flooded up to the shore and higher ground stands out as islands,
+//and rivers are draped over the base mesh just above the ground. Lakes are one body each and rivers are
+//split into square pieces, each with its own bounds, so the bodies outside the view are left out.
+//Reflections are planar, about the level of the nearest visible body (the others sample the same image).
+//The sky and the terrain are drawn mirrored about it into a target at a half or a quarter of the scene's
+//resolution. The terrain is drawn from coarser strips over the base mesh's vertices, and its tiles are culled
+//against the mirrored frustum. The projection's near plane is moved onto the water (an oblique projection),
+//so nothing below the water is drawn or passes the culling. The reflection can be redrawn every few frames
+//only; the surface then samples it where the scene was when it was drawn.
+
+static const int WATER_GRID = 512; //Mask cells per side
+static const float WATER_COVERAGE = 0.25f; //Fraction of a cell's texels that must be water
+static const int WATER_RIVER_PIECE = 32; //Cells per side of the pieces rivers are split into
+static const float WATER_RIVER_OFFSET = 0.004f; //Height of the rivers above the ground (world units)
+
+enum WaterKind
+{
+	WATER_LAKE = 1,
+	WATER_RIVER = 2
+};
+
+struct WaterMasks
+{
+	int resolution = 0; //Cells per side
+	std::vector<unsigned char> cells; //WaterKind bits of every cell (x outer, as the base mesh)
+	int lakeCells = 0;
+	int riverCells = 0;
+};
+
+struct WaterBody
+{
+	bool river = false;
+	float level = 0.0f; //Surface height of a lake, mean surface height of a river piece
+	glm::vec3 boundsMin = glm::vec3(0.0f);
+	glm::vec3 boundsMax = glm::vec3(0.0f);
+	int firstIndex = 0;
+	int indexCount = 0;
+};
+
+//Triangles in world space (heights include scaleValue), each body's a contiguous range of the indices
+struct WaterMesh
+{
+	std::vector<glm::vec3> vertices;
+	std::vector<unsigned int> indices;
+	std::vector<WaterBody> bodies;
+	double buildMs = 0.0;
+};
+
+//Matrices of the mirrored camera
+struct WaterReflectionView
+{
+	glm::mat4 view; //Mirrored about the water
+	glm::mat4 projection; //For the sky
+	glm::mat4 clippedProjection; //Oblique: its near plane is the water's
+	glm::vec3 cameraPosition;
+};
+
+struct Water
+{
+	//Settings
+	bool enabled = true;
+	bool reflections = true;
+	int reflectionDivisor = 2; //Of the scene's resolution: 2 (half) or 4 (quarter)
+	int reflectionInterval = 1; //Frames between redraws of the reflection
+	int reflectionLodStep = 4; //Base mesh vertices between those of the reflected terrain
+	float budgetMs = 1.5f; //GPU milliseconds the water is allowed (its cost is shown against it)
+
+	//The surface
+	GLuint vertexArray = 0;
+	GLuint vertexBuffer = 0;
+	GLuint indexBuffer = 0;
+	size_t vertexBytes = 0;
+	size_t indexBytes = 0;
+	std::vector<unsigned char> bodyVisible;
+
+	//Strips of the reflected terrain, over the base mesh's tiles
+	GLuint terrainIndexBuffer = 0;
+	std::vector<GLsizei> terrainTileCounts;
+	std::vector<const void*> terrainTileOffsets;
+	int terrainLodStep = 0; //What the strips were built for
+	size_t terrainIndexBytes = 0;
+
+	//Reflection target
+	GLuint reflectionFramebuffer = 0;
+	GLuint reflectionColour = 0;
+	GLuint reflectionDepth = 0;
+	int reflectionWidth = 0;
+	int reflectionHeight = 0;
+	bool reflectionValid = false;
+	float reflectionLevel = 0.0f;
+	glm::mat4 reflectionViewProjection = glm::mat4(1.0f); //Of the (unjittered) camera when the reflection was drawn
+	int framesSinceReflection = 0;
+	GLint sceneFramebuffer = 0; //Restored after drawing the reflection
+	GLint sceneViewport[4] = {};
+
+	//Statistics
+	int visibleBodies = 0; //Last frame
+	int reflectedTiles = 0; //Of the last reflection
+	int reflectionDraws = 0; //Since the start
+};
+
+//Reads a mask BMP into the cells of a resolution^2 grid: cells at least WATER_COVERAGE covered by texels
+//brighter than half are marked kind
+bool loadWaterMask(WaterMasks& masks, const char* path, WaterKind kind, int resolution = WATER_GRID);
+
+//Extracts the lakes and rivers over the scaled heights of a resolution^2 vertex grid spanning worldSize (x
+//outer, as the base mesh)
+void buildWaterMesh(WaterMesh& mesh, const WaterMasks& masks, const std::vector<float>& heights, int resolution, float worldSize);
+
+void initWater(Water& water);
+
+//Replaces the surface's buffers
+void uploadWaterMesh(Water& water, const WaterMesh& mesh);
+
+//Rebuilds the reflected terrain's strips when the LOD step changed (points and tileSize of the base mesh)
+void updateWaterTerrainLod(Water& water, int points, int tileSize);
+
+//Marks the bodies inside the frustum and returns the nearest one below the camera, whose level the
+//reflection is about (-1 if there is none, which also invalidates the last reflection)
+int cullWaterBodies(Water& water, const WaterMesh& mesh, const Frustum& frustum, glm::vec3 camera);
+
+//Whether the reflection about level is redrawn this frame (it is due, the level or the target's size
+//changed); if so its target is bound and cleared, and mirrored holds the matrices to draw it with.
+//projection is the camera's unjittered one, width and height the scene's render resolution
+bool beginWaterReflection(Water& water, float level, const glm::mat4& view, const glm::mat4& projection, glm::vec3 camera, int width,
+						  int height, WaterReflectionView& mirrored);
+
+//Back to the scene's target
+void endWaterReflection(Water& water);
+
+//Draws the visible bodies with the water program (the reflection is read from unit 0)
+void drawWaterSurface(Water& water, const WaterMesh& mesh, GLuint program, const glm::mat4& viewProjection, glm::vec3 camera,
+					  glm::vec3 light, float time);
+
+void destroyWater(Water& water);
+
+#endif
@@ -93,4 +93,77 @@ project "common"
 
 	files( sources )
 
+project "terrainbench"
+	local sources = { 
+		"tools/terrainbench/**.cpp",
+	}
+
+	kind "ConsoleApp"
+	location "tools/terrainbench"
+
+	files( sources )
+
+	links "common"
+
+	includedirs( "." );
+
+project "heightgen"
+	local sources = { 
+		"tools/heightgen/**.cpp",
+	}
+
+	kind "ConsoleApp"
+	location "tools/heightgen"
+
+	files( sources )
+
+	links "common"
+
+	includedirs( "." );
+
+project "heightconv"
+	local sources = { 
+		"tools/heightconv/**.cpp",
+	}
+
+	kind "ConsoleApp"
+	location "tools/heightconv"
+
+	files( sources )
+
+	links "common"
+
+	includedirs( "." );
+
+project "glreplay"
+	local sources = { 
+		"tools/glreplay/**.cpp",
+	}
+
+	kind "ConsoleApp"
+	location "tools/glreplay"
+
+	files( sources )
+
+	links "x-glfw"
+	links "x-glew"
+
+	includedirs( "." );
+
+project "benchmarks"
+	local sources = { 
+		"tools/benchmarks/**.cpp",
+	}
+
+	kind "ConsoleApp"
+	location "tools/benchmarks"
+
+	files( sources )
+
+	links "common"
+	links "x-glfw"
+	links "x-glew"
+
+	includedirs( "." );
+
 --EOF
@@ -1,4 +1,45 @@
-#version 420 core
+#version 430 core
+
+//Permutation defines, inserted after #version by the application (the defaults give the full shading)
+//MATERIAL_COUNT: 1 = rock, 2 = grass and rock, 3 = grass, rock and snow
+#ifndef MATERIAL_COUNT
+#define MATERIAL_COUNT 3
+#endif
+#ifndef NORMAL_MAPPING
+#define NORMAL_MAPPING 1
+#endif
+//Baked ambient occlusion (the terrain's sky shadowing)
+#ifndef TERRAIN_OCCLUSION
+#define TERRAIN_OCCLUSION 1
+#endif
+//Local point and spot lights from the froxel grid (clusteredlights.cpp)
+#ifndef CLUSTERED_LIGHTS
+#define CLUSTERED_LIGHTS 0
+#endif
+//Ambient light from the sky's spherical harmonics instead of a constant (skylight.cpp)
+#ifndef SKY_LIGHTING
+#define SKY_LIGHTING 1
+#endif
+//Glossy reflections of the prefiltered sky cube map
+#ifndef SKY_SPECULAR
+#define SKY_SPECULAR 0
+#endif
+//Far terrain reads the baked macro textures instead of the detail materials (materiallod.cpp)
+#ifndef MATERIAL_LOD
+#define MATERIAL_LOD 0
+#endif
+//Atmospheric scattering (atmosphere.cpp): 1 = sunlight through the atmosphere, 2 = and aerial perspective
+#ifndef ATMOSPHERE
+#define ATMOSPHERE 0
+#endif
+#define DEBUG_VIEW_NONE 0
+#define DEBUG_VIEW_NORMALS 1
+#define DEBUG_VIEW_MATERIALS 2
+#define DEBUG_VIEW_OCCLUSION 3
+#define DEBUG_VIEW_WIREFRAME 4
+#ifndef DEBUG_VIEW
+#define DEBUG_VIEW DEBUG_VIEW_NONE
+#endif
 
 // Input
 in vec2 UVcoords;
@@ -6,8 +47,11 @@ in vec3 vertexNormal;
 in vec3 lightDirection;
 in vec3 cameraPosition;
 in vec3 fragPos;
+#if NORMAL_MAPPING
 in mat3 TBN;
+#endif
 in float pointHeight;
+in float ambientOcclusion;
 
 in mat4 modelViewMatrix;
 // Output
@@ -23,72 +67,230 @@ layout (binding=7) uniform sampler2D grassDiffuseSampler;
 layout (binding=8) uniform sampler2D grassShininessSampler;
 layout (binding=9) uniform sampler2D grassNormals;
 
-void main(){
-	//Tiling - multiply UV coords by a scale factor
-	vec2 UV = vec2(UVcoords.x * 2, UVcoords.y * 2);
+#if MATERIAL_LOD
+layout (binding=12) uniform sampler2D macroColour; //Albedo, shininess / 500 (mirrored beyond the terrain, like the clipmap's heights)
+layout (binding=13) uniform sampler2D macroNormals; //World space
+uniform float materialLodDistance; //View distance from which only the macro textures are read
+uniform float materialLodBand; //Width of the dithered transition before it
 
-	//Get the diffuse textures of the surfaces
-	vec3 grassTexture = texture(grassDiffuseSampler, vec2(UV.x, UV.y)).rgb;
-	vec3 rockTexture = texture(DiffuseTextureSampler, vec2(UV.x, UV.y)).rgb;
-	vec3 snowTexture = texture(snowDiffuseSampler, vec2(UV.x, UV.y)).rgb;
+//Per pixel threshold in [0, 1) that does not repeat in a visible pattern (Jimenez's interleaved gradient noise)
+float interleavedGradientNoise(vec2 pixel)
+{
+	return fract(52.9829189 * fract(dot(pixel, vec2(0.06711056, 0.00583715))));
+}
+#endif
 
-	//Get the roughness of each surface
-	float grassRoughness = texture(grassShininessSampler, vec2(UV.x, UV.y)).r;
-	float rockRoughness = texture(ShininessTextureSampler, vec2(UV.x, UV.y)).r;
-	float snowRoughness = texture(snowShininessSampler, vec2(UV.x, UV.y)).r;
+#if SKY_LIGHTING
+uniform vec3 skyIrradiance[9]; //Cosine convolved SH coefficients, the order of skylight.cpp
+uniform float skyAmbientStrength;
 
-	//Calculate the shininess of each surface given the roughness	
-	float grassShininess = clamp((2/(pow(grassRoughness,4)+1e-2))-2,0,500.0f);
-	float rockShininess = clamp((2/(pow(rockRoughness,4)+1e-2))-2,0,500.0f);
-	float snowShininess = clamp((2/(pow(snowRoughness,4)+1e-2))-2,0,500.0f);
+vec3 skyAmbient(vec3 n)
+{
+	vec3 result = skyIrradiance[0] * 0.282095;
+	result += skyIrradiance[1] * (0.488603 * n.y) + skyIrradiance[2] * (0.488603 * n.z) + skyIrradiance[3] * (0.488603 * n.x);
+	result += skyIrradiance[4] * (1.092548 * n.x * n.y) + skyIrradiance[5] * (1.092548 * n.y * n.z);
+	result += skyIrradiance[6] * (0.315392 * (3.0 * n.z * n.z - 1.0)) + skyIrradiance[7] * (1.092548 * n.x * n.z);
+	result += skyIrradiance[8] * (0.546274 * (n.x * n.x - n.y * n.y));
+	return max(result, vec3(0.0));
+}
+#endif
+#if SKY_SPECULAR
+layout (binding=11) uniform samplerCube skySpecular;
+#endif
+
+#if ATMOSPHERE
+uniform vec3 sunColour; //Sunlight through the air to the camera, white with the sun overhead
+#endif
+#if ATMOSPHERE >= 2
+#define AERIAL_PERSPECTIVE_SIZE 32
+layout (binding=14) uniform sampler3D aerialPerspective; //In-scattered light and mean transmittance from the camera, per froxel
+uniform vec2 aerialScreenSize; //Size of the render target
+uniform float aerialDepthScale; //Slice coordinate = sqrt(distance * aerialDepthScale)
+uniform float exposure;
+
+//Dims the surface by the air in front of it and adds the light the air scatters towards the camera. Both
+//are combined as radiance, through the inverse of the sky's tone map and gamma (atmosphere.frag), so the
+//distant terrain fades into the horizon
+vec3 applyAerialPerspective(vec3 surface, float distance)
+{
+	float w = sqrt(distance * aerialDepthScale);
+	vec4 air = texture(aerialPerspective, vec3(gl_FragCoord.xy / aerialScreenSize, w));
+
+	//Nearer than the first slice's centre, towards no air at all
+	float fade = clamp(w * AERIAL_PERSPECTIVE_SIZE * 2.0, 0.0, 1.0);
+	vec3 radiance = -log(1.0 - min(pow(surface, vec3(2.2)), vec3(0.999))) / exposure;
+	radiance = radiance * mix(1.0, air.a, fade) + air.rgb * fade;
+	return pow(1.0 - exp(-radiance * exposure), vec3(1.0 / 2.2));
+}
+#endif
+
+#if CLUSTERED_LIGHTS
+//Froxel grid, the same as clusteredlights.hpp
+#define CLUSTER_TILES_X 16
+#define CLUSTER_TILES_Y 12
+#define CLUSTER_SLICES 24
+
+struct LocalLight
+{
+	vec4 positionRadius; //World space position, range
+	vec4 colourSpotOuter; //Colour, cosine of the spot cone (below -1 for point lights)
+	vec4 directionSpotInner; //Spot direction, cosine where the cone reaches full intensity
+};
+
+layout (std430, binding=0) readonly buffer LocalLights { LocalLight localLights[]; };
+layout (std430, binding=1) readonly buffer LightClusters { uvec2 lightClusters[]; }; //Offset and count in lightIndices
+layout (std430, binding=2) readonly buffer LightIndices { uint lightIndices[]; };
+
+uniform vec2 clusterScreenSize; //Size of the render target
+uniform vec2 clusterDepthScale; //slice = log(view depth) * x + y
+
+//Only the lights binned into this fragment's froxel are visited
+vec3 shadeLocalLights(float viewDepth, vec3 normal, vec3 diffuseColour, vec3 specularColour, float shininess)
+{
+	ivec2 tile = clamp(ivec2(gl_FragCoord.xy / clusterScreenSize * vec2(CLUSTER_TILES_X, CLUSTER_TILES_Y)), ivec2(0), ivec2(CLUSTER_TILES_X - 1, CLUSTER_TILES_Y - 1));
+	int slice = clamp(int(log(viewDepth) * clusterDepthScale.x + clusterDepthScale.y), 0, CLUSTER_SLICES - 1);
+	uvec2 cluster = lightClusters[(slice * CLUSTER_TILES_Y + tile.y) * CLUSTER_TILES_X + tile.x];
+
+	vec3 viewDirection = normalize(cameraPosition - fragPos);
+	vec3 result = vec3(0.0);
+	for (uint i = 0; i < cluster.y; i++)
+	{
+		LocalLight light = localLights[lightIndices[cluster.x + i]];
+		vec3 toLight = light.positionRadius.xyz - fragPos;
+		float lightDistance = length(toLight);
+		if (lightDistance >= light.positionRadius.w)
+			continue;
+		vec3 direction = toLight / lightDistance;
 
-	//Get the normals of each surface
-	vec3 rockNormal = texture(rockNormals, vec2(UV.x, UV.y)).rgb;
-	vec3 grassNormal = texture(grassNormals, vec2(UV.x, UV.y)).rgb;
-	vec3 snowNormal = texture(snowNormals, vec2(UV.x, UV.y)).rgb;
+		//Inverse square falloff, windowed so it reaches zero at the light's range
+		float window = clamp(1.0 - pow(lightDistance / light.positionRadius.w, 4.0), 0.0, 1.0);
+		float attenuation = window * window / (lightDistance * lightDistance + 1.0);
+		if (light.colourSpotOuter.w >= -1.0)
+			attenuation *= smoothstep(light.colourSpotOuter.w, light.directionSpotInner.w, dot(-direction, light.directionSpotInner.xyz));
+
+		float diffuseStrength = max(dot(normal, direction), 0.0);
+		float specularStrength = pow(max(dot(normal, normalize(direction + viewDirection)), 0.0), shininess);
+		result += attenuation * light.colourSpotOuter.rgb * (diffuseStrength * diffuseColour + specularStrength * specularColour);
+	}
+	return result;
+}
+#endif
+
+void main(){
+#if DEBUG_VIEW == DEBUG_VIEW_WIREFRAME
+	//Only the edges are drawn, so none of the materials are sampled
+	color = vec3(0.05, 0.05, 0.05);
+#else
+	//Tiling - multiply UV coords by a scale factor
+	vec2 UV = vec2(UVcoords.x * 2, UVcoords.y * 2);
 
 	//Interpolate the textures based on the height
 	float grassThreshold = 0.0;
 	float rockThreshold = 1.0;
 	float snowThreshold = 2.5;
 
-	vec3 finalDiffuse;
-	vec3 finalNormal;
-	float finalShininess;
-
 	//Interpolate to calculate how much of each texture we want at the point
 	//Works similar to barycentric interpolation with distOtoQR / distPtoQR
 	float RocktoGrassInterpolate = clamp( (pointHeight - grassThreshold) / (rockThreshold - grassThreshold), 0.0, 1.0);
 	float SnowtoRockInterpolate = clamp( (pointHeight - rockThreshold) / (snowThreshold - rockThreshold), 0.0, 1.0);
 
-	//Interpolate the shininess values
-	finalShininess = mix(grassShininess, rockShininess, RocktoGrassInterpolate);
-	finalShininess = mix(finalShininess, snowShininess, SnowtoRockInterpolate);
+	vec3 finalDiffuse;
+	float finalShininess;
+	vec3 transformedNormals;
+#if MATERIAL_LOD
+	//Pixels in the band before the switch distance pick either path, more of them the macro one further out.
+	//Only some pixels of a quad may sample the detail textures, so their gradients come from outside the branch
+	float viewDistance = length(vec3(modelViewMatrix * vec4(fragPos, 1)));
+	float macroAmount = clamp((viewDistance - materialLodDistance) / materialLodBand + 1.0, 0.0, 1.0);
+	vec2 dUVdx = dFdx(UV), dUVdy = dFdy(UV);
+	if (macroAmount > interleavedGradientNoise(gl_FragCoord.xy))
+	{
+		vec4 macro = textureGrad(macroColour, UVcoords, 0.5 * dUVdx, 0.5 * dUVdy);
+		finalDiffuse = macro.rgb;
+		finalShininess = macro.a * 500.0;
+		transformedNormals = normalize(vertexNormal);
+#if NORMAL_MAPPING
+		//The clipmap mirrors the terrain beyond the base grid, where the baked normals do not apply
+		if (UVcoords == clamp(UVcoords, 0.0, 1.0))
+			transformedNormals = normalize(textureGrad(macroNormals, UVcoords, 0.5 * dUVdx, 0.5 * dUVdy).rgb * 2 - 1);
+#endif
+	}
+	else
+	{
+#define SAMPLE_MATERIAL(sampler) textureGrad(sampler, UV, dUVdx, dUVdy)
+#else
+	{
+#define SAMPLE_MATERIAL(sampler) texture(sampler, UV)
+#endif
+	//Rock is always present; grass (below it) and snow (above it) are only sampled when compiled in
+	finalDiffuse = SAMPLE_MATERIAL(DiffuseTextureSampler).rgb;
+	float rockRoughness = SAMPLE_MATERIAL(ShininessTextureSampler).r;
+	finalShininess = clamp((2/(pow(rockRoughness,4)+1e-2))-2,0,500.0f);
+#if NORMAL_MAPPING
+	vec3 finalNormal = SAMPLE_MATERIAL(rockNormals).rgb;
+#endif
 
-	//Interpolate normal mapping
-	finalNormal = mix(grassNormal, rockNormal, RocktoGrassInterpolate);
-	finalNormal = mix(finalNormal, snowNormal, SnowtoRockInterpolate);
+#if MATERIAL_COUNT >= 2
+	float grassRoughness = SAMPLE_MATERIAL(grassShininessSampler).r;
+	float grassShininess = clamp((2/(pow(grassRoughness,4)+1e-2))-2,0,500.0f);
+	finalDiffuse = mix(SAMPLE_MATERIAL(grassDiffuseSampler).rgb, finalDiffuse, RocktoGrassInterpolate);
+	finalShininess = mix(grassShininess, finalShininess, RocktoGrassInterpolate);
+#if NORMAL_MAPPING
+	finalNormal = mix(SAMPLE_MATERIAL(grassNormals).rgb, finalNormal, RocktoGrassInterpolate);
+#endif
+#endif
 
-	//Interpolate diffuse colours
-	finalDiffuse = mix(grassTexture, rockTexture, RocktoGrassInterpolate);
-	finalDiffuse = mix(finalDiffuse, snowTexture, SnowtoRockInterpolate);
+#if MATERIAL_COUNT >= 3
+	float snowRoughness = SAMPLE_MATERIAL(snowShininessSampler).r;
+	float snowShininess = clamp((2/(pow(snowRoughness,4)+1e-2))-2,0,500.0f);
+	finalDiffuse = mix(finalDiffuse, SAMPLE_MATERIAL(snowDiffuseSampler).rgb, SnowtoRockInterpolate);
+	finalShininess = mix(finalShininess, snowShininess, SnowtoRockInterpolate);
+#if NORMAL_MAPPING
+	finalNormal = mix(finalNormal, SAMPLE_MATERIAL(snowNormals).rgb, SnowtoRockInterpolate);
+#endif
+#endif
 
+#if NORMAL_MAPPING
 	//Transform normals coordinate system from [0,1] to [-1,1]
-	vec3 transformedNormals = (finalNormal * 2) - 1;
+	transformedNormals = (finalNormal * 2) - 1;
 
 	//Apply TBN matrix
 	transformedNormals = normalize(TBN * transformedNormals);
+#else
+	transformedNormals = normalize(vertexNormal);
+#endif
+	}
 
+#if DEBUG_VIEW == DEBUG_VIEW_NORMALS
+	color = transformedNormals * 0.5 + 0.5;
+#elif DEBUG_VIEW == DEBUG_VIEW_MATERIALS
+	//Grass, rock and snow weights as red, green and blue
+	color = vec3(1.0 - RocktoGrassInterpolate, RocktoGrassInterpolate * (1.0 - SnowtoRockInterpolate), SnowtoRockInterpolate);
+#elif DEBUG_VIEW == DEBUG_VIEW_OCCLUSION
+	color = vec3(ambientOcclusion);
+#else
 	//Calculate Light
 	//Initialising light	
+#if ATMOSPHERE
+	vec3 lightColour = sunColour; //Reddened by the air when the sun is low
+#else
 	vec3 lightColour = {1, 1, 1}; //Set light colour to white
-	vec3 lightDir = normalize(lightDirection); //Ensure the light direction is normalised
+#endif
 
 	//The specular colour is constant
 	vec3 specularColour = {0.1, 0.1, 0.1};
 	
-	//Ambient - weaker version of regular colour
-	vec3 ambient = 0.2 * finalDiffuse * lightColour;
+	//Ambient - weaker version of regular colour (lit by the sky around the normal), darkened where the terrain hides the sky
+#if SKY_LIGHTING
+	vec3 ambientLight = skyAmbientStrength * skyAmbient(transformedNormals);
+#else
+	vec3 ambientLight = 0.2 * lightColour;
+#endif
+#if TERRAIN_OCCLUSION
+	vec3 ambient = ambientOcclusion * finalDiffuse * ambientLight;
+#else
+	vec3 ambient = finalDiffuse * ambientLight;
+#endif
 	
 	//Diffuse
 	float diffuseStrength = max(dot(transformedNormals, lightDirection), 0.0);
@@ -103,7 +305,24 @@ void main(){
 	float specularStrength = pow(max(dot(transformedNormals, bisector), 0.0), finalShininess);
 	vec3 specular = specularStrength * specularColour * lightColour;
 	
-	//color = vec3(abs(vertexNormal.x),abs(vertexNormal.y),abs(vertexNormal.z));
 	color = ambient + diffuse + specular;
 
+#if SKY_SPECULAR
+	//The sky reflected about the normal, hidden by the terrain the same as the ambient light
+	vec3 skyReflection = texture(skySpecular, reflect(-normalize(cameraPosition - fragPos), transformedNormals)).rgb;
+#if TERRAIN_OCCLUSION
+	skyReflection *= ambientOcclusion;
+#endif
+	color += specularColour * skyReflection;
+#endif
+
+#if CLUSTERED_LIGHTS
+	color += shadeLocalLights(-fragPosVCS.z, transformedNormals, finalDiffuse, specularColour, finalShininess);
+#endif
+
+#if ATMOSPHERE >= 2
+	color = applyAerialPerspective(color, length(fragPos - cameraPosition));
+#endif
+#endif
+#endif
 }
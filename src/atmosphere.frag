@@ -0,0 +1,45 @@
+#version 330 core
+out vec4 color;
+
+in vec3 texCoords;
+
+//The sky from the camera for a sun of unit illuminance (atmosphere.cpp): azimuth from the sun across (0 to pi,
+//columns crowd towards the sun), zenith angle up (the horizon in the middle, rows crowd towards it)
+uniform sampler2D skyView;
+uniform vec3 sunDirection;
+uniform vec3 sunDisc; //The sun's colour once through the atmosphere
+uniform vec2 skyViewHorizon; //Zenith angle of the horizon, and the angle from it down to the nadir
+uniform float exposure;
+
+#define SKY_VIEW_SIZE vec2(192.0, 108.0)
+#define SUN_COS_RADIUS 0.99998 //About the sun's angular radius, 0.27 degrees
+#define SUN_DISC_RADIANCE 20.0 //Per unit of illuminance, far above the sky's (the tone map saturates it)
+
+void main()
+{
+	vec3 direction = normalize(texCoords);
+
+	//Azimuth from the sun in the horizontal plane (any, looking straight up or with the sun overhead)
+	vec2 horizontal = direction.xz, sunHorizontal = sunDirection.xz;
+	float cosAzimuth = 1.0;
+	if (dot(horizontal, horizontal) > 1e-8 && dot(sunHorizontal, sunHorizontal) > 1e-8)
+		cosAzimuth = dot(normalize(horizontal), normalize(sunHorizontal));
+	float u = sqrt(clamp(0.5 - 0.5 * cosAzimuth, 0.0, 1.0));
+
+	float zenith = acos(clamp(direction.y, -1.0, 1.0));
+	float v;
+	if (zenith < skyViewHorizon.x)
+		v = 0.5 - 0.5 * sqrt(max(1.0 - zenith / skyViewHorizon.x, 0.0));
+	else
+		v = 0.5 + 0.5 * sqrt(clamp((zenith - skyViewHorizon.x) / skyViewHorizon.y, 0.0, 1.0));
+
+	//The table's parameters are at its texel centres
+	vec2 uv = (vec2(u, v) * (SKY_VIEW_SIZE - 1.0) + 0.5) / SKY_VIEW_SIZE;
+	vec3 sky = texture(skyView, uv).rgb;
+
+	//The sun's disc, with a soft edge
+	sky += smoothstep(SUN_COS_RADIUS - 0.00002, SUN_COS_RADIUS, dot(direction, sunDirection)) * sunDisc * SUN_DISC_RADIANCE;
+
+	//Tone mapped and gamma encoded, as Texture.frag's aerial perspective
+	color = vec4(pow(1.0 - exp(-sky * exposure), vec3(1.0 / 2.2)), 1.0);
+}
@@ -0,0 +1,124 @@
+#version 330 core
+
+//Permutation define shared with Texture.frag (the TBN matrix is only needed for normal mapping)
+#ifndef NORMAL_MAPPING
+#define NORMAL_MAPPING 1
+#endif
+
+// Local cell coordinate of the vertex inside its level's window
+layout(location = 0) in vec2 gridPosition;
+
+#define CLIPMAP_TEXTURE_SIZE 128
+#define CLIPMAP_GRID_CELLS 122
+#define CLIPMAP_MORPH_CELLS 12.0 //Width of the band along the outer edge blending into the next coarser level
+
+uniform sampler2DArray heightClipmap;
+uniform ivec2 levelOrigin;
+uniform float levelSpacing;
+uniform int level;
+uniform bool hasCoarser; //Whether the next coarser level is drawn around this one
+uniform float worldSize;
+
+uniform vec3 lightPos;
+uniform vec3 cameraPos;
+
+// Same outputs as Basic.vert so Texture.frag can shade the clipmap unchanged
+out vec2 UVcoords;
+out vec3 vertexNormal;
+out vec3 lightDirection;
+out vec3 cameraPosition;
+out mat4 modelViewMatrix;
+out vec3 fragPos;
+out float pointHeight;
+#if NORMAL_MAPPING
+out mat3 TBN;
+#endif
+out float ambientOcclusion;
+
+uniform mat4 MVP;
+uniform mat4 modelView;
+uniform float scaleValue;
+
+//Toroidal lookup: the grid coordinate wraps around the level's texture
+float fetchHeight(ivec2 grid, int layer)
+{
+	ivec2 texel = grid & (CLIPMAP_TEXTURE_SIZE - 1);
+	return texelFetch(heightClipmap, ivec3(texel, layer), 0).r * scaleValue;
+}
+
+float fetchHeight(ivec2 grid)
+{
+	return fetchHeight(grid, level);
+}
+
+//Height of the next coarser level's surface at a vertex of this level: its own vertex where the grids meet
+//(origins are even), the middle of its edge or cell between them
+float coarserHeight(ivec2 grid)
+{
+	ivec2 low = grid >> 1;
+	ivec2 high = (grid + 1) >> 1;
+	return 0.25 * (fetchHeight(low, level + 1) + fetchHeight(ivec2(high.x, low.y), level + 1) +
+				   fetchHeight(ivec2(low.x, high.y), level + 1) + fetchHeight(high, level + 1));
+}
+
+void main(){
+	ivec2 local = ivec2(gridPosition);
+	ivec2 grid = levelOrigin + local;
+
+	float height = fetchHeight(grid);
+
+	//Levels sample different mips, so towards the outer edge the heights morph into the coarser level's surface:
+	//on the edge itself they match it exactly and the levels meet without cracks
+	vec2 fromCentre = abs(vec2(local) - 0.5 * CLIPMAP_GRID_CELLS);
+	float morph = 0.0;
+	if (hasCoarser)
+	{
+		morph = clamp((max(fromCentre.x, fromCentre.y) - (0.5 * CLIPMAP_GRID_CELLS - CLIPMAP_MORPH_CELLS)) / CLIPMAP_MORPH_CELLS, 0.0, 1.0);
+		if (morph > 0.0)
+			height = mix(height, coarserHeight(grid), morph);
+	}
+
+	pointHeight = height;
+
+	vec3 updatedVector = vec3(grid.x * levelSpacing, height, grid.y * levelSpacing);
+
+	//Central differences over the neighbouring samples
+	float leftHeight = fetchHeight(grid - ivec2(1, 0));
+	float rightHeight = fetchHeight(grid + ivec2(1, 0));
+	float downHeight = fetchHeight(grid - ivec2(0, 1));
+	float upHeight = fetchHeight(grid + ivec2(0, 1));
+
+	vertexNormal = normalize(vec3(leftHeight - rightHeight, 2.0 * levelSpacing, downHeight - upHeight));
+
+	//The coarser level's normal across the band, from its own neighbours
+	if (morph > 0.0)
+	{
+		ivec2 coarse = grid >> 1;
+		vec3 coarserNormal = normalize(vec3(fetchHeight(coarse - ivec2(1, 0), level + 1) - fetchHeight(coarse + ivec2(1, 0), level + 1),
+											4.0 * levelSpacing,
+											fetchHeight(coarse - ivec2(0, 1), level + 1) - fetchHeight(coarse + ivec2(0, 1), level + 1)));
+		vertexNormal = normalize(mix(vertexNormal, coarserNormal, morph));
+	}
+
+	gl_Position = MVP * vec4(updatedVector, 1);
+	fragPos = updatedVector;
+
+#if NORMAL_MAPPING
+	//Setup TBN matrix (same construction as Basic.vert)
+	vec3 tangent = vec3(1,0,0);
+	vec3 bitangent = vec3(0,0,1);
+	tangent = normalize(tangent - dot(tangent, vertexNormal) * vertexNormal);
+	bitangent = normalize((bitangent - dot(bitangent, vertexNormal) * vertexNormal) - (bitangent - dot(bitangent, tangent) * tangent));
+	TBN = mat3(tangent, bitangent, vertexNormal);
+#endif
+
+	//Material UVs follow the world position so tiling matches the base mesh
+	UVcoords = updatedVector.xz / worldSize + 0.5;
+
+	//No occlusion data outside the base grid
+	ambientOcclusion = 1.0;
+
+	lightDirection = lightPos;
+	cameraPosition = cameraPos;
+	modelViewMatrix = modelView;
+}
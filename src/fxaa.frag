@@ -0,0 +1,54 @@
+#version 330 core
+
+in vec2 screenUV;
+out vec4 color;
+
+uniform sampler2D sceneColour;
+uniform vec2 uvScale; // Fraction of the texture covered by the rendered area
+uniform vec2 texelSize;
+
+#define FXAA_SPAN_MAX 8.0
+#define FXAA_REDUCE_MUL (1.0 / 8.0)
+#define FXAA_REDUCE_MIN (1.0 / 128.0)
+
+// Edges are found on displayable colours, so the HDR input is clamped first
+vec3 fetch(vec2 uv)
+{
+	uv = clamp(uv, 0.5 * texelSize, uvScale - 0.5 * texelSize);
+	return clamp(texture(sceneColour, uv).rgb, 0.0, 1.0);
+}
+
+float luma(vec3 colour)
+{
+	return dot(colour, vec3(0.299, 0.587, 0.114));
+}
+
+void main(){
+	vec2 uv = screenUV * uvScale;
+
+	vec3 centre = fetch(uv);
+	float lumaNW = luma(fetch(uv + vec2(-1.0, -1.0) * texelSize));
+	float lumaNE = luma(fetch(uv + vec2(1.0, -1.0) * texelSize));
+	float lumaSW = luma(fetch(uv + vec2(-1.0, 1.0) * texelSize));
+	float lumaSE = luma(fetch(uv + vec2(1.0, 1.0) * texelSize));
+	float lumaM = luma(centre);
+
+	float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+	float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+
+	//Blur direction runs along the edge
+	vec2 direction;
+	direction.x = -((lumaNW + lumaNE) - (lumaSW + lumaSE));
+	direction.y = ((lumaNW + lumaSW) - (lumaNE + lumaSE));
+
+	float directionReduce = max((lumaNW + lumaNE + lumaSW + lumaSE) * 0.25 * FXAA_REDUCE_MUL, FXAA_REDUCE_MIN);
+	float inverseDirectionMin = 1.0 / (min(abs(direction.x), abs(direction.y)) + directionReduce);
+	direction = clamp(direction * inverseDirectionMin, -FXAA_SPAN_MAX, FXAA_SPAN_MAX) * texelSize;
+
+	vec3 colourA = 0.5 * (fetch(uv + direction * (1.0 / 3.0 - 0.5)) + fetch(uv + direction * (2.0 / 3.0 - 0.5)));
+	vec3 colourB = colourA * 0.5 + 0.25 * (fetch(uv - direction * 0.5) + fetch(uv + direction * 0.5));
+
+	//The wider tap crossed another edge -> fall back to the narrow one
+	float lumaB = luma(colourB);
+	color = vec4((lumaB < lumaMin || lumaB > lumaMax) ? colourA : colourB, 1.0);
+}
@@ -19,6 +19,31 @@ using namespace glm;
 
 #include "common/utils.hpp"
 #include "common/controls.hpp" //Calculates camera, inputs and matrices
+#include "common/clipmap.hpp" //Camera-following terrain with constant per-frame cost
+#include "common/datasets.hpp" //Runtime-selectable heightmaps, loaded in the background
+#include "common/derived.hpp" //Normals, bounds, vegetation and AO cached until the scale or heightmap changes
+#include "common/profiler.hpp" //CPU and GPU timings of each pass
+#include "common/framepacing.hpp" //Vsync, latency and dynamic resolution
+#include "common/postprocess.hpp" //MSAA, FXAA and TAA
+#include "common/terrainquery.hpp" //CPU height lookups and ray casts
+#include "common/jobs.hpp" //Work-stealing job system for decoding, mesh generation, culling and bakes
+#include "common/culling.hpp" //Frustum culling of the base mesh tiles
+#include "common/occlusion.hpp" //Software occlusion culling against a coarse terrain depth buffer
+#include "common/terrainmesh.hpp" //Base mesh grid and per tile index ranges
+#include "common/shadervariants.hpp" //Terrain shader permutations and the program binary cache
+#include "common/glcapture.hpp" //Records frames of GL calls for tools/glreplay
+#include "common/simulation.hpp" //Fixed-rate camera and light updates on their own thread
+#include "common/clusteredlights.hpp" //Local point and spot lights binned into a froxel grid
+#include "common/resources.hpp" //Memory of every buffer, texture and program, kept under a budget
+#include "common/terrainedit.hpp" //Sculpting brushes with region-only updates and undo
+#include "common/screencapture.hpp" //Screenshots and videos read back through PBOs, encoded on their own thread
+#include "common/maptiles.hpp" //Batch rendering of z/x/y map tiles across worker processes
+#include "common/skylight.hpp" //Spherical harmonic ambient light and prefiltered reflections of the skybox
+#include "common/multiview.hpp" //Stereo, panorama and split screen views drawn by single instanced passes
+#include "common/materiallod.hpp" //Baked macro textures in place of the detail materials far away
+#include "common/framememory.hpp" //Per-frame arena, persistently mapped upload ring and heap allocation counts
+#include "common/atmosphere.hpp" //Sky and aerial perspective from precomputed scattering tables
+#include "common/water.hpp" //Lakes and rivers from masks, with reduced-resolution planar reflections
 
 //Include the stb_image library to read external textures (not bmp)
 #define STB_IMAGE_IMPLEMENTATION
@@ -27,6 +52,55 @@ using namespace glm;
 //Including file reading
 #include <fstream>
 #include <sstream>
+#include <filesystem>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <new>
+
+//Every heap allocation of the application is counted, so steady frames can be checked to make none
+void* operator new(size_t bytes)
+{
+	void* pointer = countedMalloc(bytes, nullptr);
+	if (!pointer)
+		throw bad_alloc();
+	return pointer;
+}
+
+void* operator new[](size_t bytes)
+{
+	return operator new(bytes);
+}
+
+void* operator new(size_t bytes, const nothrow_t&) noexcept
+{
+	return countedMalloc(bytes, nullptr);
+}
+
+void* operator new[](size_t bytes, const nothrow_t&) noexcept
+{
+	return countedMalloc(bytes, nullptr);
+}
+
+void operator delete(void* pointer) noexcept
+{
+	countedFree(pointer, nullptr);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+	countedFree(pointer, nullptr);
+}
+
+void operator delete(void* pointer, size_t) noexcept
+{
+	countedFree(pointer, nullptr);
+}
+
+void operator delete[](void* pointer, size_t) noexcept
+{
+	countedFree(pointer, nullptr);
+}
 
 //Variables
 GLFWwindow* window;
@@ -42,6 +116,7 @@ GLuint VertexArrayID;
 GLuint vertexbuffer;
 GLuint uvbuffer;
 GLuint normalbuffer;
+GLuint occlusionbuffer;
 GLuint elementbuffer;
 
 //Additional VAO and Buffers needed (for the advanced tasks)
@@ -51,8 +126,19 @@ GLuint sunflowerVertexArray;
 GLuint sunflowerVertexBuffer;
 GLuint sunflowerUVBuffer;
 
-//Number of indices in the plane
-unsigned int nIndices;
+//Index ranges of the base mesh tiles (tile tx * terrainTilesPerSide + tz), and which of them are drawn
+int terrainTilesPerSide = 0;
+vector<GLsizei> tileIndexCounts;
+vector<const void*> tileIndexOffsets;
+vector<unsigned char> tileVisible;
+bool cullTiles = true;
+int visibleTiles = 0;
+int tileCullTests = 0; //Tile box tests this frame, over every view
+
+//Tiles and billboards hidden behind the terrain are left out (single views of the base mesh)
+OcclusionBuffer occlusion;
+vector<unsigned char> sunflowerVisible;
+static const float sunflowerRadius = 0.075f; //Half the billboard's diagonal, rounded up
 
 //Store the rock textures
 GLuint rockDiffuseID;
@@ -72,12 +158,111 @@ GLuint grassNormalsID;
 //Height map
 GLuint heightMapID;
 
+//Available heightmaps (the material textures below are not heightmaps)
+DatasetManager datasets;
+int datasetBudgetMB = 512;
+
+//Video memory budget of the registered resources (mips are dropped and unused textures evicted above it)
+ResourceBudget resourceBudget;
+int resourceBudgetMB = 0; //0 for no limit
+const vector<string> materialTextures = {
+	"rocks.bmp", "rocks-r.bmp", "rocks-n.bmp",
+	"snow.bmp", "snow-r.bmp", "snow-n.bmp",
+	"grass.bmp", "grass-r.bmp", "grass-n.bmp"
+};
+
+//Data derived from the active heightmap and scaleValue
+TerrainDerived derived;
+
+//Clipmap terrain (replaces the base mesh when enabled)
+Clipmap clipmap;
+bool clipmapMode = false;
+static const float clipmapSpacing = 0.025f; //Grid spacing of the finest level
+static const int clipmapLevels = 8;
+
+//Offscreen scene target, vsync and latency settings
+FramePacing framePacing;
+
+//Anti-aliasing applied when presenting the scene
+PostProcess postProcess;
+
+//CPU terrain queries (camera ground clamping and mouse picking)
+TerrainQuery terrainQuery;
+bool clampCamera = true;
+static const float cameraClearance = 0.15f; //Keeps the near plane above the ground
+bool pickRequested = false;
+double pickCursorX, pickCursorY;
+bool pickHit = false;
+vec3 pickPosition;
+
+//Terrain editing: brushes sculpt the active heightmap while the left mouse button is held
+TerrainEditor terrainEditor;
+bool editTerrain = false;
+double lastBrushTime = 0.0;
+double pickMicroseconds = 0.0;
+
 //Store the program
 GLuint programID;
 
+//Terrain shader permutations (programID and clipmapID are the ones matching the settings below)
+ShaderVariants terrainShaders;
+ShaderVariants clipmapShaders;
+int terrainMaterialCount = 3;
+bool terrainNormalMapping = true;
+bool terrainOcclusion = true;
+int terrainDebugView = 0;
+const char* const debugViewNames[] = { "None", "Normals", "Material Weights", "Ambient Occlusion" };
+static const int wireframeDebugView = 4; //Unshaded edges, selected while in wireframe mode
+
+//Far terrain shaded from the macro textures (the averages are read once the material textures are loaded)
+MaterialLod materialLod;
+MaterialAverages materialAverages;
+
+//Local lights (the stress scene scatters lightCount of them over the terrain)
+ClusteredLights clusteredLights;
+bool localLights = false;
+int lightCount = 1000;
+float lightRadius = 0.4f;
+int lightSeed = 1;
+bool animateLights = true;
+double lightTime = 0.0;
+
+//Image-based sky lighting (the ambient term of the terrain and the tint of the billboards)
+SkyLighting skyLighting;
+bool skyAmbient = true;
+bool skySpecular = false;
+float skyAmbientStrength = 0.35f; //Roughly the old constant 0.2 ambient on average over the terrain's normals
+
+//Stereo, panorama and split screen views of the camera
+MultiView multiView;
+
+//Physically based sky and aerial perspective lit by lightPos (in place of the skybox while enabled)
+Atmosphere atmosphere;
+
+//Lakes and rivers from the masks (which are not heightmaps either), reflecting the terrain and the sky
+Water water;
+WaterMasks waterMasks;
+const vector<string> waterMaskFiles = { "great_lakes.bmp", "rivers.bmp" };
+vector<unsigned char> reflectionTileVisible;
+
+//Number of frames recorded by the next GL capture (F9)
+int captureFrames = 4;
+
+//Screenshots and recordings
+int screenCaptureFormat = SCREEN_CAPTURE_PNG;
+int screenCaptureFrames = 0; //Frames a recording lasts, 0 until stopped
+int screenCaptureRate = 60; //Frame rate written into videos
+
 //Additional render passes
 GLuint skyboxID;
+GLuint atmosphereSkyID;
+GLuint atmosphereTablesID;
 GLuint sunflowerID;
+GLuint waterID;
+GLuint reflectionProgramID; //Terrain permutation of the water's reflection
+GLuint clipmapID;
+GLuint fxaaID;
+GLuint taaID;
 
 //Store the skybox textures
 GLuint skyboxTextureID;
@@ -146,10 +331,11 @@ bool cursorWasJustOff = false;
 bool cursorWasJustOn = false;
 ImGuiIO* io = nullptr;
 
-//Initial position of the directional light
+//Initial position of the directional light (the simulation turns it from there)
 vec3 lightPos = vec3(0, -0.5, -0.5);
+double simulationRate = 120.0; //Simulation ticks a second
 
-bool initializeGL()
+bool initializeGL(bool visible)
 {
 	//Initialise GLFW
 	if (!glfwInit())
@@ -158,11 +344,12 @@ bool initializeGL()
 		return false;
 	}
 
-	glfwWindowHint(GLFW_SAMPLES, 1); //No anti-aliasing
+	glfwWindowHint(GLFW_SAMPLES, 1); //Anti-aliasing is applied to the offscreen scene target instead
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); //Statement to please MacOS
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE); //Headless runs still render into the hidden window
 	window = glfwCreateWindow(window_width, window_height, "OpenGLRenderer", NULL, NULL);
 
 	if (window == NULL)
@@ -195,42 +382,27 @@ bool initializeGL()
 //Create the mesh, and connect it to OpenGL
 void LoadModel()
 {
-	std::vector<vec3> vertices;
-	std::vector<vec2>uvs;
-	std::vector<unsigned int> indices;
-
-	//Create points by mapping them to [-1, 1] interval and then multiply by scale factor
-	for (int i = 0; i < n_points; i++)
-	{
-		float x = (m_scale) * ((i / float(n_points - 1)) - 0.5f) * 2.0f;
-		for (int j = 0; j < n_points; j++)
-		{
-			float z = (m_scale) * ((j / float(n_points - 1)) - 0.5f) * 2.0f;
-			vertices.push_back(vec3(x, 0, z));
-			uvs.push_back(vec2(float(i + 0.5f) / float(n_points - 1),
-								float(j + 0.5f) / float(n_points - 1)));
-		}
-	}
-
-	//Specify a triangle strip for each row of two vertices
-	//We don't want them to be connected, so we restart the primitive when changing rows
+	//Grid, UVs and the per tile triangle strips (built on the job system)
+	TerrainMesh mesh;
+	buildTerrainMesh(mesh, n_points, m_scale, derived.tileSize);
+	const vector<vec3>& vertices = mesh.vertices;
+	const vector<vec2>& uvs = mesh.uvs;
+	const vector<unsigned int>& indices = mesh.indices;
+
+	//We don't want the row strips to be connected, so we restart the primitive when changing rows
 	//This way, we specify less vertices and run the shader less times
 	glEnable(GL_PRIMITIVE_RESTART);
-	constexpr unsigned int restartIndex = numeric_limits<uint32_t>::max(); //Choose the largest index that can possibly be used
-	glPrimitiveRestartIndex(restartIndex);
-	int n = 0;
-	for (int i = 0; i < n_points - 1; i++)
+	glPrimitiveRestartIndex(terrainRestartIndex);
+
+	//Tiles outside the view can be left out of the draw
+	terrainTilesPerSide = mesh.tilesPerSide;
+	int tiles = terrainTilesPerSide * terrainTilesPerSide;
+	tileIndexCounts.resize(tiles);
+	tileIndexOffsets.resize(tiles);
+	for (int tile = 0; tile < tiles; tile++)
 	{
-		for (int j = 0; j < n_points; j++)
-		{
-			unsigned int topLeft = n;
-			unsigned int bottomLeft = topLeft + n_points;
-			indices.push_back(bottomLeft);
-			indices.push_back(topLeft);
-			n++;
-		}
-
-		indices.push_back(restartIndex);
+		tileIndexCounts[tile] = mesh.tileIndexCounts[tile];
+		tileIndexOffsets[tile] = (const void*)(mesh.tileFirstIndex[tile] * sizeof(unsigned int));
 	}
 
 	glGenVertexArrays(1, &VertexArrayID); //Initialise VAO
@@ -264,14 +436,75 @@ void LoadModel()
 		(void*)0	//Array buffer object
 	);
 
+	//Describe normals and ambient occlusion (filled in by UpdateDerivedData whenever they change)
+	vector<vec3> normals(vertices.size(), vec3(0, 1, 0));
+	vector<float> occlusion(vertices.size(), 1.0f);
+
+	glEnableVertexAttribArray(2);
+	glGenBuffers(1, &normalbuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
+	glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(vec3), &normals[0], GL_DYNAMIC_DRAW);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+	glEnableVertexAttribArray(3);
+	glGenBuffers(1, &occlusionbuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, occlusionbuffer);
+	glBufferData(GL_ARRAY_BUFFER, occlusion.size() * sizeof(float), &occlusion[0], GL_DYNAMIC_DRAW);
+	glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
 	//Describe indices
 	glGenBuffers(1, &elementbuffer);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-	
-	//Store how many indices in the plane (needed for rendering)
-	nIndices = indices.size();
 
+	//The normals and occlusion also stay on the CPU in the derived data they are uploaded from
+	registerBuffer("Terrain Vertices", "Terrain", vertexbuffer, vertices.size() * sizeof(vec3));
+	registerBuffer("Terrain UVs", "Terrain", uvbuffer, uvs.size() * sizeof(vec2));
+	registerBuffer("Terrain Normals", "Terrain", normalbuffer, normals.size() * sizeof(vec3), normals.size() * sizeof(vec3));
+	registerBuffer("Terrain Occlusion", "Terrain", occlusionbuffer, occlusion.size() * sizeof(float), occlusion.size() * sizeof(float));
+	registerBuffer("Terrain Indices", "Terrain", elementbuffer, indices.size() * sizeof(unsigned int));
+}
+
+//Decode a material BMP on a worker, then hand it over to OpenGL from the main thread
+JobHandle LoadMaterialTexture(const char* path, GLuint* textureID, GLenum textureUnit, GLint magFilter, GLint minFilter)
+{
+	struct Image
+	{
+		int width = 0;
+		int height = 0;
+		unsigned char* data = nullptr;
+	};
+	shared_ptr<Image> image = make_shared<Image>();
+
+	JobHandle decode = runJob([path, image] { loadBMP_custom(path, image->width, image->height, image->data); });
+	return runOnMainThread([path, image, textureID, textureUnit, magFilter, minFilter]
+	{
+		//Reloads (after the budget evicted or reduced the texture) re-specify the same texture name
+		if (*textureID == 0)
+			glGenTextures(1, textureID);
+		glActiveTexture(textureUnit);
+		glBindTexture(GL_TEXTURE_2D, *textureID);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, image->width, image->height, 0, GL_BGR, GL_UNSIGNED_BYTE, image->data);
+		delete[] image->data;
+		image->data = nullptr;
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 1000);
+		glGenerateMipmap(GL_TEXTURE_2D);
+
+		//Back on unit 0, so later loads do not replace the texture on its unit (BindMaterialTextures binds it for each draw)
+		glActiveTexture(GL_TEXTURE0);
+
+		registerTexture(path, "Materials", *textureID, GL_TEXTURE_2D, image->width, image->height, 1, GL_RGB, true);
+		setResourceReload(path, [path, textureID, textureUnit, magFilter, minFilter]
+		{
+			LoadMaterialTexture(path, textureID, textureUnit, magFilter, minFilter);
+		});
+	}, { decode });
 }
 
 //Loading Textures
@@ -279,72 +512,24 @@ void LoadTextures()
 {
 	/*
 	***************************************************
-		Loading the rock textures
+		Loading the rock, snow and grass textures
 	***************************************************
-
 	*/
-	//Load BMP File
-	int width, height;
-	unsigned char* data = nullptr;
-	loadBMP_custom("rocks.bmp", width, height, data);
-
-	//Hand over the BMP data to OpenGL
-	glGenTextures(1, &rockDiffuseID);
-	glBindTexture(GL_TEXTURE_2D, rockDiffuseID);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, data);
-	delete[] data;
-
-	//Finish texture setup
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glGenerateMipmap(GL_TEXTURE_2D);
-
-	//Unbind current texture -> Good practice, only bind when you need to
-	glBindTexture(GL_TEXTURE_2D, -1);
-
-	//Load the shininess texture
-	unsigned char* rockShininessData;
-	loadBMP_custom("rocks-r.bmp", width, height, rockShininessData);
-
-	//Hand over rock shininess data to OpenGL
-	glGenTextures(1, &rockShininessID);
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, rockShininessID);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, rockShininessData);
-	delete[] rockShininessData;
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glGenerateMipmap(GL_TEXTURE_2D);
-
-	glBindTexture(GL_TEXTURE_2D, -1);
 
-	//Load the rock normals texture
-	unsigned char* rockNormalsData;
-	loadBMP_custom("rocks-n.bmp", width, height, rockNormalsData);
-
-	//Hand over rock shininess data to OpenGL
-	glGenTextures(1, &rockNormalsID);
-	glActiveTexture(GL_TEXTURE3);
-	glBindTexture(GL_TEXTURE_2D, rockNormalsID);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, rockNormalsData);
-	delete[] rockNormalsData;
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glGenerateMipmap(GL_TEXTURE_2D);
+	//The nine BMPs are decoded in parallel while the heightmap loads below
+	vector<JobHandle> uploads = {
+		LoadMaterialTexture("rocks.bmp", &rockDiffuseID, GL_TEXTURE0, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR_MIPMAP_LINEAR),
+		LoadMaterialTexture("rocks-r.bmp", &rockShininessID, GL_TEXTURE2, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR_MIPMAP_LINEAR),
+		LoadMaterialTexture("rocks-n.bmp", &rockNormalsID, GL_TEXTURE3, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR_MIPMAP_LINEAR),
 
-	glBindTexture(GL_TEXTURE_2D, -1);
+		LoadMaterialTexture("snow.bmp", &snowDiffuseID, GL_TEXTURE4, GL_LINEAR, GL_NEAREST_MIPMAP_LINEAR),
+		LoadMaterialTexture("snow-r.bmp", &snowShininessID, GL_TEXTURE5, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR_MIPMAP_LINEAR),
+		LoadMaterialTexture("snow-n.bmp", &snowNormalsID, GL_TEXTURE6, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR_MIPMAP_LINEAR),
 
+		LoadMaterialTexture("grass.bmp", &grassDiffuseID, GL_TEXTURE7, GL_LINEAR, GL_NEAREST_MIPMAP_LINEAR),
+		LoadMaterialTexture("grass-r.bmp", &grassShininessID, GL_TEXTURE8, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR_MIPMAP_LINEAR),
+		LoadMaterialTexture("grass-n.bmp", &grassNormalsID, GL_TEXTURE9, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR_MIPMAP_LINEAR)
+	};
 
 	/*
 	***************************************************
@@ -352,16 +537,31 @@ void LoadTextures()
 	***************************************************
 	*/
 
-	unsigned char* heightData = nullptr;
-	loadBMP_custom("rugged.bmp", width, height, heightData);
+	//The dataset manager keeps every heightmap (and its derived data) on the CPU, the others preload in the background
+	datasets.worldSize = 2.0f * m_scale;
+	datasets.clipmapSpacing = clipmapSpacing;
+	datasets.normalResolution = n_points;
+	datasets.budgetBytes = size_t(datasetBudgetMB) << 20;
+	const float* heightData = nullptr;
+	int width = 0, height = 0;
+	vector<string> excluded = materialTextures;
+	excluded.insert(excluded.end(), waterMaskFiles.begin(), waterMaskFiles.end());
+	if (initDatasets(datasets, ".", excluded, "rugged.bmp"))
+	{
+		const Dataset& heightDataset = *datasets.datasets[datasets.active];
+		heightData = &heightDataset.heights[0];
+		width = heightDataset.width;
+		height = heightDataset.height;
+	}
+	else
+		cout << "Failed to load the initial heightmap" << endl;
 
-	//Hand over heightmap data to OpenGl
+	//Hand over the decoded heights to OpenGl (one float per texel, so the shader reads them directly)
 	glGenTextures(1, &heightMapID);
 	glActiveTexture(GL_TEXTURE1);
 	glBindTexture(GL_TEXTURE_2D, heightMapID);
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, heightData);
-	delete[] heightData;
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT, heightData);
 
 	//Sampling method for the height map
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -371,144 +571,18 @@ void LoadTextures()
 	glGenerateMipmap(GL_TEXTURE_2D);
 
 	//Unbind current texture after initialisation (good practice)
-	glBindTexture(GL_TEXTURE_2D, -1);
-
-
-	/*
-	***************************************************
-		Loading the snow textures
-	***************************************************
-	*/
-
-	//Snow Diffuse
-	unsigned char* snowDiffuseData = nullptr;
-	loadBMP_custom("snow.bmp", width, height, snowDiffuseData);
-
-	//Hand over snow diffuse data to OpenGl
-	glGenTextures(1, &snowDiffuseID);
-	glActiveTexture(GL_TEXTURE4);
-	glBindTexture(GL_TEXTURE_2D, snowDiffuseID);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, snowDiffuseData);
-	delete[] snowDiffuseData;
-
-	//Sampling method for the snow diffuse
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
-	glGenerateMipmap(GL_TEXTURE_2D);
-
-	//Unbind current texture after initialisation (good practice)
-	glBindTexture(GL_TEXTURE_2D, -1);
-
-	//Snow Shininess
-	unsigned char* snowShininessData;
-	loadBMP_custom("snow-r.bmp", width, height, snowShininessData);
-
-	//Hand over snow shininess data to OpenGL
-	glGenTextures(1, &snowShininessID);
-	glActiveTexture(GL_TEXTURE5);
-	glBindTexture(GL_TEXTURE_2D, snowShininessID);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, snowShininessData);
-	delete[] snowShininessData;
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glGenerateMipmap(GL_TEXTURE_2D);
-
-	glBindTexture(GL_TEXTURE_2D, -1);
-
-	//Snow Normals
-	unsigned char* snowNormalData;
-	loadBMP_custom("snow-n.bmp", width, height, snowNormalData);
-
-	//Hand over snow shininess data to OpenGL
-	glGenTextures(1, &snowNormalsID);
-	glActiveTexture(GL_TEXTURE6);
-	glBindTexture(GL_TEXTURE_2D, snowNormalsID);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, snowNormalData);
-	delete[] snowNormalData;
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glGenerateMipmap(GL_TEXTURE_2D);
-
-	glBindTexture(GL_TEXTURE_2D, -1);
-
-	/*
-	***************************************************
-		Loading the grass textures
-	***************************************************
-	*/
-
-	//Grass Diffuse
-	unsigned char* grassDiffuseData = nullptr;
-	loadBMP_custom("grass.bmp", width, height, grassDiffuseData);
-
-	//Hand over snow diffuse data to OpenGl
-	glGenTextures(1, &grassDiffuseID);
-	glActiveTexture(GL_TEXTURE7);
-	glBindTexture(GL_TEXTURE_2D, grassDiffuseID);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, grassDiffuseData);
-	delete[] grassDiffuseData;
-
-	//Sampling method for the snow diffuse
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
-	glGenerateMipmap(GL_TEXTURE_2D);
-
-	//Unbind current texture after initialisation (good practice)
-	glBindTexture(GL_TEXTURE_2D, -1);
-
-	//Grass Shininess
-	unsigned char* grassShininessData;
-	loadBMP_custom("grass-r.bmp", width, height, grassShininessData);
-
-	//Hand over grass shininess data to OpenGL
-	glGenTextures(1, &grassShininessID);
-	glActiveTexture(GL_TEXTURE8);
-	glBindTexture(GL_TEXTURE_2D, grassShininessID);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, grassShininessData);
-	delete[] grassShininessData;
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glGenerateMipmap(GL_TEXTURE_2D);
-
-	glBindTexture(GL_TEXTURE_2D, -1);
-
-	//Grass Normals
-	unsigned char* grassNormalData;
-	loadBMP_custom("grass-n.bmp", width, height, grassNormalData);
-
-	//Hand over grass shininess data to OpenGL
-	glGenTextures(1, &grassNormalsID);
-	glActiveTexture(GL_TEXTURE9);
-	glBindTexture(GL_TEXTURE_2D, grassNormalsID);
-	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_BGR, GL_UNSIGNED_BYTE, grassNormalData);
-	delete[] grassNormalData;
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-	glGenerateMipmap(GL_TEXTURE_2D);
-
-	glBindTexture(GL_TEXTURE_2D, -1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	registerTexture("Heightmap", "Terrain", heightMapID, GL_TEXTURE_2D, width, height, 1, GL_R32F, true, size_t(width) * height * sizeof(float));
+
+	//Upload the materials as their decodes finish
+	waitForJobs(uploads);
+	glActiveTexture(GL_TEXTURE0);
+
+	//What the materials average to far away, for the macro textures
+	const GLuint diffuse[MATERIAL_INDEX_COUNT] = { rockDiffuseID, grassDiffuseID, snowDiffuseID };
+	const GLuint roughness[MATERIAL_INDEX_COUNT] = { rockShininessID, grassShininessID, snowShininessID };
+	const GLuint normals[MATERIAL_INDEX_COUNT] = { rockNormalsID, grassNormalsID, snowNormalsID };
+	materialAverages = readMaterialAverages(diffuse, roughness, normals, terrainMaterialCount);
 }
 
 //Read shader file and compile it
@@ -603,6 +677,7 @@ void LoadShaders(GLuint& program, const char* vertex_file_path, const char* frag
 		}
 
 		//cout << "Linking program: " << (Result == GL_TRUE ? "Success" : "Failed") << endl;
+		registerProgram(fragment_file_path, "Programs", program);
 
 	}
 	
@@ -619,6 +694,36 @@ void LoadShaders(GLuint& program, const char* vertex_file_path, const char* frag
 		glDeleteShader(GeometryShaderID);
 }
 
+//Compile a compute shader into its own program
+void LoadComputeShader(GLuint& program, const char* compute_file_path)
+{
+	GLuint ComputeShaderID = glCreateShader(GL_COMPUTE_SHADER);
+	if (readAndCompileShader(compute_file_path, ComputeShaderID))
+	{
+		GLint Result = GL_FALSE;
+		int InfoLogLength;
+
+		program = glCreateProgram();
+		glAttachShader(program, ComputeShaderID);
+		glLinkProgram(program);
+
+		glGetProgramiv(program, GL_LINK_STATUS, &Result);
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &InfoLogLength);
+		if (InfoLogLength > 0)
+		{
+			std::vector<char> ProgramErrorMessage(InfoLogLength + 1);
+			glGetProgramInfoLog(program, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+			cout << &ProgramErrorMessage[0];
+		}
+		registerProgram(compute_file_path, "Programs", program);
+	}
+	else
+	{
+		cout << "Program will not be linked: the compute shader has an error" << endl;
+	}
+	glDeleteShader(ComputeShaderID);
+}
+
 //
 //Clean Up Routines
 //
@@ -626,6 +731,8 @@ void UnloadModel()
 {
 	glDeleteBuffers(1, &vertexbuffer);
 	glDeleteBuffers(1, &uvbuffer);
+	glDeleteBuffers(1, &normalbuffer);
+	glDeleteBuffers(1, &occlusionbuffer);
 	glDeleteBuffers(1, &elementbuffer);
 	glDeleteVertexArrays(1, &VertexArrayID);
 
@@ -635,6 +742,10 @@ void UnloadModel()
 	glDeleteVertexArrays(1, &sunflowerVertexArray);
 	glDeleteBuffers(1, &sunflowerVertexBuffer);
 	glDeleteBuffers(1, &sunflowerUVBuffer);
+
+	unregisterCategory("Terrain");
+	unregisterCategory("Skybox");
+	unregisterCategory("Sunflowers");
 }
 
 void UnloadTextures()
@@ -653,18 +764,172 @@ void UnloadTextures()
 	glDeleteTextures(1, &grassShininessID);
 	glDeleteTextures(1, &grassNormalsID);
 
-	//Delete the skybox texture
+	//Delete the skybox texture and its prefiltered reflections
 	glDeleteTextures(1, &skyboxTextureID);
+	destroySkyLighting(skyLighting);
 
 	//Delete sunflower texture
 	glDeleteTextures(1, &sunflowerTextureID);
+
+	unregisterCategory("Materials");
+	unregisterResource("Heightmap");
+	unregisterResource("Skybox");
+	unregisterResource("Sky Specular");
+	unregisterResource("Sunflower");
 }
 
 void UnloadShaders()
 {
-	glDeleteProgram(programID);
+	destroyShaderVariants(terrainShaders);
+	destroyShaderVariants(clipmapShaders);
 	glDeleteProgram(skyboxID);
+	glDeleteProgram(atmosphereSkyID);
+	glDeleteProgram(atmosphereTablesID);
 	glDeleteProgram(sunflowerID);
+	glDeleteProgram(waterID);
+	glDeleteProgram(fxaaID);
+	glDeleteProgram(taaID);
+	unregisterCategory("Programs");
+}
+
+//Local lights are binned for a single camera, so they are left out of multi-view rendering
+bool LocalLightsActive()
+{
+	return localLights && !multiView.enabled;
+}
+
+//The terrain's ATMOSPHERE define: the aerial perspective volume covers a single camera, so multi-view keeps
+//only the sunlight through the atmosphere
+int AtmosphereShading()
+{
+	if (!atmosphere.enabled)
+		return 0;
+	return atmosphere.aerialPerspective && !multiView.enabled ? 2 : 1;
+}
+
+//Register a terrain permutation under its defines when it is first built
+void RegisterShaderVariant(const char* family, const ShaderDefine* defines, int count, GLuint program)
+{
+	string name = family;
+	for (int i = 0; i < count; i++)
+		name += " " + string(defines[i].name) + "=" + to_string(defines[i].value);
+	registerProgram(name.c_str(), "Programs", program);
+}
+
+//Set a define of a permutation by its name
+void SetShaderDefine(ShaderDefine* defines, int count, const char* name, int value)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (string(defines[i].name) == name)
+		{
+			defines[i].value = value;
+			return;
+		}
+	}
+	cout << "Unknown shader define " << name << endl;
+}
+
+//Pick the terrain permutations for the current shading settings (each is compiled, or loaded from the
+//binary cache, the first time it is needed)
+void SelectTerrainShaders()
+{
+	//The clipmap is always drawn per view, so it leaves out the last define; the base mesh instances its
+	//tiles per view in a single pass
+	const ShaderDefine defines[] = {
+		{ "MATERIAL_COUNT", terrainMaterialCount },
+		{ "NORMAL_MAPPING", terrainNormalMapping },
+		{ "TERRAIN_OCCLUSION", terrainOcclusion },
+		{ "CLUSTERED_LIGHTS", LocalLightsActive() },
+		{ "SKY_LIGHTING", skyAmbient },
+		{ "SKY_SPECULAR", skySpecular && skyLighting.specularTexture },
+		{ "MATERIAL_LOD", materialLod.enabled && materialLod.colourTexture },
+		{ "ATMOSPHERE", AtmosphereShading() },
+		{ "DEBUG_VIEW", isWireframe ? wireframeDebugView : terrainDebugView },
+		{ "MULTI_VIEW", isMultiViewSinglePass(multiView) }
+	};
+	const int count = int(sizeof(defines) / sizeof(defines[0])), clipmapCount = count - 1;
+
+	//The water's reflection is small and seen through ripples: it leaves out normal mapping, the local lights
+	//(binned for the camera's view), the sky's reflections and the aerial perspective (the camera's volume)
+	ShaderDefine reflectionDefines[count];
+	copy(defines, defines + count, reflectionDefines);
+	SetShaderDefine(reflectionDefines, count, "NORMAL_MAPPING", 0);
+	SetShaderDefine(reflectionDefines, count, "CLUSTERED_LIGHTS", 0);
+	SetShaderDefine(reflectionDefines, count, "SKY_SPECULAR", 0);
+	SetShaderDefine(reflectionDefines, count, "ATMOSPHERE", std::min(AtmosphereShading(), 1));
+	SetShaderDefine(reflectionDefines, count, "MULTI_VIEW", 0);
+
+	size_t terrainBuilt = terrainShaders.programs.size();
+	size_t clipmapBuilt = clipmapShaders.programs.size();
+	programID = getShaderVariant(terrainShaders, defines, count);
+	clipmapID = getShaderVariant(clipmapShaders, defines, clipmapCount);
+
+	if (terrainShaders.programs.size() != terrainBuilt)
+		RegisterShaderVariant("Terrain", defines, count, programID);
+	if (clipmapShaders.programs.size() != clipmapBuilt)
+		RegisterShaderVariant("Clipmap", defines, clipmapCount, clipmapID);
+
+	if (water.enabled && water.reflections)
+	{
+		terrainBuilt = terrainShaders.programs.size();
+		reflectionProgramID = getShaderVariant(terrainShaders, reflectionDefines, count);
+		if (terrainShaders.programs.size() != terrainBuilt)
+			RegisterShaderVariant("Terrain", reflectionDefines, count, reflectionProgramID);
+	}
+}
+
+void ReloadShaders()
+{
+	UnloadShaders();
+	LoadShaders(skyboxID, "src/skyboxVert.vert", "src/skyboxFrag.frag");
+	LoadShaders(atmosphereSkyID, "src/skyboxVert.vert", "src/atmosphere.frag");
+	LoadComputeShader(atmosphereTablesID, "src/atmosphere.comp");
+	LoadShaders(sunflowerID, "src/sunflower.vert", "src/sunflower.frag", "src/sunflower.geom");
+	LoadShaders(waterID, "src/water.vert", "src/water.frag");
+	LoadShaders(fxaaID, "src/post.vert", "src/fxaa.frag");
+	LoadShaders(taaID, "src/post.vert", "src/taa.frag");
+	SelectTerrainShaders();
+}
+
+//Records the next frames to the first unused capture_N.glcap, for replay with tools/glreplay
+void StartCapture()
+{
+	if (isCapturing())
+		return;
+
+	string path;
+	for (int i = 0; path.empty() || filesystem::exists(path); i++)
+		path = "capture_" + to_string(i) + ".glcap";
+
+	int width, height;
+	glfwGetFramebufferSize(window, &width, &height);
+	requestCapture(path.c_str(), captureFrames, width, height);
+}
+
+//Writes the next frame to the first unused screenshot_N.png
+void TakeScreenshot()
+{
+	string path;
+	for (int i = 0; path.empty() || filesystem::exists(path); i++)
+		path = "screenshot_" + to_string(i) + ".png";
+	startScreenCapture(path.c_str(), SCREEN_CAPTURE_PNG, 1);
+}
+
+//Starts recording into the first unused recording_N directory (PNG) or recording_N.y4m, or stops the recording
+void ToggleRecording()
+{
+	if (getScreenCaptureStats().recording)
+	{
+		stopScreenCapture();
+		return;
+	}
+
+	const char* extension = screenCaptureFormat == SCREEN_CAPTURE_Y4M ? ".y4m" : "";
+	string path;
+	for (int i = 0; path.empty() || filesystem::exists(path); i++)
+		path = "recording_" + to_string(i) + extension;
+	startScreenCapture(path.c_str(), ScreenCaptureFormat(screenCaptureFormat), screenCaptureFrames, screenCaptureRate);
 }
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -691,59 +956,55 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 	//Reload shaders if r is pressed
 	if (key == GLFW_KEY_R && action == GLFW_PRESS)
 	{
-		UnloadShaders();
-		LoadShaders(programID, "src/Basic.vert", "src/Texture.frag");
-		LoadShaders(skyboxID, "src/skyboxVert.vert", "src/skyboxFrag.frag");
-		LoadShaders(sunflowerID, "src/sunflower.vert", "src/sunflower.frag", "src/sunflower.geom");
-
+		ReloadShaders();
 	}
 
-	//Rotate Directional Light around x axis
-	if (key == GLFW_KEY_W && (action == GLFW_PRESS || action == GLFW_REPEAT))
-	{
-		//Create rotation matrix
-		float angle = radians(5.0);
-		mat4 rotationMatrix = rotate(mat4(1.0), angle, vec3(1.0, 0.0, 0.0));
-
-		//Apply rotation matrix to light Position
-		lightPos = vec3(rotationMatrix * vec4(lightPos, 0.0));
+	//W/S and A/D (turning the light) are held keys, sampled with the camera input every frame
 
+	//Increment and decrement the scale value (affects the height of the mountains)
+	if (key == GLFW_KEY_T && (action == GLFW_PRESS || action == GLFW_REPEAT))
+	{
+		scaleValue = scaleValue + 0.1;
 	}
 
-	if (key == GLFW_KEY_S && (action == GLFW_PRESS || action == GLFW_REPEAT))
+	if (key == GLFW_KEY_G && (action == GLFW_PRESS || action == GLFW_REPEAT))
 	{
-		float angle = radians(355.0);
-		mat4 rotationMatrix = rotate(mat4(1.0), angle, vec3(1.0, 0.0, 0.0));
-		lightPos = vec3(rotationMatrix * vec4(lightPos, 0.0));
+		if(scaleValue > 0)
+			scaleValue = scaleValue - 0.1;
+	}
 
+	//Switch between the base mesh and the clipmap terrain
+	if (key == GLFW_KEY_C && action == GLFW_PRESS)
+	{
+		clipmapMode = !clipmapMode;
 	}
 
-	//Rotate Directional Light around z axis
-	if (key == GLFW_KEY_A && (action == GLFW_PRESS || action == GLFW_REPEAT))
+	//Capture the next frames' GL calls with F9
+	if (key == GLFW_KEY_F9 && action == GLFW_PRESS)
 	{
-		float angle = radians(5.0);
-		mat4 rotationMatrix = rotate(mat4(1.0), angle, vec3(0.0, 0.0, 1.0));
-		lightPos = vec3(rotationMatrix * vec4(lightPos, 0.0));
+		StartCapture();
+	}
 
+	//Screenshot with F10, start and stop recording with F11
+	if (key == GLFW_KEY_F10 && action == GLFW_PRESS)
+	{
+		TakeScreenshot();
 	}
 
-	if (key == GLFW_KEY_D && (action == GLFW_PRESS || action == GLFW_REPEAT))
+	if (key == GLFW_KEY_F11 && action == GLFW_PRESS)
 	{
-		float angle = radians(355.0);
-		mat4 rotationMatrix = rotate(mat4(1.0), angle, vec3(0.0, 0.0, 1.0));
-		lightPos = vec3(rotationMatrix * vec4(lightPos, 0.0));
+		ToggleRecording();
 	}
 
-	//Increment and decrement the scale value (affects the height of the mountains)
-	if (key == GLFW_KEY_T && (action == GLFW_PRESS || action == GLFW_REPEAT))
+	//Undo and redo terrain edits with Ctrl+Z and Ctrl+Y
+	if (key == GLFW_KEY_Z && (mods & GLFW_MOD_CONTROL) && (action == GLFW_PRESS || action == GLFW_REPEAT))
 	{
-		scaleValue = scaleValue + 0.1;
+		undoTerrainEdit(terrainEditor);
 	}
 
-	if (key == GLFW_KEY_G && (action == GLFW_PRESS || action == GLFW_REPEAT))
+	if (key == GLFW_KEY_Y && (mods & GLFW_MOD_CONTROL) && (action == GLFW_PRESS || action == GLFW_REPEAT))
 	{
-		if(scaleValue > 0)
-			scaleValue = scaleValue - 0.1;
+		redoTerrainEdit(terrainEditor);
 	}
 }
 
@@ -772,6 +1033,13 @@ void mouse_callback(GLFWwindow* window, int button, int action, int mods)
 			
 		cursorOff = !cursorOff;
 	}
+
+	//Left click on the terrain (while the cursor is free and not over the UI) picks a point
+	if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && !cursorOff && !io->WantCaptureMouse)
+	{
+		glfwGetCursorPos(window, &pickCursorX, &pickCursorY);
+		pickRequested = true;
+	}
 }
 
 void LoadSkybox()
@@ -807,25 +1075,47 @@ void LoadSkybox()
 		"external/skybox/back.jpg"
 	};
 
-	//Load every face of the texture individually in a loop
+	//Read, hash (for the sky lighting cache) and decode the faces in parallel using the external stbi_image library
+	vector<unsigned char*> faceData(cubeTextures.size());
+	vector<int> faceWidths(cubeTextures.size()), faceHeights(cubeTextures.size());
+	SkyFace skyFaces[6];
+	parallelFor(0, int(cubeTextures.size()), 1, [&](int first, int last)
+	{
+		for (int i = first; i < last; i++)
+		{
+			ifstream file(cubeTextures.at(i), ios::binary);
+			vector<unsigned char> bytes((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
+			int numChannels;
+			faceData[i] = stbi_load_from_memory(bytes.data(), int(bytes.size()), &faceWidths[i], &faceHeights[i], &numChannels, 3);
+			skyFaces[i] = { faceData[i], faceWidths[i], faceHeights[i], 3, hashSkyFile(bytes) };
+		}
+	});
+
+	//Upload every face of the texture individually in a loop
 	for (int i = 0; i < cubeTextures.size(); i++)
 	{
-		//Load the image using the external stbi_image library
-		int width, height, numChannels;
-		unsigned char* skyboxData = stbi_load(cubeTextures.at(i), &width, &height, &numChannels, 0);
+		unsigned char* skyboxData = faceData[i];
 
 		//Check that it went through alright
 		if (skyboxData) {
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, skyboxData);
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, faceWidths[i], faceHeights[i], 0, GL_RGB, GL_UNSIGNED_BYTE, skyboxData);
 			//cout << "Successfully loaded: " << cubeTextures.at(i) << endl;
 		}
 		else
 			cout << "Failed to load at path: " << cubeTextures.at(i) << endl;
+	}
 
+	//Ambient (and reflected) sky light, baked from the decoded faces or loaded from the cache
+	if (bakeSkyLighting(skyLighting, skyFaces, "skycache"))
+		cout << "Sky lighting " << (skyLighting.fromCache ? "loaded from cache" : "baked") << " in " << skyLighting.bakeMs << " ms" << endl;
+	else
+		cout << "Sky lighting needs six square faces of one size" << endl;
 
-		//Free image data (we don't need it anymore)
+	//Free image data (we don't need it anymore)
+	for (unsigned char* skyboxData : faceData)
 		stbi_image_free(skyboxData);
-	}
+
+	glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTextureID);
 	
 	//Set the texture parameters
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
@@ -833,6 +1123,12 @@ void LoadSkybox()
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+
+	registerBuffer("Skybox Vertices", "Skybox", skyboxBuffer, skyboxVerts.size() * sizeof(vec3));
+	registerTexture("Skybox", "Skybox", skyboxTextureID, GL_TEXTURE_CUBE_MAP, faceWidths[0], faceHeights[0], 6, GL_RGB, false);
+	if (skyLighting.specularTexture)
+		registerTexture("Sky Specular", "Skybox", skyLighting.specularTexture, GL_TEXTURE_CUBE_MAP, skyLighting.specularSize,
+						skyLighting.specularSize, 6, GL_RGB16F, false);
 }
 
 //Load the sunflower billboards
@@ -862,7 +1158,7 @@ void LoadSunflower()
 
 	glGenBuffers(1, &sunflowerVertexBuffer);
 	glBindBuffer(GL_ARRAY_BUFFER, sunflowerVertexBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sunflowerVerts.size() * sizeof(vec3), &sunflowerVerts[0], GL_STATIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, sunflowerVerts.size() * sizeof(vec3), &sunflowerVerts[0], GL_DYNAMIC_DRAW);
 	
 	glVertexAttribPointer(
 		0,	//attribute
@@ -887,6 +1183,11 @@ void LoadSunflower()
 		(void*)0	//Array buffer object
 	);
 
+	//The sunflowers rest on the terrain, so their heights are derived data (offset slightly so the bottom touches the ground)
+	vector<VegetationSite> sites;
+	for (size_t i = 0; i < sunflowerVerts.size(); i++)
+		sites.push_back({ vec3(sunflowerVerts[i].x, 0.04f, sunflowerVerts[i].z) });
+	initDerived(derived, n_points, 2.0f * m_scale, sites);
 
 	//Load sunflower texture
 	glGenTextures(1, &sunflowerTextureID);
@@ -915,42 +1216,959 @@ void LoadSunflower()
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 
+	registerBuffer("Sunflower Vertices", "Sunflowers", sunflowerVertexBuffer, sunflowerVerts.size() * sizeof(vec3));
+	registerBuffer("Sunflower UVs", "Sunflowers", sunflowerUVBuffer, sunflowerTexCoords.size() * sizeof(vec2));
+	registerTexture("Sunflower", "Sunflowers", sunflowerTextureID, GL_TEXTURE_2D, sunflowerData ? width : 0, sunflowerData ? height : 0, 1, GL_RGBA, false);
 }
 
-//Initialize ImGui
-void initializeImGui()
+//Reduce the lake and river masks to cells; the water mesh is extracted from them as derived data
+void LoadWater()
 {
-	IMGUI_CHECKVERSION();
-	ImGui::CreateContext();
-	io = &ImGui::GetIO(); (void)io;
-	io->WantCaptureMouse = false;
-	ImGui::StyleColorsDark();
-	ImGui_ImplGlfw_InitForOpenGL(window, true);
-	ImGui_ImplOpenGL3_Init("#version 330");
+	WaterKind kinds[] = { WATER_LAKE, WATER_RIVER };
+	for (size_t i = 0; i < waterMaskFiles.size(); i++)
+	{
+		if (!loadWaterMask(waterMasks, waterMaskFiles[i].c_str(), kinds[i]))
+			cout << "Failed to load: " << waterMaskFiles[i] << endl;
+	}
+	setDerivedWaterMasks(derived, &waterMasks);
+
+	initWater(water);
+	updateWaterTerrainLod(water, n_points, derived.tileSize);
 }
 
-void RenderImGui()
+//Setup the clipmap terrain from the decoded height map
+void LoadClipmap()
 {
-	//Setup
-	ImGui_ImplOpenGL3_NewFrame();
-	ImGui_ImplGlfw_NewFrame();
-	ImGui::NewFrame();
-
-	//Creating the window
-	ImGui::Begin("UI Window");
-
-	ImGui::Checkbox("Wireframe", &isWireframe);
+	if (datasets.active < 0 || !initClipmap(clipmap, datasets.datasets[datasets.active]->clipmapHeights, clipmapSpacing, clipmapLevels))
+		cout << "Failed to initialise the clipmap: no height field loaded" << endl;
+}
 
-	if (ImGui::Button("Reload Shaders"))
+//Rebuild whatever a scale or heightmap change invalidated (nothing at all in steady state)
+void UpdateDerivedData()
+{
+	setDerivedDataset(derived, datasets.active >= 0 ? datasets.datasets[datasets.active].get() : nullptr);
+	setDerivedScale(derived, scaleValue);
+	MaterialAverages materials = materialAverages;
+	materials.count = terrainMaterialCount;
+	setDerivedMaterials(derived, materials);
+
+	//These stay glBufferSubData rather than going through the upload ring: they are whole-map vertex data
+	//(megabytes once after a change, whole rows of it after an edit), and staging them would grow every
+	//region of the ring to the largest of them for good
+	if (requireDerived(derived, DERIVED_NORMALS))
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, derived.normals.size() * sizeof(vec3), &derived.normals[0]);
+	}
+	else if (derived.regionFirst <= derived.regionLast)
 	{
-		UnloadShaders();
-		LoadShaders(programID, "src/Basic.vert", "src/Texture.frag");
-		LoadShaders(skyboxID, "src/skyboxVert.vert", "src/skyboxFrag.frag");
-		LoadShaders(sunflowerID, "src/sunflower.vert", "src/sunflower.frag", "src/sunflower.geom");
+		//Only the rows a terrain edit patched
+		size_t first = size_t(derived.regionFirst) * derived.resolution;
+		size_t count = size_t(derived.regionLast - derived.regionFirst + 1) * derived.resolution;
+		glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(vec3), count * sizeof(vec3), &derived.normals[first]);
+	}
+	derived.regionFirst = INT_MAX;
+	derived.regionLast = -1;
+
+	//Finishes in the background, the previous occlusion stays in use until then
+	if (requireDerived(derived, DERIVED_AO))
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, occlusionbuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, derived.ambientOcclusion.size() * sizeof(float), &derived.ambientOcclusion[0]);
+	}
+
+	//Baked in the background as well (after the normals, which it is built from, have been uploaded)
+	if (requireDerived(derived, DERIVED_MACRO_MATERIAL))
+		uploadMacroMaterial(materialLod, derived.macroMaterial);
+
+	if (requireDerived(derived, DERIVED_VEGETATION))
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, sunflowerVertexBuffer);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, derived.vegetation.size() * sizeof(vec3), &derived.vegetation[0]);
+	}
+
+	if (requireDerived(derived, DERIVED_WATER))
+		uploadWaterMesh(water, derived.water);
+
+	requireDerived(derived, DERIVED_TILE_BOUNDS);
+	requireDerived(derived, DERIVED_OCCLUDER);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	setTerrainQuery(terrainQuery, datasets.active >= 0 ? datasets.datasets[datasets.active].get() : nullptr, scaleValue);
+}
+
+//Register the targets and buffers the modules own at their current sizes (they change with the resolution,
+//the anti-aliasing mode and the light count)
+void RegisterModuleResources()
+{
+	const size_t colourBytes = 8, depthBytes = 4; //RGBA16F and 24 bit depth (padded)
+
+	registerTexture("Scene Colour", "Targets", framePacing.sceneColour, GL_TEXTURE_2D, framePacing.framebufferWidth, framePacing.framebufferHeight, 1,
+					GL_RGBA16F, false);
+	registerTexture("Scene Depth", "Targets", framePacing.sceneDepth, GL_TEXTURE_2D, framePacing.framebufferWidth, framePacing.framebufferHeight, 1,
+					GL_DEPTH_COMPONENT24, false);
+
+	size_t msaaTexels = size_t(postProcess.msaaWidth) * postProcess.msaaHeight * postProcess.msaaAllocatedSamples;
+	registerBuffer("MSAA Colour", "Targets", postProcess.msaaColour, msaaTexels * colourBytes);
+	registerBuffer("MSAA Depth", "Targets", postProcess.msaaDepth, msaaTexels * depthBytes);
+	for (int i = 0; i < 2; i++)
+		registerTexture(i == 0 ? "TAA History 0" : "TAA History 1", "Targets", postProcess.historyTextures[i], GL_TEXTURE_2D,
+						postProcess.historyTextures[i] ? postProcess.historyWidth : 0, postProcess.historyHeight, 1, GL_RGBA16F, false);
+	registerTexture("Offscreen Output", "Targets", postProcess.outputColour, GL_TEXTURE_2D, postProcess.outputWidth, postProcess.outputHeight, 1,
+					GL_RGBA8, false);
+
+	registerTexture("Clipmap Heights", "Terrain", clipmap.heightTexture, GL_TEXTURE_2D_ARRAY, CLIPMAP_TEXTURE_SIZE, CLIPMAP_TEXTURE_SIZE,
+					clipmap.numLevels, GL_R32F, false);
+
+	registerBuffer("Edit History", "Terrain", 0, 0, terrainEditor.historyBytes); //CPU only, edits upload through the ring
+	registerTexture("Macro Colour", "Terrain", materialLod.colourTexture, GL_TEXTURE_2D, materialLod.size, materialLod.size, 1, GL_RGBA8, true,
+					derived.macroMaterial.colour.size() * sizeof(uint32_t));
+	registerTexture("Macro Normals", "Terrain", materialLod.normalTexture, GL_TEXTURE_2D, materialLod.size, materialLod.size, 1, GL_RGBA8, true,
+					derived.macroMaterial.normal.size() * sizeof(uint32_t));
+
+	ScreenCaptureStats screenCapture = getScreenCaptureStats();
+	for (int i = 0; i < SCREEN_CAPTURE_BUFFERS; i++)
+	{
+		char name[32];
+		snprintf(name, sizeof(name), "Screen Capture %d", i);
+		registerBuffer(name, "Capture", screenCapture.buffers[i], screenCapture.bufferBytes[i], i == 0 ? screenCapture.queuedBytes : 0);
+	}
+
+	registerTexture("Transmittance", "Atmosphere", atmosphere.transmittanceTexture, GL_TEXTURE_2D, TRANSMITTANCE_WIDTH, TRANSMITTANCE_HEIGHT, 1,
+					GL_RGB16F, false, atmosphere.transmittance.size() * sizeof(vec3));
+	registerTexture("Multiple Scattering", "Atmosphere", atmosphere.multiScatteringTexture, GL_TEXTURE_2D, MULTI_SCATTERING_SIZE,
+					MULTI_SCATTERING_SIZE, 1, GL_RGB16F, false, atmosphere.multiScattering.size() * sizeof(vec3));
+	registerTexture("Sky View", "Atmosphere", atmosphere.skyViewTexture, GL_TEXTURE_2D, SKY_VIEW_WIDTH, SKY_VIEW_HEIGHT, 1, GL_RGBA16F, false);
+	registerTexture("Aerial Perspective", "Atmosphere", atmosphere.aerialTexture, GL_TEXTURE_3D, AERIAL_PERSPECTIVE_SIZE, AERIAL_PERSPECTIVE_SIZE,
+					AERIAL_PERSPECTIVE_SIZE, GL_RGBA16F, false);
+
+	registerTexture("Water Reflection", "Water", water.reflectionColour, GL_TEXTURE_2D, water.reflectionWidth, water.reflectionHeight, 1, GL_RGBA8,
+					false);
+	registerTexture("Water Reflection Depth", "Water", water.reflectionDepth, GL_RENDERBUFFER, water.reflectionWidth, water.reflectionHeight, 1,
+					GL_DEPTH_COMPONENT24, false);
+	registerBuffer("Water Vertices", "Water", water.vertexBuffer, water.vertexBytes, derived.water.vertices.size() * sizeof(vec3));
+	registerBuffer("Water Indices", "Water", water.indexBuffer, water.indexBytes, derived.water.indices.size() * sizeof(unsigned int));
+	registerBuffer("Reflected Terrain Indices", "Water", water.terrainIndexBuffer, water.terrainIndexBytes);
+
+	//Multi-view commands, light lists and height texture updates are written into the upload ring every frame
+	const FrameMemoryStats& frameMemory = getFrameMemoryStats();
+	registerBuffer("Upload Ring", "Frame", frameMemory.uploadBuffer, frameMemory.uploadRegionBytes * UPLOAD_RING_FRAMES);
+	registerBuffer("Frame Arena", "Frame", 0, 0, frameMemory.arenaCapacity);
+}
+
+//Height the camera must stay above (no limit away from the terrain or when clamping is off)
+float CameraGroundHeight(float x, float z)
+{
+	if (!clampCamera || !insideTerrain(terrainQuery, x, z))
+		return -numeric_limits<float>::max();
+	return terrainHeightAt(terrainQuery, x, z) + cameraClearance;
+}
+
+//Cast a ray from a cursor position through the (unjittered) camera into the terrain
+bool CursorRaycast(const mat4& viewProjection, double cursorX, double cursorY, vec3& hit)
+{
+	int width, height;
+	glfwGetWindowSize(window, &width, &height);
+	vec2 ndc = vec2(2.0 * cursorX / width - 1.0, 1.0 - 2.0 * cursorY / height);
+
+	mat4 inverseViewProjection = inverse(viewProjection);
+	vec4 nearPoint = inverseViewProjection * vec4(ndc, -1.0f, 1.0f);
+	vec4 farPoint = inverseViewProjection * vec4(ndc, 1.0f, 1.0f);
+	vec3 origin = vec3(nearPoint) / nearPoint.w;
+	vec3 direction = vec3(farPoint) / farPoint.w - origin;
+	return raycastTerrain(terrainQuery, origin, direction, length(direction), hit);
+}
+
+void PickTerrain(const mat4& viewProjection)
+{
+	double start = glfwGetTime();
+	pickHit = CursorRaycast(viewProjection, pickCursorX, pickCursorY, pickPosition);
+	pickMicroseconds = (glfwGetTime() - start) * 1000000.0;
+}
+
+//Sculpt under the cursor while the left button is held, then bring the textures, clipmap and base mesh up to
+//date inside the changed region only
+void EditTerrain(const mat4& viewProjection)
+{
+	setEditedDataset(terrainEditor, datasets.active >= 0 ? datasets.datasets[datasets.active].get() : nullptr, n_points);
+
+	double now = glfwGetTime();
+	bool held = glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+	vec3 hit;
+	double cursorX, cursorY;
+	glfwGetCursorPos(window, &cursorX, &cursorY);
+	if (editTerrain && held && !cursorOff && !(io && io->WantCaptureMouse) && CursorRaycast(viewProjection, cursorX, cursorY, hit))
+		applyTerrainBrush(terrainEditor, terrainQuery, hit, terrainEditor.stroking ? float(std::min(now - lastBrushTime, 0.1)) : 1.0f / 60.0f);
+	else if (!held)
+		endTerrainStroke(terrainEditor);
+	lastBrushTime = now;
+
+	EditRect texels, vertices;
+	if (!flushTerrainEdits(terrainEditor, heightMapID, texels, vertices))
+		return;
+
+	//The first stroke swaps the dataset's clipmap mips for editable ones
+	const Dataset& edited = *terrainEditor.dataset;
+	if (clipmap.source != edited.clipmapHeights)
+		setClipmapHeights(clipmap, edited.clipmapHeights);
+	else
+		updateClipmapRegion(clipmap, texels.x0, texels.z0, texels.x1, texels.z1);
+
+	updateDerivedRegion(derived, vertices.x0, vertices.x1, vertices.z0, vertices.z1);
+	UpdateDerivedData();
+}
+
+//Index ranges of the base mesh tiles to draw (the ones tileVisible marks, when culled)
+void GatherTerrainTiles(bool culled, FrameVector<GLsizei>& counts, FrameVector<const void*>& offsets)
+{
+	for (size_t tile = 0; tile < tileIndexCounts.size(); tile++)
+	{
+		if (culled && !tileVisible[tile])
+			continue;
+		counts.push_back(tileIndexCounts[tile]);
+		offsets.push_back(tileIndexOffsets[tile]);
+	}
+}
+
+//Draw the base mesh tiles that intersect the view (every tile until the tile bounds are built)
+void DrawTerrainTiles(const mat4& viewProjection)
+{
+	bool culled = false;
+	visibleTiles = int(tileIndexCounts.size());
+	if (cullTiles)
+	{
+		Frustum frustum = extractFrustum(viewProjection);
+		int tests = 0;
+		int visible = cullTerrainTiles(&frustum, 1, derived, tileVisible, &tests);
+		tileCullTests += tests;
+		culled = tileVisible.size() == tileIndexCounts.size();
+		if (culled && occlusion.ready)
+			visible -= cullOccludedTiles(occlusion, derived, tileVisible);
+		if (culled)
+			visibleTiles = visible;
+	}
+
+	FrameVector<GLsizei> counts;
+	FrameVector<const void*> offsets;
+	GatherTerrainTiles(culled, counts, offsets);
+	if (!counts.empty())
+		glMultiDrawElements(GL_TRIANGLE_STRIP, &counts[0], GL_UNSIGNED_INT, &offsets[0], GLsizei(counts.size()));
+}
+
+//Whether this frame is tested against the occlusion buffer. It holds the terrain seen from one camera above
+//it: from below or outside, the back faces the renderer culls would hide things
+bool OcclusionActive()
+{
+	vec3 cameraPos = getCameraPosition();
+	return occlusion.enabled && !clipmapMode && multiView.count == 1 && !derived.occluder.vertices.empty() &&
+		   insideTerrain(terrainQuery, cameraPos.x, cameraPos.z) && cameraPos.y > terrainHeightAt(terrainQuery, cameraPos.x, cameraPos.z);
+}
+
+//Draw the billboards, leaving out the ones hidden in the occlusion buffer
+void DrawSunflowers()
+{
+	if (!occlusion.ready)
+	{
+		glDrawArrays(GL_POINTS, 0, 3);
+		return;
+	}
+
+	int count = int(derived.vegetation.size());
+	sunflowerVisible.assign(count, 1);
+	cullOccludedPoints(occlusion, derived.vegetation, sunflowerRadius, sunflowerVisible);
+
+	//Runs of visible billboards
+	FrameVector<GLint> firsts;
+	FrameVector<GLsizei> counts;
+	for (int i = 0; i < count; i++)
+	{
+		if (!sunflowerVisible[i])
+			continue;
+		if (!counts.empty() && firsts.back() + counts.back() == i)
+			counts.back()++;
+		else
+		{
+			firsts.push_back(i);
+			counts.push_back(1);
+		}
+	}
+	if (!counts.empty())
+		glMultiDrawArrays(GL_POINTS, &firsts[0], &counts[0], GLsizei(counts.size()));
+}
+
+//Draws the base mesh tiles visible in any of this frame's views, each instanced once per view
+void DrawTerrainTilesMultiView()
+{
+	bool culled = false;
+	visibleTiles = int(tileIndexCounts.size());
+	if (cullTiles)
+	{
+		int visible = cullMultiViewTiles(multiView, derived, tileVisible);
+		tileCullTests += multiView.cullTests;
+		culled = tileVisible.size() == tileIndexCounts.size();
+		if (culled)
+			visibleTiles = visible;
+	}
+
+	FrameVector<GLsizei> counts;
+	FrameVector<const void*> offsets;
+	GatherTerrainTiles(culled, counts, offsets);
+	drawMultiViewElements(multiView, GL_TRIANGLE_STRIP, counts, offsets);
+}
+
+//Bind the material textures to the units Texture.frag reads them from, and mark the ones the current
+//permutation samples as used (so the budget keeps them and evicted ones start reloading)
+void BindMaterialTextures()
+{
+	struct MaterialTexture
+	{
+		const char* path;
+		GLuint id;
+		GLenum unit;
+		int material; //Sampled when MATERIAL_COUNT is above this (0 rock, 1 grass, 2 snow)
+		bool normals;
+	};
+	const MaterialTexture textures[] = {
+		{ "rocks.bmp", rockDiffuseID, GL_TEXTURE0, 0, false },
+		{ "rocks-r.bmp", rockShininessID, GL_TEXTURE2, 0, false },
+		{ "rocks-n.bmp", rockNormalsID, GL_TEXTURE3, 0, true },
+		{ "snow.bmp", snowDiffuseID, GL_TEXTURE4, 2, false },
+		{ "snow-r.bmp", snowShininessID, GL_TEXTURE5, 2, false },
+		{ "snow-n.bmp", snowNormalsID, GL_TEXTURE6, 2, true },
+		{ "grass.bmp", grassDiffuseID, GL_TEXTURE7, 1, false },
+		{ "grass-r.bmp", grassShininessID, GL_TEXTURE8, 1, false },
+		{ "grass-n.bmp", grassNormalsID, GL_TEXTURE9, 1, true }
+	};
+
+	//Unit 0 is left active, as the draws below expect
+	for (int i = int(sizeof(textures) / sizeof(textures[0])) - 1; i >= 0; i--)
+	{
+		glActiveTexture(textures[i].unit);
+		glBindTexture(GL_TEXTURE_2D, textures[i].id);
+		if (textures[i].material < terrainMaterialCount && (!textures[i].normals || terrainNormalMapping))
+			touchResource(textures[i].path);
+	}
+
+	//The prefiltered sky goes on unit 11 (after the clipmap's heights)
+	if (skySpecular && skyLighting.specularTexture)
+	{
+		glActiveTexture(GL_TEXTURE11);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, skyLighting.specularTexture);
+		glActiveTexture(GL_TEXTURE0);
+		touchResource("Sky Specular");
+	}
+
+	//The macro textures go on units 12 and 13
+	if (materialLod.enabled && materialLod.colourTexture)
+	{
+		glActiveTexture(GL_TEXTURE12);
+		glBindTexture(GL_TEXTURE_2D, materialLod.colourTexture);
+		glActiveTexture(GL_TEXTURE13);
+		glBindTexture(GL_TEXTURE_2D, materialLod.normalTexture);
+		glActiveTexture(GL_TEXTURE0);
+	}
+}
+
+//Sky lighting uniforms of a terrain or billboard program (with the sky lighting off, the billboards keep their colour)
+void SetSkyUniforms(GLuint program)
+{
+	setSkyUniforms(skyLighting, program, skyAmbientStrength);
+	if (!skyAmbient)
+		glUniform1f(glGetUniformLocation(program, "skyTintScale"), 0.0f);
+}
+
+//Whether the water is drawn this frame (its reflection is about a single camera)
+bool WaterActive()
+{
+	return water.enabled && multiView.count == 1 && !derived.water.bodies.empty();
+}
+
+//The sky and the base mesh mirrored about the water, into its reflection target. The terrain is drawn from the
+//water's coarser strips, culled against the mirrored (oblique) frustum
+void DrawWaterReflection(const WaterReflectionView& mirrored, vec3 light)
+{
+	GLuint skyProgram = atmosphere.enabled ? atmosphereSkyID : skyboxID;
+	glDepthMask(GL_FALSE);
+	glUseProgram(skyProgram);
+	glBindVertexArray(skyboxVertexArray);
+	if (atmosphere.enabled)
+		setAtmosphereSkyUniforms(atmosphere, atmosphereSkyID);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTextureID);
+	glUniformMatrix4fv(glGetUniformLocation(skyProgram, "views"), 1, GL_FALSE, &mirrored.view[0][0]);
+	glUniformMatrix4fv(glGetUniformLocation(skyProgram, "projections"), 1, GL_FALSE, &mirrored.projection[0][0]);
+	glUniform1i(glGetUniformLocation(skyProgram, "firstView"), 0);
+	glDrawArrays(GL_TRIANGLES, 0, GLsizei(skyboxVerts.size()));
+	glDepthMask(GL_TRUE);
+
+	mat4 viewProjection = mirrored.clippedProjection * mirrored.view;
+	bool culled = false;
+	water.reflectedTiles = int(water.terrainTileCounts.size());
+	if (cullTiles)
+	{
+		water.reflectedTiles = cullTerrainTiles(extractFrustum(viewProjection), derived, reflectionTileVisible);
+		culled = reflectionTileVisible.size() == water.terrainTileCounts.size();
+	}
+
+	FrameVector<GLsizei> counts;
+	FrameVector<const void*> offsets;
+	for (size_t tile = 0; tile < water.terrainTileCounts.size(); tile++)
+	{
+		if (culled && !reflectionTileVisible[tile])
+			continue;
+		counts.push_back(water.terrainTileCounts[tile]);
+		offsets.push_back(water.terrainTileOffsets[tile]);
+	}
+
+	glUseProgram(reflectionProgramID);
+	glUniform3f(glGetUniformLocation(reflectionProgramID, "lightPos"), light.x, light.y, light.z);
+	glUniform1f(glGetUniformLocation(reflectionProgramID, "scaleValue"), scaleValue);
+	glUniformMatrix4fv(glGetUniformLocation(reflectionProgramID, "modelView"), 1, GL_FALSE, &mirrored.view[0][0]);
+	glUniformMatrix4fv(glGetUniformLocation(reflectionProgramID, "MVP"), 1, GL_FALSE, &viewProjection[0][0]);
+	glUniform3f(glGetUniformLocation(reflectionProgramID, "cameraPos"), mirrored.cameraPosition.x, mirrored.cameraPosition.y,
+				mirrored.cameraPosition.z);
+	SetSkyUniforms(reflectionProgramID);
+	setMaterialLodUniforms(materialLod, reflectionProgramID);
+	if (atmosphere.enabled)
+		setAtmosphereUniforms(atmosphere, reflectionProgramID, water.reflectionWidth, water.reflectionHeight);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, heightMapID);
+	glUniform1i(glGetUniformLocation(reflectionProgramID, "heightMap"), 1);
+	BindMaterialTextures();
+
+	//The water's strips index the base mesh's vertices
+	glBindVertexArray(VertexArrayID);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, water.terrainIndexBuffer);
+	if (!counts.empty())
+		glMultiDrawElements(GL_TRIANGLE_STRIP, &counts[0], GL_UNSIGNED_INT, &offsets[0], GLsizei(counts.size()));
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
+	glBindVertexArray(0);
+}
+
+//Draws a map tile into the bound framebuffer: an orthographic camera looks straight down on the tile's
+//rectangle, with -z (north) at the top of the image
+void DrawMapTile(const MapTile& tile)
+{
+	vec4 rect = mapTileRect(tile, 2.0f * m_scale);
+	vec3 centre(0.5f * (rect.x + rect.z), 0.0f, 0.5f * (rect.y + rect.w));
+	float halfSize = 0.5f * (rect.z - rect.x);
+
+	//The depth range just covers the terrain's heights
+	float minHeight = 0.0f, maxHeight = 0.0f;
+	for (const TileBounds& bounds : derived.tileBounds)
+	{
+		minHeight = std::min(minHeight, bounds.minHeight);
+		maxHeight = std::max(maxHeight, bounds.maxHeight);
+	}
+	vec3 eye(centre.x, maxHeight + 1.0f, centre.z);
+	mat4 ViewMatrix = lookAt(eye, centre, vec3(0, 0, -1));
+	mat4 ProjectionMatrix = ortho(-halfSize, halfSize, -halfSize, halfSize, 0.0f, maxHeight - minHeight + 2.0f);
+	mat4 MVP = ProjectionMatrix * ViewMatrix;
+
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	SelectTerrainShaders();
+	glUseProgram(programID);
+	glBindVertexArray(VertexArrayID);
+	glUniformMatrix4fv(glGetUniformLocation(programID, "modelView"), 1, GL_FALSE, &ViewMatrix[0][0]);
+	glUniformMatrix4fv(glGetUniformLocation(programID, "MVP"), 1, GL_FALSE, &MVP[0][0]);
+	glUniform3f(glGetUniformLocation(programID, "lightPos"), lightPos.x, lightPos.y, lightPos.z);
+	glUniform3f(glGetUniformLocation(programID, "cameraPos"), eye.x, eye.y, eye.z);
+	glUniform1f(glGetUniformLocation(programID, "scaleValue"), scaleValue);
+	SetSkyUniforms(programID);
+	setMaterialLodUniforms(materialLod, programID);
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, heightMapID);
+	glUniform1i(glGetUniformLocation(programID, "heightMap"), 1);
+	BindMaterialTextures();
+	DrawTerrainTiles(MVP);
+	glBindVertexArray(0);
+}
+
+//Worker process of a tile batch (--tile-worker): renders the tiles the coordinator hands out until it
+//has no more. Everything stays loaded between tiles; each is drawn with 4x MSAA and resolved before readback
+int RunTileWorker(const string& socketPath, int tileSize, const string& outputDirectory)
+{
+	int connection = connectMapTileWorker(socketPath.c_str());
+	if (connection < 0)
+	{
+		cerr << "Could not connect to " << socketPath << endl;
+		return 1;
+	}
+
+	GLuint renderbuffers[3], framebuffers[2];
+	glGenRenderbuffers(3, renderbuffers);
+	glGenFramebuffers(2, framebuffers);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, 4, GL_RGBA8, tileSize, tileSize);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, 4, GL_DEPTH_COMPONENT24, tileSize, tileSize);
+	glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[2]);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, tileSize, tileSize);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[0]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[1]);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[2]);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	//Bring the derived data fully up to date first (ambient occlusion is baked in the background)
+	do
+	{
+		runMainThreadJobs();
+		UpdateDerivedData();
+		this_thread::yield();
+	} while (derived.dirty[DERIVED_AO]);
+
+	vector<uint8_t> pixels(size_t(tileSize) * tileSize * 4);
+	MapTile tile;
+	while (nextMapTile(connection, tile))
+	{
+		auto start = chrono::steady_clock::now();
+		beginFrameMemory();
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[0]);
+		glViewport(0, 0, tileSize, tileSize);
+		DrawMapTile(tile);
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[1]);
+		glBlitFramebuffer(0, 0, tileSize, tileSize, 0, 0, tileSize, tileSize, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[1]);
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glReadPixels(0, 0, tileSize, tileSize, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		endFrameMemory();
+
+		bool written = writePng(mapTilePath(outputDirectory, tile).c_str(), &pixels[0], tileSize, tileSize);
+		finishMapTile(connection, tile, written, chrono::duration<double, milli>(chrono::steady_clock::now() - start).count());
+	}
+	closeMapTileWorker(connection);
+
+	glDeleteFramebuffers(2, framebuffers);
+	glDeleteRenderbuffers(3, renderbuffers);
+	return 0;
+}
+
+//Initialize ImGui
+void initializeImGui()
+{
+	IMGUI_CHECKVERSION();
+	ImGui::SetAllocatorFunctions(countedMalloc, countedFree); //Counted with the frame's heap allocations
+	ImGui::CreateContext();
+	io = &ImGui::GetIO(); (void)io;
+	io->WantCaptureMouse = false;
+	ImGui::StyleColorsDark();
+	ImGui_ImplGlfw_InitForOpenGL(window, true);
+	ImGui_ImplOpenGL3_Init("#version 330");
+}
+
+void RenderImGui()
+{
+	//Setup
+	ImGui_ImplOpenGL3_NewFrame();
+	ImGui_ImplGlfw_NewFrame();
+	ImGui::NewFrame();
+
+	//Creating the window
+	ImGui::Begin("UI Window");
+
+	ImGui::Checkbox("Wireframe", &isWireframe);
+
+	if (ImGui::Button("Reload Shaders"))
+	{
+		ReloadShaders();
 	}
 
 	ImGui::SliderFloat("Scale", &scaleValue, 0.1f, 2.5f);
 
+	//Heightmap selection (switches once the background load and upload finish)
+	if (datasets.active >= 0)
+	{
+		int pending = datasets.pending;
+		int shown = pending >= 0 ? pending : datasets.active;
+		if (ImGui::BeginCombo("Heightmap", datasets.datasets[shown]->name.c_str()))
+		{
+			for (int i = 0; i < int(datasets.datasets.size()); i++)
+			{
+				const Dataset& dataset = *datasets.datasets[i];
+				const char* states[] = { "", " (queued)", " (loading)", " (ready)", " (failed)" };
+				string label = dataset.name + (i == datasets.active ? "" : states[dataset.state]);
+				if (ImGui::Selectable(label.c_str(), i == shown))
+					selectDataset(datasets, i);
+			}
+			ImGui::EndCombo();
+		}
+
+		if (datasets.pending >= 0)
+			ImGui::Text("Switching: %d/%d rows uploaded", datasets.uploadedRows, datasets.datasets[datasets.pending]->height);
+
+		const Dataset& activeDataset = *datasets.datasets[datasets.active];
+		ImGui::Text("Height bounds: %.3f - %.3f", activeDataset.minHeight, activeDataset.maxHeight);
+		ImGui::Text("Heightmap memory: %zu MB", size_t(datasets.residentBytes) >> 20);
+		if (ImGui::SliderInt("Memory Budget (MB)", &datasetBudgetMB, 64, 4096))
+			datasets.budgetBytes = size_t(datasetBudgetMB) << 20;
+	}
+
+	if (ImGui::CollapsingHeader("Shading"))
+	{
+		ImGui::SliderInt("Materials", &terrainMaterialCount, 1, 3);
+		ImGui::Checkbox("Normal Mapping", &terrainNormalMapping);
+		ImGui::Checkbox("Ambient Occlusion", &terrainOcclusion);
+		ImGui::Combo("Debug View", &terrainDebugView, debugViewNames, 4);
+
+		ImGui::Checkbox("Material LOD", &materialLod.enabled);
+		ImGui::SliderFloat("LOD Distance", &materialLod.distance, 0.5f, 20.0f);
+		ImGui::SliderFloat("LOD Band", &materialLod.band, 0.0f, 5.0f);
+		if (materialLod.colourTexture)
+			ImGui::Text("Macro textures: %dx%d, baked in %.1f ms", materialLod.size, materialLod.size, materialLod.bakeMs);
+		else
+			ImGui::Text("Macro textures: baking");
+		ImGui::Text("Terrain: GPU %.2f ms", getSectionGpuMs("Terrain"));
+
+		ImGui::Text("Shader permutations: %d built, %d from the binary cache (%.1f ms)",
+					terrainShaders.compiled + clipmapShaders.compiled, terrainShaders.loadedFromCache + clipmapShaders.loadedFromCache,
+					terrainShaders.buildMs + clipmapShaders.buildMs);
+	}
+
+	if (ImGui::CollapsingHeader("Sky Lighting"))
+	{
+		ImGui::Checkbox("Sky Ambient", &skyAmbient);
+		ImGui::SliderFloat("Ambient Strength", &skyAmbientStrength, 0.0f, 1.0f);
+		ImGui::BeginDisabled(!skyLighting.specularTexture);
+		ImGui::Checkbox("Sky Reflections", &skySpecular);
+		ImGui::EndDisabled();
+
+		vec3 up = evaluateSkyIrradiance(skyLighting, vec3(0, 1, 0)), down = evaluateSkyIrradiance(skyLighting, vec3(0, -1, 0));
+		ImGui::Text("Irradiance: up (%.2f, %.2f, %.2f), down (%.2f, %.2f, %.2f)", up.x, up.y, up.z, down.x, down.y, down.z);
+		ImGui::Text("%s in %.1f ms, reflections %dx%d per face", skyLighting.fromCache ? "Loaded from cache" : "Baked", skyLighting.bakeMs,
+					skyLighting.specularSize, skyLighting.specularSize);
+	}
+
+	if (ImGui::CollapsingHeader("Atmosphere"))
+	{
+		ImGui::Checkbox("Enable##Atmosphere", &atmosphere.enabled);
+		ImGui::Checkbox("Aerial Perspective", &atmosphere.aerialPerspective);
+		ImGui::SliderFloat("Exposure", &atmosphere.exposure, 1.0f, 40.0f);
+		ImGui::SliderFloat("Air Density", &atmosphere.rayleighDensity, 0.0f, 4.0f);
+		ImGui::SliderFloat("Haze", &atmosphere.mieDensity, 0.0f, 20.0f);
+		ImGui::SliderFloat("Km per Unit", &atmosphere.kilometresPerUnit, 0.1f, 10.0f);
+		ImGui::SliderFloat("Aerial Range (km)", &atmosphere.aerialDistance, 4.0f, 128.0f);
+
+		if (atmosphere.enabled)
+		{
+			vec3 sun = atmosphere.sunColour;
+			ImGui::Text("Sun elevation %.1f degrees, transmittance (%.2f, %.2f, %.2f), camera at %.2f km",
+						degrees(asin(atmosphere.sunDirection.y)), sun.x, sun.y, sun.z, atmosphere.cameraAltitude);
+			ImGui::Text("Transmittance and multiple scattering: %d builds, %.1f ms", atmosphere.transmittanceBuilds, atmosphere.transmittanceMs);
+			ImGui::Text("Sky view %dx%d: %d builds, %.2f ms", SKY_VIEW_WIDTH, SKY_VIEW_HEIGHT, atmosphere.skyViewBuilds, atmosphere.skyViewMs);
+			ImGui::Text("Aerial perspective %d^3: %d builds, %.2f ms", AERIAL_PERSPECTIVE_SIZE, atmosphere.aerialBuilds, atmosphere.aerialMs);
+			ImGui::Text("Tables this frame: %.2f ms CPU, %.2f ms GPU; sky GPU %.2f ms, terrain GPU %.2f ms", atmosphere.frameMs,
+						getSectionGpuMs("Atmosphere"), getSectionGpuMs("Skybox"), getSectionGpuMs("Terrain"));
+		}
+		if (multiView.enabled)
+			ImGui::Text("Aerial perspective is off while multi-view is enabled");
+	}
+
+	if (ImGui::CollapsingHeader("Water"))
+	{
+		ImGui::Checkbox("Enable##Water", &water.enabled);
+		ImGui::Checkbox("Reflections", &water.reflections);
+		int divisor = water.reflectionDivisor == 4 ? 1 : 0;
+		const char* divisorNames[] = { "Half", "Quarter" };
+		if (ImGui::Combo("Reflection Resolution", &divisor, divisorNames, 2))
+			water.reflectionDivisor = divisor == 1 ? 4 : 2;
+		ImGui::SliderInt("Reflection Interval", &water.reflectionInterval, 1, 8);
+		int lod = water.reflectionLodStep == 4 ? 2 : water.reflectionLodStep - 1;
+		const char* lodNames[] = { "Full", "Every 2nd Vertex", "Every 4th Vertex" };
+		if (ImGui::Combo("Reflected Terrain", &lod, lodNames, 3))
+			water.reflectionLodStep = lod == 2 ? 4 : lod + 1;
+		ImGui::SliderFloat("Budget (ms)", &water.budgetMs, 0.1f, 5.0f);
+
+		const WaterMesh& mesh = derived.water;
+		ImGui::Text("Masks: %d lake and %d river cells of %d^2", waterMasks.lakeCells, waterMasks.riverCells, waterMasks.resolution);
+		ImGui::Text("Mesh: %zu bodies, %zu triangles, built in %.1f ms", mesh.bodies.size(), mesh.indices.size() / 3, mesh.buildMs);
+		ImGui::Text("Visible: %d bodies; reflection %dx%d, %d tiles, %d draws", water.visibleBodies, water.reflectionWidth,
+					water.reflectionHeight, water.reflectedTiles, water.reflectionDraws);
+
+		double gpuMs = getSectionGpuMs("Water");
+		ImGui::Text("Reflection: CPU %.3f ms, GPU %.2f ms", getSectionCpuMs("Water Reflection"), getSectionGpuMs("Water Reflection"));
+		ImGui::Text("Surface: CPU %.3f ms, GPU %.2f ms", getSectionCpuMs("Water Surface"), getSectionGpuMs("Water Surface"));
+		ImGui::TextColored(gpuMs > water.budgetMs ? ImVec4(1.0f, 0.4f, 0.3f, 1.0f) : ImVec4(0.5f, 1.0f, 0.5f, 1.0f),
+						   "Water: CPU %.3f ms, GPU %.2f of %.2f ms", getSectionCpuMs("Water"), gpuMs, water.budgetMs);
+		if (multiView.enabled)
+			ImGui::Text("Off while multi-view is enabled");
+	}
+
+	if (ImGui::CollapsingHeader("Local Lights"))
+	{
+		ImGui::Checkbox("Enable", &localLights);
+		ImGui::SliderInt("Light Count", &lightCount, 1, 10000);
+		ImGui::SliderFloat("Light Radius", &lightRadius, 0.05f, 2.0f);
+		ImGui::InputInt("Seed", &lightSeed);
+		ImGui::Checkbox("Animate", &animateLights);
+
+		if (localLights)
+		{
+			int occupied = std::max(clusteredLights.occupiedClusters, 1);
+			ImGui::Text("Visible: %d of %zu lights", clusteredLights.visibleLights, clusteredLights.lights.size());
+			ImGui::Text("Froxels: %d of %d lit, %.1f lights each on average, %d at most", clusteredLights.occupiedClusters, CLUSTER_COUNT,
+						double(clusteredLights.indices.size()) / occupied, clusteredLights.maxClusterLights);
+			ImGui::Text("Binning: %.3f ms, %zu indices (%zu KB uploaded)", clusteredLights.binMs, clusteredLights.indices.size(),
+						(clusteredLights.lights.size() * sizeof(LocalLight) + clusteredLights.indices.size() * sizeof(uint32_t) +
+						 clusteredLights.clusters.size() * sizeof(LightCluster)) >> 10);
+			ImGui::Text("Terrain: GPU %.2f ms", getSectionGpuMs("Terrain"));
+		}
+		if (multiView.enabled)
+			ImGui::Text("Off while multi-view is enabled");
+	}
+
+	if (ImGui::CollapsingHeader("Multi-View"))
+	{
+		ImGui::Checkbox("Enable", &multiView.enabled);
+		ImGui::Combo("Layout", &multiView.layout, multiViewLayoutNames, MULTI_VIEW_LAYOUT_COUNT);
+		if (multiView.layout == MULTI_VIEW_STEREO)
+			ImGui::SliderFloat("Eye Separation", &multiView.eyeSeparation, 0.0f, 1.0f);
+		else
+			ImGui::SliderInt("Views", &multiView.views, 2, MAX_VIEWS);
+		ImGui::BeginDisabled(!multiView.supported);
+		ImGui::Checkbox("Single Pass", &multiView.singlePass);
+		ImGui::EndDisabled();
+		if (!multiView.supported)
+			ImGui::Text("GL_ARB_shader_viewport_layer_array is missing: views are drawn one at a time");
+		ImGui::Text("TAA and local lights are off while enabled; the clipmap is drawn per view");
+
+		double cpuMs = getSectionCpuMs("Skybox") + getSectionCpuMs("Terrain") + getSectionCpuMs("Billboards");
+		double gpuMs = getSectionGpuMs("Skybox") + getSectionGpuMs("Terrain") + getSectionGpuMs("Billboards");
+		ImGui::Text("%d views, %s", multiView.count, isMultiViewSinglePass(multiView) ? "single pass" : "drawn per view");
+		ImGui::Text("Culling: %d frusta, %d tile tests, %d tiles visible", multiView.cullFrustumCount, tileCullTests, visibleTiles);
+		ImGui::Text("Scene passes: CPU %.3f ms, GPU %.2f ms", cpuMs, gpuMs);
+	}
+
+	if (ImGui::CollapsingHeader("Derived Data"))
+	{
+		const char* names[] = { "Heights", "Normals", "Tile Bounds", "Vegetation", "Ambient Occlusion", "Macro Material", "Occluder", "Water" };
+		for (int product = DERIVED_HEIGHTS; product < DERIVED_NODE_COUNT; product++)
+			ImGui::Text("%s: %d builds%s", names[product - DERIVED_HEIGHTS], derived.rebuilds[product], derived.dirty[product] ? " (stale)" : "");
+	}
+
+	if (ImGui::CollapsingHeader("Terrain Queries"))
+	{
+		ImGui::Checkbox("Keep Camera Above Terrain", &clampCamera);
+		ImGui::Text("Ground under camera: %.3f", terrainHeightAt(terrainQuery, getCameraPosition().x, getCameraPosition().z));
+		if (pickHit)
+			ImGui::Text("Picked: (%.3f, %.3f, %.3f) in %.1f us", pickPosition.x, pickPosition.y, pickPosition.z, pickMicroseconds);
+		else
+			ImGui::Text("Picked: nothing (left click the terrain while the mouse is free)");
+	}
+
+	if (ImGui::CollapsingHeader("Terrain Editing"))
+	{
+		static const char* brushNames[] = { "Raise", "Lower", "Flatten" };
+
+		ImGui::Checkbox("Sculpt (hold the left mouse button)", &editTerrain);
+		ImGui::Combo("Brush", &terrainEditor.brush, brushNames, 3);
+		ImGui::SliderFloat("Radius", &terrainEditor.radius, 0.05f, 3.0f);
+		ImGui::SliderFloat("Strength", &terrainEditor.strength, 0.01f, 2.0f);
+
+		if (ImGui::Button("Undo (Ctrl+Z)"))
+			undoTerrainEdit(terrainEditor);
+		ImGui::SameLine();
+		if (ImGui::Button("Redo (Ctrl+Y)"))
+			redoTerrainEdit(terrainEditor);
+		ImGui::Text("History: %zu undo, %zu redo, %.1f KB", terrainEditor.undo.size(), terrainEditor.redo.size(), terrainEditor.historyBytes / 1024.0);
+		ImGui::Text("Last dab: %d texels in %.3f ms", terrainEditor.texelsEdited, terrainEditor.brushMs);
+		ImGui::Text("Last update: %d texels uploaded in %.3f ms", terrainEditor.texelsUploaded, terrainEditor.flushMs);
+	}
+
+	ImGui::Checkbox("Clipmap Terrain", &clipmapMode);
+	if (clipmapMode)
+		ImGui::Text("Clipmap texels uploaded: %d", clipmap.texelsUpdated);
+	else
+	{
+		ImGui::Checkbox("Frustum Culling", &cullTiles);
+		ImGui::Text("Visible tiles: %d/%d", visibleTiles, int(tileIndexCounts.size()));
+		ImGui::Checkbox("Occlusion Culling", &occlusion.enabled);
+		if (occlusion.enabled)
+		{
+			ImGui::SliderInt("Occlusion Buffer Width", &occlusion.width, 64, 512);
+			if (occlusion.triangles > 0)
+			{
+				ImGui::Text("Occluded: %d tiles, %d billboards", occlusion.culledTiles, occlusion.culledInstances);
+				ImGui::Text("%d triangles into %dx%d in %.3f ms, %d boxes tested in %.3f ms", occlusion.triangles, occlusion.width, occlusion.height,
+							occlusion.rasteriseMs, occlusion.tested, occlusion.testMs);
+			}
+			else
+				ImGui::Text("Needs a single view from above the terrain");
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Anti-Aliasing"))
+	{
+		ImGui::Combo("Mode", &postProcess.mode, antiAliasingNames, AA_MODE_COUNT);
+		if (postProcess.mode == AA_MSAA)
+		{
+			const char* sampleCounts[] = { "2x", "4x", "8x" };
+			int sampleIndex = postProcess.msaaSamples == 2 ? 0 : (postProcess.msaaSamples == 4 ? 1 : 2);
+			if (ImGui::Combo("Samples", &sampleIndex, sampleCounts, 3))
+				postProcess.msaaSamples = 2 << sampleIndex;
+		}
+		if (postProcess.mode == AA_TAA)
+			ImGui::SliderFloat("History Blend", &postProcess.taaBlend, 0.02f, 0.5f);
+		if (postProcess.activeMode != postProcess.mode)
+			ImGui::Text("Using %s while multi-view is enabled", antiAliasingNames[postProcess.activeMode]);
+
+		//Scene + resolve GPU time of each mode, from the last time it was selected
+		for (int mode = 0; mode < AA_MODE_COUNT; mode++)
+		{
+			if (postProcess.modeCostMs[mode] > 0.0)
+				ImGui::Text("%s: %.2f ms", antiAliasingNames[mode], postProcess.modeCostMs[mode]);
+			else
+				ImGui::Text("%s: not measured", antiAliasingNames[mode]);
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Frame Pacing"))
+	{
+		const char* vsyncModes[] = { "Off", "Every Refresh", "Every Other Refresh" };
+		ImGui::Combo("Vsync", &framePacing.swapInterval, vsyncModes, 3);
+		ImGui::SliderFloat("Target Frame Time (ms)", &framePacing.targetFrameMs, 4.0f, 50.0f);
+		ImGui::Checkbox("Adaptive Resolution", &framePacing.adaptiveResolution);
+		ImGui::SliderFloat("Minimum Resolution Scale", &framePacing.minResolutionScale, 0.25f, 1.0f);
+		ImGui::Checkbox("Low Latency", &framePacing.lowLatency);
+		if (framePacing.lowLatency)
+			ImGui::SliderInt("Max Frames In Flight", &framePacing.maxFramesInFlight, 1, MAX_FRAMES_IN_FLIGHT);
+
+		ImGui::Text("Render resolution: %dx%d (%.0f%%)", framePacing.renderWidth, framePacing.renderHeight, framePacing.resolutionScale * 100.0f);
+		ImGui::Text("Fence wait: %.2f ms", framePacing.fenceWaitMs);
+
+		const FrameStats& stats = getFrameStats();
+		ImGui::PlotLines("Frame Time", stats.history, stats.count, stats.count == FRAME_HISTORY ? stats.next : 0, NULL, 0.0f, 2.0f * framePacing.targetFrameMs, ImVec2(0, 60));
+		ImGui::Text("Avg %.2f  Min %.2f  Max %.2f  99%% %.2f ms", stats.averageMs, stats.minMs, stats.maxMs, stats.p99Ms);
+		ImGui::Text("Input to photon: %.1f ms (last %.1f, max %.1f)", stats.inputLatencyMs, stats.lastInputLatencyMs, stats.maxInputLatencyMs);
+
+		SimulationStats simulation = getSimulationStats();
+		ImGui::Text("Simulation: %.0f Hz, %llu ticks (%llu late), %.3f ms a tick", simulation.tickRate, simulation.ticks, simulation.lateTicks, simulation.tickMs);
+
+		//Per pass timings
+		for (const ProfilerSection& section : getProfilerSections())
+			ImGui::Text("%*s%s: CPU %.2f ms, GPU %.2f ms", section.depth * 2, "", section.name.c_str(), section.cpuMs, section.gpuMs);
+	}
+
+	if (ImGui::CollapsingHeader("Capture"))
+	{
+		ImGui::SliderInt("Frames", &captureFrames, 1, 16);
+		if (ImGui::Button("Capture (F9)"))
+			StartCapture();
+
+		const CaptureStats& stats = getCaptureStats();
+		if (isCapturing())
+			ImGui::Text("Capturing...");
+		else if (!stats.path.empty())
+			ImGui::Text("Last capture: %s, %d frames, %llu calls, %zu KB (snapshot %zu KB)", stats.path.c_str(), stats.frames, stats.calls,
+						stats.bytes >> 10, stats.snapshotBytes >> 10);
+	}
+
+	if (ImGui::CollapsingHeader("Screen Capture"))
+	{
+		const char* formats[] = { "PNG", "Y4M" };
+		ImGui::Combo("Format", &screenCaptureFormat, formats, 2);
+		ImGui::SliderInt("Recording Frames", &screenCaptureFrames, 0, 3600);
+		ImGui::SliderInt("Video Frame Rate", &screenCaptureRate, 24, 120);
+		if (ImGui::Button("Screenshot (F10)"))
+			TakeScreenshot();
+		ImGui::SameLine();
+
+		ScreenCaptureStats stats = getScreenCaptureStats();
+		if (ImGui::Button(stats.recording ? "Stop Recording (F11)" : "Record (F11)"))
+			ToggleRecording();
+
+		//Compare the frame time statistics with and without a capture running to see its cost
+		if (!stats.path.empty())
+		{
+			ImGui::Text("%s: %s", stats.active ? "Capturing" : "Last capture", stats.path.c_str());
+			ImGui::Text("%d frames read, %d written, %d dropped, %d queued (%zu MB)", stats.framesRead, stats.framesWritten,
+						stats.framesDropped, stats.queuedFrames, stats.queuedBytes >> 20);
+			ImGui::Text("Readback %.2f ms a frame (%d waits), encode %.2f ms a frame", stats.readbackMs, stats.readbackWaits, stats.encodeMs);
+			ImGui::Text("Frame time: avg %.2f, 99%% %.2f ms", getFrameStats().averageMs, getFrameStats().p99Ms);
+		}
+		if (!stats.error.empty())
+			ImGui::TextColored(ImVec4(1, 0.4f, 0.4f, 1), "%s", stats.error.c_str());
+	}
+
+	if (ImGui::CollapsingHeader("Job System"))
+	{
+		//Utilisation over the last half second (worker 0 is the main thread, busy only while it runs jobs)
+		static vector<WorkerStats> previous, utilisation;
+		static double lastSample = -1.0;
+		double now = glfwGetTime();
+		if (now - lastSample >= 0.5)
+		{
+			vector<WorkerStats> current = getJobStats();
+			utilisation.assign(current.size(), WorkerStats());
+			for (size_t i = 0; i < current.size() && i < previous.size(); i++)
+			{
+				utilisation[i].busySeconds = current[i].busySeconds - previous[i].busySeconds;
+				utilisation[i].idleSeconds = current[i].idleSeconds - previous[i].idleSeconds;
+			}
+			for (size_t i = 0; i < current.size(); i++)
+			{
+				utilisation[i].jobsRun = current[i].jobsRun;
+				utilisation[i].steals = current[i].steals;
+			}
+			previous = current;
+			lastSample = now;
+		}
+
+		ImGui::Text("Workers: %d (including the main thread)", getWorkerCount());
+		for (size_t i = 0; i < utilisation.size(); i++)
+		{
+			const WorkerStats& stats = utilisation[i];
+			double total = stats.busySeconds + stats.idleSeconds;
+			ImGui::Text("%s %2zu: %5.1f%% busy, %llu jobs, %llu stolen", i == 0 ? "Main  " : "Worker", i,
+						total > 0.0 ? 100.0 * stats.busySeconds / total : 0.0, stats.jobsRun, stats.steals);
+		}
+	}
+
+	if (ImGui::CollapsingHeader("Frame Memory"))
+	{
+		const FrameMemoryStats& frameMemory = getFrameMemoryStats();
+		ImGui::Text("Heap allocations: %llu last frame (%.1f KB), none for %d frames", frameMemory.heapAllocations, frameMemory.heapBytes / 1024.0,
+					frameMemory.steadyFrames);
+		ImGui::Text("Frame arena: %.1f of %.1f KB, grown %d times", frameMemory.arenaBytes / 1024.0, frameMemory.arenaCapacity / 1024.0,
+					frameMemory.arenaGrowths);
+		ImGui::Text("Upload ring: %.1f of %.1f KB a frame x %d, grown %d times", frameMemory.uploadBytes / 1024.0,
+					frameMemory.uploadRegionBytes / 1024.0, UPLOAD_RING_FRAMES, frameMemory.uploadGrowths);
+		ImGui::Text("Fence waits: %d (%.2f ms in total)", frameMemory.fenceWaits, frameMemory.fenceWaitMs);
+	}
+
+	if (ImGui::CollapsingHeader("Memory"))
+	{
+		static const char* kinds[] = { "Buffers", "Textures", "Programs" };
+
+		ImGui::SliderInt("VRAM budget (MB, 0 = off)", &resourceBudgetMB, 0, 1024);
+		ResourceTotals totals = getResourceTotals();
+		ImGui::Text("Total: %.2f MB VRAM, %.2f MB RAM", totals.gpuTotal / 1048576.0, totals.cpuTotal / 1048576.0);
+		for (int kind = 0; kind < 3; kind++)
+			ImGui::Text("%-8s %8.2f MB VRAM %8.2f MB RAM", kinds[kind], totals.gpuBytes[kind] / 1048576.0, totals.cpuBytes[kind] / 1048576.0);
+		ImGui::Text("Mips dropped: %d, evictions: %d, restores: %d", resourceBudget.mipsDropped, resourceBudget.evictions, resourceBudget.restores);
+		if (ImGui::Button("Dump to resources.txt"))
+			dumpResources("resources.txt");
+
+		if (ImGui::TreeNode("Resources"))
+		{
+			for (const ResourceInfo& resource : getResources())
+			{
+				if (resource.kind == RESOURCE_TEXTURE)
+					ImGui::Text("%-24s %9.1f KB  %dx%d%s%s", resource.name.c_str(), resource.gpuBytes / 1024.0, resource.width, resource.height,
+								resource.droppedLevels ? " (reduced)" : "", resource.evicted ? " (evicted)" : "");
+				else
+					ImGui::Text("%-24s %9.1f KB", resource.name.c_str(), resource.gpuBytes / 1024.0);
+			}
+			ImGui::TreePop();
+		}
+	}
+
 	ImGui::End();
 
 	//Actually drawing the window
@@ -965,11 +2183,350 @@ void DestroyImGui()
 	ImGui::DestroyContext();
 }
 
-int main(){
+//Headless benchmarks (--multiview-benchmark, --material-lod-benchmark, --occlusion-benchmark, --frame-memory-benchmark,
+//--atmosphere-benchmark, --water-benchmark).
+//Each case changes the settings being compared and is warmed up (shader variants, GPU timer latency); then the
+//CPU and GPU times of the benchmark's sections are averaged over the measured frames
+struct BenchmarkCase
+{
+	string name;
+	function<void()> apply;
+	function<void()> update; //Every frame after the input, when set (to move the light)
+	double cpuMs = 0.0;
+	double gpuMs = 0.0;
+	double statistic = 0.0;
+};
+
+struct Benchmark
+{
+	string title;
+	string note;
+	vector<const char*> sections; //Timed together
+	const char* statisticName = nullptr; //Column of an average per-frame value (none when null)
+	function<double()> statistic;
+	vector<BenchmarkCase> cases;
+	size_t current = 0;
+	int frame = 0;
+};
+static const int benchmarkWarmup = 20, benchmarkFrames = 100;
+Benchmark benchmark;
+
+//The scene passes of each layout drawn view by view and in single passes, against a single view
+Benchmark MultiViewBenchmark()
+{
+	Benchmark result;
+	result.title = "Multi-view: skybox, terrain and billboards";
+	if (!multiView.supported)
+		result.note = "GL_ARB_shader_viewport_layer_array is missing: the single pass cases are drawn per view";
+	result.sections = { "Skybox", "Terrain", "Billboards" };
+	result.statisticName = "Tile tests";
+	result.statistic = [] { return double(tileCullTests); };
+
+	struct Case
+	{
+		const char* name;
+		bool enabled;
+		int layout;
+		int views;
+		bool singlePass;
+	};
+	const Case cases[] = {
+		{ "Single view", false, MULTI_VIEW_STEREO, 1, false },
+		{ "Stereo, per view", true, MULTI_VIEW_STEREO, 2, false },
+		{ "Stereo, single pass", true, MULTI_VIEW_STEREO, 2, true },
+		{ "Panorama x3, per view", true, MULTI_VIEW_PANORAMA, 3, false },
+		{ "Panorama x3, single pass", true, MULTI_VIEW_PANORAMA, 3, true },
+		{ "Split screen x4, per view", true, MULTI_VIEW_SPLIT, 4, false },
+		{ "Split screen x4, single pass", true, MULTI_VIEW_SPLIT, 4, true }
+	};
+	for (const Case& c : cases)
+	{
+		result.cases.push_back({ c.name, [c]
+		{
+			multiView.enabled = c.enabled;
+			multiView.layout = c.layout;
+			multiView.views = c.views;
+			multiView.singlePass = c.singlePass;
+		} });
+	}
+	return result;
+}
+
+//Terrain shading with the detail materials everywhere, then with the macro textures from closer and closer
+//(the starting camera looks across the whole terrain)
+Benchmark MaterialLodBenchmark()
+{
+	Benchmark result;
+	result.title = "Material LOD: terrain";
+	result.sections = { "Terrain" };
+	result.cases.push_back({ "Detail materials", [] { materialLod.enabled = false; } });
+	for (float distance : { 6.0f, 4.0f, 2.0f })
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "Macro from %.0f (band %.1f)", distance, materialLod.band);
+		result.cases.push_back({ name, [distance]
+		{
+			materialLod.enabled = true;
+			materialLod.distance = distance;
+		} });
+	}
+	return result;
+}
+
+//The scene passes without and with occlusion culling, counting the tiles and billboards left out
+Benchmark OcclusionBenchmark()
+{
+	Benchmark result;
+	result.title = "Occlusion culling: terrain and billboards";
+	result.sections = { "Occlusion", "Terrain", "Billboards" };
+	result.statisticName = "Culled";
+	result.statistic = [] { return double(occlusion.culledTiles + occlusion.culledInstances); };
+	result.cases.push_back({ "Frustum culling", [] { occlusion.enabled = false; } });
+	for (int width : { 128, 256, 512 })
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "Occlusion, %d wide", width);
+		result.cases.push_back({ name, [width]
+		{
+			occlusion.enabled = true;
+			occlusion.width = width;
+		} });
+	}
+	return result;
+}
+
+//Heap allocations of whole frames in the configurations that upload to the ring every frame (none are
+//expected once the arena, the ring and the scratch vectors have grown to fit)
+Benchmark FrameMemoryBenchmark()
+{
+	Benchmark result;
+	result.title = "Frame memory: heap allocations per frame";
+	result.sections = { "Scene" };
+	result.statisticName = "Heap allocs";
+	result.statistic = [] { return double(getFrameMemoryStats().heapAllocations); };
+	result.cases.push_back({ "Single view", [] { multiView.enabled = false; } });
+	result.cases.push_back({ "Local lights", [] { localLights = true; } });
+	result.cases.push_back({ "Stereo, single pass", []
+	{
+		localLights = false;
+		multiView.enabled = true;
+		multiView.layout = MULTI_VIEW_STEREO;
+		multiView.singlePass = true;
+	} });
+	return result;
+}
+
+//The skybox against the atmosphere with its tables built once, rebuilt for a light turning around (the
+//aerial perspective only) and for a rising sun (the sky view as well). The light is set every frame, after
+//the main loop has read it from the UI
+Benchmark AtmosphereBenchmark()
+{
+	//The sun ahead of the camera, low over the terrain
+	auto sunAt = [](float elevation, float azimuth)
+	{
+		return vec3(cos(elevation) * sin(azimuth), sin(elevation), cos(elevation) * cos(azimuth));
+	};
+	auto fixedSun = [sunAt] { lightPos = sunAt(radians(15.0f), radians(20.0f)); };
+
+	Benchmark result;
+	result.title = "Atmosphere: sky, terrain and table rebuilds";
+	result.sections = { "Atmosphere", "Skybox", "Terrain" };
+	result.statisticName = "Table ms";
+	result.statistic = [] { return atmosphere.enabled ? atmosphere.frameMs : 0.0; };
+	result.cases.push_back({ "Skybox", [] { atmosphere.enabled = false; }, fixedSun });
+	result.cases.push_back({ "Sky only", []
+	{
+		atmosphere.enabled = true;
+		atmosphere.aerialPerspective = false;
+	}, fixedSun });
+	result.cases.push_back({ "Sky and aerial perspective", [] { atmosphere.aerialPerspective = true; }, fixedSun });
+	result.cases.push_back({ "Light turning", [] {}, [sunAt] { lightPos = sunAt(radians(15.0f), radians(20.0f + 0.5f * benchmark.frame)); } });
+	result.cases.push_back({ "Sun rising", [] {}, [sunAt] { lightPos = sunAt(radians(5.0f + 0.2f * benchmark.frame), radians(20.0f)); } });
+	return result;
+}
+
+//The terrain without water, then the water with its reflection at half and a quarter of the resolution, redrawn
+//every frame or every fourth, and of the terrain at full detail against every fourth vertex. The water's
+//section holds its reflection and surface, so it is its whole cost
+Benchmark WaterBenchmark()
+{
+	Benchmark result;
+	result.title = "Water: reflection and surface";
+	result.sections = { "Water", "Terrain" };
+	result.statisticName = "Tiles";
+	result.statistic = [] { return WaterActive() ? double(water.reflectedTiles) : 0.0; };
+
+	struct Case
+	{
+		const char* name;
+		bool enabled;
+		int divisor;
+		int interval;
+		int lodStep;
+	};
+	const Case cases[] = {
+		{ "No water", false, 2, 1, 4 },
+		{ "Half, full detail", true, 2, 1, 1 },
+		{ "Half", true, 2, 1, 4 },
+		{ "Quarter", true, 4, 1, 4 },
+		{ "Quarter, every 4th frame", true, 4, 4, 4 }
+	};
+	for (const Case& c : cases)
+	{
+		result.cases.push_back({ c.name, [c]
+		{
+			water.enabled = c.enabled;
+			water.reflectionDivisor = c.divisor;
+			water.reflectionInterval = c.interval;
+			water.reflectionLodStep = c.lodStep;
+		} });
+	}
+	return result;
+}
+
+void StartBenchmark(Benchmark started)
+{
+	benchmark = move(started);
+	benchmark.cases[0].apply();
+}
+
+//Once a frame, after the profiler has its timings; false once every case has been measured
+bool StepBenchmark()
+{
+	BenchmarkCase& current = benchmark.cases[benchmark.current];
+	if (benchmark.frame >= benchmarkWarmup)
+	{
+		for (const char* section : benchmark.sections)
+		{
+			current.cpuMs += getSectionLastCpuMs(section) / benchmarkFrames;
+			current.gpuMs += getSectionLastGpuMs(section) / benchmarkFrames;
+		}
+		if (benchmark.statistic)
+			current.statistic += benchmark.statistic() / benchmarkFrames;
+	}
+	if (++benchmark.frame < benchmarkWarmup + benchmarkFrames)
+		return true;
+
+	benchmark.frame = 0;
+	if (++benchmark.current == benchmark.cases.size())
+		return false;
+	benchmark.cases[benchmark.current].apply();
+	return true;
+}
+
+void PrintBenchmark()
+{
+	printf("%s, %dx%d, %d frames a case\n", benchmark.title.c_str(), framePacing.renderWidth, framePacing.renderHeight, benchmarkFrames);
+	if (!benchmark.note.empty())
+		printf("%s\n", benchmark.note.c_str());
+	printf("%-30s %9s %9s %9s %9s", "Case", "CPU ms", "GPU ms", "CPU rel", "GPU rel");
+	if (benchmark.statisticName)
+		printf(" %12s", benchmark.statisticName);
+	printf("\n");
+
+	const BenchmarkCase& first = benchmark.cases[0];
+	for (const BenchmarkCase& result : benchmark.cases)
+	{
+		printf("%-30s %9.3f %9.3f %8.2fx %8.2fx", result.name.c_str(), result.cpuMs, result.gpuMs, result.cpuMs / std::max(first.cpuMs, 1e-6),
+			   result.gpuMs / std::max(first.gpuMs, 1e-6));
+		if (benchmark.statisticName)
+			printf(" %12.2f", result.statistic);
+		printf("\n");
+	}
+}
+
+int main(int argc, char** argv){
+	//Command line: --headless renders into a hidden window and exits once its capture is written (a single
+	//screenshot unless --capture says otherwise); --capture N records N frames from startup (0 until closed);
+	//--capture-format png|y4m; --capture-output path; --capture-after N skips the first frames (while data streams in)
+	//--multiview-benchmark, --material-lod-benchmark, --occlusion-benchmark, --frame-memory-benchmark,
+	//--atmosphere-benchmark and --water-benchmark render headless through their cases, print the timings and exit
+	//Map tiles: --tiles minX,minZ,maxX,maxZ (world units) renders every tile of --zoom a-b in that box with
+	//--workers processes, into --tile-output as z/x/y.png (--tile-size pixels a side); --tile-worker is
+	//passed to the workers by the coordinator
+	bool headless = false;
+	int startupCapture = -1;
+	int captureAfter = 0;
+	string captureOutput;
+	bool tileBatch = false;
+	float tileBounds[4] = { -m_scale, -m_scale, m_scale, m_scale };
+	int minZoom = 0, maxZoom = 0, tileWorkers = 4, tileSize = 256;
+	string tileOutput = "tiles", tileWorkerSocket;
+	string benchmarkName;
+	for (int i = 1; i < argc; i++)
+	{
+		string option = argv[i];
+		if (option == "--headless")
+			headless = true;
+		else if (option == "--tiles" && i + 1 < argc)
+		{
+			tileBatch = true;
+			sscanf(argv[++i], "%f,%f,%f,%f", &tileBounds[0], &tileBounds[1], &tileBounds[2], &tileBounds[3]);
+		}
+		else if (option == "--zoom" && i + 1 < argc)
+		{
+			if (sscanf(argv[++i], "%d-%d", &minZoom, &maxZoom) < 2)
+				maxZoom = minZoom;
+		}
+		else if (option == "--workers" && i + 1 < argc)
+			tileWorkers = std::max(1, atoi(argv[++i]));
+		else if (option == "--tile-size" && i + 1 < argc)
+			tileSize = std::max(16, atoi(argv[++i]));
+		else if (option == "--tile-output" && i + 1 < argc)
+			tileOutput = argv[++i];
+		else if (option == "--tile-worker" && i + 1 < argc)
+			tileWorkerSocket = argv[++i];
+		else if (option == "--capture" && i + 1 < argc)
+			startupCapture = std::max(0, atoi(argv[++i]));
+		else if (option == "--capture-format" && i + 1 < argc)
+			screenCaptureFormat = string(argv[++i]) == "y4m" ? SCREEN_CAPTURE_Y4M : SCREEN_CAPTURE_PNG;
+		else if (option == "--capture-output" && i + 1 < argc)
+			captureOutput = argv[++i];
+		else if (option == "--capture-after" && i + 1 < argc)
+			captureAfter = std::max(0, atoi(argv[++i]));
+		else if (option == "--multiview-benchmark" || option == "--material-lod-benchmark" || option == "--occlusion-benchmark" ||
+				 option == "--frame-memory-benchmark" || option == "--atmosphere-benchmark" || option == "--water-benchmark")
+		{
+			benchmarkName = option;
+			headless = true;
+		}
+		else
+			cerr << "Unknown option " << option << endl;
+	}
+	if (headless && startupCapture < 0 && benchmarkName.empty())
+		startupCapture = 1;
+	//A headless run exits once its capture is written, so it cannot record until stopped
+	if (headless && startupCapture == 0 && benchmarkName.empty())
+	{
+		cerr << "--capture 0 records until stopped, which needs a window: give --headless a frame count" << endl;
+		return -1;
+	}
+
+	//The coordinator of a tile batch only hands out work; the workers do the rendering
+	if (tileBatch)
+	{
+		vector<MapTile> tiles = mapTilesInBounds(2.0f * m_scale, tileBounds[0], tileBounds[1], tileBounds[2], tileBounds[3], minZoom, maxZoom);
+		vector<string> workerArguments = { "--tile-size", to_string(tileSize), "--tile-output", tileOutput };
+		MapTileStats stats;
+		bool complete = runMapTileBatch(argv[0], workerArguments, tiles, tileWorkers, stats);
+		printf("%d tiles in %.2f s: %.1f tiles/s (%.1f ms a tile in a worker), %d failed, %d retried\n", stats.tiles, stats.seconds,
+			   stats.tilesPerSecond, stats.renderMs, stats.failed, stats.retried);
+		for (size_t i = 0; i < stats.tilesPerWorker.size(); i++)
+			printf("  worker %zu: %d tiles\n", i, stats.tilesPerWorker[i]);
+		return complete ? 0 : 1;
+	}
+	if (!tileWorkerSocket.empty())
+		headless = true;
+	if (captureOutput.empty())
+		captureOutput = screenCaptureFormat == SCREEN_CAPTURE_Y4M ? "capture.y4m" : startupCapture == 1 ? "capture.png" : "capture";
+
 	//Initialise OpenGL and its extensions
-	if (!initializeGL())
+	if (!initializeGL(!headless))
 		return -1;
 
+	//Worker threads for loading, mesh generation, culling and bakes
+	initJobSystem();
+
 	//Initialise ImGui
 	initializeImGui();
 
@@ -979,32 +2536,136 @@ int main(){
 	//Setup program for the model
 	LoadModel();
 	LoadTextures();
-	programID = glCreateProgram();
-	LoadShaders(programID, "src/Basic.vert", "src/Texture.frag");
+
+	//CPU terrain queries use the base mesh's world -> texture mapping
+	initTerrainQuery(terrainQuery, 2.0f * m_scale, 0.5f / (n_points - 1));
+	setCameraGroundFunction(CameraGroundHeight);
+	initShaderVariants(terrainShaders, "src/Basic.vert", "src/Texture.frag");
 
 	//Setup program for the skybox
 	skyboxID = glCreateProgram();
 	LoadSkybox();
 	LoadShaders(skyboxID, "src/skyboxVert.vert", "src/skyboxFrag.frag");
 
+	//The atmosphere's sky is drawn with the skybox's cube, from tables its compute program builds
+	atmosphereSkyID = glCreateProgram();
+	LoadShaders(atmosphereSkyID, "src/skyboxVert.vert", "src/atmosphere.frag");
+	LoadComputeShader(atmosphereTablesID, "src/atmosphere.comp");
+
 	//Setup Program for the billboards
 	sunflowerID = glCreateProgram();
 	LoadSunflower();
 	LoadShaders(sunflowerID, "src/sunflower.vert", "src/sunflower.frag", "src/sunflower.geom");
 
+	//Setup program for the lakes and rivers
+	waterID = glCreateProgram();
+	LoadWater();
+	LoadShaders(waterID, "src/water.vert", "src/water.frag");
+
+	//Setup program for the clipmap terrain
+	LoadClipmap();
+	initShaderVariants(clipmapShaders, "src/clipmap.vert", "src/Texture.frag");
+	SelectTerrainShaders();
+
+	//Setup programs for anti-aliasing
+	fxaaID = glCreateProgram();
+	LoadShaders(fxaaID, "src/post.vert", "src/fxaa.frag");
+	taaID = glCreateProgram();
+	LoadShaders(taaID, "src/post.vert", "src/taa.frag");
+
 	//Set general OpenGL properties related to rendering
 	glClearColor(0.7f, 0.8f, 1.0f, 0.0f);
 	glEnable(GL_DEPTH_TEST);
 	glDepthFunc(GL_LESS);
 	glEnable(GL_CULL_FACE);
 
+	//Setup the offscreen scene target and the pass timers
+	int framebufferWidth, framebufferHeight;
+	glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+	if (!initFramePacing(framePacing, framebufferWidth, framebufferHeight))
+		return -1;
+	initPostProcess(postProcess);
+	postProcess.offscreen = headless;
+	initProfiler();
+	initMultiView(multiView);
+	initFrameMemory();
+	initAtmosphere(atmosphere);
+
+	//Tile workers render what the coordinator hands them and exit
+	if (!tileWorkerSocket.empty())
+	{
+		int result = RunTileWorker(tileWorkerSocket, tileSize, tileOutput);
+		DestroyImGui();
+		destroyDerived(derived);
+		destroyDatasets(datasets);
+		destroyJobSystem();
+		glfwTerminate();
+		return result;
+	}
+	initScreenCapture();
+
+	//Headless runs go as fast as the encoder allows, at a fixed resolution
+	if (headless)
+	{
+		framePacing.swapInterval = 0;
+		framePacing.adaptiveResolution = false;
+	}
+	int frameNumber = 0;
+	if (!benchmarkName.empty())
+	{
+		if (benchmarkName == "--multiview-benchmark")
+			StartBenchmark(MultiViewBenchmark());
+		else if (benchmarkName == "--material-lod-benchmark")
+			StartBenchmark(MaterialLodBenchmark());
+		else if (benchmarkName == "--occlusion-benchmark")
+			StartBenchmark(OcclusionBenchmark());
+		else if (benchmarkName == "--atmosphere-benchmark")
+			StartBenchmark(AtmosphereBenchmark());
+		else if (benchmarkName == "--water-benchmark")
+			StartBenchmark(WaterBenchmark());
+		else
+			StartBenchmark(FrameMemoryBenchmark());
+	}
+
+	//Camera and light updates run at a fixed rate on their own thread
+	SimulationState initialState;
+	initialState.lightPos = lightPos;
+	startSimulation(simulationRate, initialState);
+
 	do
 	{
+		beginFrameMemory();
+		profilerBeginFrame();
+
+		//The scene is drawn at the (possibly reduced) render resolution, then upscaled
+		glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+		beginScenePass(framePacing, framebufferWidth, framebufferHeight);
+		beginPostProcess(postProcess, framePacing, !multiView.enabled);
+		profilerBeginSection("Scene");
+
 		//Clear the screen (prevents drawing on top of previous frame)
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		//Compute the MVP matrix from keyboard and mouse input
-		computeMatricesFromInputs(cursorOff, cursorWasJustOn, cursorWasJustOff);
+		//GL work handed back by jobs (uploads of decoded data)
+		runMainThreadJobs();
+
+		//Continue a pending heightmap switch; the new texture replaces heightMapID once fully uploaded
+		if (updateDatasets(datasets, heightMapID))
+		{
+			const Dataset& heightDataset = *datasets.datasets[datasets.active];
+			setClipmapHeights(clipmap, heightDataset.clipmapHeights);
+			registerTexture("Heightmap", "Terrain", heightMapID, GL_TEXTURE_2D, heightDataset.width, heightDataset.height, 1, GL_R32F, true,
+							heightDataset.heights.size() * sizeof(float));
+		}
+		UpdateDerivedData();
+
+		//Compute the MVP matrix from keyboard and mouse input (applied by the simulation thread)
+		double inputTime = computeMatricesFromInputs(cursorOff, cursorWasJustOn, cursorWasJustOff);
+		if (inputTime > 0.0)
+			profilerInputSample(inputTime);
+		lightPos = getLightPosition();
+		if (!benchmarkName.empty() && benchmark.cases[benchmark.current].update)
+			benchmark.cases[benchmark.current].update();
 
 		if (cursorWasJustOff)
 			cursorWasJustOff = false;
@@ -1014,117 +2675,307 @@ int main(){
 
 		mat4 ProjectionMatrix = getProjectionMatrix();
 		mat4 ViewMatrix = getViewMatrix();
-		mat4 ModelMatrix = mat4(1.0);
-		mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
-
-		//Create only the model view matrix to get the view coordinate system
-		mat4 modelViewMatrix = ViewMatrix * ModelMatrix;
 
+		if (pickRequested)
+		{
+			PickTerrain(getUnjitteredProjectionMatrix() * ViewMatrix);
+			pickRequested = false;
+		}
+		EditTerrain(getUnjitteredProjectionMatrix() * ViewMatrix);
 		vec3 cameraPos = getCameraPosition();
-		string title = "Rasterisation - (" + to_string(cameraPos[0]) + "," + to_string(cameraPos[1]) + "," + to_string(cameraPos[2]) + ")";
-		glfwSetWindowTitle(window, title.c_str());
+		char title[128];
+		snprintf(title, sizeof(title), "Rasterisation - (%f,%f,%f)", cameraPos[0], cameraPos[1], cameraPos[2]);
+		glfwSetWindowTitle(window, title);
 
 		if (isWireframe)
 			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 		else
 			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
-		//First pass -> draw skybox
-		glDepthMask(GL_FALSE);
-		glUseProgram(skyboxID);
+		//Every view of a stereo, panorama or split screen layout (a single one covering the target otherwise),
+		//drawn by one instanced submission of each pass or by a submission per view
+		buildMultiViews(multiView, ViewMatrix, ProjectionMatrix, framePacing.renderWidth, framePacing.renderHeight);
+		bool singlePass = isMultiViewSinglePass(multiView);
+		tileCullTests = 0;
+		int viewPasses = singlePass ? 1 : multiView.count;
+		int viewsPerPass = singlePass ? multiView.count : 1;
+		if (singlePass)
+			setMultiViewViewports(multiView);
+		auto beginView = [&](int view)
+		{
+			if (multiView.count > 1)
+				setViewViewport(multiView, view);
+		};
+
+		//Features that are switched off (or unused in wireframe) are compiled out of the terrain shaders
+		SelectTerrainShaders();
 
-		//Get the view matrix without translation (required for skybox)
-		mat4 modifiedView = mat4(mat3(ViewMatrix));
+		//The atmosphere's tables are only rebuilt when the light, the camera or the settings changed
+		if (atmosphere.enabled)
+		{
+			profilerBeginSection("Atmosphere");
+			updateAtmosphere(atmosphere, atmosphereTablesID, lightPos, cameraPos);
+			if (AtmosphereShading() == 2)
+				updateAerialPerspective(atmosphere, atmosphereTablesID, getUnjitteredProjectionMatrix() * ViewMatrix);
+			profilerEndSection();
+		}
 
-		glUniformMatrix4fv(glGetUniformLocation(skyboxID, "view"), 1, GL_FALSE, &modifiedView[0][0]);
-		glUniformMatrix4fv(glGetUniformLocation(skyboxID, "projection"), 1, GL_FALSE, &ProjectionMatrix[0][0]);
+		//First pass -> draw skybox (or the atmosphere's sky through the same cube)
+		profilerBeginSection("Skybox");
+		glDepthMask(GL_FALSE);
+		GLuint skyProgram = atmosphere.enabled ? atmosphereSkyID : skyboxID;
+		glUseProgram(skyProgram);
 
+		//The vertex shader removes the translation from the view matrix (required for skybox)
 		glBindVertexArray(skyboxVertexArray);
+		if (atmosphere.enabled)
+			setAtmosphereSkyUniforms(atmosphere, atmosphereSkyID);
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTextureID);
-		glDrawArrays(GL_TRIANGLES, 0, skyboxVerts.size());
+		for (int view = 0; view < viewPasses; view++)
+		{
+			if (!singlePass)
+				beginView(view);
+			setMultiViewUniforms(multiView, skyProgram, view, viewsPerPass);
+			glDrawArraysInstanced(GL_TRIANGLES, 0, skyboxVerts.size(), viewsPerPass);
+		}
 
 		glBindVertexArray(0);
 
 		glUseProgram(programID);
 		glDepthMask(GL_TRUE);
+		profilerEndSection();
+
+		//Local lights are binned for this frame's camera before the terrain is shaded
+		if (LocalLightsActive())
+		{
+			profilerBeginSection("Light Binning");
+			if (animateLights)
+				lightTime = glfwGetTime();
+			buildLightStressScene(clusteredLights.lights, terrainQuery, 2.0f * m_scale, lightCount, lightRadius, unsigned(lightSeed), lightTime);
+			binLights(clusteredLights, ViewMatrix, ProjectionMatrix);
+			uploadClusteredLights(clusteredLights);
+			profilerEndSection();
+		}
+
+		//The terrain is rasterised on the CPU first, so hidden tiles and billboards are never submitted
+		resetOcclusion(occlusion);
+		if (OcclusionActive())
+		{
+			profilerBeginSection("Occlusion");
+			rasteriseOccluder(occlusion, derived.occluder, multiView.viewProjection[0], float(framePacing.renderWidth) / framePacing.renderHeight);
+			profilerEndSection();
+		}
+
+		profilerBeginSection("Terrain");
 
+		//Second pass (alternative) -> clipmap terrain following the camera (drawn for each view on its own)
+		if (clipmapMode)
+		{
+			glUseProgram(clipmapID);
+
+			//Only the rows/columns exposed by the camera movement are uploaded
+			updateClipmap(clipmap, cameraPos);
+
+			glUniform3f(glGetUniformLocation(clipmapID, "lightPos"), lightPos.x, lightPos.y, lightPos.z);
+			glUniform1f(glGetUniformLocation(clipmapID, "scaleValue"), scaleValue);
+			glUniform1f(glGetUniformLocation(clipmapID, "worldSize"), 2.0f * m_scale);
+			if (LocalLightsActive())
+				setClusterUniforms(clusteredLights, clipmapID, framePacing.renderWidth, framePacing.renderHeight);
+			SetSkyUniforms(clipmapID);
+			setMaterialLodUniforms(materialLod, clipmapID);
+			if (atmosphere.enabled)
+				setAtmosphereUniforms(atmosphere, clipmapID, framePacing.renderWidth, framePacing.renderHeight);
+
+			BindMaterialTextures();
+			for (int view = 0; view < multiView.count; view++)
+			{
+				beginView(view);
+				vec3 viewPosition = multiView.cameraPosition[view];
+				glUniformMatrix4fv(glGetUniformLocation(clipmapID, "modelView"), 1, GL_FALSE, &multiView.view[view][0][0]);
+				glUniformMatrix4fv(glGetUniformLocation(clipmapID, "MVP"), 1, GL_FALSE, &multiView.viewProjection[view][0][0]);
+				glUniform3f(glGetUniformLocation(clipmapID, "cameraPos"), viewPosition.x, viewPosition.y, viewPosition.z);
+				drawClipmap(clipmap, clipmapID, GL_TEXTURE10);
+			}
+			if (singlePass)
+				setMultiViewViewports(multiView);
+			glUseProgram(programID);
+		}
 
 		//Bind the mesh VAO
 		glBindVertexArray(VertexArrayID);
 
-		glUniformMatrix4fv(glGetUniformLocation(programID, "modelView"), 1, GL_FALSE, &modelViewMatrix[0][0]);
-
 		//Send the uniform values to the shaders
 		glUniform3f(glGetUniformLocation(programID, "lightPos"), lightPos.x, lightPos.y, lightPos.z);
-		glUniform3f(glGetUniformLocation(programID, "cameraPos"), cameraPos.x, cameraPos.y, cameraPos.z);
 
-		glUniform1f(glGetUniformLocation(programID, "numPoints"), n_points);
 		glUniform1f(glGetUniformLocation(programID, "scaleValue"), scaleValue);
+		if (LocalLightsActive())
+			setClusterUniforms(clusteredLights, programID, framePacing.renderWidth, framePacing.renderHeight);
+		SetSkyUniforms(programID);
+		setMaterialLodUniforms(materialLod, programID);
+		if (atmosphere.enabled)
+			setAtmosphereUniforms(atmosphere, programID, framePacing.renderWidth, framePacing.renderHeight);
 		
 		
 		//Second pass -> base mesh
 		glUseProgram(programID);
 
-		//Get a handle for our uniforms
-		GLuint MatrixID = glGetUniformLocation(programID, "MVP");
-		glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
 		//Assign the height map to the correct uniform value in the vertex shader
 		glActiveTexture(GL_TEXTURE1);
 		glBindTexture(GL_TEXTURE_2D, heightMapID);
 		glUniform1i(glGetUniformLocation(programID, "heightMap"), 1);
+		if (!clipmapMode)
+			touchResource("Heightmap");
 
-		//Assign the rock shininess to the fragment shader
-		glActiveTexture(GL_TEXTURE2);
-		glBindTexture(GL_TEXTURE_2D, rockShininessID);
+		//Assign the material textures to the fragment shader
+		BindMaterialTextures();
 
-		//Assign the texture colour to the fragment shader
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, rockDiffuseID);
+		//Draw: every view by one instanced submission culled once, or each view with its own matrices and culling
+		if (!clipmapMode && singlePass)
+		{
+			setMultiViewUniforms(multiView, programID, 0, multiView.count);
+			DrawTerrainTilesMultiView();
+		}
+		else if (!clipmapMode)
+		{
+			for (int view = 0; view < multiView.count; view++)
+			{
+				beginView(view);
+				vec3 viewPosition = multiView.cameraPosition[view];
+				glUniformMatrix4fv(glGetUniformLocation(programID, "modelView"), 1, GL_FALSE, &multiView.view[view][0][0]);
+				glUniformMatrix4fv(glGetUniformLocation(programID, "MVP"), 1, GL_FALSE, &multiView.viewProjection[view][0][0]);
+				glUniform3f(glGetUniformLocation(programID, "cameraPos"), viewPosition.x, viewPosition.y, viewPosition.z);
+				DrawTerrainTiles(multiView.viewProjection[view]);
+			}
+		}
+		profilerEndSection();
 
-		//Draw
-		glDrawElements(GL_TRIANGLE_STRIP, //Mode
-					  (GLsizei)nIndices, //Count
-					  GL_UNSIGNED_INT, //Type
-					  (void*)0	//Element array buffer offset
-		);
+		//Lakes and rivers: the reflection (when due) then the surface, timed together so the water can be budgeted
+		if (WaterActive())
+		{
+			profilerBeginSection("Water");
+			updateWaterTerrainLod(water, n_points, derived.tileSize);
+			mat4 unjitteredProjection = getUnjitteredProjectionMatrix();
+			int reflected = cullWaterBodies(water, derived.water, extractFrustum(multiView.viewProjection[0]), cameraPos);
+
+			profilerBeginSection("Water Reflection");
+			WaterReflectionView mirrored;
+			if (reflected >= 0 && beginWaterReflection(water, derived.water.bodies[reflected].level, ViewMatrix, unjitteredProjection, cameraPos,
+													   framePacing.renderWidth, framePacing.renderHeight, mirrored))
+			{
+				DrawWaterReflection(mirrored, lightPos);
+				endWaterReflection(water);
+			}
+			profilerEndSection();
+
+			profilerBeginSection("Water Surface");
+			glUseProgram(waterID);
+			drawWaterSurface(water, derived.water, waterID, ProjectionMatrix * ViewMatrix, cameraPos, lightPos, float(glfwGetTime()));
+			profilerEndSection();
+
+			glUseProgram(programID);
+			profilerEndSection();
+		}
 
 		//Third pass -> handle billboards
+		profilerBeginSection("Billboards");
 		glUseProgram(sunflowerID);
 
 		glDisable(GL_CULL_FACE);
 
-		glUniformMatrix4fv(glGetUniformLocation(sunflowerID, "view"), 1, GL_FALSE, &ViewMatrix[0][0]);
-		glUniformMatrix4fv(glGetUniformLocation(sunflowerID, "projection"), 1, GL_FALSE, &ProjectionMatrix[0][0]);
-
 		glUniformMatrix4fv(glGetUniformLocation(sunflowerID, "cameraPosition"), 1, GL_FALSE, &cameraPos[0]);
-
-		//Pass the height map texture to the sunflower's vertex shader
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, heightMapID);
-		glUniform1i(glGetUniformLocation(sunflowerID, "heightMap"), 1);
-
-		glUniform1f(glGetUniformLocation(sunflowerID, "scaleValue"), scaleValue);
+		SetSkyUniforms(sunflowerID);
 
 		//Pass the sunflower texture
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, sunflowerTextureID);
 
+		//Alpha-to-coverage removes the transparent background with MSAA (antialiased edges); the other modes
+		//draw into single-sample targets, where it does nothing, so the shader discards it instead
+		//The geometry shader runs once per view in a single pass
+		bool alphaToCoverage = isMultisampled(postProcess);
+		glUniform1i(glGetUniformLocation(sunflowerID, "alphaToCoverage"), alphaToCoverage);
+		if (alphaToCoverage)
+			glEnable(GL_SAMPLE_ALPHA_TO_COVERAGE);
 		glBindVertexArray(sunflowerVertexArray);
-		glDrawArrays(GL_POINTS, 0, 3);
+		for (int view = 0; view < viewPasses; view++)
+		{
+			if (!singlePass)
+				beginView(view);
+			setMultiViewUniforms(multiView, sunflowerID, view, viewsPerPass);
+			DrawSunflowers();
+		}
 		glBindVertexArray(0);
+		if (alphaToCoverage)
+			glDisable(GL_SAMPLE_ALPHA_TO_COVERAGE);
 
 		glUseProgram(programID);
 		glEnable(GL_CULL_FACE);
+		profilerEndSection();
 
+		//Only the scene passes are drawn from the camera the occlusion buffer holds
+		occlusion.ready = false;
+
+		//Back to the whole target
+		if (multiView.count > 1)
+			glViewport(0, 0, framePacing.renderWidth, framePacing.renderHeight);
+
+		profilerEndSection();
+
+		//Resolve and present with the selected anti-aliasing (timed per mode so their costs can be compared)
+		const char* antiAliasingSection = antiAliasingNames[postProcess.activeMode];
+		profilerBeginSection(antiAliasingSection);
+		mat4 unjitteredViewProjection = getUnjitteredProjectionMatrix() * ViewMatrix;
+		applyPostProcess(postProcess, framePacing, fxaaID, taaID, unjitteredViewProjection, framebufferWidth, framebufferHeight);
+		profilerEndSection();
+		postProcess.modeCostMs[postProcess.activeMode] = getSectionGpuMs("Scene") + getSectionGpuMs(antiAliasingSection);
+
+		//Screenshots and recordings take the finished image, without the UI
+		if (startupCapture >= 0 && frameNumber == captureAfter)
+			startScreenCapture(captureOutput.c_str(), ScreenCaptureFormat(screenCaptureFormat), startupCapture, screenCaptureRate, headless);
+		profilerBeginSection("Screen Capture");
+		readScreenCapture(presentedFramebuffer(postProcess), framebufferWidth, framebufferHeight);
+		profilerEndSection();
+
+		profilerBeginSection("UI");
 		RenderImGui();
+		profilerEndSection();
+
+		//Keep the registered resources within the video memory budget (after every use this frame was marked)
+		RegisterModuleResources();
+		resourceBudget.gpuBytes = size_t(resourceBudgetMB) << 20;
+		enforceResourceBudget(resourceBudget);
+
 		//Swap Buffers
 		glfwSwapBuffers(window);
+		endFramePacing(framePacing, getSectionLastGpuMs("Scene") + getSectionLastGpuMs(antiAliasingSection));
+		profilerEndFrame();
 		glfwPollEvents();
+		endFrameMemory();
+
+		frameNumber++;
+		if (headless && benchmarkName.empty() && frameNumber > captureAfter && !isScreenCapturing())
+			glfwSetWindowShouldClose(window, GL_TRUE);
+		if (!benchmarkName.empty() && !StepBenchmark())
+			glfwSetWindowShouldClose(window, GL_TRUE);
 
 	} while (glfwWindowShouldClose(window) == 0);
 
+	stopSimulation();
+
+	//Writes whatever was read back before closing
+	destroyScreenCapture();
+	if (!benchmarkName.empty())
+		PrintBenchmark();
+	else if (headless)
+	{
+		ScreenCaptureStats capture = getScreenCaptureStats();
+		cout << "Wrote " << capture.framesWritten << " frames to " << capture.path << " (" << capture.framesDropped << " dropped), average frame "
+			 << getFrameStats().averageMs << " ms" << endl;
+		if (!capture.error.empty())
+			cerr << capture.error << endl;
+	}
+
 	//Destroy ImGui
 	DestroyImGui();
 
@@ -1132,6 +2983,22 @@ int main(){
 	UnloadModel();
 	UnloadShaders();
 	UnloadTextures();
+	destroyClipmap(clipmap);
+	destroyDerived(derived);
+	destroyDatasets(datasets);
+	destroyJobSystem();
+	destroyPostProcess(postProcess);
+	destroyFramePacing(framePacing);
+	destroyClusteredLights(clusteredLights);
+	destroyMultiView(multiView);
+	destroyMaterialLod(materialLod);
+	destroyAtmosphere(atmosphere);
+	unregisterCategory("Atmosphere");
+	destroyWater(water);
+	unregisterCategory("Water");
+	destroyTerrainEditor(terrainEditor);
+	destroyFrameMemory();
+	destroyProfiler();
 	glfwTerminate();
 	return 0;
 }
\ No newline at end of file
@@ -0,0 +1,10 @@
+#version 330 core
+
+// Fullscreen triangle generated from the vertex index (no vertex buffer needed)
+out vec2 screenUV;
+
+void main(){
+	vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	screenUV = corner;
+	gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
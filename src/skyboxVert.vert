@@ -1,13 +1,23 @@
 #version 330 core
+#extension GL_ARB_shader_viewport_layer_array : enable
 layout (location = 0) in vec3 vertexPos;
 
 out vec3 texCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
+//One view per instance (multiview.cpp): instance i draws view firstView + i into viewport i
+#define MAX_VIEWS 4
+uniform mat4 projections[MAX_VIEWS];
+uniform mat4 views[MAX_VIEWS];
+uniform int firstView;
 
 void main()
 {
+	int view = firstView + gl_InstanceID;
 	texCoords = vertexPos;
-	gl_Position = projection * view * vec4(vertexPos, 1.0);
+
+	//The view matrix without translation (the sky is infinitely far away)
+	gl_Position = projections[view] * mat4(mat3(views[view])) * vec4(vertexPos, 1.0);
+#ifdef GL_ARB_shader_viewport_layer_array
+	gl_ViewportIndex = gl_InstanceID;
+#endif
 }
\ No newline at end of file
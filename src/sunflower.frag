@@ -1,17 +1,23 @@
 #version 330
 
 uniform sampler2D sampler;
+uniform bool alphaToCoverage; //Only while the scene is drawn into the multisampled target
 
 in vec2 textureCoords;
+in vec3 skyTint;
 out vec4 color;
 
 void main()
 {
 	
 	vec4 colour = texture(sampler, textureCoords);
+	colour.rgb *= skyTint;
 
-	//Discard the transparent background
-	if(colour.a < 1.0)
+	//With MSAA the transparent background is removed with alpha-to-coverage: sharpening alpha to a one pixel ramp
+	//keeps the petals crisp while the edge is still spread over the samples. Single-sample targets discard it
+	if (alphaToCoverage)
+		colour.a = clamp((colour.a - 0.5) / max(fwidth(colour.a), 0.0001) + 0.5, 0.0, 1.0);
+	else if (colour.a < 1.0)
 		discard;
 	
 	color = colour;
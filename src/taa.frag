@@ -0,0 +1,49 @@
+#version 330 core
+
+in vec2 screenUV;
+out vec4 color;
+
+uniform sampler2D sceneColour;
+uniform sampler2D sceneDepth;
+uniform sampler2D history;
+uniform vec2 uvScale; // Fraction of the textures covered by the rendered area
+uniform vec2 texelSize;
+
+uniform mat4 inverseViewProjection; // Current frame, without jitter
+uniform mat4 previousViewProjection;
+uniform float blend; // Weight of the current frame (1 discards the history)
+
+void main(){
+	vec2 uv = screenUV * uvScale;
+	vec3 current = texture(sceneColour, uv).rgb;
+
+	//Colour range of the neighbourhood; history outside it is stale (disocclusion, moving billboards)
+	vec3 minColour = current;
+	vec3 maxColour = current;
+	for (int y = -1; y <= 1; y++)
+	{
+		for (int x = -1; x <= 1; x++)
+		{
+			vec2 neighbourUV = clamp(uv + vec2(x, y) * texelSize, 0.5 * texelSize, uvScale - 0.5 * texelSize);
+			vec3 neighbour = texture(sceneColour, neighbourUV).rgb;
+			minColour = min(minColour, neighbour);
+			maxColour = max(maxColour, neighbour);
+		}
+	}
+
+	//Reproject the pixel with its depth to find where it was last frame (the scene is static, only the camera moves)
+	float depth = texture(sceneDepth, uv).r;
+	vec4 worldPos = inverseViewProjection * vec4(vec3(screenUV, depth) * 2.0 - 1.0, 1.0);
+	worldPos /= worldPos.w;
+	vec4 previousPos = previousViewProjection * worldPos;
+	vec2 previousUV = previousPos.xy / previousPos.w * 0.5 + 0.5;
+
+	if (blend >= 1.0 || any(lessThan(previousUV, vec2(0.0))) || any(greaterThan(previousUV, vec2(1.0))))
+	{
+		color = vec4(current, 1.0);
+		return;
+	}
+
+	vec3 historyColour = clamp(texture(history, previousUV * uvScale).rgb, minColour, maxColour);
+	color = vec4(mix(historyColour, current, blend), 1.0);
+}
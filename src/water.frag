@@ -0,0 +1,55 @@
+#version 330 core
+out vec4 color;
+
+in vec3 fragPos;
+
+//The scene mirrored about the water (water.cpp), drawn while the camera was at reflectionViewProjection
+uniform sampler2D reflection;
+uniform mat4 reflectionViewProjection;
+uniform int reflectionValid;
+
+uniform vec3 cameraPos;
+uniform vec3 lightPos; //Towards the light
+uniform float time; //Seconds
+
+#define WATER_COLOUR vec3(0.02, 0.09, 0.12) //Seen straight down
+#define SKY_COLOUR vec3(0.55, 0.65, 0.75) //Reflected while there is no reflection to sample
+#define RIPPLE_DISTORTION 0.04 //Offset of the reflection's coordinates per unit of slope
+
+//Slope of a few small waves travelling across the water: direction, frequency (radians per world unit),
+//amplitude (world units) and speed (radians per second)
+vec2 rippleSlope(vec2 position)
+{
+	const vec4 waves[3] = vec4[3](vec4(0.96, 0.28, 60.0, 0.0008), vec4(-0.37, 0.93, 90.0, 0.0005), vec4(0.71, -0.71, 140.0, 0.0003));
+	const vec3 speeds = vec3(2.0, 2.5, 3.0);
+
+	vec2 slope = vec2(0.0);
+	for (int i = 0; i < 3; i++)
+		slope += waves[i].xy * (waves[i].z * waves[i].w * cos(dot(waves[i].xy, position) * waves[i].z - speeds[i] * time));
+	return slope;
+}
+
+void main()
+{
+	vec2 slope = rippleSlope(fragPos.xz);
+	vec3 normal = normalize(vec3(-slope.x, 1.0, -slope.y));
+	vec3 toCamera = normalize(cameraPos - fragPos);
+
+	//Schlick's approximation, for water's reflectance of 0.02 head on
+	float fresnel = 0.02 + 0.98 * pow(1.0 - max(dot(normal, toCamera), 0.0), 5.0);
+
+	//Where the water was on screen when the reflection was drawn, moved by the ripples
+	vec3 reflected = SKY_COLOUR;
+	if (reflectionValid != 0)
+	{
+		vec4 clip = reflectionViewProjection * vec4(fragPos, 1.0);
+		vec2 uv = clip.xy / clip.w * 0.5 + 0.5 + slope * RIPPLE_DISTORTION;
+		reflected = texture(reflection, clamp(uv, 0.0, 1.0)).rgb;
+	}
+
+	//The sun's highlight
+	vec3 light = normalize(lightPos);
+	float specular = light.y > 0.0 ? pow(max(dot(normal, normalize(light + toCamera)), 0.0), 400.0) * 2.0 : 0.0;
+
+	color = vec4(mix(WATER_COLOUR, reflected, fresnel) + specular, 1.0);
+}
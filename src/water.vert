@@ -0,0 +1,13 @@
+#version 330 core
+
+layout(location = 0) in vec3 vertexPosition; //World space (water.cpp)
+
+uniform mat4 MVP;
+
+out vec3 fragPos;
+
+void main()
+{
+	fragPos = vertexPosition;
+	gl_Position = MVP * vec4(vertexPosition, 1.0);
+}
@@ -0,0 +1,458 @@
+//CPU pipeline micro-benchmarks
+//Times the CPU side of loading and drawing the terrain over several sizes: BMP loading, height decoding,
+//normal generation, the base mesh grid and indices, the camera matrices, clustered light binning and the
+//skybox JPEG decode.
+//Each case is repeated until it has run for a minimum time and reported by its median. Results can be
+//written as JSON and compared against an earlier run, failing (exit code 2) when a case is slower than
+//its baseline by more than the threshold.
+//Usage: benchmarks [--json PATH] [--baseline PATH] [--threshold PCT] [--threshold NAME=PCT]
+//                  [--filter TEXT] [--threads N] [--quick]
+//  --json PATH           write the results (this file can be used as a later --baseline)
+//  --baseline PATH       compare against the results of an earlier --json run
+//  --threshold PCT       allowed slowdown of the median before a case counts as a regression (default 15)
+//  --threshold NAME=PCT  the same for the cases of one benchmark (e.g. skybox_decode=30)
+//  --filter TEXT         only run benchmarks whose name contains TEXT
+//  --threads N           run with N job system workers (default 0: everything on the calling thread)
+//  --quick               skip the largest size of each benchmark
+//Run from the repository root so the skybox faces are found.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <glm/glm.hpp>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "external/stb_image.h"
+
+#include "common/clusteredlights.hpp"
+#include "common/controls.hpp"
+#include "common/datasets.hpp"
+#include "common/framememory.hpp"
+#include "common/jobs.hpp"
+#include "common/terraingen.hpp"
+#include "common/terrainmesh.hpp"
+#include "common/terrainquery.hpp"
+#include "common/utils.hpp"
+
+//controls.cpp reads the renderer's window for input; only its input-free matrix code is used here
+struct GLFWwindow;
+GLFWwindow* window = nullptr;
+
+static const double minSeconds = 0.25; //Per case, after one warm-up run
+static const int minSamples = 5;
+static const int maxSamples = 1000;
+
+struct BenchmarkResult
+{
+	string name;
+	int size = 0;
+	int samples = 0;
+	double medianMs = 0.0;
+	double minMs = 0.0;
+	double meanMs = 0.0;
+	double itemsPerSecond = 0.0; //Per the benchmark's own unit (texels, vertices, calls...)
+};
+
+static volatile double sink; //Keeps results alive so nothing is optimised away
+
+static BenchmarkResult measure(const string& name, int size, double items, const function<void()>& body)
+{
+	body();
+
+	vector<double> samples;
+	auto start = chrono::steady_clock::now();
+	while (int(samples.size()) < maxSamples)
+	{
+		auto sampleStart = chrono::steady_clock::now();
+		body();
+		auto now = chrono::steady_clock::now();
+		samples.push_back(chrono::duration<double, milli>(now - sampleStart).count());
+		if (int(samples.size()) >= minSamples && chrono::duration<double>(now - start).count() >= minSeconds)
+			break;
+	}
+
+	BenchmarkResult result;
+	result.name = name;
+	result.size = size;
+	result.samples = int(samples.size());
+	sort(samples.begin(), samples.end());
+	size_t middle = samples.size() / 2;
+	result.medianMs = samples.size() % 2 ? samples[middle] : 0.5 * (samples[middle - 1] + samples[middle]);
+	result.minMs = samples[0];
+	for (double sample : samples)
+		result.meanMs += sample / samples.size();
+	result.itemsPerSecond = items / (result.medianMs / 1000.0);
+
+	printf("%-24s %8d %8d %12.4f %12.4f %14.3g\n", name.c_str(), size, result.samples, result.medianMs, result.minMs, result.itemsPerSecond);
+	fflush(stdout);
+	return result;
+}
+
+//Synthetic heightmap BMP of the given size (the same encoding as the shipped ones)
+static bool writeTestBMP(const string& path, int size)
+{
+	FILE* file = fopen(path.c_str(), "wb");
+	if (!file)
+		return false;
+
+	TerrainNoise noise;
+	noise.seed = 7;
+	noise.heightScale = 0.6f;
+	vector<float> heights(size);
+	vector<unsigned char> row(((size_t(size) * 3 + 3) / 4) * 4);
+	bool ok = writeBMPHeader(file, size, size);
+	for (int y = 0; y < size && ok; y++)
+	{
+		generateHeightRows(noise, size, y, 1, heights.data());
+		encodeHeightRows(heights.data(), size, 1, row.data());
+		ok = fwrite(row.data(), 1, row.size(), file) == row.size();
+	}
+	fclose(file);
+	return ok;
+}
+
+static string formatJSON(const vector<BenchmarkResult>& results)
+{
+	string json = "{\n  \"benchmarks\": [\n";
+	char line[512];
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchmarkResult& r = results[i];
+		snprintf(line, sizeof(line),
+				 "    { \"name\": \"%s\", \"size\": %d, \"samples\": %d, \"median_ms\": %.6f, \"min_ms\": %.6f, \"mean_ms\": %.6f, \"items_per_second\": %.6g }%s\n",
+				 r.name.c_str(), r.size, r.samples, r.medianMs, r.minMs, r.meanMs, r.itemsPerSecond, i + 1 < results.size() ? "," : "");
+		json += line;
+	}
+	return json + "  ]\n}\n";
+}
+
+//Reads back the entries formatJSON writes (name, size and median of each object); false if nothing was found
+static bool readBaseline(const string& path, map<pair<string, int>, double>& medians)
+{
+	ifstream stream(path);
+	if (!stream.is_open())
+		return false;
+	stringstream buffer;
+	buffer << stream.rdbuf();
+	string text = buffer.str();
+
+	size_t position = 0;
+	while ((position = text.find('{', position + 1)) != string::npos)
+	{
+		size_t end = text.find('}', position);
+		if (end == string::npos)
+			break;
+		string entry = text.substr(position, end - position);
+		position = end;
+
+		size_t name = entry.find("\"name\"");
+		size_t size = entry.find("\"size\"");
+		size_t median = entry.find("\"median_ms\"");
+		if (name == string::npos || size == string::npos || median == string::npos)
+			continue;
+
+		size_t nameStart = entry.find('"', entry.find(':', name)) + 1;
+		size_t nameEnd = entry.find('"', nameStart);
+		if (nameStart == 0 || nameEnd == string::npos)
+			continue;
+		int sizeValue = atoi(entry.c_str() + entry.find(':', size) + 1);
+		double medianValue = atof(entry.c_str() + entry.find(':', median) + 1);
+		medians[make_pair(entry.substr(nameStart, nameEnd - nameStart), sizeValue)] = medianValue;
+	}
+	return !medians.empty();
+}
+
+static void printUsage()
+{
+	printf("Usage: benchmarks [--json PATH] [--baseline PATH] [--threshold PCT] [--threshold NAME=PCT]\n"
+		   "                  [--filter TEXT] [--threads N] [--quick]\n");
+}
+
+int main(int argc, char** argv)
+{
+	string jsonPath, baselinePath, filter;
+	double threshold = 15.0;
+	map<string, double> thresholds;
+	int threads = 0;
+	bool quick = false;
+	for (int i = 1; i < argc; i++)
+	{
+		const char* option = argv[i];
+		if (!strcmp(option, "--quick"))
+		{
+			quick = true;
+			continue;
+		}
+		if (i + 1 >= argc)
+		{
+			printUsage();
+			return 1;
+		}
+		string value = argv[++i];
+		if (!strcmp(option, "--json"))
+			jsonPath = value;
+		else if (!strcmp(option, "--baseline"))
+			baselinePath = value;
+		else if (!strcmp(option, "--filter"))
+			filter = value;
+		else if (!strcmp(option, "--threads"))
+			threads = max(0, atoi(value.c_str()));
+		else if (!strcmp(option, "--threshold"))
+		{
+			size_t equals = value.find('=');
+			if (equals == string::npos)
+				threshold = atof(value.c_str());
+			else
+				thresholds[value.substr(0, equals)] = atof(value.c_str() + equals + 1);
+		}
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+
+	//Read before running, so a bad path fails straight away
+	map<pair<string, int>, double> baseline;
+	if (!baselinePath.empty() && !readBaseline(baselinePath, baseline))
+	{
+		printf("Cannot read the baseline %s\n", baselinePath.c_str());
+		return 1;
+	}
+
+	if (threads > 0)
+		initJobSystem(threads);
+
+	auto enabled = [&](const char* name) { return filter.empty() || string(name).find(filter) != string::npos; };
+	auto sizes = [&](vector<int> all)
+	{
+		if (quick && all.size() > 1)
+			all.pop_back();
+		return all;
+	};
+
+	printf("Workers: %d\n\n", getWorkerCount());
+	printf("%-24s %8s %8s %12s %12s %14s\n", "Benchmark", "Size", "Samples", "Median ms", "Min ms", "Items/s");
+	vector<BenchmarkResult> results;
+
+	//BMP loading and height decoding (size: width and height of the map)
+	if (enabled("loadBMP_custom") || enabled("height_decode"))
+	{
+		for (int size : sizes({ 256, 1024, 4096 }))
+		{
+			string path = (filesystem::temp_directory_path() / ("benchmark_heights_" + to_string(size) + ".bmp")).string();
+			if (!writeTestBMP(path, size))
+			{
+				printf("Cannot write %s, skipping size %d\n", path.c_str(), size);
+				continue;
+			}
+
+			double texels = double(size) * size;
+			if (enabled("loadBMP_custom"))
+			{
+				results.push_back(measure("loadBMP_custom", size, texels, [&]
+				{
+					int width, height;
+					unsigned char* data = nullptr;
+					if (loadBMP_custom(path.c_str(), width, height, data))
+					{
+						sink = data[0];
+						delete[] data;
+					}
+				}));
+			}
+
+			int width, height;
+			unsigned char* data = nullptr;
+			if (enabled("height_decode") && loadBMP_custom(path.c_str(), width, height, data))
+			{
+				vector<float> heights;
+				results.push_back(measure("height_decode", size, texels, [&]
+				{
+					decodeHeightBMP(data, width, height, heights);
+					sink = heights[heights.size() / 2];
+				}));
+				delete[] data;
+			}
+			filesystem::remove(path);
+		}
+	}
+
+	//Normals of the vertex grid (size: grid resolution) from a 1024x1024 map
+	if (enabled("normals"))
+	{
+		Dataset dataset;
+		dataset.width = dataset.height = 1024;
+		dataset.heights.resize(size_t(1024) * 1024);
+		TerrainNoise noise;
+		generateHeightRows(noise, 1024, 0, 1024, dataset.heights.data());
+
+		for (int resolution : sizes({ 200, 512, 1024 }))
+		{
+			results.push_back(measure("normals", resolution, double(resolution) * resolution, [&]
+			{
+				computeDatasetNormals(dataset, resolution);
+				sink = dataset.normals[0].y;
+			}));
+		}
+	}
+
+	//Base mesh grid and strip indices, as LoadModel builds them (size: vertices per side)
+	if (enabled("terrain_mesh"))
+	{
+		for (int points : sizes({ 200, 513, 1025 }))
+		{
+			TerrainMesh mesh;
+			results.push_back(measure("terrain_mesh", points, double(points) * points, [&]
+			{
+				buildTerrainMesh(mesh, points, 10.0f, 33);
+				sink = mesh.indices.back();
+			}));
+		}
+	}
+
+	//View and projection matrices of a moving camera (size: matrices per sample)
+	if (enabled("camera_matrices"))
+	{
+		for (int count : sizes({ 1000, 100000 }))
+		{
+			results.push_back(measure("camera_matrices", count, count, [&]
+			{
+				glm::mat4 view, projection, unjittered;
+				float sum = 0.0f;
+				for (int i = 0; i < count; i++)
+				{
+					float t = i * 0.001f;
+					computeCameraMatrices(glm::vec3(t, 2.0f, -t), t, 0.1f * sinf(t), 45.0f, glm::vec2(0.0001f, -0.0001f), view, projection, unjittered);
+					sum += view[3][0] + projection[2][0];
+				}
+				sink = sum;
+			}));
+		}
+	}
+
+	//Stress scene lights binned into the froxel grid, seen from above the terrain (size: number of lights)
+	if (enabled("light_binning"))
+	{
+		TerrainQuery query;
+		initTerrainQuery(query, 10.0f, 0.0f);
+		glm::mat4 view, projection, unjittered;
+		computeCameraMatrices(glm::vec3(0.0f, 1.5f, -4.0f), 0.0f, -0.4f, 45.0f, glm::vec2(0.0f), view, projection, unjittered);
+
+		for (int count : sizes({ 1000, 4000, 10000 }))
+		{
+			ClusteredLights clustered;
+			buildLightStressScene(clustered.lights, query, 10.0f, count, 0.4f, 1, 0.0);
+			endFrameMemory(); //Releases the scene's scratch
+			results.push_back(measure("light_binning", count, count, [&]
+			{
+				binLights(clustered, view, projection);
+				sink = float(clustered.indices.size());
+			}));
+		}
+	}
+
+	//Skybox faces decoded as LoadSkybox does (size: number of faces)
+	if (enabled("skybox_decode"))
+	{
+		const char* faces[] = { "external/skybox/right.jpg", "external/skybox/left.jpg", "external/skybox/top.jpg",
+								"external/skybox/bottom.jpg", "external/skybox/front.jpg", "external/skybox/back.jpg" };
+		vector<vector<unsigned char>> files;
+		for (const char* face : faces)
+		{
+			ifstream stream(face, ios::binary);
+			if (stream.is_open())
+				files.push_back(vector<unsigned char>(istreambuf_iterator<char>(stream), istreambuf_iterator<char>()));
+		}
+
+		//Decoded from memory so disk caching does not change the numbers
+		if (files.size() == 6)
+		{
+			for (int count : sizes({ 1, 6 }))
+			{
+				int faceWidth = 0, faceHeight = 0, channels;
+				stbi_info_from_memory(files[0].data(), int(files[0].size()), &faceWidth, &faceHeight, &channels);
+				results.push_back(measure("skybox_decode", count, double(count) * faceWidth * faceHeight, [&]
+				{
+					for (int i = 0; i < count; i++)
+					{
+						int width, height, numChannels;
+						unsigned char* pixels = stbi_load_from_memory(files[i].data(), int(files[i].size()), &width, &height, &numChannels, 0);
+						if (pixels)
+							sink = pixels[0];
+						stbi_image_free(pixels);
+					}
+				}));
+			}
+		}
+		else
+			printf("Skybox faces not found (run from the repository root), skipping skybox_decode\n");
+	}
+
+	destroyJobSystem();
+
+	if (!jsonPath.empty())
+	{
+		FILE* file = fopen(jsonPath.c_str(), "wb");
+		string json = formatJSON(results);
+		if (!file || fwrite(json.data(), 1, json.size(), file) != json.size())
+		{
+			printf("Cannot write %s\n", jsonPath.c_str());
+			if (file)
+				fclose(file);
+			return 1;
+		}
+		fclose(file);
+		printf("\nResults written to %s\n", jsonPath.c_str());
+	}
+
+	if (baselinePath.empty())
+		return 0;
+
+	//Regressions are printed to stderr as well, so they stand out in CI logs
+	int regressions = 0, compared = 0;
+	printf("\nBaseline %s:\n", baselinePath.c_str());
+	for (const BenchmarkResult& result : results)
+	{
+		auto found = baseline.find(make_pair(result.name, result.size));
+		if (found == baseline.end() || found->second <= 0.0)
+		{
+			printf("  %-24s %8d  no baseline\n", result.name.c_str(), result.size);
+			continue;
+		}
+		compared++;
+
+		auto own = thresholds.find(result.name);
+		double allowed = own != thresholds.end() ? own->second : threshold;
+		double change = 100.0 * (result.medianMs / found->second - 1.0);
+		bool regressed = change > allowed;
+		printf("  %-24s %8d  %10.4f ms vs %10.4f ms  %+7.1f%%%s\n", result.name.c_str(), result.size, result.medianMs, found->second, change,
+			   regressed ? "  REGRESSION" : "");
+		if (regressed)
+		{
+			fflush(stdout);
+			fprintf(stderr, "REGRESSION: %s (size %d) is %.1f%% slower than the baseline (allowed %.1f%%)\n", result.name.c_str(), result.size, change, allowed);
+			regressions++;
+		}
+	}
+
+	if (regressions > 0)
+	{
+		fprintf(stderr, "FAILED: %d of %d benchmarks regressed\n", regressions, compared);
+		return 2;
+	}
+	printf("No regressions (%d compared)\n", compared);
+	return 0;
+}
@@ -0,0 +1,870 @@
+//GL capture replay
+//Re-issues the calls of a capture written by the renderer (F9, see common/glcapture.hpp) in a hidden
+//window: the snapshot rebuilds every resource once, then the captured frames are played back in a
+//loop and timed per call group (the profiler sections of the frame) on the CPU and the GPU.
+//Usage: glreplay <capture.glcap> [--loops N]
+//Software rendering: LIBGL_ALWAYS_SOFTWARE=1 glreplay ... (a display is still needed, e.g. Xvfb)
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#define GLCAPTURE_NO_REDIRECT
+#include "common/glcapture.hpp"
+
+//Bounds-checked reading of the stream; a truncated file ends the replay instead of reading past it
+struct Reader
+{
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+	size_t position = 0;
+	bool ok = true;
+
+	template <typename T>
+	T get()
+	{
+		T value{};
+		if (position + sizeof(T) > size)
+		{
+			ok = false;
+			return value;
+		}
+		memcpy(&value, data + position, sizeof(T));
+		position += sizeof(T);
+		return value;
+	}
+
+	const void* getBlob(uint32_t& length)
+	{
+		length = get<uint32_t>();
+		if (!ok || position + length > size)
+		{
+			ok = false;
+			length = 0;
+			return nullptr;
+		}
+		const void* blob = length ? data + position : nullptr;
+		position += length;
+		return blob;
+	}
+
+	string getString()
+	{
+		uint32_t length;
+		const char* text = (const char*)getBlob(length);
+		return text ? string(text, length) : string();
+	}
+
+	//Pixels of a transfer: an offset into the bound unpack buffer, or inline bytes
+	const void* getPixels()
+	{
+		if (get<uint8_t>())
+			return (const void*)uintptr_t(get<uint64_t>());
+		uint32_t length;
+		return getBlob(length);
+	}
+};
+
+//Captured object names to the names of this context
+struct NameMap
+{
+	map<GLuint, GLuint> names;
+
+	GLuint operator[](GLuint captured) const
+	{
+		if (captured == 0)
+			return 0;
+		auto found = names.find(captured);
+		return found != names.end() ? found->second : 0;
+	}
+};
+
+struct GroupStats
+{
+	string name;
+	int depth = 0;
+	unsigned long long calls = 0;
+	double cpuMs = 0.0;
+	double gpuMs = 0.0;
+};
+
+//One execution of a group, resolved once its timestamps are available
+struct GroupTiming
+{
+	int group;
+	GLuint queries[2];
+	chrono::steady_clock::time_point cpuStart;
+	unsigned long long firstCall;
+};
+
+struct Replay
+{
+	Reader reader;
+	size_t framesStart = 0; //Stream position right after the snapshot
+
+	NameMap textures, buffers, vertexArrays, framebuffers, renderbuffers, programs, shaders;
+	map<pair<GLuint, GLint>, GLint> uniformLocations; //(captured program, captured location) to location
+	GLuint currentProgram = 0; //Captured name
+
+	//Timing
+	bool timing = false;
+	unsigned long long calls = 0;
+	vector<GroupStats> groups;
+	map<string, int> groupIndices; //By path (parent/child) so equally named sections in different places stay apart
+	vector<int> openGroups;
+	vector<string> openPaths;
+	vector<GroupTiming> openTimings, finishedTimings;
+	vector<GLuint> freeQueries;
+};
+
+static GLuint takeQuery(Replay& replay)
+{
+	if (replay.freeQueries.empty())
+	{
+		replay.freeQueries.resize(64);
+		glGenQueries(64, &replay.freeQueries[0]);
+	}
+	GLuint query = replay.freeQueries.back();
+	replay.freeQueries.pop_back();
+	return query;
+}
+
+static void generateNames(Reader& reader, NameMap& map, void (*generate)(GLsizei, GLuint*))
+{
+	uint32_t count = reader.get<uint32_t>();
+	for (uint32_t i = 0; i < count && reader.ok; i++)
+	{
+		GLuint captured = reader.get<GLuint>();
+		GLuint name = 0;
+		generate(1, &name);
+		map.names[captured] = name;
+	}
+}
+
+static void deleteNames(Reader& reader, NameMap& map, void (*destroy)(GLsizei, const GLuint*))
+{
+	uint32_t count = reader.get<uint32_t>();
+	for (uint32_t i = 0; i < count && reader.ok; i++)
+	{
+		GLuint captured = reader.get<GLuint>();
+		GLuint name = map[captured];
+		if (name)
+			destroy(1, &name);
+		map.names.erase(captured);
+	}
+}
+
+//Generic wrappers, as the glGen* entry points are function pointers loaded by GLEW
+static void genTextures(GLsizei n, GLuint* names) { glGenTextures(n, names); }
+static void deleteTextures(GLsizei n, const GLuint* names) { glDeleteTextures(n, names); }
+static void genBuffers(GLsizei n, GLuint* names) { glGenBuffers(n, names); }
+static void deleteBuffers(GLsizei n, const GLuint* names) { glDeleteBuffers(n, names); }
+static void genVertexArrays(GLsizei n, GLuint* names) { glGenVertexArrays(n, names); }
+static void deleteVertexArrays(GLsizei n, const GLuint* names) { glDeleteVertexArrays(n, names); }
+static void genFramebuffers(GLsizei n, GLuint* names) { glGenFramebuffers(n, names); }
+static void deleteFramebuffers(GLsizei n, const GLuint* names) { glDeleteFramebuffers(n, names); }
+static void genRenderbuffers(GLsizei n, GLuint* names) { glGenRenderbuffers(n, names); }
+static void deleteRenderbuffers(GLsizei n, const GLuint* names) { glDeleteRenderbuffers(n, names); }
+
+static void beginGroup(Replay& replay, const string& name)
+{
+	string path = replay.openPaths.empty() ? name : replay.openPaths.back() + "/" + name;
+	auto found = replay.groupIndices.find(path);
+	int group;
+	if (found == replay.groupIndices.end())
+	{
+		GroupStats stats;
+		stats.name = name;
+		stats.depth = int(replay.openGroups.size());
+		group = int(replay.groups.size());
+		replay.groups.push_back(stats);
+		replay.groupIndices[path] = group;
+	}
+	else
+		group = found->second;
+
+	replay.openGroups.push_back(group);
+	replay.openPaths.push_back(path);
+	if (!replay.timing)
+		return;
+
+	GroupTiming timing;
+	timing.group = group;
+	timing.queries[0] = takeQuery(replay);
+	timing.queries[1] = takeQuery(replay);
+	timing.firstCall = replay.calls;
+	glQueryCounter(timing.queries[0], GL_TIMESTAMP);
+	timing.cpuStart = chrono::steady_clock::now();
+	replay.openTimings.push_back(timing);
+}
+
+static void endGroup(Replay& replay)
+{
+	if (replay.openGroups.empty())
+		return;
+	replay.openGroups.pop_back();
+	replay.openPaths.pop_back();
+	if (!replay.timing || replay.openTimings.empty())
+		return;
+
+	GroupTiming timing = replay.openTimings.back();
+	replay.openTimings.pop_back();
+	glQueryCounter(timing.queries[1], GL_TIMESTAMP);
+	GroupStats& stats = replay.groups[timing.group];
+	stats.cpuMs += chrono::duration<double, milli>(chrono::steady_clock::now() - timing.cpuStart).count();
+	stats.calls += replay.calls - timing.firstCall;
+	replay.finishedTimings.push_back(timing);
+}
+
+//Waits for the GPU and adds the timestamps of the finished groups
+static void resolveTimings(Replay& replay)
+{
+	for (GroupTiming& timing : replay.finishedTimings)
+	{
+		GLuint64 start = 0, end = 0;
+		glGetQueryObjectui64v(timing.queries[0], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(timing.queries[1], GL_QUERY_RESULT, &end);
+		replay.groups[timing.group].gpuMs += double(end - start) / 1000000.0;
+		replay.freeQueries.push_back(timing.queries[0]);
+		replay.freeQueries.push_back(timing.queries[1]);
+	}
+	replay.finishedTimings.clear();
+}
+
+static void uniform(Replay& replay)
+{
+	Reader& reader = replay.reader;
+	CaptureUniformKind kind = CaptureUniformKind(reader.get<uint8_t>());
+	int components = reader.get<uint8_t>();
+	GLint capturedLocation = reader.get<GLint>();
+	GLsizei count = reader.get<GLsizei>();
+	GLboolean transpose = reader.get<uint8_t>();
+	uint32_t length;
+	const void* values = reader.getBlob(length);
+	if (!reader.ok || length < size_t(count) * components * 4)
+		return;
+
+	auto found = replay.uniformLocations.find(make_pair(replay.currentProgram, capturedLocation));
+	GLint location = found != replay.uniformLocations.end() ? found->second : capturedLocation;
+	if (kind == CAPTURE_UNIFORM_FLOAT)
+	{
+		const GLfloat* v = (const GLfloat*)values;
+		switch (components)
+		{
+		case 1: glUniform1fv(location, count, v); break;
+		case 2: glUniform2fv(location, count, v); break;
+		case 3: glUniform3fv(location, count, v); break;
+		case 4: glUniform4fv(location, count, v); break;
+		case 9: glUniformMatrix3fv(location, count, transpose, v); break;
+		case 16: glUniformMatrix4fv(location, count, transpose, v); break;
+		}
+	}
+	else if (kind == CAPTURE_UNIFORM_UINT)
+	{
+		const GLuint* v = (const GLuint*)values;
+		switch (components)
+		{
+		case 1: glUniform1uiv(location, count, v); break;
+		case 2: glUniform2uiv(location, count, v); break;
+		case 3: glUniform3uiv(location, count, v); break;
+		case 4: glUniform4uiv(location, count, v); break;
+		}
+	}
+	else
+	{
+		const GLint* v = (const GLint*)values;
+		switch (components)
+		{
+		case 1: glUniform1iv(location, count, v); break;
+		case 2: glUniform2iv(location, count, v); break;
+		case 3: glUniform3iv(location, count, v); break;
+		case 4: glUniform4iv(location, count, v); break;
+		}
+	}
+}
+
+//Executes records until the end of the snapshot or of a frame; false at the end of the stream or on a bad record
+static bool execute(Replay& replay, GLFWwindow* window)
+{
+	Reader& reader = replay.reader;
+	while (reader.ok && reader.position < reader.size)
+	{
+		CaptureOp op = CaptureOp(reader.get<uint16_t>());
+		replay.calls++;
+		switch (op)
+		{
+		case CAPTURE_SNAPSHOT_END:
+			return true;
+		case CAPTURE_FRAME_END:
+			while (!replay.openGroups.empty())
+				endGroup(replay);
+			glfwSwapBuffers(window);
+			return true;
+		case CAPTURE_GROUP_BEGIN:
+			beginGroup(replay, reader.getString());
+			break;
+		case CAPTURE_GROUP_END:
+			endGroup(replay);
+			break;
+
+		case CAPTURE_GEN_TEXTURES: generateNames(reader, replay.textures, genTextures); break;
+		case CAPTURE_DELETE_TEXTURES: deleteNames(reader, replay.textures, deleteTextures); break;
+		case CAPTURE_GEN_BUFFERS: generateNames(reader, replay.buffers, genBuffers); break;
+		case CAPTURE_DELETE_BUFFERS: deleteNames(reader, replay.buffers, deleteBuffers); break;
+		case CAPTURE_GEN_VERTEX_ARRAYS: generateNames(reader, replay.vertexArrays, genVertexArrays); break;
+		case CAPTURE_DELETE_VERTEX_ARRAYS: deleteNames(reader, replay.vertexArrays, deleteVertexArrays); break;
+		case CAPTURE_GEN_FRAMEBUFFERS: generateNames(reader, replay.framebuffers, genFramebuffers); break;
+		case CAPTURE_DELETE_FRAMEBUFFERS: deleteNames(reader, replay.framebuffers, deleteFramebuffers); break;
+		case CAPTURE_GEN_RENDERBUFFERS: generateNames(reader, replay.renderbuffers, genRenderbuffers); break;
+		case CAPTURE_DELETE_RENDERBUFFERS: deleteNames(reader, replay.renderbuffers, deleteRenderbuffers); break;
+
+		case CAPTURE_CREATE_PROGRAM:
+		{
+			GLuint captured = reader.get<GLuint>();
+			replay.programs.names[captured] = glCreateProgram();
+			break;
+		}
+		case CAPTURE_DELETE_PROGRAM:
+		{
+			GLuint captured = reader.get<GLuint>();
+			glDeleteProgram(replay.programs[captured]);
+			replay.programs.names.erase(captured);
+			break;
+		}
+		case CAPTURE_CREATE_SHADER:
+		{
+			GLenum stage = reader.get<GLenum>();
+			GLuint captured = reader.get<GLuint>();
+			replay.shaders.names[captured] = glCreateShader(stage);
+			break;
+		}
+		case CAPTURE_DELETE_SHADER:
+		{
+			GLuint captured = reader.get<GLuint>();
+			glDeleteShader(replay.shaders[captured]);
+			replay.shaders.names.erase(captured);
+			break;
+		}
+		case CAPTURE_SHADER_SOURCE:
+		{
+			GLuint shader = replay.shaders[reader.get<GLuint>()];
+			string source = reader.getString();
+			const char* text = source.c_str();
+			glShaderSource(shader, 1, &text, NULL);
+			break;
+		}
+		case CAPTURE_COMPILE_SHADER:
+			glCompileShader(replay.shaders[reader.get<GLuint>()]);
+			break;
+		case CAPTURE_ATTACH_SHADER:
+		{
+			GLuint program = replay.programs[reader.get<GLuint>()];
+			glAttachShader(program, replay.shaders[reader.get<GLuint>()]);
+			break;
+		}
+		case CAPTURE_LINK_PROGRAM:
+		{
+			GLuint program = replay.programs[reader.get<GLuint>()];
+			glLinkProgram(program);
+			GLint linked = GL_FALSE;
+			glGetProgramiv(program, GL_LINK_STATUS, &linked);
+			if (!linked)
+				printf("Warning: a captured program failed to link on this driver\n");
+			break;
+		}
+
+		case CAPTURE_USE_PROGRAM:
+			replay.currentProgram = reader.get<GLuint>();
+			glUseProgram(replay.programs[replay.currentProgram]);
+			break;
+		case CAPTURE_BIND_TEXTURE:
+		{
+			GLenum target = reader.get<GLenum>();
+			glBindTexture(target, replay.textures[reader.get<GLuint>()]);
+			break;
+		}
+		case CAPTURE_ACTIVE_TEXTURE:
+			glActiveTexture(reader.get<GLenum>());
+			break;
+		case CAPTURE_BIND_BUFFER:
+		{
+			GLenum target = reader.get<GLenum>();
+			glBindBuffer(target, replay.buffers[reader.get<GLuint>()]);
+			break;
+		}
+		case CAPTURE_BIND_BUFFER_BASE:
+		{
+			GLenum target = reader.get<GLenum>();
+			GLuint index = reader.get<GLuint>();
+			glBindBufferBase(target, index, replay.buffers[reader.get<GLuint>()]);
+			break;
+		}
+		case CAPTURE_BIND_BUFFER_RANGE:
+		{
+			GLenum target = reader.get<GLenum>();
+			GLuint index = reader.get<GLuint>();
+			GLuint buffer = replay.buffers[reader.get<GLuint>()];
+			int64_t offset = reader.get<int64_t>();
+			glBindBufferRange(target, index, buffer, GLintptr(offset), GLsizeiptr(reader.get<int64_t>()));
+			break;
+		}
+		case CAPTURE_BIND_VERTEX_ARRAY:
+			glBindVertexArray(replay.vertexArrays[reader.get<GLuint>()]);
+			break;
+		case CAPTURE_BIND_FRAMEBUFFER:
+		{
+			GLenum target = reader.get<GLenum>();
+			glBindFramebuffer(target, replay.framebuffers[reader.get<GLuint>()]);
+			break;
+		}
+		case CAPTURE_BIND_RENDERBUFFER:
+		{
+			GLenum target = reader.get<GLenum>();
+			glBindRenderbuffer(target, replay.renderbuffers[reader.get<GLuint>()]);
+			break;
+		}
+		case CAPTURE_ENABLE:
+			glEnable(reader.get<GLenum>());
+			break;
+		case CAPTURE_DISABLE:
+			glDisable(reader.get<GLenum>());
+			break;
+		case CAPTURE_VIEWPORT:
+		{
+			GLint x = reader.get<GLint>(), y = reader.get<GLint>();
+			GLsizei width = reader.get<GLsizei>(), height = reader.get<GLsizei>();
+			glViewport(x, y, width, height);
+			break;
+		}
+		case CAPTURE_VIEWPORT_INDEXED:
+		{
+			GLuint index = reader.get<GLuint>();
+			GLfloat x = reader.get<GLfloat>(), y = reader.get<GLfloat>();
+			GLfloat width = reader.get<GLfloat>(), height = reader.get<GLfloat>();
+			glViewportIndexedf(index, x, y, width, height);
+			break;
+		}
+		case CAPTURE_POLYGON_MODE:
+		{
+			GLenum face = reader.get<GLenum>();
+			glPolygonMode(face, reader.get<GLenum>());
+			break;
+		}
+		case CAPTURE_DEPTH_MASK:
+			glDepthMask(reader.get<GLboolean>());
+			break;
+		case CAPTURE_DEPTH_FUNC:
+			glDepthFunc(reader.get<GLenum>());
+			break;
+		case CAPTURE_CLEAR_COLOR:
+		{
+			GLfloat r = reader.get<GLfloat>(), g = reader.get<GLfloat>(), b = reader.get<GLfloat>(), a = reader.get<GLfloat>();
+			glClearColor(r, g, b, a);
+			break;
+		}
+		case CAPTURE_CLEAR:
+			glClear(reader.get<GLbitfield>());
+			break;
+		case CAPTURE_PIXEL_STORE:
+		{
+			GLenum pname = reader.get<GLenum>();
+			glPixelStorei(pname, reader.get<GLint>());
+			break;
+		}
+		case CAPTURE_PRIMITIVE_RESTART_INDEX:
+			glPrimitiveRestartIndex(reader.get<GLuint>());
+			break;
+		case CAPTURE_TEX_PARAMETER:
+		{
+			GLenum target = reader.get<GLenum>(), pname = reader.get<GLenum>();
+			glTexParameteri(target, pname, reader.get<GLint>());
+			break;
+		}
+
+		case CAPTURE_BUFFER_DATA:
+		{
+			GLenum target = reader.get<GLenum>();
+			int64_t size = reader.get<int64_t>();
+			GLenum usage = reader.get<GLenum>();
+			uint32_t length;
+			const void* data = reader.getBlob(length);
+			glBufferData(target, GLsizeiptr(size), length >= size ? data : nullptr, usage);
+			break;
+		}
+		case CAPTURE_BUFFER_SUB_DATA:
+		{
+			GLenum target = reader.get<GLenum>();
+			int64_t offset = reader.get<int64_t>();
+			uint32_t length;
+			const void* data = reader.getBlob(length);
+			glBufferSubData(target, GLintptr(offset), length, data);
+			break;
+		}
+		case CAPTURE_TEX_IMAGE_2D:
+		{
+			GLenum target = reader.get<GLenum>();
+			GLint level = reader.get<GLint>(), internalFormat = reader.get<GLint>();
+			GLsizei width = reader.get<GLsizei>(), height = reader.get<GLsizei>();
+			GLint border = reader.get<GLint>();
+			GLenum format = reader.get<GLenum>(), type = reader.get<GLenum>();
+			glTexImage2D(target, level, internalFormat, width, height, border, format, type, reader.getPixels());
+			break;
+		}
+		case CAPTURE_TEX_IMAGE_3D:
+		{
+			GLenum target = reader.get<GLenum>();
+			GLint level = reader.get<GLint>(), internalFormat = reader.get<GLint>();
+			GLsizei width = reader.get<GLsizei>(), height = reader.get<GLsizei>(), depth = reader.get<GLsizei>();
+			GLint border = reader.get<GLint>();
+			GLenum format = reader.get<GLenum>(), type = reader.get<GLenum>();
+			glTexImage3D(target, level, internalFormat, width, height, depth, border, format, type, reader.getPixels());
+			break;
+		}
+		case CAPTURE_TEX_STORAGE_2D:
+		{
+			GLenum target = reader.get<GLenum>();
+			GLsizei levels = reader.get<GLsizei>();
+			GLenum internalFormat = reader.get<GLenum>();
+			GLsizei width = reader.get<GLsizei>(), height = reader.get<GLsizei>();
+			glTexStorage2D(target, levels, internalFormat, width, height);
+			break;
+		}
+		case CAPTURE_TEX_SUB_IMAGE_2D:
+		{
+			GLenum target = reader.get<GLenum>();
+			GLint level = reader.get<GLint>(), x = reader.get<GLint>(), y = reader.get<GLint>();
+			GLsizei width = reader.get<GLsizei>(), height = reader.get<GLsizei>();
+			GLenum format = reader.get<GLenum>(), type = reader.get<GLenum>();
+			glTexSubImage2D(target, level, x, y, width, height, format, type, reader.getPixels());
+			break;
+		}
+		case CAPTURE_TEX_SUB_IMAGE_3D:
+		{
+			GLenum target = reader.get<GLenum>();
+			GLint level = reader.get<GLint>(), x = reader.get<GLint>(), y = reader.get<GLint>(), z = reader.get<GLint>();
+			GLsizei width = reader.get<GLsizei>(), height = reader.get<GLsizei>(), depth = reader.get<GLsizei>();
+			GLenum format = reader.get<GLenum>(), type = reader.get<GLenum>();
+			glTexSubImage3D(target, level, x, y, z, width, height, depth, format, type, reader.getPixels());
+			break;
+		}
+		case CAPTURE_GENERATE_MIPMAP:
+			glGenerateMipmap(reader.get<GLenum>());
+			break;
+		case CAPTURE_RENDERBUFFER_STORAGE_MULTISAMPLE:
+		{
+			GLenum target = reader.get<GLenum>();
+			GLsizei samples = reader.get<GLsizei>();
+			GLenum internalFormat = reader.get<GLenum>();
+			GLsizei width = reader.get<GLsizei>(), height = reader.get<GLsizei>();
+			glRenderbufferStorageMultisample(target, samples, internalFormat, width, height);
+			break;
+		}
+		case CAPTURE_RENDERBUFFER_STORAGE:
+		{
+			GLenum target = reader.get<GLenum>(), internalFormat = reader.get<GLenum>();
+			GLsizei width = reader.get<GLsizei>(), height = reader.get<GLsizei>();
+			glRenderbufferStorage(target, internalFormat, width, height);
+			break;
+		}
+		case CAPTURE_FRAMEBUFFER_TEXTURE_2D:
+		{
+			GLenum target = reader.get<GLenum>(), attachment = reader.get<GLenum>(), textureTarget = reader.get<GLenum>();
+			GLuint texture = replay.textures[reader.get<GLuint>()];
+			glFramebufferTexture2D(target, attachment, textureTarget, texture, reader.get<GLint>());
+			break;
+		}
+		case CAPTURE_FRAMEBUFFER_RENDERBUFFER:
+		{
+			GLenum target = reader.get<GLenum>(), attachment = reader.get<GLenum>(), renderbufferTarget = reader.get<GLenum>();
+			glFramebufferRenderbuffer(target, attachment, renderbufferTarget, replay.renderbuffers[reader.get<GLuint>()]);
+			break;
+		}
+		case CAPTURE_VERTEX_ATTRIB_POINTER:
+		{
+			GLuint index = reader.get<GLuint>();
+			GLint size = reader.get<GLint>();
+			GLenum type = reader.get<GLenum>();
+			GLboolean normalized = reader.get<GLboolean>();
+			GLsizei stride = reader.get<GLsizei>();
+			uint64_t offset = reader.get<uint64_t>();
+			glVertexAttribPointer(index, size, type, normalized, stride, (const void*)uintptr_t(offset));
+			break;
+		}
+		case CAPTURE_ENABLE_VERTEX_ATTRIB_ARRAY:
+			glEnableVertexAttribArray(reader.get<GLuint>());
+			break;
+
+		case CAPTURE_UNIFORM_LOCATION:
+		{
+			GLuint captured = reader.get<GLuint>();
+			string name = reader.getString();
+			GLint capturedLocation = reader.get<GLint>();
+			replay.uniformLocations[make_pair(captured, capturedLocation)] = glGetUniformLocation(replay.programs[captured], name.c_str());
+			break;
+		}
+		case CAPTURE_UNIFORM:
+			uniform(replay);
+			break;
+
+		case CAPTURE_DRAW_ARRAYS:
+		{
+			GLenum mode = reader.get<GLenum>();
+			GLint first = reader.get<GLint>();
+			glDrawArrays(mode, first, reader.get<GLsizei>());
+			break;
+		}
+		case CAPTURE_MULTI_DRAW_ARRAYS:
+		{
+			GLenum mode = reader.get<GLenum>();
+			GLsizei drawCount = reader.get<GLsizei>();
+			vector<GLint> firsts(drawCount > 0 ? drawCount : 0);
+			vector<GLsizei> counts(firsts.size());
+			for (size_t i = 0; i < firsts.size() && reader.ok; i++)
+			{
+				firsts[i] = reader.get<GLint>();
+				counts[i] = reader.get<GLsizei>();
+			}
+			if (reader.ok && !firsts.empty())
+				glMultiDrawArrays(mode, &firsts[0], &counts[0], drawCount);
+			break;
+		}
+		case CAPTURE_DRAW_ELEMENTS:
+		{
+			GLenum mode = reader.get<GLenum>();
+			GLsizei count = reader.get<GLsizei>();
+			GLenum type = reader.get<GLenum>();
+			glDrawElements(mode, count, type, (const void*)uintptr_t(reader.get<uint64_t>()));
+			break;
+		}
+		case CAPTURE_MULTI_DRAW_ELEMENTS:
+		{
+			GLenum mode = reader.get<GLenum>(), type = reader.get<GLenum>();
+			GLsizei drawCount = reader.get<GLsizei>();
+			vector<GLsizei> counts(drawCount > 0 ? drawCount : 0);
+			vector<const void*> offsets(counts.size());
+			for (size_t i = 0; i < counts.size() && reader.ok; i++)
+			{
+				counts[i] = reader.get<GLsizei>();
+				offsets[i] = (const void*)uintptr_t(reader.get<uint64_t>());
+			}
+			if (reader.ok && !counts.empty())
+				glMultiDrawElements(mode, &counts[0], type, &offsets[0], drawCount);
+			break;
+		}
+		case CAPTURE_DRAW_ARRAYS_INSTANCED:
+		{
+			GLenum mode = reader.get<GLenum>();
+			GLint first = reader.get<GLint>();
+			GLsizei count = reader.get<GLsizei>();
+			glDrawArraysInstanced(mode, first, count, reader.get<GLsizei>());
+			break;
+		}
+		case CAPTURE_MULTI_DRAW_ELEMENTS_INDIRECT:
+		{
+			GLenum mode = reader.get<GLenum>(), type = reader.get<GLenum>();
+			const void* indirect = (const void*)uintptr_t(reader.get<uint64_t>());
+			GLsizei drawCount = reader.get<GLsizei>();
+			glMultiDrawElementsIndirect(mode, type, indirect, drawCount, reader.get<GLsizei>());
+			break;
+		}
+		case CAPTURE_BLIT_FRAMEBUFFER:
+		{
+			GLint v[8];
+			for (GLint& value : v)
+				value = reader.get<GLint>();
+			GLbitfield mask = reader.get<GLbitfield>();
+			glBlitFramebuffer(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7], mask, reader.get<GLenum>());
+			break;
+		}
+		case CAPTURE_BIND_IMAGE_TEXTURE:
+		{
+			GLuint unit = reader.get<GLuint>();
+			GLuint texture = replay.textures[reader.get<GLuint>()];
+			GLint level = reader.get<GLint>();
+			GLboolean layered = reader.get<uint8_t>();
+			GLint layer = reader.get<GLint>();
+			GLenum access = reader.get<GLenum>();
+			glBindImageTexture(unit, texture, level, layered, layer, access, reader.get<GLenum>());
+			break;
+		}
+		case CAPTURE_DISPATCH_COMPUTE:
+		{
+			GLuint x = reader.get<GLuint>(), y = reader.get<GLuint>();
+			glDispatchCompute(x, y, reader.get<GLuint>());
+			break;
+		}
+		case CAPTURE_MEMORY_BARRIER:
+			glMemoryBarrier(reader.get<GLbitfield>());
+			break;
+
+		default:
+			printf("Unknown record %d at byte %zu\n", int(op), reader.position - sizeof(uint16_t));
+			reader.ok = false;
+			return false;
+		}
+	}
+	return false;
+}
+
+static void printUsage()
+{
+	printf("Usage: glreplay <capture.glcap> [--loops N]\n");
+}
+
+int main(int argc, char** argv)
+{
+	const char* path = nullptr;
+	int loops = 5;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--loops") == 0 && i + 1 < argc)
+			loops = max(1, atoi(argv[++i]));
+		else if (!path)
+			path = argv[i];
+		else
+		{
+			printUsage();
+			return 1;
+		}
+	}
+	if (!path)
+	{
+		printUsage();
+		return 1;
+	}
+
+	FILE* file = fopen(path, "rb");
+	if (!file)
+	{
+		printf("Cannot open %s\n", path);
+		return 1;
+	}
+	CaptureHeader header;
+	bool ok = fread(&header, sizeof(header), 1, file) == 1;
+	vector<uint8_t> stream;
+	if (ok)
+	{
+		long start = ftell(file);
+		fseek(file, 0, SEEK_END);
+		stream.resize(size_t(ftell(file) - start));
+		fseek(file, start, SEEK_SET);
+		ok = stream.empty() || fread(&stream[0], 1, stream.size(), file) == stream.size();
+	}
+	fclose(file);
+	if (!ok || memcmp(header.magic, "GLCP", 4) != 0 || header.version != CAPTURE_VERSION || stream.empty())
+	{
+		printf("%s is not a capture this replay understands\n", path);
+		return 1;
+	}
+
+	//Hidden window at the captured size (the default framebuffer is drawn to as in the renderer)
+	if (!glfwInit())
+	{
+		printf("Failed to initialize GLFW\n");
+		return 1;
+	}
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	GLFWwindow* window = glfwCreateWindow(max(header.width, 1), max(header.height, 1), "glreplay", NULL, NULL);
+	if (!window)
+	{
+		printf("Failed to create a GL 4.5 context\n");
+		glfwTerminate();
+		return 1;
+	}
+	glfwMakeContextCurrent(window);
+	glewExperimental = true;
+	if (glewInit() != GLEW_OK)
+	{
+		printf("Failed to initialize GLEW\n");
+		glfwTerminate();
+		return 1;
+	}
+	glfwSwapInterval(0);
+	printf("Capture: %s, %d frame(s) at %dx%d, %zu KB\n", path, header.frames, header.width, header.height, stream.size() >> 10);
+	printf("Renderer: %s\n", (const char*)glGetString(GL_RENDERER));
+
+	Replay replay;
+	replay.reader.data = &stream[0];
+	replay.reader.size = stream.size();
+
+	auto start = chrono::steady_clock::now();
+	if (!execute(replay, window))
+	{
+		printf("The capture ends inside its snapshot\n");
+		glfwTerminate();
+		return 1;
+	}
+	glFinish();
+	printf("Snapshot: %.1f ms (%llu calls)\n", chrono::duration<double, milli>(chrono::steady_clock::now() - start).count(), replay.calls);
+	replay.framesStart = replay.reader.position;
+
+	//The first loop warms up (shader compilation on first draw, driver allocations) and is not timed; later
+	//loops start from the state the previous one ended in, as the renderer's next frame would
+	GLuint frameQueries[2];
+	glGenQueries(2, frameQueries);
+	double cpuMs = 0.0, gpuMs = 0.0, worstCpuMs = 0.0;
+	int framesTimed = 0;
+	for (int loop = 0; loop <= loops && replay.reader.ok; loop++)
+	{
+		replay.timing = loop > 0;
+		replay.reader.position = replay.framesStart;
+		for (int frame = 0; frame < int(header.frames) && replay.reader.ok; frame++)
+		{
+			unsigned long long firstCall = replay.calls;
+			glQueryCounter(frameQueries[0], GL_TIMESTAMP);
+			auto frameStart = chrono::steady_clock::now();
+			if (!execute(replay, window))
+				break;
+			glQueryCounter(frameQueries[1], GL_TIMESTAMP);
+			double frameMs = chrono::duration<double, milli>(chrono::steady_clock::now() - frameStart).count();
+
+			GLuint64 begin = 0, end = 0;
+			glGetQueryObjectui64v(frameQueries[0], GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(frameQueries[1], GL_QUERY_RESULT, &end);
+			resolveTimings(replay);
+			if (replay.timing)
+			{
+				cpuMs += frameMs;
+				gpuMs += double(end - begin) / 1000000.0;
+				worstCpuMs = max(worstCpuMs, frameMs);
+				framesTimed++;
+			}
+			else if (loop == 0 && frame == 0)
+				printf("Calls per frame: %llu\n", replay.calls - firstCall);
+		}
+	}
+	if (!replay.reader.ok || framesTimed == 0)
+	{
+		printf("The capture is truncated or has an unknown record\n");
+		glfwTerminate();
+		return 1;
+	}
+
+	printf("\n%-32s %12s %10s %10s\n", "Group", "Calls/frame", "CPU ms", "GPU ms");
+	for (const GroupStats& group : replay.groups)
+	{
+		string name = string(size_t(group.depth) * 2, ' ') + group.name;
+		printf("%-32s %12.0f %10.3f %10.3f\n", name.c_str(), double(group.calls) / framesTimed, group.cpuMs / framesTimed, group.gpuMs / framesTimed);
+	}
+	printf("%-32s %12s %10.3f %10.3f\n", "Frame", "", cpuMs / framesTimed, gpuMs / framesTimed);
+	printf("Worst frame (CPU): %.3f ms over %d timed frames\n", worstCpuMs, framesTimed);
+
+	glDeleteQueries(2, frameQueries);
+	if (!replay.freeQueries.empty())
+		glDeleteQueries(GLsizei(replay.freeQueries.size()), &replay.freeQueries[0]);
+	glfwTerminate();
+	return 0;
+}
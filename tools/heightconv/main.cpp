@@ -0,0 +1,134 @@
+//Heightmap converter
+//Converts a 24-bit BMP heightmap into the native .hmap container and compares the two:
+//file size, full load time (BMP read + decode vs. tile decompression on one and on all threads),
+//random tile reads and the largest height difference.
+//Usage: heightconv <input.bmp> [output.hmap] [--uint16] [--tile N]
+//  --uint16   16-bit samples scaled to the map's height range (half the size, lossy) instead of float32
+//  --tile N   tile size in samples (default 256)
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "common/heightfile.hpp"
+#include "common/jobs.hpp"
+#include "common/utils.hpp"
+
+static const int loadRepeats = 5;
+
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+//Best of a few runs, in milliseconds
+template <typename Function>
+static double bestOf(Function function)
+{
+	double best = 1e30;
+	for (int i = 0; i < loadRepeats; i++)
+	{
+		auto start = chrono::steady_clock::now();
+		function();
+		best = min(best, secondsSince(start) * 1000.0);
+	}
+	return best;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		printf("Usage: heightconv <input.bmp> [output.hmap] [--uint16] [--tile N]\n");
+		return 1;
+	}
+
+	string input = argv[1];
+	string output = filesystem::path(input).replace_extension(".hmap").string();
+	HeightSampleFormat format = HEIGHT_FLOAT32;
+	int tileSize = 256;
+	for (int i = 2; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--uint16"))
+			format = HEIGHT_UINT16;
+		else if (!strcmp(argv[i], "--tile") && i + 1 < argc)
+			tileSize = max(8, atoi(argv[++i]));
+		else
+			output = argv[i];
+	}
+
+	//Reference: the way the renderer has always loaded heightmaps
+	int width, height;
+	vector<float> heights;
+	double bmpMs = bestOf([&]
+	{
+		unsigned char* data = nullptr;
+		if (loadBMP_custom(input.c_str(), width, height, data))
+			decodeHeightBMP(data, width, height, heights);
+		delete[] data;
+	});
+	if (heights.empty())
+	{
+		printf("Cannot read %s\n", input.c_str());
+		return 1;
+	}
+
+	initJobSystem();
+	auto start = chrono::steady_clock::now();
+	if (!writeHeightFile(output.c_str(), heights.data(), width, height, format, tileSize))
+	{
+		printf("Cannot write %s\n", output.c_str());
+		return 1;
+	}
+	double writeMs = secondsSince(start) * 1000.0;
+
+	uintmax_t bmpBytes = filesystem::file_size(input);
+	uintmax_t hmapBytes = filesystem::file_size(output);
+	printf("%s: %dx%d, %s samples, %dx%d tiles\n", output.c_str(), width, height, format == HEIGHT_UINT16 ? "16-bit" : "float32", tileSize, tileSize);
+	printf("Size: BMP %.2f MB, hmap %.2f MB (%.1f%%), written in %.1f ms\n", bmpBytes / 1048576.0, hmapBytes / 1048576.0, 100.0 * hmapBytes / bmpBytes, writeMs);
+
+	//Full loads (all threads, then inline on this thread only)
+	int loadedWidth = 0, loadedHeight = 0;
+	vector<float> loaded;
+	bool ok = true;
+	double parallelMs = bestOf([&] { ok = ok && loadHeightFile(output.c_str(), loadedWidth, loadedHeight, loaded); });
+	int threads = getWorkerCount();
+	destroyJobSystem();
+	double serialMs = bestOf([&] { ok = ok && loadHeightFile(output.c_str(), loadedWidth, loadedHeight, loaded); });
+	if (!ok || loadedWidth != width || loadedHeight != height)
+	{
+		printf("Reading %s back failed\n", output.c_str());
+		return 1;
+	}
+
+	printf("Load: BMP + decode %.2f ms, hmap %.2f ms on 1 thread, %.2f ms on %d threads\n", bmpMs, serialMs, parallelMs, threads);
+
+	double maxError = 0.0;
+	for (size_t i = 0; i < heights.size(); i++)
+		maxError = max(maxError, double(fabs(loaded[i] - heights[i])));
+	printf("Largest height difference: %g (%s)\n", maxError, maxError == 0.0 ? "lossless" : "quantised");
+
+	//Random access: single tiles from an open file
+	HeightFile file;
+	if (!openHeightFile(output.c_str(), file))
+		return 1;
+	mt19937 rng(1234);
+	vector<float> tile(size_t(tileSize) * tileSize);
+	const int reads = 256;
+	start = chrono::steady_clock::now();
+	for (int i = 0; i < reads && ok; i++)
+		ok = readHeightTile(file, int(rng() % file.tilesX), int(rng() % file.tilesY), tile.data());
+	double tileUs = secondsSince(start) * 1e6 / reads;
+	closeHeightFile(file);
+	printf("Random tile read: %.1f us per %dx%d tile\n", tileUs, tileSize, tileSize);
+
+	return ok ? 0 : 1;
+}
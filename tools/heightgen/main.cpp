@@ -0,0 +1,217 @@
+//Procedural heightmap generator
+//Writes a seeded fBm or ridged heightmap of any size as a 24-bit BMP (the encoding the renderer and
+//datasets load) and/or raw little-endian float32 rows. Bands of rows are generated on the job system
+//while the previous band is written, so memory use does not grow with the image (32768^2 is fine).
+//Usage: heightgen <width> [height] [options]
+//  --seed N          noise seed (default 1)
+//  --octaves N       octaves (default: until the finest is about 2 pixels per cell)
+//  --frequency F     lattice cells across the map for the first octave (default 4)
+//  --lacunarity F    frequency multiplier per octave (default 2)
+//  --gain F          amplitude multiplier per octave (default 0.5)
+//  --ridged          ridged multifractal instead of fBm
+//  --scale H         height of the highest possible point in world units (default 1)
+//  --bmp PATH        BMP output (default generated_<width>x<height>.bmp when no output is given)
+//  --raw PATH        raw float32 output, row y at offset y * width * 4
+//  --threads N       threads including this one (default: every hardware thread)
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "common/jobs.hpp"
+#include "common/terraingen.hpp"
+
+static const size_t samplesPerBand = size_t(1) << 23;
+
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static void usage()
+{
+	printf("Usage: heightgen <width> [height] [--seed N] [--octaves N] [--frequency F] [--lacunarity F] [--gain F]\n"
+		   "                 [--ridged] [--scale H] [--bmp PATH] [--raw PATH] [--threads N]\n");
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		usage();
+		return 1;
+	}
+
+	int width = atoi(argv[1]);
+	int height = width;
+	int first = 2;
+	if (argc > 2 && argv[2][0] != '-')
+	{
+		height = atoi(argv[2]);
+		first = 3;
+	}
+
+	TerrainNoise noise;
+	noise.octaves = 0;
+	string bmpPath, rawPath;
+	int threads = -1;
+	for (int i = first; i < argc; i++)
+	{
+		const char* option = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+		if (!strcmp(option, "--ridged"))
+		{
+			noise.ridged = true;
+			continue;
+		}
+		if (!value)
+		{
+			usage();
+			return 1;
+		}
+
+		if (!strcmp(option, "--seed"))
+			noise.seed = unsigned(strtoul(value, nullptr, 10));
+		else if (!strcmp(option, "--octaves"))
+			noise.octaves = atoi(value);
+		else if (!strcmp(option, "--frequency"))
+			noise.frequency = float(atof(value));
+		else if (!strcmp(option, "--lacunarity"))
+			noise.lacunarity = float(atof(value));
+		else if (!strcmp(option, "--gain"))
+			noise.gain = float(atof(value));
+		else if (!strcmp(option, "--scale"))
+			noise.heightScale = float(atof(value));
+		else if (!strcmp(option, "--bmp"))
+			bmpPath = value;
+		else if (!strcmp(option, "--raw"))
+			rawPath = value;
+		else if (!strcmp(option, "--threads"))
+			threads = atoi(value);
+		else
+		{
+			usage();
+			return 1;
+		}
+		i++;
+	}
+
+	if (width < 2 || height < 2 || width > 65536 || height > 65536)
+	{
+		printf("Width and height must be between 2 and 65536\n");
+		return 1;
+	}
+
+	//Octaves until a lattice cell of the finest is about two pixels wide
+	if (noise.octaves <= 0)
+	{
+		noise.octaves = 1;
+		for (float f = noise.frequency * noise.lacunarity; f <= 0.5f * width && noise.octaves < 24; f *= noise.lacunarity)
+			noise.octaves++;
+	}
+
+	if (bmpPath.empty() && rawPath.empty())
+		bmpPath = "generated_" + to_string(width) + "x" + to_string(height) + ".bmp";
+
+	FILE* bmp = nullptr;
+	FILE* raw = nullptr;
+	if (!bmpPath.empty())
+	{
+		bmp = fopen(bmpPath.c_str(), "wb");
+		if (!bmp || !writeBMPHeader(bmp, width, height))
+		{
+			printf("Cannot write %s (24-bit BMPs are limited to 4 GB)\n", bmpPath.c_str());
+			return 1;
+		}
+	}
+	if (!rawPath.empty())
+	{
+		raw = fopen(rawPath.c_str(), "wb");
+		if (!raw)
+		{
+			printf("Cannot write %s\n", rawPath.c_str());
+			return 1;
+		}
+	}
+
+	initJobSystem(threads > 0 ? threads - 1 : -1);
+	printf("%dx%d %s, seed %u, %d octaves, %d threads\n", width, height, noise.ridged ? "ridged" : "fBm", noise.seed, noise.octaves, getWorkerCount());
+
+	//Two bands: one being generated while the other is written
+	int bandRows = int(max(size_t(1), samplesPerBand / width));
+	size_t rowSize = (size_t(width) * 3 + 3) & ~size_t(3);
+	vector<float> heights[2];
+	vector<unsigned char> pixels[2];
+	for (int b = 0; b < 2; b++)
+	{
+		heights[b].resize(size_t(bandRows) * width);
+		pixels[b].resize(bmp ? size_t(bandRows) * rowSize : 0);
+	}
+
+	atomic<bool> writeFailed{ false };
+	JobHandle writing;
+	float minHeight = noise.heightScale, maxHeight = 0.0f;
+	double generateSeconds = 0.0;
+	auto start = chrono::steady_clock::now();
+
+	int band = 0;
+	for (int firstRow = 0; firstRow < height; firstRow += bandRows, band ^= 1)
+	{
+		int rows = min(bandRows, height - firstRow);
+		float* bandHeights = heights[band].data();
+		unsigned char* bandPixels = pixels[band].data();
+
+		auto generateStart = chrono::steady_clock::now();
+		parallelFor(0, rows, 4, [&](int begin, int end)
+		{
+			generateHeightRows(noise, width, firstRow + begin, end - begin, bandHeights + size_t(begin) * width);
+			if (bmp)
+				encodeHeightRows(bandHeights + size_t(begin) * width, width, end - begin, bandPixels + size_t(begin) * rowSize);
+		});
+		generateSeconds += secondsSince(generateStart);
+
+		auto bounds = minmax_element(bandHeights, bandHeights + size_t(rows) * width);
+		minHeight = min(minHeight, *bounds.first);
+		maxHeight = max(maxHeight, *bounds.second);
+
+		//The other band's buffers are free once its write has finished
+		waitForJob(writing);
+		writing = runJob([=, &writeFailed]
+		{
+			if (bmp && fwrite(bandPixels, 1, rows * rowSize, bmp) != rows * rowSize)
+				writeFailed = true;
+			if (raw && fwrite(bandHeights, sizeof(float), size_t(rows) * width, raw) != size_t(rows) * width)
+				writeFailed = true;
+		});
+	}
+	waitForJob(writing);
+
+	if (bmp && fclose(bmp) != 0)
+		writeFailed = true;
+	if (raw && fclose(raw) != 0)
+		writeFailed = true;
+	destroyJobSystem();
+
+	double seconds = secondsSince(start);
+	double megasamples = double(width) * height / 1e6;
+	printf("Heights %.4f - %.4f\n", minHeight, maxHeight);
+	printf("Generated in %.2f s (%.1f Msamples/s), %.2f s in total including writing\n", generateSeconds, megasamples / generateSeconds, seconds);
+	if (!bmpPath.empty())
+		printf("Wrote %s\n", bmpPath.c_str());
+	if (!rawPath.empty())
+		printf("Wrote %s\n", rawPath.c_str());
+
+	if (writeFailed)
+	{
+		printf("Writing failed (disk full?)\n");
+		return 1;
+	}
+	return 0;
+}
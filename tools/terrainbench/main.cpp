@@ -0,0 +1,173 @@
+//Terrain query benchmark
+//Times batched height lookups, ground clamping and ray casts against a heightmap and checks the
+//hierarchical ray cast against a brute-force march.
+//Usage: terrainbench [heightmap.bmp] (a synthetic 4096x4096 field is used if it cannot be loaded)
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+using namespace std;
+
+#include "common/datasets.hpp"
+#include "common/terrainquery.hpp"
+#include "common/utils.hpp"
+
+static const float worldSize = 10.0f;
+static const int batchSize = 4096;
+static const int batches = 200;
+
+static double secondsSince(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static void synthesizeHeights(Dataset& dataset, int size)
+{
+	dataset.width = dataset.height = size;
+	dataset.heights.resize(size_t(size) * size);
+	for (int z = 0; z < size; z++)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			float u = float(x) / size, v = float(z) / size;
+			float h = 0.3f * sinf(u * 7.0f) * cosf(v * 5.0f) + 0.1f * sinf(u * 61.0f + v * 37.0f) + 0.02f * sinf(u * 509.0f) * sinf(v * 431.0f);
+			dataset.heights[size_t(z) * size + x] = 0.45f + h;
+		}
+	}
+}
+
+//Reference: march in steps of a quarter sample and return the first point below the surface
+static bool marchTerrain(const TerrainQuery& query, glm::vec3 origin, glm::vec3 direction, float maxDistance, float step, float& tHit)
+{
+	direction = glm::normalize(direction);
+	for (float t = 0.0f; t <= maxDistance; t += step)
+	{
+		glm::vec3 p = origin + direction * t;
+		if (insideTerrain(query, p.x, p.z) && p.y <= terrainHeightAt(query, p.x, p.z))
+		{
+			tHit = t;
+			return true;
+		}
+	}
+	return false;
+}
+
+int main(int argc, char** argv)
+{
+	const char* path = argc > 1 ? argv[1] : "rugged.bmp";
+
+	Dataset dataset;
+	int width, height;
+	unsigned char* data = nullptr;
+	if (loadBMP_custom(path, width, height, data))
+	{
+		dataset.width = width;
+		dataset.height = height;
+		decodeHeightBMP(data, width, height, dataset.heights);
+		delete[] data;
+		printf("Heightmap: %s (%dx%d)\n", path, width, height);
+	}
+	else
+	{
+		synthesizeHeights(dataset, 4096);
+		printf("Heightmap: synthetic (%dx%d)\n", dataset.width, dataset.height);
+	}
+
+	auto start = chrono::steady_clock::now();
+	dataset.heightPyramid = buildHeightPyramid(dataset.heights, dataset.width, dataset.height);
+	printf("Pyramid build: %.2f ms (%zu levels)\n", secondsSince(start) * 1000.0, dataset.heightPyramid->levels.size());
+
+	float maxHeight = 0.0f;
+	for (float h : dataset.heights)
+		maxHeight = max(maxHeight, h);
+
+	TerrainQuery query;
+	initTerrainQuery(query, worldSize, 0.5f / 199.0f);
+	setTerrainQuery(query, &dataset, 1.0f);
+
+	mt19937 rng(1234);
+	uniform_real_distribution<float> world(-0.5f * worldSize, 0.5f * worldSize);
+	uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+	//Batched lookups spread over the whole terrain (worst case for the cache) and around one point
+	vector<glm::vec2> scattered(batchSize), local(batchSize);
+	glm::vec2 centre(world(rng), world(rng));
+	for (int i = 0; i < batchSize; i++)
+	{
+		scattered[i] = glm::vec2(world(rng), world(rng));
+		local[i] = centre + glm::vec2(unit(rng) - 0.5f, unit(rng) - 0.5f);
+	}
+
+	vector<float> heights(batchSize);
+	double checksum = 0.0;
+	const char* names[] = { "scattered", "local" };
+	const vector<glm::vec2>* inputs[] = { &scattered, &local };
+	for (int set = 0; set < 2; set++)
+	{
+		start = chrono::steady_clock::now();
+		for (int b = 0; b < batches; b++)
+		{
+			terrainHeights(query, inputs[set]->data(), heights.data(), batchSize);
+			checksum += heights[b % batchSize];
+		}
+		double seconds = secondsSince(start);
+		printf("Height lookups (%s): %.1f ns/query, %.3f ms per batch of %d\n", names[set],
+			   seconds * 1e9 / (double(batches) * batchSize), seconds * 1000.0 / batches, batchSize);
+	}
+
+	vector<glm::vec3> points(batchSize);
+	size_t moved = 0;
+	start = chrono::steady_clock::now();
+	for (int b = 0; b < batches; b++)
+	{
+		for (int i = 0; i < batchSize; i++)
+			points[i] = glm::vec3(scattered[i].x, 0.0f, scattered[i].y);
+		moved += clampToTerrain(query, points.data(), batchSize, 0.15f);
+	}
+	double clampSeconds = secondsSince(start);
+	printf("Ground clamping: %.1f ns/point, %.3f ms per batch of %d (%zu moved)\n",
+		   clampSeconds * 1e9 / (double(batches) * batchSize), clampSeconds * 1000.0 / batches, batchSize, moved);
+
+	//Picking-like rays: from above the terrain, looking down at varying angles
+	vector<glm::vec3> origins(batchSize), directions(batchSize);
+	for (int i = 0; i < batchSize; i++)
+	{
+		origins[i] = glm::vec3(world(rng), maxHeight + 0.2f + 2.0f * unit(rng), world(rng));
+		float angle = unit(rng) * 6.2831853f;
+		directions[i] = glm::normalize(glm::vec3(cosf(angle), -0.05f - unit(rng), sinf(angle)));
+	}
+
+	const float maxDistance = 2.0f * worldSize;
+	int hits = 0;
+	vector<glm::vec3> hitPoints(batchSize);
+	vector<bool> hitFlags(batchSize);
+	start = chrono::steady_clock::now();
+	for (int i = 0; i < batchSize; i++)
+	{
+		hitFlags[i] = raycastTerrain(query, origins[i], directions[i], maxDistance, hitPoints[i]);
+		hits += hitFlags[i];
+	}
+	double raySeconds = secondsSince(start);
+	printf("Ray casts: %.2f us/ray, %.3f ms for %d (%d hits)\n", raySeconds * 1e6 / batchSize, raySeconds * 1000.0, batchSize, hits);
+
+	//Validation: the exact hit may only be earlier than the march (which can step over thin peaks), never later
+	const int checked = 256;
+	float step = 0.25f * worldSize / dataset.width;
+	int errors = 0;
+	start = chrono::steady_clock::now();
+	for (int i = 0; i < checked; i++)
+	{
+		float tReference;
+		bool referenceHit = marchTerrain(query, origins[i], directions[i], maxDistance, step, tReference);
+		float tHit = glm::length(hitPoints[i] - origins[i]);
+		if (referenceHit && (!hitFlags[i] || tHit > tReference + step))
+			errors++;
+	}
+	printf("Brute-force march: %.2f us/ray; %d/%d rays disagree\n", secondsSince(start) * 1e6 / checked, errors, checked);
+
+	printf("(checksum %.3f)\n", checksum);
+	return errors == 0 ? 0 : 1;
+}